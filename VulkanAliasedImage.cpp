@@ -0,0 +1,29 @@
+﻿#include "VulkanAliasedImage.hpp"
+
+#include "VulkanGpuDevice.hpp"
+
+usagi::VulkanImageHeap::VulkanImageHeap(
+    VulkanGpuDevice *device,
+    const vk::MemoryRequirements &requirements,
+    const vk::MemoryPropertyFlags &mem_properties,
+    const vk::MemoryPropertyFlags &preferred_properties)
+    : VulkanMemoryPool(device)
+{
+    mMemoryRequirements = requirements;
+    allocateDeviceMemory(mem_properties, preferred_properties);
+}
+
+usagi::VulkanAliasedImage::VulkanAliasedImage(
+    vk::UniqueImage vk_image,
+    GpuImageFormat format,
+    const Vector2u32 &size,
+    std::shared_ptr<VulkanImageHeap> heap,
+    const std::size_t offset)
+    : VulkanGpuImage(std::move(format), size, heap->device())
+    , mImage(std::move(vk_image))
+    , mHeap(std::move(heap))
+    , mOffset(offset)
+{
+    mDevice->device().bindImageMemory(mImage.get(), mHeap->memory(), mOffset);
+    VulkanGpuImage::createBaseView();
+}
@@ -0,0 +1,73 @@
+﻿#pragma once
+
+#include <Usagi/Core/Exception.hpp>
+
+#include "VulkanGpuImage.hpp"
+#include "VulkanMemoryPool.hpp"
+
+namespace usagi
+{
+/**
+ * \brief A single allocation whose ranges are assigned to images by the
+ * user. The ranges of images which are never used at the same time may
+ * overlap.
+ */
+class VulkanImageHeap : public VulkanMemoryPool
+{
+public:
+    /**
+     * \param requirements The size, the alignment of the allocation and the
+     * memory types allowed by all the images placed in it.
+     */
+    VulkanImageHeap(
+        VulkanGpuDevice *device,
+        const vk::MemoryRequirements &requirements,
+        const vk::MemoryPropertyFlags &mem_properties,
+        const vk::MemoryPropertyFlags &preferred_properties);
+
+    std::size_t size() const { return mMemoryRequirements.size; }
+
+    // the ranges are not tracked
+    void deallocate(std::size_t offset) override { }
+};
+
+/**
+ * \brief An image placed at an offset of a VulkanImageHeap, which may be
+ * shared with other images. The content is undefined when the image is
+ * accessed for the first time after the others sharing the memory.
+ */
+class VulkanAliasedImage : public VulkanGpuImage
+{
+    vk::UniqueImage mImage;
+    // the memory must outlive the image
+    std::shared_ptr<VulkanImageHeap> mHeap;
+    std::size_t mOffset = 0;
+
+public:
+    VulkanAliasedImage(
+        vk::UniqueImage vk_image,
+        GpuImageFormat format,
+        const Vector2u32 &size,
+        std::shared_ptr<VulkanImageHeap> heap,
+        std::size_t offset);
+
+    vk::Image image() const override { return mImage.get(); }
+    const std::shared_ptr<VulkanImageHeap> & heap() const { return mHeap; }
+    std::size_t offset() const { return mOffset; }
+
+    // the content is produced by the GPU
+    void upload(const void *data, std::size_t size) override
+    {
+        USAGI_THROW(std::runtime_error("Operation not supported."));
+    }
+
+    void uploadRegion(
+        const void *buf_data,
+        std::size_t buf_size,
+        const Vector2i &tex_offset,
+        const Vector2u32 &tex_size) override
+    {
+        USAGI_THROW(std::runtime_error("Operation not supported."));
+    }
+};
+}
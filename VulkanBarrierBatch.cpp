@@ -0,0 +1,222 @@
+﻿#include "VulkanBarrierBatch.hpp"
+
+#include <algorithm>
+
+#include "VulkanGpuImage.hpp"
+
+const vk::AccessFlags usagi::VulkanBarrierBatch::WRITE_ACCESSES =
+    vk::AccessFlagBits::eShaderWrite |
+    vk::AccessFlagBits::eColorAttachmentWrite |
+    vk::AccessFlagBits::eDepthStencilAttachmentWrite |
+    vk::AccessFlagBits::eTransferWrite |
+    vk::AccessFlagBits::eHostWrite |
+    vk::AccessFlagBits::eMemoryWrite;
+
+vk::AccessFlags usagi::VulkanBarrierBatch::layoutAccesses(
+    const vk::ImageLayout layout)
+{
+    using vk::AccessFlagBits;
+    switch(layout)
+    {
+        case vk::ImageLayout::eGeneral:
+            return AccessFlagBits::eShaderRead | AccessFlagBits::eShaderWrite;
+        case vk::ImageLayout::eColorAttachmentOptimal:
+            return AccessFlagBits::eColorAttachmentRead |
+                AccessFlagBits::eColorAttachmentWrite;
+        case vk::ImageLayout::eDepthStencilAttachmentOptimal:
+            return AccessFlagBits::eDepthStencilAttachmentRead |
+                AccessFlagBits::eDepthStencilAttachmentWrite;
+        case vk::ImageLayout::eDepthStencilReadOnlyOptimal:
+            return AccessFlagBits::eDepthStencilAttachmentRead |
+                AccessFlagBits::eShaderRead;
+        case vk::ImageLayout::eShaderReadOnlyOptimal:
+            return AccessFlagBits::eShaderRead;
+        case vk::ImageLayout::eTransferSrcOptimal:
+            return AccessFlagBits::eTransferRead;
+        case vk::ImageLayout::eTransferDstOptimal:
+            return AccessFlagBits::eTransferWrite;
+        case vk::ImageLayout::ePreinitialized:
+            return AccessFlagBits::eHostWrite;
+        // the presentation engine makes the writes visible by itself
+        case vk::ImageLayout::ePresentSrcKHR:
+        default: return { };
+    }
+}
+
+void usagi::VulkanBarrierBatch::transition(
+    VulkanGpuImage &image,
+    const std::uint32_t base_mip,
+    const std::uint32_t mip_count,
+    const std::uint32_t base_layer,
+    const std::uint32_t layer_count,
+    const vk::ImageLayout layout,
+    const vk::PipelineStageFlags stages,
+    const vk::AccessFlags access,
+    const bool discard,
+    const vk::PipelineStageFlags untracked_src_stages)
+{
+    const auto vk_image = image.image();
+    const auto writes = static_cast<bool>(access & WRITE_ACCESSES);
+
+    for(auto layer = base_layer; layer < base_layer + layer_count; ++layer)
+    for(auto mip = base_mip; mip < base_mip + mip_count; ++mip)
+    {
+        auto &state = image.subresourceState(mip, layer);
+        const auto transits = layout != state.layout || writes;
+
+        // no command can access the subresource before the pending barrier
+        // so both transitions can be done by it.
+        const auto pending = std::find_if(mBarriers.begin(), mBarriers.end(),
+            [&](const PendingBarrier &b) {
+                return b.image == vk_image && b.mip == mip &&
+                    b.layer == layer;
+            });
+        if(pending != mBarriers.end())
+        {
+            if(transits)
+            {
+                // a pending read barrier only waits for the last write. the
+                // earlier reads must also finish before the transition.
+                const auto src_stages = state.stages | state.read_stages;
+                mSrcStages |= src_stages ? src_stages : untracked_src_stages;
+                pending->src_access |= state.access;
+                if(discard)
+                    pending->old_layout = vk::ImageLayout::eUndefined;
+            }
+            pending->new_layout = layout;
+            pending->dst_access |= access;
+            mDstStages |= stages;
+        }
+        else if(!transits)
+        {
+            // reading in the same layout only needs to wait for the last
+            // write if the stages are not synchronized with it yet
+            const auto missing = stages & ~state.read_stages;
+            if(!missing) continue;
+            if(state.stages)
+            {
+                PendingBarrier b;
+                b.image = vk_image;
+                b.aspects = image.aspects();
+                b.mip = mip;
+                b.layer = layer;
+                b.old_layout = layout;
+                b.new_layout = layout;
+                b.src_access = state.access;
+                b.dst_access = access;
+                mBarriers.push_back(b);
+                mSrcStages |= state.stages;
+                mDstStages |= missing;
+            }
+            state.read_stages |= stages;
+            continue;
+        }
+        else
+        {
+            PendingBarrier b;
+            b.image = vk_image;
+            b.aspects = image.aspects();
+            b.mip = mip;
+            b.layer = layer;
+            b.old_layout = discard ? vk::ImageLayout::eUndefined : state.layout;
+            b.new_layout = layout;
+            b.src_access = state.access;
+            b.dst_access = access;
+            mBarriers.push_back(b);
+            // the earlier reads must also finish before overwriting
+            const auto src_stages = state.stages | state.read_stages;
+            mSrcStages |= src_stages ? src_stages : untracked_src_stages;
+            mDstStages |= stages;
+        }
+
+        if(transits)
+        {
+            state.layout = layout;
+            state.stages = stages;
+            state.access = access & WRITE_ACCESSES;
+            state.read_stages = writes ? vk::PipelineStageFlags { } : stages;
+        }
+        else
+        {
+            state.read_stages |= stages;
+        }
+    }
+}
+
+void usagi::VulkanBarrierBatch::transition(
+    VulkanGpuImage &image,
+    const vk::ImageLayout layout,
+    const vk::PipelineStageFlags stages,
+    const vk::AccessFlags access,
+    const bool discard,
+    const vk::PipelineStageFlags untracked_src_stages)
+{
+    transition(image, 0, image.mipLevels(), 0, image.arrayLayers(),
+        layout, stages, access, discard, untracked_src_stages);
+}
+
+void usagi::VulkanBarrierBatch::record(const vk::CommandBuffer cmd)
+{
+    record(cmd, ~vk::PipelineStageFlags { }, ~vk::AccessFlags { });
+}
+
+void usagi::VulkanBarrierBatch::record(
+    const vk::CommandBuffer cmd,
+    const vk::PipelineStageFlags queue_stages,
+    const vk::AccessFlags queue_accesses)
+{
+    if(mBarriers.empty()) return;
+
+    // the pending barriers are per subresource. merge the consecutive mip
+    // levels of the same layer into one barrier.
+    mImageBarriers.clear();
+    for(auto &&b : mBarriers)
+    {
+        if(!mImageBarriers.empty())
+        {
+            auto &last = mImageBarriers.back();
+            auto &range = last.subresourceRange;
+            if(last.image == b.image &&
+                last.oldLayout == b.old_layout &&
+                last.newLayout == b.new_layout &&
+                last.srcAccessMask == b.src_access &&
+                last.dstAccessMask == b.dst_access &&
+                range.baseArrayLayer == b.layer &&
+                range.baseMipLevel + range.levelCount == b.mip)
+            {
+                ++range.levelCount;
+                continue;
+            }
+        }
+        vk::ImageMemoryBarrier barrier;
+        barrier.setImage(b.image);
+        barrier.setOldLayout(b.old_layout);
+        barrier.setNewLayout(b.new_layout);
+        barrier.setSrcAccessMask(b.src_access & queue_accesses);
+        barrier.setDstAccessMask(b.dst_access);
+        barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+        barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+        barrier.subresourceRange.setAspectMask(b.aspects);
+        barrier.subresourceRange.setBaseMipLevel(b.mip);
+        barrier.subresourceRange.setLevelCount(1);
+        barrier.subresourceRange.setBaseArrayLayer(b.layer);
+        barrier.subresourceRange.setLayerCount(1);
+        mImageBarriers.push_back(barrier);
+    }
+
+    auto src_stages = mSrcStages & queue_stages;
+    if(src_stages != mSrcStages)
+        src_stages |= vk::PipelineStageFlagBits::eAllCommands;
+    cmd.pipelineBarrier(
+        src_stages ? src_stages : vk::PipelineStageFlagBits::eTopOfPipe,
+        mDstStages,
+        { }, { }, { }, mImageBarriers);
+    clear();
+}
+
+void usagi::VulkanBarrierBatch::clear()
+{
+    mBarriers.clear();
+    mSrcStages = { };
+    mDstStages = { };
+}
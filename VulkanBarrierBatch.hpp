@@ -0,0 +1,101 @@
+﻿#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+namespace usagi
+{
+class VulkanGpuImage;
+
+/**
+ * \brief Collects the image transitions requested between two commands and
+ * records them with a single vkCmdPipelineBarrier. The source stages and
+ * accesses are taken from the tracked states of the subresources rather than
+ * guessed from the layouts, and no barrier is emitted for reads already
+ * synchronized with the last write.
+ *
+ * Transitions of a subresource which already has a pending barrier are folded
+ * into it, since no command can access the subresource in between.
+ */
+class VulkanBarrierBatch
+{
+    struct PendingBarrier
+    {
+        vk::Image image;
+        vk::ImageAspectFlags aspects;
+        std::uint32_t mip = 0;
+        std::uint32_t layer = 0;
+        vk::ImageLayout old_layout = vk::ImageLayout::eUndefined;
+        vk::ImageLayout new_layout = vk::ImageLayout::eUndefined;
+        vk::AccessFlags src_access;
+        vk::AccessFlags dst_access;
+    };
+    std::vector<PendingBarrier> mBarriers;
+    vk::PipelineStageFlags mSrcStages;
+    vk::PipelineStageFlags mDstStages;
+    // scratch buffer for merging the barriers of adjacent mip levels
+    std::vector<vk::ImageMemoryBarrier> mImageBarriers;
+
+public:
+    /**
+     * \brief The accesses which are writes.
+     */
+    static const vk::AccessFlags WRITE_ACCESSES;
+
+    /**
+     * \brief The accesses usually done to an image in the layout.
+     */
+    static vk::AccessFlags layoutAccesses(vk::ImageLayout layout);
+
+    /**
+     * \brief Make the subresources accessible by the stages in the layout.
+     * \param discard The content is not needed so the transition may start
+     * from the undefined layout.
+     * \param untracked_src_stages The source stages used if the subresource
+     * has not been accessed by any tracked command, e.g. a swapchain image
+     * waiting for a semaphore.
+     */
+    void transition(
+        VulkanGpuImage &image,
+        std::uint32_t base_mip,
+        std::uint32_t mip_count,
+        std::uint32_t base_layer,
+        std::uint32_t layer_count,
+        vk::ImageLayout layout,
+        vk::PipelineStageFlags stages,
+        vk::AccessFlags access,
+        bool discard = false,
+        vk::PipelineStageFlags untracked_src_stages =
+            vk::PipelineStageFlagBits::eTopOfPipe);
+    /**
+     * \brief Transition all the subresources of the image.
+     */
+    void transition(
+        VulkanGpuImage &image,
+        vk::ImageLayout layout,
+        vk::PipelineStageFlags stages,
+        vk::AccessFlags access,
+        bool discard = false,
+        vk::PipelineStageFlags untracked_src_stages =
+            vk::PipelineStageFlagBits::eTopOfPipe);
+
+    /**
+     * \brief Record the pending barriers. Does nothing if there is none.
+     */
+    void record(vk::CommandBuffer cmd);
+    /**
+     * \brief Record on a queue only supporting some of the stages, e.g. a
+     * dedicated compute queue. The unsupported source stages and accesses
+     * were last used on other queues which the submission waits for with
+     * semaphores, so they are replaced by a dependency on all the commands.
+     */
+    void record(
+        vk::CommandBuffer cmd,
+        vk::PipelineStageFlags queue_stages,
+        vk::AccessFlags queue_accesses);
+
+    bool empty() const { return mBarriers.empty(); }
+    void clear();
+};
+}
@@ -1,21 +1,50 @@
 ﻿#pragma once
 
-#include <vector>
+#include <atomic>
+#include <cstdint>
 
 #include <Usagi/Utility/Noncopyable.hpp>
 
 namespace usagi
 {
+class VulkanResourceTracker;
+
 /**
  * \brief Base class for tracking device resource usage using reference-
- * counting.
+ * counting. The resources used by the command lists of a frame are stamped
+ * with the frame number, so only one reference per frame is taken rather
+ * than one per use. See VulkanResourceTracker.
  */
 class VulkanBatchResource : Noncopyable
 {
+    // the last frame whose context holds a reference to the resource
+    std::atomic<std::uint64_t> mLastUsedFrame { 0 };
+
 public:
     virtual ~VulkanBatchResource() = default;
 
-    virtual void appendAdditionalResources(
-        std::vector<std::shared_ptr<VulkanBatchResource>> &resources) { }
+    /**
+     * \brief Stamp the resource as used during the frame.
+     * \return true for the first use in the frame, in which case the caller
+     * must keep the resource alive until the frame is completed.
+     */
+    bool markUsed(const std::uint64_t frame_number)
+    {
+        auto last = mLastUsedFrame.load(std::memory_order_relaxed);
+        // only one of the command lists recorded in parallel wins
+        while(last != frame_number)
+        {
+            if(mLastUsedFrame.compare_exchange_weak(
+                last, frame_number, std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * \brief Track the resources referred to by this one, e.g. the image of
+     * a view. Called for every use since they may be replaced in between.
+     */
+    virtual void trackAdditionalResources(VulkanResourceTracker &tracker) { }
 };
 }
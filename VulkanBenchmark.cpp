@@ -0,0 +1,334 @@
+﻿#include "VulkanBenchmark.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <numeric>
+#include <ostream>
+#include <random>
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Core/Logging.hpp>
+
+#include "VulkanBufferAllocation.hpp"
+#include "VulkanComputeCommandList.hpp"
+#include "VulkanComputePipeline.hpp"
+#include "VulkanGpuBuffer.hpp"
+#include "VulkanGpuCommandPool.hpp"
+#include "VulkanGpuDevice.hpp"
+#include "VulkanGraphicsCommandList.hpp"
+#include "VulkanPooledImage.hpp"
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+double elapsedNs(const Clock::time_point begin)
+{
+    return std::chrono::duration<double, std::nano>(
+        Clock::now() - begin).count();
+}
+
+usagi::VulkanBenchmarkResult summarize(
+    std::string name,
+    std::vector<double> &samples,
+    const double work_per_sample,
+    std::string unit)
+{
+    usagi::VulkanBenchmarkResult result;
+    result.name = std::move(name);
+    result.unit = std::move(unit);
+    result.samples = samples.size();
+    if(samples.empty()) return result;
+
+    std::sort(samples.begin(), samples.end());
+    const auto total = std::accumulate(samples.begin(), samples.end(), 0.0);
+    const auto n = samples.size();
+    result.mean_ns = total / n;
+    result.min_ns = samples.front();
+    result.median_ns = samples[n / 2];
+    result.p99_ns = samples[std::min(n - 1, n * 99 / 100)];
+    if(total > 0)
+        result.throughput = work_per_sample * n / (total * 1e-9);
+
+    LOG(info, "{}: median {:.0f} ns, p99 {:.0f} ns, {:.1f} {}",
+        result.name, result.median_ns, result.p99_ns,
+        result.throughput, result.unit);
+    return result;
+}
+}
+
+usagi::VulkanBenchmarkSuite::VulkanBenchmarkSuite(
+    VulkanGpuDevice *device,
+    VulkanBenchmarkConfig config)
+    : mDevice(device)
+    , mConfig(std::move(config))
+    , mCommandPool(std::make_shared<VulkanGpuCommandPool>(device))
+{
+}
+
+std::vector<usagi::VulkanBenchmarkResult> usagi::VulkanBenchmarkSuite::run()
+{
+    std::vector<VulkanBenchmarkResult> results;
+
+    results.push_back(measureDescriptorAllocation());
+    results.push_back(measureMemoryPool());
+    results.push_back(measureUpload());
+    results.push_back(measureSubmission());
+    if(mConfig.compute_shader)
+    {
+        for(auto &&r : measureCompile())
+            results.push_back(std::move(r));
+        if(!mConfig.resource_sets.empty())
+            results.push_back(measureBindResourceSet());
+    }
+
+    mDevice->waitIdle();
+    mDevice->reclaimResources();
+    return results;
+}
+
+usagi::VulkanBenchmarkResult
+    usagi::VulkanBenchmarkSuite::measureBindResourceSet()
+{
+    if(!mConfig.compute_shader || mConfig.resource_sets.empty())
+        USAGI_THROW(std::logic_error("Bind benchmark is not configured."));
+
+    auto compiler = mDevice->createComputePipelineCompiler();
+    compiler->setShader(mConfig.compute_shader);
+    const auto pipeline = compiler->compile();
+
+    std::vector<double> samples;
+    samples.reserve(mConfig.iterations);
+    for(std::size_t i = 0; i < mConfig.iterations; ++i)
+    {
+        // the lists are released without being submitted, which returns
+        // their descriptor pools
+        const auto list = mCommandPool->allocateComputeCommandList();
+        list->beginRecording();
+        list->bindPipeline(pipeline);
+
+        const auto begin = Clock::now();
+        for(std::size_t j = 0; j < mConfig.operations_per_sample; ++j)
+        {
+            list->bindResourceSet(0, mConfig.resource_sets[
+                j % mConfig.resource_sets.size()]);
+        }
+        samples.push_back(elapsedNs(begin));
+
+        list->endRecording();
+    }
+    return summarize("bind_resource_set", samples,
+        static_cast<double>(mConfig.operations_per_sample), "binds/s");
+}
+
+usagi::VulkanBenchmarkResult
+    usagi::VulkanBenchmarkSuite::measureDescriptorAllocation()
+{
+    // a typical material set
+    std::vector<vk::DescriptorSetLayoutBinding> bindings(3);
+    bindings[0].setDescriptorType(vk::DescriptorType::eUniformBuffer);
+    bindings[1].setDescriptorType(vk::DescriptorType::eSampledImage);
+    bindings[2].setDescriptorType(vk::DescriptorType::eSampler);
+    for(std::uint32_t i = 0; i < bindings.size(); ++i)
+    {
+        bindings[i].setBinding(i);
+        bindings[i].setDescriptorCount(1);
+        bindings[i].setStageFlags(vk::ShaderStageFlagBits::eCompute);
+    }
+    const auto layout = mDevice->layoutRegistry()->descriptorSetLayout(
+        std::move(bindings));
+    const auto &demand = layout->descriptorCounts();
+    const auto vk_layout = layout->layout();
+    const auto allocator = mDevice->descriptorPoolAllocator();
+
+    vk::DescriptorSetAllocateInfo info;
+    info.setDescriptorSetCount(1);
+    info.setPSetLayouts(&vk_layout);
+
+    std::vector<double> samples;
+    samples.reserve(mConfig.iterations);
+    for(std::size_t i = 0; i < mConfig.iterations; ++i)
+    {
+        // same as VulkanDescriptorBinder::allocateDescriptorSet()
+        std::vector<VulkanDescriptorPoolAllocator::Pool> pools;
+        VulkanDescriptorCounts usage;
+
+        const auto begin = Clock::now();
+        for(std::size_t j = 0; j < mConfig.operations_per_sample; ++j)
+        {
+            if(pools.empty() || !pools.back().remaining.contains(demand))
+                pools.push_back(allocator->acquire(demand));
+            auto &pool = pools.back();
+            info.setDescriptorPool(pool.pool.get());
+            vk::DescriptorSet set;
+            const auto result = mDevice->device().allocateDescriptorSets(
+                &info, &set);
+            if(result != vk::Result::eSuccess)
+            {
+                LOG(error, "vkAllocateDescriptorSets failed: {}",
+                    vk::to_string(result));
+                USAGI_THROW(std::runtime_error(
+                    "Could not allocate descriptor set."));
+            }
+            pool.remaining.subtract(demand);
+            usage.add(demand);
+        }
+        allocator->release(std::move(pools), usage);
+        samples.push_back(elapsedNs(begin));
+    }
+    return summarize("descriptor_allocation", samples,
+        static_cast<double>(mConfig.operations_per_sample), "sets/s");
+}
+
+std::vector<usagi::VulkanBenchmarkResult>
+    usagi::VulkanBenchmarkSuite::measureCompile()
+{
+    if(!mConfig.compute_shader)
+        USAGI_THROW(std::logic_error("Compile benchmark is not configured."));
+
+    const auto compile = [&]() {
+        auto compiler = mDevice->createComputePipelineCompiler();
+        compiler->setShader(mConfig.compute_shader);
+        const auto begin = Clock::now();
+        // the shader module is created by compile() too
+        const auto pipeline = compiler->compile();
+        return elapsedNs(begin);
+    };
+
+    std::vector<VulkanBenchmarkResult> results;
+    std::vector<double> samples { compile() };
+    results.push_back(summarize("compile_cold", samples, 1, "pipelines/s"));
+
+    samples.clear();
+    for(std::size_t i = 0; i < mConfig.compile_iterations; ++i)
+        samples.push_back(compile());
+    results.push_back(summarize("compile_warm", samples, 1, "pipelines/s"));
+    return results;
+}
+
+usagi::VulkanBenchmarkResult usagi::VulkanBenchmarkSuite::measureMemoryPool()
+{
+    std::mt19937 rng(mConfig.seed);
+    std::uniform_int_distribution<std::size_t> sizes(
+        mConfig.min_allocation_size, mConfig.max_allocation_size);
+    std::uniform_int_distribution<std::size_t> indices(
+        0, mConfig.live_allocations - 1);
+
+    std::vector<std::shared_ptr<GpuBuffer>> buffers;
+    for(std::size_t i = 0; i < mConfig.live_allocations; ++i)
+    {
+        auto buffer = mDevice->createBuffer(
+            GpuBufferUsage::UNIFORM, VulkanBufferPlacement::DEVICE_LOCAL);
+        buffer->allocate(sizes(rng));
+        buffers.push_back(std::move(buffer));
+    }
+
+    // the random numbers are drawn before timing each sample
+    std::vector<std::pair<std::size_t, std::size_t>> ops(
+        mConfig.operations_per_sample);
+    std::vector<double> samples;
+    samples.reserve(mConfig.iterations);
+    for(std::size_t i = 0; i < mConfig.iterations; ++i)
+    {
+        for(auto &&op : ops)
+            op = { indices(rng), sizes(rng) };
+
+        const auto begin = Clock::now();
+        for(auto &&op : ops)
+        {
+            auto &buffer = buffers[op.first];
+            buffer->release();
+            buffer->allocate(op.second);
+        }
+        samples.push_back(elapsedNs(begin));
+    }
+    buffers.clear();
+    mDevice->reclaimResources();
+
+    return summarize("memory_pool_reallocation", samples,
+        static_cast<double>(mConfig.operations_per_sample), "allocations/s");
+}
+
+usagi::VulkanBenchmarkResult usagi::VulkanBenchmarkSuite::measureUpload()
+{
+    GpuImageCreateInfo info;
+    info.size = { mConfig.upload_extent, mConfig.upload_extent };
+    info.format = GpuBufferFormat::R8G8B8A8_UNORM;
+    info.mip_levels = 1;
+    info.usage = GpuImageUsage::SAMPLED;
+    const auto image = mDevice->createImage(info, { });
+    const std::size_t size =
+        std::size_t { mConfig.upload_extent } * mConfig.upload_extent * 4;
+
+    mDevice->waitIdle();
+    mDevice->reclaimResources();
+
+    std::vector<double> samples;
+    samples.reserve(mConfig.upload_iterations);
+    for(std::size_t i = 0; i < mConfig.upload_iterations; ++i)
+    {
+        // the staging buffer is filled before timing. the sample includes
+        // the submission and the wait as well as the copy, so it is the
+        // latency of an upload rather than the copy bandwidth.
+        {
+            const auto buffer = mDevice->allocateStageBuffer(size);
+            memset(buffer->mappedAddress(), static_cast<int>(i), size);
+
+            const auto begin = Clock::now();
+            mDevice->copyBufferToImage(buffer, image.get(),
+                Vector2i::Zero(), info.size);
+            mDevice->flushUploads();
+            mDevice->waitIdle();
+            samples.push_back(elapsedNs(begin));
+        }
+        mDevice->reclaimResources();
+    }
+    return summarize("upload_submit_to_idle", samples, 1, "uploads/s");
+}
+
+usagi::VulkanBenchmarkResult usagi::VulkanBenchmarkSuite::measureSubmission()
+{
+    std::vector<double> samples;
+    samples.reserve(mConfig.iterations);
+    for(std::size_t i = 0; i < mConfig.iterations; ++i)
+    {
+        const auto begin = Clock::now();
+        {
+            const auto list = mCommandPool->allocateGraphicsCommandList();
+            list->beginRecording();
+            list->endRecording();
+            mDevice->submitGraphicsJobs({ list }, { }, { }, { });
+        }
+        mDevice->reclaimResources();
+        samples.push_back(elapsedNs(begin));
+    }
+    mDevice->waitIdle();
+    mDevice->reclaimResources();
+
+    return summarize("submit_graphics_jobs", samples, 1, "submits/s");
+}
+
+void usagi::writeBenchmarkResults(
+    std::ostream &out,
+    const std::vector<VulkanBenchmarkResult> &results)
+{
+    // the names and units are plain identifiers, so nothing is escaped
+    const auto flags = out.flags();
+    const auto precision = out.precision();
+    out << std::fixed << std::setprecision(1);
+    for(auto &&r : results)
+    {
+        out << "{\"name\":\"" << r.name << "\""
+            << ",\"samples\":" << r.samples
+            << ",\"mean_ns\":" << r.mean_ns
+            << ",\"min_ns\":" << r.min_ns
+            << ",\"median_ns\":" << r.median_ns
+            << ",\"p99_ns\":" << r.p99_ns
+            << ",\"throughput\":" << r.throughput
+            << ",\"unit\":\"" << r.unit << "\"}\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,134 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+class ShaderResource;
+class SpirvBinary;
+class VulkanGpuCommandPool;
+class VulkanGpuDevice;
+
+struct VulkanBenchmarkConfig
+{
+    // the samples taken by each benchmark unless given below
+    std::size_t iterations = 1000;
+    // the operations timed together in one sample of the cheap benchmarks,
+    // so that the clock overhead doesn't dominate
+    std::size_t operations_per_sample = 256;
+
+    // the buffers kept allocated from the device-local pool. each operation
+    // frees a random one and allocates it again with a random size.
+    std::size_t live_allocations = 256;
+    std::size_t min_allocation_size = 256;
+    std::size_t max_allocation_size = 1024 * 1024; // 1 MiB
+
+    // the width and height of the RGBA8 image uploaded by each sample
+    std::uint32_t upload_extent = 2048;
+    std::size_t upload_iterations = 32;
+
+    std::size_t compile_iterations = 16;
+
+    /**
+     * \brief The compute shader compiled by the compile benchmarks and bound
+     * by the bind benchmark, which are skipped if it is null.
+     */
+    std::shared_ptr<SpirvBinary> compute_shader;
+    /**
+     * \brief The resource sets matching the set 0 of the compute shader. The
+     * bind benchmark cycles through them so that each bind changes the set.
+     * Skipped if empty.
+     */
+    std::vector<std::vector<std::shared_ptr<ShaderResource>>> resource_sets;
+
+    // the random sizes and choices are the same for the same seed
+    std::uint32_t seed = 1;
+};
+
+struct VulkanBenchmarkResult
+{
+    std::string name;
+    std::size_t samples = 0;
+    // the duration of one sample
+    double mean_ns = 0;
+    double min_ns = 0;
+    double median_ns = 0;
+    double p99_ns = 0;
+    // the work done per second over all the samples, in the unit
+    double throughput = 0;
+    std::string unit;
+};
+
+/**
+ * \brief Measures the hot paths of the backend on a device without any
+ * window or swapchain, so it can run on headless machines. Only offscreen
+ * resources are created and the GPU work is synchronized with waitIdle(),
+ * so the device should not be used by anything else while running.
+ *
+ * The results can be written as JSON lines with writeBenchmarkResults() and
+ * compared between driver or engine versions.
+ */
+class VulkanBenchmarkSuite : Noncopyable
+{
+    VulkanGpuDevice *mDevice = nullptr;
+    VulkanBenchmarkConfig mConfig;
+    std::shared_ptr<VulkanGpuCommandPool> mCommandPool;
+
+public:
+    explicit VulkanBenchmarkSuite(
+        VulkanGpuDevice *device,
+        VulkanBenchmarkConfig config = { });
+
+    /**
+     * \brief Run all the benchmarks whose inputs are configured.
+     */
+    std::vector<VulkanBenchmarkResult> run();
+
+    /**
+     * \brief Record bindResourceSet() on compute command lists, cycling
+     * through the configured resource sets.
+     */
+    VulkanBenchmarkResult measureBindResourceSet();
+    /**
+     * \brief Allocate descriptor sets from the pools of the device pool
+     * allocator, in the same way as the command lists.
+     */
+    VulkanBenchmarkResult measureDescriptorAllocation();
+    /**
+     * \brief The first compile of the shader by the device, which misses the
+     * reflection cache and the layout registry, and the later compiles by
+     * new compilers which hit them and the driver pipeline cache. The first
+     * one may still hit the pipeline cache saved by an earlier run.
+     */
+    std::vector<VulkanBenchmarkResult> measureCompile();
+    /**
+     * \brief Free and allocate buffers of random sizes from the device-local
+     * buffer pool while the other buffers fragment it.
+     */
+    VulkanBenchmarkResult measureMemoryPool();
+    /**
+     * \brief The latency from recording copyBufferToImage() of a filled
+     * staging buffer to the device being idle after the copy. Filling the
+     * buffer is not timed.
+     */
+    VulkanBenchmarkResult measureUpload();
+    /**
+     * \brief Submit empty graphics command lists one by one, reclaiming the
+     * completed batches after each submission.
+     */
+    VulkanBenchmarkResult measureSubmission();
+};
+
+/**
+ * \brief Write one JSON object per line for each result.
+ */
+void writeBenchmarkResults(
+    std::ostream &out,
+    const std::vector<VulkanBenchmarkResult> &results);
+}
@@ -0,0 +1,123 @@
+﻿#include "VulkanBuddyAllocator.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <new>
+
+#include "VulkanHelper.hpp"
+
+using namespace usagi::vulkan;
+
+usagi::VulkanBuddyAllocator::VulkanBuddyAllocator(
+    void *base,
+    const std::size_t total_size,
+    const std::size_t min_block_size)
+    : mBase(reinterpret_cast<std::uintptr_t>(base))
+    , mTotalSize(total_size / min_block_size * min_block_size)
+    , mMinBlockSize(min_block_size)
+{
+    assert(min_block_size > 0 &&
+        (min_block_size & (min_block_size - 1)) == 0);
+
+    const auto units = mTotalSize / mMinBlockSize;
+    if(units == 0) return;
+    mFreeBlocks.resize(highestBit(units) + 1);
+
+    // cover the pool with blocks of decreasing sizes so that each of them is
+    // aligned to its size.
+    std::size_t offset = 0;
+    for(auto order = static_cast<std::int32_t>(mFreeBlocks.size()) - 1;
+        order >= 0; --order)
+    {
+        if(units & (std::size_t(1) << order))
+        {
+            mFreeBlocks[order].insert(offset);
+            offset += blockSize(order);
+        }
+    }
+}
+
+void * usagi::VulkanBuddyAllocator::allocate(
+    const std::size_t size,
+    const std::size_t alignment)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    const auto units = alignUp(std::max({ size, alignment, std::size_t(1) }),
+        mMinBlockSize) / mMinBlockSize;
+    auto order = highestBit(units);
+    if((std::size_t(1) << order) != units) ++order;
+
+    // find the smallest free block which is large enough
+    auto found = order;
+    while(found < mFreeBlocks.size() && mFreeBlocks[found].empty())
+        ++found;
+    if(found >= mFreeBlocks.size())
+        throw std::bad_alloc();
+
+    auto &list = mFreeBlocks[found];
+    const auto offset = *list.begin();
+    list.erase(list.begin());
+
+    // return the upper halves to the free lists
+    while(found > order)
+    {
+        --found;
+        mFreeBlocks[found].insert(offset + blockSize(found));
+    }
+
+    mAllocations.insert({ offset, { order, size } });
+    mUsedSize += blockSize(order);
+    mRequestedSize += size;
+
+    return reinterpret_cast<void*>(mBase + offset);
+}
+
+void usagi::VulkanBuddyAllocator::deallocate(void *pointer)
+{
+    auto offset = static_cast<std::size_t>(
+        reinterpret_cast<std::uintptr_t>(pointer) - mBase);
+    const auto iter = mAllocations.find(offset);
+    assert(iter != mAllocations.end());
+    if(iter == mAllocations.end()) return;
+
+    auto order = iter->second.order;
+    mUsedSize -= blockSize(order);
+    mRequestedSize -= iter->second.requested_size;
+    mAllocations.erase(iter);
+
+    // a buddy only lies completely inside the pool if it was split from a
+    // larger block, so it is never found otherwise.
+    while(order + 1 < mFreeBlocks.size())
+    {
+        const auto buddy = offset ^ blockSize(order);
+        const auto buddy_iter = mFreeBlocks[order].find(buddy);
+        if(buddy_iter == mFreeBlocks[order].end()) break;
+        mFreeBlocks[order].erase(buddy_iter);
+        offset = std::min(offset, buddy);
+        ++order;
+    }
+    mFreeBlocks[order].insert(offset);
+}
+
+usagi::VulkanSubAllocatorStatistics
+    usagi::VulkanBuddyAllocator::statistics() const
+{
+    VulkanSubAllocatorStatistics stats;
+    stats.total_size = mTotalSize;
+    stats.used_size = mUsedSize;
+    stats.free_size = mTotalSize - mUsedSize;
+    stats.allocation_count = mAllocations.size();
+    stats.wasted_size = mUsedSize - mRequestedSize;
+
+    for(std::size_t order = 0; order < mFreeBlocks.size(); ++order)
+    {
+        const auto count = mFreeBlocks[order].size();
+        stats.free_block_count += count;
+        if(count > 0)
+            stats.largest_free_block = blockSize(
+                static_cast<std::uint32_t>(order));
+    }
+
+    return stats;
+}
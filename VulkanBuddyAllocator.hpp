@@ -0,0 +1,61 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "VulkanSubAllocator.hpp"
+
+namespace usagi
+{
+/**
+ * \brief Binary buddy allocator. Blocks are powers of two multiples of the
+ * minimum block size and aligned to their sizes, so any alignment not larger
+ * than the block is satisfied for free. Freed blocks are merged with their
+ * buddies when both halves are free.
+ *
+ * Wastes up to half of each allocation, but the free space stays in large
+ * blocks which suits pools with mostly large allocations.
+ */
+class VulkanBuddyAllocator : public VulkanSubAllocator
+{
+    const std::uintptr_t mBase;
+    const std::size_t mTotalSize;
+    const std::size_t mMinBlockSize;
+
+    // offsets of the free blocks of each order. block size of order k is
+    // mMinBlockSize << k.
+    std::vector<std::unordered_set<std::size_t>> mFreeBlocks;
+
+    struct Allocation
+    {
+        std::uint32_t order;
+        std::size_t requested_size;
+    };
+    std::unordered_map<std::size_t, Allocation> mAllocations;
+
+    std::size_t mUsedSize = 0;
+    std::size_t mRequestedSize = 0;
+
+    std::size_t blockSize(std::uint32_t order) const
+    {
+        return mMinBlockSize << order;
+    }
+
+public:
+    /**
+     * \param min_block_size Must be a power of two.
+     */
+    VulkanBuddyAllocator(
+        void *base,
+        std::size_t total_size,
+        std::size_t min_block_size);
+
+    void * allocate(std::size_t size, std::size_t alignment = 1) override;
+    void deallocate(void *pointer) override;
+
+    std::size_t usedSize() const override { return mUsedSize; }
+    VulkanSubAllocatorStatistics statistics() const override;
+};
+}
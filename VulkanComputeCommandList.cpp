@@ -0,0 +1,258 @@
+﻿#include "VulkanComputeCommandList.hpp"
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Utility/TypeCast.hpp>
+
+#include "VulkanComputePipeline.hpp"
+#include "VulkanGpuBuffer.hpp"
+#include "VulkanGpuCommandPool.hpp"
+#include "VulkanGpuDevice.hpp"
+#include "VulkanGpuImage.hpp"
+#include "VulkanHelper.hpp"
+#include "VulkanShaderResource.hpp"
+
+usagi::VulkanComputeCommandList::VulkanComputeCommandList(
+    std::shared_ptr<VulkanGpuCommandPool> pool,
+    vk::UniqueCommandBuffer vk_command_buffer)
+    : mCommandPool(std::move(pool))
+    , mOwnedCommandBuffer(std::move(vk_command_buffer))
+    , mCommandBuffer(mOwnedCommandBuffer.get())
+    , mDescriptors(mCommandPool->device())
+    , mResources(nullptr)
+    , mDebugLabels(mCommandPool->device()->debugUtilsEnabled())
+{
+    initQueueCapabilities();
+}
+
+usagi::VulkanComputeCommandList::VulkanComputeCommandList(
+    std::shared_ptr<VulkanGpuCommandPool> pool,
+    const vk::CommandBuffer vk_command_buffer)
+    : mCommandPool(std::move(pool))
+    , mCommandBuffer(vk_command_buffer)
+    , mDescriptors(mCommandPool->device())
+    , mResources(mCommandPool->device()->currentFrame())
+    , mDebugLabels(mCommandPool->device()->debugUtilsEnabled())
+{
+    initQueueCapabilities();
+}
+
+void usagi::VulkanComputeCommandList::initQueueCapabilities()
+{
+    if(!mCommandPool->device()->hasDedicatedComputeQueue())
+    {
+        // recorded for the graphics queue
+        mQueueStages = ~vk::PipelineStageFlags { };
+        mQueueAccesses = ~vk::AccessFlags { };
+        return;
+    }
+
+    using vk::PipelineStageFlagBits;
+    using vk::AccessFlagBits;
+    mQueueStages =
+        PipelineStageFlagBits::eTopOfPipe |
+        PipelineStageFlagBits::eDrawIndirect |
+        PipelineStageFlagBits::eComputeShader |
+        PipelineStageFlagBits::eTransfer |
+        PipelineStageFlagBits::eBottomOfPipe |
+        PipelineStageFlagBits::eHost |
+        PipelineStageFlagBits::eAllCommands;
+    mQueueAccesses =
+        AccessFlagBits::eIndirectCommandRead |
+        AccessFlagBits::eUniformRead |
+        AccessFlagBits::eShaderRead |
+        AccessFlagBits::eShaderWrite |
+        AccessFlagBits::eTransferRead |
+        AccessFlagBits::eTransferWrite |
+        AccessFlagBits::eHostRead |
+        AccessFlagBits::eHostWrite |
+        AccessFlagBits::eMemoryRead |
+        AccessFlagBits::eMemoryWrite;
+}
+
+void usagi::VulkanComputeCommandList::beginRecording()
+{
+    mCurrentPipeline = nullptr;
+    mDescriptors.reset();
+    mConstants.clear();
+
+    vk::CommandBufferBeginInfo command_buffer_begin_info;
+    command_buffer_begin_info.setFlags(
+        vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+
+    mCommandBuffer.begin(command_buffer_begin_info);
+}
+
+void usagi::VulkanComputeCommandList::endRecording()
+{
+    // the transitions for the next command lists
+    flushBarriers();
+    mCommandBuffer.end();
+    mResources.flush();
+}
+
+void usagi::VulkanComputeCommandList::transition(
+    VulkanGpuImage &image,
+    const vk::ImageLayout layout,
+    const vk::AccessFlags access,
+    const vk::PipelineStageFlags stages,
+    const bool discard)
+{
+    mBarriers.transition(image, layout, stages, access, discard);
+}
+
+void usagi::VulkanComputeCommandList::memoryBarrier(
+    const vk::PipelineStageFlags src_stages,
+    const vk::AccessFlags src_access,
+    const vk::PipelineStageFlags dst_stages,
+    const vk::AccessFlags dst_access)
+{
+    flushBarriers();
+
+    vk::MemoryBarrier barrier;
+    barrier.setSrcAccessMask(src_access);
+    barrier.setDstAccessMask(dst_access);
+    mCommandBuffer.pipelineBarrier(src_stages, dst_stages, { },
+        { barrier }, { }, { });
+}
+
+void usagi::VulkanComputeCommandList::flushBarriers()
+{
+    mBarriers.record(mCommandBuffer, mQueueStages, mQueueAccesses);
+}
+
+void usagi::VulkanComputeCommandList::trackResource(
+    const std::shared_ptr<VulkanBatchResource> &resource)
+{
+    mResources.track(resource);
+}
+
+void usagi::VulkanComputeCommandList::bindPipeline(
+    std::shared_ptr<VulkanComputePipeline> pipeline)
+{
+    if(mCurrentPipeline == pipeline.get()) return;
+
+    flushConstants();
+    mCommandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+        pipeline->pipeline());
+    // the layouts are kept alive by the tracked pipelines
+    mDescriptors.setPipelineLayout(pipeline->pipelineLayout());
+    mCurrentPipeline = pipeline.get();
+    mResources.track(pipeline);
+}
+
+void usagi::VulkanComputeCommandList::bindResourceSet(
+    const std::uint32_t set_id,
+    std::initializer_list<std::shared_ptr<ShaderResource>> resources)
+{
+    bindResourceSetImpl(set_id, resources);
+}
+
+void usagi::VulkanComputeCommandList::bindResourceSet(
+    const std::uint32_t set_id,
+    const std::vector<std::shared_ptr<ShaderResource>> &resources)
+{
+    bindResourceSetImpl(set_id, resources);
+}
+
+template <typename Container>
+void usagi::VulkanComputeCommandList::bindResourceSetImpl(
+    const std::uint32_t set_id,
+    Container &resources)
+{
+    assert(mCurrentPipeline);
+
+    // see VulkanGraphicsCommandList::bindResourceSetImpl()
+    mShaderResources.clear();
+    for(auto &&r : resources)
+    {
+        mShaderResources.push_back(r
+            ? &dynamic_cast_ref<VulkanShaderResource>(r.get())
+            : nullptr);
+    }
+    if(!mDescriptors.bind(mCommandBuffer, vk::PipelineBindPoint::eCompute,
+        set_id, mShaderResources))
+        return;
+
+    auto iter = resources.begin();
+    for(auto &&r : mShaderResources)
+    {
+        // the immutable samplers are kept alive by the pipeline
+        if(r) mResources.track(r->batchResource(), *iter);
+        ++iter;
+    }
+}
+
+void usagi::VulkanComputeCommandList::setConstant(
+    const char *name,
+    const void *data,
+    const std::size_t size)
+{
+    if(mCurrentPipeline == nullptr)
+        USAGI_THROW(std::runtime_error(
+            "No active pipeline is bound, unable to retrieve pipeline layout."
+        ));
+
+    const auto constant_info = mCurrentPipeline->queryConstantInfo(name);
+    if(size != constant_info.size)
+        USAGI_THROW(std::runtime_error("Unmatched constant size."));
+
+    setConstant(constant_info, data);
+}
+
+void usagi::VulkanComputeCommandList::setConstant(
+    const VulkanPushConstantField &field,
+    const void *data)
+{
+    assert(mCurrentPipeline);
+    assert(field.offset + field.size <=
+        mCurrentPipeline->pipelineLayout()->pushConstantSize());
+    mConstants.set(field, data);
+}
+
+void usagi::VulkanComputeCommandList::flushConstants()
+{
+    if(mCurrentPipeline)
+    {
+        mConstants.flush(mCommandBuffer,
+            *mCurrentPipeline->pipelineLayout());
+    }
+}
+
+void usagi::VulkanComputeCommandList::dispatch(
+    const std::uint32_t group_count_x,
+    const std::uint32_t group_count_y,
+    const std::uint32_t group_count_z)
+{
+    flushBarriers();
+    flushConstants();
+    mCommandBuffer.dispatch(group_count_x, group_count_y, group_count_z);
+}
+
+vk::Buffer usagi::VulkanComputeCommandList::trackBuffer(
+    const std::shared_ptr<GpuBuffer> &buffer,
+    std::size_t &offset)
+{
+    auto &vk_buffer = vulkan::backendCast<VulkanGpuBuffer>(buffer.get());
+    offset += vk_buffer.offset();
+    // transient buffers are reclaimed with the frame
+    if(const auto &allocation = vk_buffer.allocation())
+        mResources.track(allocation);
+    return vk_buffer.buffer();
+}
+
+void usagi::VulkanComputeCommandList::dispatchIndirect(
+    const std::shared_ptr<GpuBuffer> &buffer,
+    std::size_t offset)
+{
+    const auto vk_buffer = trackBuffer(buffer, offset);
+    dispatchIndirect(vk_buffer, offset);
+}
+
+void usagi::VulkanComputeCommandList::dispatchIndirect(
+    const vk::Buffer buffer,
+    const vk::DeviceSize offset)
+{
+    flushBarriers();
+    flushConstants();
+    mCommandBuffer.dispatchIndirect(buffer, offset);
+}
@@ -0,0 +1,173 @@
+﻿#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "VulkanBarrierBatch.hpp"
+#include "VulkanBatchResource.hpp"
+#include "VulkanDescriptorBinder.hpp"
+#include "VulkanPushConstantBuffer.hpp"
+#include "VulkanResourceTracker.hpp"
+
+namespace usagi
+{
+class GpuBuffer;
+class ShaderResource;
+class VulkanGpuCommandPool;
+class VulkanGpuImage;
+class VulkanComputePipeline;
+class VulkanShaderResource;
+
+/**
+ * \brief Records compute work. The command list is allocated from the queue
+ * family of the compute queue of the device, which may be a dedicated one
+ * running alongside the graphics queue. The work is submitted with
+ * VulkanGpuDevice::submitComputeJobs() and ordered with the graphics jobs by
+ * semaphores.
+ *
+ * The storage buffers may be used by all the queues. The storage images of
+ * the render graph are shared by the graphics and compute queue families, so
+ * no ownership transfer is needed either.
+ */
+class VulkanComputeCommandList : public VulkanBatchResource
+{
+    // this shared_ptr is used to ensure that the pool won't be freed before
+    // command lists.
+    std::shared_ptr<VulkanGpuCommandPool> mCommandPool;
+    // null if the command buffer is recycled by the frame context
+    vk::UniqueCommandBuffer mOwnedCommandBuffer;
+    vk::CommandBuffer mCommandBuffer;
+    // kept alive by the tracked resources
+    VulkanComputePipeline *mCurrentPipeline = nullptr;
+    VulkanDescriptorBinder mDescriptors;
+    VulkanResourceTracker mResources;
+    // scratch buffer for the resources of bindResourceSet()
+    std::vector<VulkanShaderResource *> mShaderResources;
+    // recorded before the next command depending on them
+    VulkanPushConstantBuffer mConstants;
+
+    VulkanBarrierBatch mBarriers;
+    // the stages and accesses supported by the queue family. the images last
+    // accessed by other queues are synchronized by the semaphores instead.
+    vk::PipelineStageFlags mQueueStages;
+    vk::AccessFlags mQueueAccesses;
+    // VK_EXT_debug_utils is enabled on the device
+    const bool mDebugLabels;
+
+    void initQueueCapabilities();
+    template <typename Container>
+    void bindResourceSetImpl(std::uint32_t set_id, Container &resources);
+    void flushConstants();
+    vk::Buffer trackBuffer(
+        const std::shared_ptr<GpuBuffer> &buffer,
+        std::size_t &offset);
+
+public:
+    VulkanComputeCommandList(
+        std::shared_ptr<VulkanGpuCommandPool> pool,
+        vk::UniqueCommandBuffer vk_command_buffer);
+    /**
+     * \brief Use a command buffer owned by the pool of a frame context. The
+     * command list must not be used after the context is reused.
+     */
+    VulkanComputeCommandList(
+        std::shared_ptr<VulkanGpuCommandPool> pool,
+        vk::CommandBuffer vk_command_buffer);
+
+    void beginRecording();
+    void endRecording();
+
+    /**
+     * \brief Request a transition of all the subresources of the image, e.g.
+     * to vk::ImageLayout::eGeneral for storage images. The barriers are
+     * batched until the next dispatch.
+     */
+    void transition(
+        VulkanGpuImage &image,
+        vk::ImageLayout layout,
+        vk::AccessFlags access,
+        vk::PipelineStageFlags stages =
+            vk::PipelineStageFlagBits::eComputeShader,
+        bool discard = false);
+    /**
+     * \brief Make the writes of the previous commands to the buffers visible
+     * to the later ones, e.g. between two dispatches, or before reading the
+     * arguments of an indirect dispatch.
+     */
+    void memoryBarrier(
+        vk::PipelineStageFlags src_stages,
+        vk::AccessFlags src_access,
+        vk::PipelineStageFlags dst_stages,
+        vk::AccessFlags dst_access);
+    void flushBarriers();
+    /**
+     * \brief Keep the resource alive until the GPU finished executing the
+     * command list, see VulkanResourceTracker.
+     */
+    void trackResource(const std::shared_ptr<VulkanBatchResource> &resource);
+
+    /**
+     * \brief Label the commands until the matching popLabel(), see
+     * VulkanGraphicsCommandList::pushLabel().
+     */
+    void pushLabel(const char *name)
+    {
+#ifndef USAGI_VULKAN_NO_DEBUG_LABELS
+        if(mDebugLabels)
+        {
+            vk::DebugUtilsLabelEXT label;
+            label.setPLabelName(name);
+            mCommandBuffer.beginDebugUtilsLabelEXT(label);
+        }
+#endif
+    }
+    void popLabel()
+    {
+#ifndef USAGI_VULKAN_NO_DEBUG_LABELS
+        if(mDebugLabels) mCommandBuffer.endDebugUtilsLabelEXT();
+#endif
+    }
+
+    void bindPipeline(std::shared_ptr<VulkanComputePipeline> pipeline);
+    /**
+     * \brief Bind the resources in the order of the bindings, same as
+     * VulkanGraphicsCommandList::bindResourceSet(). Storage buffers are
+     * bound with GpuBuffers and storage images with the views of images in
+     * the general layout.
+     */
+    void bindResourceSet(
+        std::uint32_t set_id,
+        std::initializer_list<std::shared_ptr<ShaderResource>> resources);
+    void bindResourceSet(
+        std::uint32_t set_id,
+        const std::vector<std::shared_ptr<ShaderResource>> &resources);
+    void setConstant(const char *name, const void *data, std::size_t size);
+    /**
+     * \brief Set a push constant field resolved by
+     * VulkanComputePipeline::queryConstantInfo(). The fields set before a
+     * dispatch are pushed together.
+     */
+    void setConstant(const VulkanPushConstantField &field, const void *data);
+
+    void dispatch(
+        std::uint32_t group_count_x,
+        std::uint32_t group_count_y = 1,
+        std::uint32_t group_count_z = 1);
+    /**
+     * \brief Dispatch with the group counts read from the buffer as a
+     * vk::DispatchIndirectCommand, e.g. written by a previous dispatch.
+     */
+    void dispatchIndirect(
+        const std::shared_ptr<GpuBuffer> &buffer,
+        std::size_t offset);
+    /**
+     * \brief Dispatch with the arguments in a buffer which is not tracked,
+     * e.g. a region of the transient buffer.
+     */
+    void dispatchIndirect(vk::Buffer buffer, vk::DeviceSize offset);
+
+    vk::CommandBuffer commandBuffer() const { return mCommandBuffer; }
+};
+}
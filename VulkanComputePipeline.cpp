@@ -0,0 +1,25 @@
+﻿#include "VulkanComputePipeline.hpp"
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Core/Logging.hpp>
+
+#include "VulkanGpuDevice.hpp"
+#include "VulkanHelper.hpp"
+
+void usagi::VulkanComputePipeline::setDebugName(const char *name)
+{
+    mDevice->setObjectName(vk::ObjectType::ePipeline,
+        vulkan::handleValue(mPipeline.get()), name);
+}
+
+usagi::VulkanPushConstantField usagi::VulkanComputePipeline::queryConstantInfo(
+    const char *name) const
+{
+    const auto iter = mConstantFieldMap.find(name);
+    if(iter == mConstantFieldMap.end())
+    {
+        LOG(error, "Nonexisting push constant field: {}", name);
+        USAGI_THROW(std::logic_error("Referenced invalid resource."));
+    }
+    return iter->second;
+}
@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+
+#include <vulkan/vulkan.hpp>
+
+#include "VulkanBatchResource.hpp"
+#include "VulkanGraphicsPipeline.hpp"
+#include "VulkanLayoutRegistry.hpp"
+
+namespace usagi
+{
+class VulkanGpuDevice;
+
+class VulkanComputePipeline : public VulkanBatchResource
+{
+public:
+    using PushConstantFieldMap =
+        std::map<std::string, VulkanPushConstantField, std::less<>>;
+
+private:
+    VulkanGpuDevice *mDevice = nullptr;
+    vk::UniquePipeline mPipeline;
+    // shared with the pipelines having the same layout
+    const std::shared_ptr<VulkanPipelineLayout> mPipelineLayout;
+
+    const PushConstantFieldMap mConstantFieldMap;
+
+public:
+    VulkanComputePipeline(
+        VulkanGpuDevice *device,
+        vk::UniquePipeline vk_pipeline,
+        std::shared_ptr<VulkanPipelineLayout> pipeline_layout,
+        PushConstantFieldMap constant_field_map)
+        : mDevice { device }
+        , mPipeline { std::move(vk_pipeline) }
+        , mPipelineLayout { std::move(pipeline_layout) }
+        , mConstantFieldMap { std::move(constant_field_map) }
+    {
+    }
+
+    vk::Pipeline pipeline() const { return mPipeline.get(); }
+    /**
+     * \brief Name the pipeline for the debuggers. Does nothing if debug
+     * utils are disabled.
+     */
+    void setDebugName(const char *name);
+    vk::PipelineLayout layout() const { return mPipelineLayout->layout(); }
+    VulkanPipelineLayout * pipelineLayout() const
+    {
+        return mPipelineLayout.get();
+    }
+
+    /**
+     * \brief Find the push constant field, which may be resolved once and
+     * passed to VulkanComputeCommandList::setConstant() for every dispatch.
+     */
+    VulkanPushConstantField queryConstantInfo(const char *name) const;
+};
+}
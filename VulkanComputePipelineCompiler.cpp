@@ -0,0 +1,168 @@
+﻿#include "VulkanComputePipelineCompiler.hpp"
+
+#include <map>
+#include <vector>
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Core/Logging.hpp>
+#include <Usagi/Runtime/Graphics/Shader/SpirvBinary.hpp>
+#include <Usagi/Utility/TypeCast.hpp>
+
+#include "VulkanComputePipeline.hpp"
+#include "VulkanGpuDevice.hpp"
+#include "VulkanSampler.hpp"
+#include "VulkanShaderReflection.hpp"
+
+usagi::VulkanComputePipelineCompiler::VulkanComputePipelineCompiler(
+    VulkanGpuDevice *device)
+    : mDevice { device }
+{
+}
+
+void usagi::VulkanComputePipelineCompiler::setShader(
+    std::shared_ptr<SpirvBinary> shader,
+    std::string entry_point)
+{
+    mShader = std::move(shader);
+    mEntryPoint = std::move(entry_point);
+    mModule.reset();
+}
+
+void usagi::VulkanComputePipelineCompiler::setDynamicUniformBuffer(
+    const std::uint32_t set,
+    const std::uint32_t binding)
+{
+    mDynamicUniformBuffers.emplace(set, binding);
+}
+
+void usagi::VulkanComputePipelineCompiler::setImmutableSampler(
+    const std::uint32_t set,
+    const std::uint32_t binding,
+    std::shared_ptr<GpuSampler> sampler)
+{
+    mImmutableSamplers[{ set, binding }] =
+        dynamic_pointer_cast_throw<VulkanSampler>(std::move(sampler));
+}
+
+std::shared_ptr<usagi::VulkanComputePipeline>
+    usagi::VulkanComputePipelineCompiler::compile()
+{
+    if(!mShader)
+        USAGI_THROW(std::logic_error("Compute shader is not set."));
+
+    LOG(info, "Compiling compute pipeline...");
+
+    if(!mModule)
+    {
+        auto &bytecodes = mShader->bytecodes();
+        vk::ShaderModuleCreateInfo module_info;
+        module_info.setCodeSize(
+            bytecodes.size() * sizeof(SpirvBinary::Bytecode));
+        module_info.setPCode(bytecodes.data());
+        mModule = mDevice->device().createShaderModuleUnique(module_info);
+    }
+
+    LOG(info, "Generating pipeline layout...");
+
+    const auto reflection =
+        mDevice->shaderReflectionCache()->reflect(*mShader);
+
+    VulkanComputePipeline::PushConstantFieldMap push_constant_fields;
+    for(auto &&f : reflection->push_constant_fields)
+    {
+        VulkanPushConstantField field;
+        field.offset = f.offset;
+        field.size = f.size;
+        push_constant_fields[f.name] = field;
+    }
+    std::vector<vk::PushConstantRange> push_constants;
+    if(reflection->push_constant_size != 0)
+    {
+        vk::PushConstantRange range;
+        range.setOffset(reflection->push_constant_offset);
+        range.setSize(reflection->push_constant_size -
+            reflection->push_constant_offset);
+        range.setStageFlags(vk::ShaderStageFlagBits::eCompute);
+        push_constants.push_back(range);
+    }
+
+    std::map<std::uint32_t, std::vector<vk::DescriptorSetLayoutBinding>>
+        desc_set_layout_bindings;
+    std::map<std::uint32_t, std::vector<std::shared_ptr<VulkanSampler>>>
+        immutable_samplers;
+    for(auto &&b : reflection->descriptor_bindings)
+    {
+        vk::DescriptorSetLayoutBinding layout_binding;
+        layout_binding.setStageFlags(vk::ShaderStageFlagBits::eCompute);
+        layout_binding.setBinding(b.binding);
+        layout_binding.setDescriptorCount(b.count);
+        auto type = b.type;
+        if(type == vk::DescriptorType::eUniformBuffer &&
+            mDynamicUniformBuffers.count({ b.set, b.binding }))
+            type = vk::DescriptorType::eUniformBufferDynamic;
+        layout_binding.setDescriptorType(type);
+        const auto sampler = mImmutableSamplers.find({ b.set, b.binding });
+        if(type == vk::DescriptorType::eSampler &&
+            sampler != mImmutableSamplers.end())
+        {
+            if(b.count != 1)
+            {
+                LOG(error, "Immutable sampler at set {} binding {} is an "
+                    "array.", b.set, b.binding);
+                USAGI_THROW(std::logic_error(
+                    "Unsupported immutable sampler."));
+            }
+            layout_binding.setPImmutableSamplers(
+                sampler->second->samplerPointer());
+            immutable_samplers[b.set].push_back(sampler->second);
+        }
+        desc_set_layout_bindings[b.set].push_back(layout_binding);
+    }
+
+    const auto registry = mDevice->layoutRegistry();
+    // the unused set numbers are filled with empty layouts, same as the
+    // graphics pipelines.
+    std::vector<std::shared_ptr<VulkanDescriptorSetLayout>> desc_set_layouts;
+    for(auto &&layout : desc_set_layout_bindings)
+    {
+        while(desc_set_layouts.size() < layout.first)
+            desc_set_layouts.push_back(registry->descriptorSetLayout({ }));
+        desc_set_layouts.push_back(registry->descriptorSetLayout(
+            std::move(layout.second),
+            std::move(immutable_samplers[layout.first])));
+    }
+    auto pipeline_layout = registry->pipelineLayout(
+        std::move(desc_set_layouts), std::move(push_constants));
+
+    vk::ComputePipelineCreateInfo pipeline_info;
+    pipeline_info.stage.setStage(vk::ShaderStageFlagBits::eCompute);
+    pipeline_info.stage.setModule(mModule.get());
+    pipeline_info.stage.setPName(mEntryPoint.c_str());
+    pipeline_info.setLayout(pipeline_layout->layout());
+    if(mParentPipeline)
+    {
+        pipeline_info.setFlags(vk::PipelineCreateFlagBits::eDerivative);
+        pipeline_info.setBasePipelineHandle(mParentPipeline->pipeline());
+        pipeline_info.setBasePipelineIndex(-1);
+    }
+    else
+    {
+        pipeline_info.setFlags(vk::PipelineCreateFlagBits::eAllowDerivatives);
+    }
+
+    auto pipeline = mDevice->device().createComputePipelineUnique(
+        mDevice->pipelineCache(), pipeline_info);
+    auto wrapped_pipeline = std::make_shared<VulkanComputePipeline>(
+        mDevice,
+        std::move(pipeline),
+        std::move(pipeline_layout),
+        std::move(push_constant_fields)
+    );
+
+    // if more pipelines are created using this compiler, they will be the
+    // children of the first one
+    if(!mParentPipeline)
+        mParentPipeline = wrapped_pipeline;
+
+    return std::move(wrapped_pipeline);
+}
@@ -0,0 +1,61 @@
+﻿#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+class SpirvBinary;
+class GpuSampler;
+class VulkanGpuDevice;
+class VulkanComputePipeline;
+class VulkanSampler;
+
+/**
+ * \brief Builds compute pipelines. The pipeline layout is generated from the
+ * reflection of the shader in the same way as graphics pipelines, so both
+ * kinds of pipelines share the layouts of the registry of the device.
+ */
+class VulkanComputePipelineCompiler : Noncopyable
+{
+    VulkanGpuDevice *mDevice = nullptr;
+
+    std::shared_ptr<SpirvBinary> mShader;
+    std::string mEntryPoint = "main";
+    vk::UniqueShaderModule mModule;
+    std::set<std::pair<std::uint32_t, std::uint32_t>> mDynamicUniformBuffers;
+    std::map<std::pair<std::uint32_t, std::uint32_t>,
+        std::shared_ptr<VulkanSampler>> mImmutableSamplers;
+
+    // the first pipeline compiled, from which the later ones are derived
+    std::shared_ptr<VulkanComputePipeline> mParentPipeline;
+
+public:
+    explicit VulkanComputePipelineCompiler(VulkanGpuDevice *device);
+
+    void setShader(
+        std::shared_ptr<SpirvBinary> shader,
+        std::string entry_point = "main");
+    /**
+     * \brief Use a dynamic uniform buffer for the binding, see
+     * VulkanGraphicsPipelineCompiler::setDynamicUniformBuffer().
+     */
+    void setDynamicUniformBuffer(std::uint32_t set, std::uint32_t binding);
+    /**
+     * \brief Bake the sampler into the set layout, see
+     * VulkanGraphicsPipelineCompiler::setImmutableSampler().
+     */
+    void setImmutableSampler(
+        std::uint32_t set,
+        std::uint32_t binding,
+        std::shared_ptr<GpuSampler> sampler);
+
+    std::shared_ptr<VulkanComputePipeline> compile();
+};
+}
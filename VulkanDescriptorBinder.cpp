@@ -0,0 +1,183 @@
+﻿#include "VulkanDescriptorBinder.hpp"
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Core/Logging.hpp>
+
+#include "VulkanGpuDevice.hpp"
+#include "VulkanLayoutRegistry.hpp"
+#include "VulkanShaderResource.hpp"
+
+usagi::VulkanDescriptorBinder::VulkanDescriptorBinder(VulkanGpuDevice *device)
+    : mDevice(device)
+{
+}
+
+usagi::VulkanDescriptorBinder::~VulkanDescriptorBinder()
+{
+    // the command list is only released after the GPU finished executing it
+    // or if it is never submitted.
+    if(!mDescriptorPools.empty())
+    {
+        mDevice->descriptorPoolAllocator()->release(
+            std::move(mDescriptorPools), mDescriptorUsage);
+    }
+}
+
+void usagi::VulkanDescriptorBinder::reset()
+{
+    mBoundLayout = nullptr;
+    mBoundDescriptorSets.clear();
+}
+
+void usagi::VulkanDescriptorBinder::setPipelineLayout(
+    VulkanPipelineLayout *layout)
+{
+    // the descriptor sets bound with another layout stay valid for the sets
+    // whose layouts are compatible.
+    if(mBoundLayout == layout) return;
+
+    if(mBoundLayout && layout)
+    {
+        const auto compatible = mBoundLayout->compatibleSetCount(*layout);
+        if(mBoundDescriptorSets.size() > compatible)
+            mBoundDescriptorSets.resize(compatible);
+    }
+    else
+    {
+        mBoundDescriptorSets.clear();
+    }
+    mBoundLayout = layout;
+}
+
+usagi::VulkanDescriptorSetLayout & usagi::VulkanDescriptorBinder::setLayout(
+    const std::uint32_t set_id) const
+{
+    assert(mBoundLayout);
+
+    const auto layout = mBoundLayout->setLayout(set_id);
+    if(!layout)
+    {
+        LOG(error, "Nonexisting descriptor set id = {}", set_id);
+        USAGI_THROW(std::logic_error("Referenced invalid resource."));
+    }
+    return *layout;
+}
+
+vk::DescriptorSet usagi::VulkanDescriptorBinder::allocateDescriptorSet(
+    const VulkanDescriptorSetLayout &layout)
+{
+    const auto allocator = mDevice->descriptorPoolAllocator();
+    const auto &demand = layout.descriptorCounts();
+    const auto vk_layout = layout.layout();
+
+    vk::DescriptorSetAllocateInfo info;
+    info.setDescriptorSetCount(1);
+    info.setPSetLayouts(&vk_layout);
+
+    // the remaining space of the pools is tracked so allocation failures
+    // are not expected. if the driver still runs out of pool memory, try
+    // once more with a fresh pool.
+    for(auto i = 0; i < 2; ++i)
+    {
+        if(mDescriptorPools.empty() ||
+            !mDescriptorPools.back().remaining.contains(demand))
+            mDescriptorPools.push_back(allocator->acquire(demand));
+
+        auto &pool = mDescriptorPools.back();
+        info.setDescriptorPool(pool.pool.get());
+        vk::DescriptorSet set;
+        const auto result = mDevice->device().allocateDescriptorSets(
+            &info, &set);
+        if(result == vk::Result::eSuccess)
+        {
+            pool.remaining.subtract(demand);
+            mDescriptorUsage.add(demand);
+            return set;
+        }
+        if(result != vk::Result::eErrorOutOfPoolMemory &&
+            result != vk::Result::eErrorFragmentedPool)
+        {
+            LOG(error, "vkAllocateDescriptorSets failed: {}",
+                vk::to_string(result));
+            break;
+        }
+        // don't use this pool for further allocations
+        pool.remaining = { };
+    }
+    USAGI_THROW(std::runtime_error("Could not allocate descriptor set."));
+}
+
+bool usagi::VulkanDescriptorBinder::bind(
+    const vk::CommandBuffer cmd,
+    const vk::PipelineBindPoint bind_point,
+    const std::uint32_t set_id,
+    const std::vector<VulkanShaderResource *> &resources)
+{
+    auto &layout = setLayout(set_id);
+
+    // the infos are referenced by the writes so don't resize them later
+    mDescriptorWrites.resize(resources.size());
+    mDescriptorInfos.resize(resources.size());
+    mDescriptorSetKey.clear();
+    mDynamicOffsets.clear();
+    mDescriptorSetKey.layout = layout.layout();
+    std::size_t write_count = 0;
+    for(std::size_t i = 0; i < resources.size(); ++i)
+    {
+        const auto binding = static_cast<uint32_t>(i);
+        const auto &layout_binding = layout.binding(binding);
+        // immutable samplers are part of the layout. the resource may be
+        // null for them.
+        if(layout_binding.pImmutableSamplers &&
+            layout_binding.descriptorType == vk::DescriptorType::eSampler)
+            continue;
+        if(!resources[i])
+        {
+            LOG(error, "No resource is given for binding {}", binding);
+            USAGI_THROW(std::logic_error("Referenced invalid resource."));
+        }
+        auto &write = mDescriptorWrites[write_count++];
+        auto &info = mDescriptorInfos[i];
+        write = vk::WriteDescriptorSet { };
+        info = VulkanResourceInfo { };
+        write.setDescriptorType(layout_binding.descriptorType);
+        write.setDstBinding(binding);
+        write.setDstArrayElement(0);
+        write.setDescriptorCount(1);
+        resources[i]->fillShaderResourceInfo(write, info);
+        if(write.descriptorType == vk::DescriptorType::eUniformBufferDynamic)
+        {
+            // the offset is given when binding the set, so the same set is
+            // reused for all the regions of the buffer with the same size.
+            auto &buffer_info = std::get<vk::DescriptorBufferInfo>(info);
+            mDynamicOffsets.push_back(
+                static_cast<std::uint32_t>(buffer_info.offset));
+            buffer_info.setOffset(0);
+        }
+        mDescriptorSetKey.addBinding(write.descriptorType, binding, info);
+    }
+    mDescriptorWrites.resize(write_count);
+
+    auto desc_set = mDevice->descriptorSetCache()->acquire(
+        mDescriptorSetKey, mDescriptorWrites);
+    if(!desc_set)
+    {
+        // the cache is full, use a set only valid for this command list.
+        desc_set = allocateDescriptorSet(layout);
+        for(auto &&write : mDescriptorWrites)
+            write.setDstSet(desc_set);
+        mDevice->device().updateDescriptorSets(mDescriptorWrites, { });
+    }
+
+    if(mBoundDescriptorSets.size() <= set_id)
+        mBoundDescriptorSets.resize(set_id + 1);
+    // the resources are already tracked when the set was bound. sets with
+    // dynamic offsets may refer to other buffers sharing the same handle.
+    if(mBoundDescriptorSets[set_id] == desc_set && mDynamicOffsets.empty())
+        return false;
+
+    cmd.bindDescriptorSets(bind_point, mBoundLayout->layout(),
+        set_id, { desc_set }, mDynamicOffsets);
+    mBoundDescriptorSets[set_id] = desc_set;
+    return true;
+}
@@ -0,0 +1,78 @@
+﻿#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+#include "VulkanDescriptorPoolAllocator.hpp"
+#include "VulkanDescriptorSetCache.hpp"
+
+namespace usagi
+{
+class VulkanGpuDevice;
+class VulkanPipelineLayout;
+class VulkanDescriptorSetLayout;
+class VulkanShaderResource;
+
+/**
+ * \brief Writes and binds the descriptor sets of a command list. The sets are
+ * taken from the descriptor set cache of the device when possible, otherwise
+ * allocated from the descriptor pools borrowed by the binder, which are
+ * returned when the binder is destroyed along with its command list.
+ *
+ * The sets bound with a pipeline layout are remembered, so rebinding the same
+ * set is skipped and the sets stay bound after switching to a pipeline with a
+ * compatible layout.
+ */
+class VulkanDescriptorBinder : Noncopyable
+{
+    VulkanGpuDevice *mDevice = nullptr;
+
+    // borrowed from the device and returned when the binder is destroyed.
+    // the sets are freed by resetting the pools.
+    std::vector<VulkanDescriptorPoolAllocator::Pool> mDescriptorPools;
+    VulkanDescriptorCounts mDescriptorUsage;
+
+    VulkanPipelineLayout *mBoundLayout = nullptr;
+    std::vector<vk::DescriptorSet> mBoundDescriptorSets;
+
+    // scratch buffers reused by bind() to avoid allocations
+    VulkanDescriptorSetCache::Key mDescriptorSetKey;
+    std::vector<vk::WriteDescriptorSet> mDescriptorWrites;
+    std::vector<VulkanResourceInfo> mDescriptorInfos;
+    std::vector<std::uint32_t> mDynamicOffsets;
+
+    VulkanDescriptorSetLayout & setLayout(std::uint32_t set_id) const;
+    vk::DescriptorSet allocateDescriptorSet(
+        const VulkanDescriptorSetLayout &layout);
+
+public:
+    explicit VulkanDescriptorBinder(VulkanGpuDevice *device);
+    ~VulkanDescriptorBinder();
+
+    /**
+     * \brief Forget the bound sets, e.g. when beginning a command buffer.
+     */
+    void reset();
+    /**
+     * \brief Switch to the layout of a newly bound pipeline. The sets bound
+     * with an incompatible layout are forgotten. The layout must be kept
+     * alive by the command list.
+     */
+    void setPipelineLayout(VulkanPipelineLayout *layout);
+
+    /**
+     * \brief Write the resources to a set of the current pipeline layout and
+     * bind it. The bindings with immutable samplers are not written.
+     * \return false if the same set is already bound, in which case the
+     * resources are already tracked by the command list.
+     */
+    bool bind(
+        vk::CommandBuffer cmd,
+        vk::PipelineBindPoint bind_point,
+        std::uint32_t set_id,
+        const std::vector<VulkanShaderResource *> &resources);
+};
+}
@@ -0,0 +1,154 @@
+﻿#include "VulkanDescriptorPoolAllocator.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+#include <Usagi/Core/Logging.hpp>
+
+#include "VulkanGpuDevice.hpp"
+
+void usagi::VulkanDescriptorCounts::add(
+    const vk::DescriptorType type,
+    const std::uint32_t count)
+{
+    const auto index = static_cast<std::size_t>(type);
+    assert(index < TYPE_COUNT);
+    descriptors[index] += count;
+}
+
+void usagi::VulkanDescriptorCounts::add(const VulkanDescriptorCounts &other)
+{
+    sets += other.sets;
+    for(std::size_t i = 0; i < TYPE_COUNT; ++i)
+        descriptors[i] += other.descriptors[i];
+}
+
+void usagi::VulkanDescriptorCounts::subtract(
+    const VulkanDescriptorCounts &other)
+{
+    assert(contains(other));
+    sets -= other.sets;
+    for(std::size_t i = 0; i < TYPE_COUNT; ++i)
+        descriptors[i] -= other.descriptors[i];
+}
+
+bool usagi::VulkanDescriptorCounts::contains(
+    const VulkanDescriptorCounts &other) const
+{
+    if(sets < other.sets) return false;
+    for(std::size_t i = 0; i < TYPE_COUNT; ++i)
+        if(descriptors[i] < other.descriptors[i]) return false;
+    return true;
+}
+
+namespace
+{
+std::uint32_t roundUpPowerOfTwo(std::uint32_t value)
+{
+    std::uint32_t result = 1;
+    while(result < value) result <<= 1;
+    return result;
+}
+}
+
+usagi::VulkanDescriptorPoolAllocator::VulkanDescriptorPoolAllocator(
+    VulkanGpuDevice *device)
+    : mDevice(device)
+{
+}
+
+usagi::VulkanDescriptorCounts usagi::VulkanDescriptorPoolAllocator::sizeClass(
+    const VulkanDescriptorCounts &demand) const
+{
+    VulkanDescriptorCounts size;
+    size.sets = roundUpPowerOfTwo(std::max({
+        MIN_POOL_SETS, mObservedUsage.sets, demand.sets
+    }));
+    for(std::size_t i = 0; i < VulkanDescriptorCounts::TYPE_COUNT; ++i)
+    {
+        // don't reserve space for the types never used
+        const auto used = std::max(
+            mObservedUsage.descriptors[i], demand.descriptors[i]);
+        if(used == 0) continue;
+        size.descriptors[i] = roundUpPowerOfTwo(
+            std::max(MIN_POOL_DESCRIPTORS, used));
+    }
+    return size;
+}
+
+usagi::VulkanDescriptorPoolAllocator::Pool
+    usagi::VulkanDescriptorPoolAllocator::createPool(
+        const VulkanDescriptorCounts &capacity) const
+{
+    std::vector<vk::DescriptorPoolSize> sizes;
+    for(std::size_t i = 0; i < VulkanDescriptorCounts::TYPE_COUNT; ++i)
+    {
+        if(capacity.descriptors[i] == 0) continue;
+        sizes.emplace_back(
+            static_cast<vk::DescriptorType>(i), capacity.descriptors[i]);
+    }
+
+    // sets are never freed individually. the whole pool is reset instead.
+    vk::DescriptorPoolCreateInfo info;
+    info.setMaxSets(capacity.sets);
+    info.setPoolSizeCount(static_cast<uint32_t>(sizes.size()));
+    info.setPPoolSizes(sizes.data());
+
+    Pool pool;
+    pool.pool = mDevice->device().createDescriptorPoolUnique(info);
+    pool.capacity = capacity;
+    pool.remaining = capacity;
+
+    LOG(info, "Created transient descriptor pool: {} sets", capacity.sets);
+
+    return std::move(pool);
+}
+
+usagi::VulkanDescriptorPoolAllocator::Pool
+    usagi::VulkanDescriptorPoolAllocator::acquire(
+        const VulkanDescriptorCounts &demand)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // the most recently returned pool is found first
+    for(auto i = mFreePools.rbegin(); i != mFreePools.rend(); ++i)
+    {
+        if(!i->remaining.contains(demand)) continue;
+        auto pool = std::move(*i);
+        mFreePools.erase(std::next(i).base());
+        return std::move(pool);
+    }
+    return createPool(sizeClass(demand));
+}
+
+void usagi::VulkanDescriptorPoolAllocator::release(
+    std::vector<Pool> pools,
+    const VulkanDescriptorCounts &usage)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // decaying peak, so that the pools shrink slowly after a burst
+    mObservedUsage.sets = std::max(
+        usage.sets, mObservedUsage.sets - mObservedUsage.sets / 8);
+    for(std::size_t i = 0; i < VulkanDescriptorCounts::TYPE_COUNT; ++i)
+    {
+        auto &observed = mObservedUsage.descriptors[i];
+        observed = std::max(usage.descriptors[i], observed - observed / 8);
+    }
+
+    // pools of lower classes than the current one are destroyed, so that
+    // a command list can usually fit itself in one pool.
+    const auto size_class = sizeClass({ });
+    for(auto &&pool : pools)
+    {
+        if(pool.capacity.sets < size_class.sets / 2)
+            continue;
+        // unused pools don't need a reset
+        if(pool.remaining.sets != pool.capacity.sets)
+        {
+            mDevice->device().resetDescriptorPool(pool.pool.get());
+            pool.remaining = pool.capacity;
+        }
+        mFreePools.push_back(std::move(pool));
+    }
+}
@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include <array>
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+class VulkanGpuDevice;
+
+/**
+ * \brief Number of descriptor sets and descriptors of each type.
+ */
+struct VulkanDescriptorCounts
+{
+    // VK_DESCRIPTOR_TYPE_SAMPLER to VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT
+    static constexpr std::size_t TYPE_COUNT = 11;
+
+    std::uint32_t sets = 0;
+    std::array<std::uint32_t, TYPE_COUNT> descriptors { };
+
+    void add(vk::DescriptorType type, std::uint32_t count);
+    void add(const VulkanDescriptorCounts &other);
+    void subtract(const VulkanDescriptorCounts &other);
+    bool contains(const VulkanDescriptorCounts &other) const;
+    bool empty() const { return sets == 0; }
+};
+
+/**
+ * \brief Hands out descriptor pools to command lists and takes them back when
+ * the command lists are released, which only happens after the GPU has
+ * finished executing them. Returned pools are reset and reused, so pools are
+ * only created when the demand grows.
+ *
+ * The sizes of new pools are learned from the peak usage of recently
+ * released command lists and rounded up to powers of two, so the pools fall
+ * into a few size classes. Pools smaller than the current class are dropped
+ * when returned.
+ */
+class VulkanDescriptorPoolAllocator : Noncopyable
+{
+public:
+    struct Pool
+    {
+        vk::UniqueDescriptorPool pool;
+        VulkanDescriptorCounts capacity;
+        VulkanDescriptorCounts remaining;
+    };
+
+private:
+    VulkanGpuDevice *mDevice = nullptr;
+    // command lists may be recorded and released on different threads
+    std::mutex mMutex;
+    std::vector<Pool> mFreePools;
+    // decaying peak of the per-command-list usage
+    VulkanDescriptorCounts mObservedUsage;
+
+    static constexpr std::uint32_t MIN_POOL_SETS = 16;
+    static constexpr std::uint32_t MIN_POOL_DESCRIPTORS = 16;
+
+    VulkanDescriptorCounts sizeClass(const VulkanDescriptorCounts &demand) const;
+    Pool createPool(const VulkanDescriptorCounts &capacity) const;
+
+public:
+    explicit VulkanDescriptorPoolAllocator(VulkanGpuDevice *device);
+
+    /**
+     * \brief Get a reset pool with enough space for the demand.
+     */
+    Pool acquire(const VulkanDescriptorCounts &demand);
+
+    /**
+     * \brief Return the pools of a released command list along with the
+     * total amount of descriptors it allocated. The GPU must not be using any
+     * set allocated from the pools.
+     */
+    void release(std::vector<Pool> pools, const VulkanDescriptorCounts &usage);
+
+    std::size_t freePoolCount() const { return mFreePools.size(); }
+};
+}
@@ -0,0 +1,258 @@
+﻿#include "VulkanDescriptorSetCache.hpp"
+
+#include <Usagi/Core/Logging.hpp>
+
+#include "VulkanGpuDevice.hpp"
+#include "VulkanHelper.hpp"
+
+using namespace usagi::vulkan;
+
+bool usagi::VulkanDescriptorSetCache::Binding::operator==(
+    const Binding &rhs) const
+{
+    return type == rhs.type &&
+        binding == rhs.binding &&
+        resource == rhs.resource &&
+        sampler == rhs.sampler &&
+        offset == rhs.offset &&
+        range == rhs.range;
+}
+
+bool usagi::VulkanDescriptorSetCache::Key::operator==(const Key &rhs) const
+{
+    return layout == rhs.layout && bindings == rhs.bindings;
+}
+
+void usagi::VulkanDescriptorSetCache::Key::clear()
+{
+    layout = nullptr;
+    bindings.clear();
+}
+
+void usagi::VulkanDescriptorSetCache::Key::addBinding(
+    const vk::DescriptorType type,
+    const std::uint32_t binding,
+    const VulkanResourceInfo &info)
+{
+    Binding b;
+    b.type = type;
+    b.binding = binding;
+    if(auto image = std::get_if<vk::DescriptorImageInfo>(&info))
+    {
+        b.resource = handleValue(image->imageView);
+        b.sampler = handleValue(image->sampler);
+        // the layout is determined by the descriptor type
+    }
+    else if(auto buffer = std::get_if<vk::DescriptorBufferInfo>(&info))
+    {
+        b.resource = handleValue(buffer->buffer);
+        b.offset = buffer->offset;
+        b.range = buffer->range;
+    }
+    bindings.push_back(b);
+}
+
+std::size_t usagi::VulkanDescriptorSetCache::KeyHasher::operator()(
+    const Key &key) const
+{
+    std::size_t seed = 0;
+    hashCombine(seed, handleValue(key.layout));
+    for(auto &&b : key.bindings)
+    {
+        hashCombine(seed, static_cast<std::uint64_t>(b.type));
+        hashCombine(seed, b.binding);
+        hashCombine(seed, b.resource);
+        hashCombine(seed, b.sampler);
+        hashCombine(seed, b.offset);
+        hashCombine(seed, b.range);
+    }
+    return seed;
+}
+
+usagi::VulkanDescriptorSetCache::VulkanDescriptorSetCache(
+    VulkanGpuDevice *device)
+    : mDevice(device)
+{
+}
+
+vk::DescriptorPool usagi::VulkanDescriptorSetCache::createPool()
+{
+    vk::DescriptorPoolCreateInfo info;
+    info.setFlags(vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet);
+    info.setMaxSets(SETS_PER_POOL);
+    std::initializer_list<vk::DescriptorPoolSize> sizes {
+        { vk::DescriptorType::eSampler, SETS_PER_POOL },
+        { vk::DescriptorType::eSampledImage, SETS_PER_POOL },
+        { vk::DescriptorType::eUniformBuffer, SETS_PER_POOL },
+        { vk::DescriptorType::eUniformBufferDynamic, SETS_PER_POOL },
+        { vk::DescriptorType::eStorageBuffer, SETS_PER_POOL },
+        { vk::DescriptorType::eStorageImage, SETS_PER_POOL },
+        { vk::DescriptorType::eInputAttachment, SETS_PER_POOL },
+    };
+    info.setPoolSizeCount(static_cast<uint32_t>(sizes.size()));
+    info.setPPoolSizes(sizes.begin());
+    mPools.push_back(mDevice->device().createDescriptorPoolUnique(info));
+    LOG(info, "Created descriptor set cache pool #{}", mPools.size());
+    return mPools.back().get();
+}
+
+bool usagi::VulkanDescriptorSetCache::allocate(
+    const vk::DescriptorSetLayout layout,
+    Entry &entry)
+{
+    vk::DescriptorSetAllocateInfo info;
+    info.setDescriptorSetCount(1);
+    info.setPSetLayouts(&layout);
+
+    const auto try_allocate = [&](const vk::DescriptorPool pool) {
+        info.setDescriptorPool(pool);
+        // use the non-throwing version since running out of pool memory is
+        // expected.
+        const auto result = mDevice->device().allocateDescriptorSets(
+            &info, &entry.set);
+        if(result != vk::Result::eSuccess)
+            return false;
+        entry.pool = pool;
+        return true;
+    };
+
+    // the newest pool is the most likely to have free space
+    for(auto i = mPools.rbegin(); i != mPools.rend(); ++i)
+        if(try_allocate(i->get())) return true;
+
+    if(mPools.size() >= MAX_POOLS)
+        return false;
+
+    return try_allocate(createPool());
+}
+
+void usagi::VulkanDescriptorSetCache::addReference(
+    const std::uint64_t object,
+    const Key *key)
+{
+    if(object == 0) return;
+
+    const auto range = mReferences.equal_range(object);
+    for(auto i = range.first; i != range.second; ++i)
+        if(i->second == key) return;
+    mReferences.emplace(object, key);
+}
+
+void usagi::VulkanDescriptorSetCache::removeReference(
+    const std::uint64_t object,
+    const Key *key)
+{
+    if(object == 0) return;
+
+    const auto range = mReferences.equal_range(object);
+    for(auto i = range.first; i != range.second; ++i)
+    {
+        if(i->second == key)
+        {
+            mReferences.erase(i);
+            return;
+        }
+    }
+}
+
+vk::DescriptorSet usagi::VulkanDescriptorSetCache::acquire(
+    const Key &key,
+    std::vector<vk::WriteDescriptorSet> &writes)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    const auto iter = mSets.find(key);
+    if(iter != mSets.end())
+    {
+        iter->second.last_frame = mFrameNumber;
+        mLru.splice(mLru.end(), mLru, iter->second.lru);
+        return iter->second.set;
+    }
+
+    Entry entry;
+    if(!allocate(key.layout, entry) &&
+        (retire() == 0 || !allocate(key.layout, entry)))
+        return { };
+    entry.last_frame = mFrameNumber;
+
+    // publish the set only after it is written
+    for(auto &&write : writes)
+        write.setDstSet(entry.set);
+    mDevice->device().updateDescriptorSets(writes, { });
+
+    const auto inserted = mSets.emplace(key, entry).first;
+    const auto key_ptr = &inserted->first;
+    inserted->second.lru = mLru.insert(mLru.end(), key_ptr);
+    addReference(handleValue(key.layout), key_ptr);
+    for(auto &&b : key.bindings)
+    {
+        addReference(b.resource, key_ptr);
+        addReference(b.sampler, key_ptr);
+    }
+
+    return entry.set;
+}
+
+void usagi::VulkanDescriptorSetCache::erase(const Key *key)
+{
+    const auto iter = mSets.find(*key);
+    assert(iter != mSets.end());
+
+    removeReference(handleValue(key->layout), key);
+    for(auto &&b : key->bindings)
+    {
+        removeReference(b.resource, key);
+        removeReference(b.sampler, key);
+    }
+    mDevice->device().freeDescriptorSets(
+        iter->second.pool, { iter->second.set });
+    mLru.erase(iter->second.lru);
+    mSets.erase(iter);
+}
+
+std::size_t usagi::VulkanDescriptorSetCache::retire()
+{
+    const auto frames_in_flight = mDevice->framesInFlight();
+    std::size_t count = 0;
+    for(auto i = mLru.begin(); i != mLru.end() && count < RETIRE_BATCH;)
+    {
+        // erasing the set removes it from the list
+        const auto key = *i++;
+        const auto last_frame = mSets.find(*key)->second.last_frame;
+        if(last_frame == 0) continue;
+        // the later sets are used more recently
+        if(last_frame + frames_in_flight > mFrameNumber) break;
+        erase(key);
+        ++count;
+    }
+    if(count != 0)
+        LOG(info, "Retired {} descriptor sets from the cache.", count);
+    return count;
+}
+
+std::size_t usagi::VulkanDescriptorSetCache::size()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSets.size();
+}
+
+void usagi::VulkanDescriptorSetCache::beginFrame(
+    const std::uint64_t frame_number)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFrameNumber = frame_number;
+}
+
+void usagi::VulkanDescriptorSetCache::evict(const std::uint64_t object)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    const auto range = mReferences.equal_range(object);
+    if(range.first == range.second) return;
+
+    // the references are removed while erasing the sets, so collect the keys
+    // first. each key is only referenced once per object.
+    mEvictList.clear();
+    for(auto i = range.first; i != range.second; ++i)
+        mEvictList.push_back(i->second);
+    for(auto &&key : mEvictList)
+        erase(key);
+}
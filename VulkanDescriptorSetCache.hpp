@@ -0,0 +1,150 @@
+﻿#pragma once
+
+#include <list>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+#include "VulkanResourceInfo.hpp"
+
+namespace usagi
+{
+class VulkanGpuDevice;
+
+/**
+ * \brief Keeps the descriptor sets written by command lists so that binding
+ * the same resources with the same layout again reuses the set instead of
+ * allocating and writing a new one.
+ *
+ * The cached sets are never updated after being written, so they can be used
+ * by multiple command lists simultaneously. Since a set may only be used by
+ * command lists which also hold the referenced objects, a set is freed as
+ * soon as any Vulkan object it references is destroyed. The owners of these
+ * objects must call evict() before destroying them.
+ *
+ * The objects may be destroyed on other threads, such as the pipelines
+ * released by the compilation workers, so the cache is guarded by a mutex.
+ *
+ * The sets referencing objects which are never destroyed, such as the ranges
+ * of pooled buffers after being freed or renamed, are retired from the least
+ * recently used ones when the pools are full. A set is only retired after
+ * the frames using it are completed, assuming that the command lists are
+ * submitted in the frame they are recorded. The sets used before the first
+ * frame are only freed by evict().
+ */
+class VulkanDescriptorSetCache : Noncopyable
+{
+public:
+    struct Binding
+    {
+        vk::DescriptorType type = vk::DescriptorType::eSampler;
+        std::uint32_t binding = 0;
+        // image view or buffer
+        std::uint64_t resource = 0;
+        // sampler
+        std::uint64_t sampler = 0;
+        vk::DeviceSize offset = 0;
+        vk::DeviceSize range = 0;
+
+        bool operator==(const Binding &rhs) const;
+    };
+
+    struct Key
+    {
+        vk::DescriptorSetLayout layout;
+        std::vector<Binding> bindings;
+
+        bool operator==(const Key &rhs) const;
+
+        void clear();
+        void addBinding(
+            vk::DescriptorType type,
+            std::uint32_t binding,
+            const VulkanResourceInfo &info);
+    };
+
+private:
+    VulkanGpuDevice *mDevice = nullptr;
+    std::mutex mMutex;
+
+    struct KeyHasher
+    {
+        std::size_t operator()(const Key &key) const;
+    };
+
+    using LruList = std::list<const Key *>;
+
+    struct Entry
+    {
+        vk::DescriptorSet set;
+        vk::DescriptorPool pool;
+        // the frame when the set was last acquired. 0 before the first frame.
+        std::uint64_t last_frame = 0;
+        LruList::iterator lru;
+    };
+    using SetMap = std::unordered_map<Key, Entry, KeyHasher>;
+    SetMap mSets;
+    // the keys ordered from the least recently used
+    LruList mLru;
+    std::uint64_t mFrameNumber = 0;
+    // maps the referenced objects to the keys of the sets using them.
+    // pointers to the elements of unordered_map remain valid after rehashing.
+    std::unordered_multimap<std::uint64_t, const Key *> mReferences;
+    std::vector<const Key *> mEvictList;
+
+    // sets are individually freed upon eviction
+    std::vector<vk::UniqueDescriptorPool> mPools;
+
+    static constexpr std::uint32_t SETS_PER_POOL = 256;
+    // limits the memory used by the cache, the command lists fallback to
+    // allocating their own sets when the cache is full.
+    static constexpr std::size_t MAX_POOLS = 16;
+    // the sets retired at once when the pools are full
+    static constexpr std::size_t RETIRE_BATCH = 64;
+
+    vk::DescriptorPool createPool();
+    bool allocate(vk::DescriptorSetLayout layout, Entry &entry);
+    void addReference(std::uint64_t object, const Key *key);
+    void removeReference(std::uint64_t object, const Key *key);
+    void erase(const Key *key);
+    /**
+     * \brief Free up to RETIRE_BATCH least recently used sets whose frames
+     * are completed and return the number of freed sets.
+     */
+    std::size_t retire();
+
+public:
+    explicit VulkanDescriptorSetCache(VulkanGpuDevice *device);
+
+    /**
+     * \brief Find the set matching the key, or allocate a new one and write
+     * the resources to it. The set is written before the lock is released,
+     * so other threads never see a set being written.
+     * \param key
+     * \param writes The writes of the resources described by the key. Their
+     * destination sets are overwritten.
+     * \return The cached set, or a null handle if the cache is full.
+     */
+    vk::DescriptorSet acquire(
+        const Key &key,
+        std::vector<vk::WriteDescriptorSet> &writes);
+
+    /**
+     * \brief Free the sets referencing the object, which may be an image view,
+     * a sampler, a buffer, or a descriptor set layout.
+     */
+    void evict(std::uint64_t object);
+
+    /**
+     * \brief Called when a frame begins, after the GPU completed the frame
+     * framesInFlight() frames before it.
+     */
+    void beginFrame(std::uint64_t frame_number);
+
+    std::size_t size();
+};
+}
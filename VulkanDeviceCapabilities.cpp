@@ -0,0 +1,119 @@
+﻿#include "VulkanDeviceCapabilities.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+usagi::VulkanDeviceCapabilities::VulkanDeviceCapabilities(
+    const vk::PhysicalDevice physical_device)
+    : mPhysicalDevice(physical_device)
+{
+    mProperties = mPhysicalDevice.getProperties();
+    mMemoryProperties = mPhysicalDevice.getMemoryProperties();
+    mSupportedFeatures = mPhysicalDevice.getFeatures();
+    mQueueFamilies = mPhysicalDevice.getQueueFamilyProperties();
+    mExtensions = mPhysicalDevice.enumerateDeviceExtensionProperties();
+
+    for(std::size_t i = 0; i < CORE_FORMAT_COUNT; ++i)
+    {
+        mFormatProperties[i] = mPhysicalDevice.getFormatProperties(
+            static_cast<vk::Format>(i));
+    }
+}
+
+void usagi::VulkanDeviceCapabilities::setEnabled(
+    const vk::PhysicalDeviceFeatures &features,
+    const std::vector<const char *> &extensions)
+{
+    mEnabledFeatures = features;
+    mEnabledExtensions.assign(extensions.begin(), extensions.end());
+}
+
+bool usagi::VulkanDeviceCapabilities::isExtensionSupported(
+    const char *name) const
+{
+    return std::any_of(mExtensions.begin(), mExtensions.end(),
+        [&](const vk::ExtensionProperties &e) {
+            return strcmp(e.extensionName, name) == 0;
+        });
+}
+
+bool usagi::VulkanDeviceCapabilities::isExtensionEnabled(
+    const char *name) const
+{
+    return std::find(mEnabledExtensions.begin(), mEnabledExtensions.end(),
+        name) != mEnabledExtensions.end();
+}
+
+vk::FormatProperties usagi::VulkanDeviceCapabilities::formatProperties(
+    const vk::Format format) const
+{
+    const auto index = static_cast<std::size_t>(format);
+    if(index < CORE_FORMAT_COUNT)
+        return mFormatProperties[index];
+    return mPhysicalDevice.getFormatProperties(format);
+}
+
+bool usagi::VulkanDeviceCapabilities::supportsOptimalTiling(
+    const vk::Format format,
+    const vk::FormatFeatureFlags &features) const
+{
+    return (formatProperties(format).optimalTilingFeatures & features)
+        == features;
+}
+
+bool usagi::VulkanDeviceCapabilities::isFormatFamilyEnabled(
+    const vk::Format format) const
+{
+    const auto value = static_cast<std::size_t>(format);
+    const auto in_range = [&](vk::Format first, vk::Format last) {
+        return value >= static_cast<std::size_t>(first) &&
+            value <= static_cast<std::size_t>(last);
+    };
+    if(in_range(vk::Format::eBc1RgbUnormBlock, vk::Format::eBc7SrgbBlock))
+        return mEnabledFeatures.textureCompressionBC;
+    if(in_range(vk::Format::eEtc2R8G8B8UnormBlock,
+        vk::Format::eEacR11G11SnormBlock))
+        return mEnabledFeatures.textureCompressionETC2;
+    if(in_range(vk::Format::eAstc4x4UnormBlock,
+        vk::Format::eAstc12x12SrgbBlock))
+        return mEnabledFeatures.textureCompressionASTC_LDR;
+    return true;
+}
+
+bool usagi::VulkanDeviceCapabilities::supportsBufferFormat(
+    const vk::Format format,
+    const vk::FormatFeatureFlags &features) const
+{
+    return (formatProperties(format).bufferFeatures & features) == features;
+}
+
+vk::FormatFeatureFlags usagi::VulkanDeviceCapabilities::requiredFormatFeatures(
+    const vk::ImageUsageFlags &usages)
+{
+    using Usage = vk::ImageUsageFlagBits;
+    using Feature = vk::FormatFeatureFlagBits;
+
+    vk::FormatFeatureFlags features;
+    if(usages & Usage::eSampled)
+        features |= Feature::eSampledImage;
+    if(usages & Usage::eStorage)
+        features |= Feature::eStorageImage;
+    if(usages & Usage::eColorAttachment)
+        features |= Feature::eColorAttachment;
+    if(usages & Usage::eDepthStencilAttachment)
+        features |= Feature::eDepthStencilAttachment;
+    // the transfer features are implied without VK_KHR_maintenance1
+    return features;
+}
+
+vk::DeviceSize usagi::VulkanDeviceCapabilities::deviceLocalMemorySize() const
+{
+    vk::DeviceSize size = 0;
+    for(std::uint32_t i = 0; i < mMemoryProperties.memoryHeapCount; ++i)
+    {
+        const auto &heap = mMemoryProperties.memoryHeaps[i];
+        if(heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+            size += heap.size;
+    }
+    return size;
+}
@@ -0,0 +1,105 @@
+﻿#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+/**
+ * \brief The properties, limits, features, and format support of a physical
+ * device, queried once so that the hot paths and the capability checks don't
+ * go through the driver.
+ *
+ * The supported capabilities are filled when constructed. The enabled
+ * features and extensions are recorded by the device after it is created and
+ * never change afterwards.
+ */
+class VulkanDeviceCapabilities : Noncopyable
+{
+    vk::PhysicalDevice mPhysicalDevice;
+    vk::PhysicalDeviceProperties mProperties;
+    vk::PhysicalDeviceMemoryProperties mMemoryProperties;
+    vk::PhysicalDeviceFeatures mSupportedFeatures;
+    vk::PhysicalDeviceFeatures mEnabledFeatures;
+    std::vector<vk::QueueFamilyProperties> mQueueFamilies;
+    std::vector<vk::ExtensionProperties> mExtensions;
+    std::vector<std::string> mEnabledExtensions;
+
+    // VK_FORMAT_UNDEFINED to VK_FORMAT_ASTC_12x12_SRGB_BLOCK. the formats
+    // introduced by extensions are queried on demand.
+    static constexpr std::size_t CORE_FORMAT_COUNT =
+        static_cast<std::size_t>(vk::Format::eAstc12x12SrgbBlock) + 1;
+    std::array<vk::FormatProperties, CORE_FORMAT_COUNT> mFormatProperties;
+
+public:
+    explicit VulkanDeviceCapabilities(vk::PhysicalDevice physical_device);
+
+    void setEnabled(
+        const vk::PhysicalDeviceFeatures &features,
+        const std::vector<const char *> &extensions);
+
+    vk::PhysicalDevice physicalDevice() const { return mPhysicalDevice; }
+
+    const vk::PhysicalDeviceProperties & properties() const
+    {
+        return mProperties;
+    }
+    const vk::PhysicalDeviceLimits & limits() const
+    {
+        return mProperties.limits;
+    }
+    const vk::PhysicalDeviceMemoryProperties & memoryProperties() const
+    {
+        return mMemoryProperties;
+    }
+    const vk::PhysicalDeviceFeatures & supportedFeatures() const
+    {
+        return mSupportedFeatures;
+    }
+    const vk::PhysicalDeviceFeatures & enabledFeatures() const
+    {
+        return mEnabledFeatures;
+    }
+    const std::vector<vk::QueueFamilyProperties> & queueFamilies() const
+    {
+        return mQueueFamilies;
+    }
+
+    bool isExtensionSupported(const char *name) const;
+    bool isExtensionEnabled(const char *name) const;
+
+    vk::FormatProperties formatProperties(vk::Format format) const;
+    /**
+     * \brief Whether images of the format with optimal tiling support all
+     * the features.
+     */
+    bool supportsOptimalTiling(
+        vk::Format format,
+        const vk::FormatFeatureFlags &features) const;
+    bool supportsBufferFormat(
+        vk::Format format,
+        const vk::FormatFeatureFlags &features) const;
+    /**
+     * \brief Whether the device feature needed by a block-compressed format
+     * is enabled. Always true for the other formats. The format features must
+     * still be checked.
+     */
+    bool isFormatFamilyEnabled(vk::Format format) const;
+
+    /**
+     * \brief The format features needed by images having the usages.
+     */
+    static vk::FormatFeatureFlags requiredFormatFeatures(
+        const vk::ImageUsageFlags &usages);
+
+    /**
+     * \brief The sum of the sizes of the device-local heaps.
+     */
+    vk::DeviceSize deviceLocalMemorySize() const;
+};
+}
@@ -0,0 +1,159 @@
+﻿#include "VulkanDrawBatcher.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+
+#include "VulkanGpuDevice.hpp"
+#include "VulkanGraphicsCommandList.hpp"
+#include "VulkanTransientBuffer.hpp"
+
+namespace
+{
+auto stateOf(const usagi::VulkanDrawBatcher::Draw &d)
+{
+    return std::tie(d.pipeline, d.resource_set, d.resources,
+        d.vertex_buffer, d.vertex_buffer_offset,
+        d.index_buffer, d.index_buffer_offset, d.index_type);
+}
+}
+
+usagi::VulkanDrawBatcher::VulkanDrawBatcher(
+    VulkanGpuDevice *device,
+    const Ordering ordering)
+    : mDevice(device)
+    , mOrdering(ordering)
+{
+}
+
+bool usagi::VulkanDrawBatcher::lessState(const Draw &lhs, const Draw &rhs)
+{
+    return stateOf(lhs) < stateOf(rhs);
+}
+
+bool usagi::VulkanDrawBatcher::sameState(const Draw &lhs, const Draw &rhs)
+{
+    return stateOf(lhs) == stateOf(rhs);
+}
+
+void usagi::VulkanDrawBatcher::add(Draw draw)
+{
+    if(draw.count == 0 || draw.instance_count == 0) return;
+    mDraws.push_back(std::move(draw));
+}
+
+void usagi::VulkanDrawBatcher::record(VulkanGraphicsCommandList &cmd)
+{
+    if(mDraws.empty()) return;
+
+    mOrder.resize(mDraws.size());
+    for(std::size_t i = 0; i < mOrder.size(); ++i)
+        mOrder[i] = i;
+    // the pointers compared by the states don't reflect the depth order,
+    // so the draws are only sorted when the order doesn't matter
+    if(mOrdering == Ordering::STATE)
+    {
+        std::stable_sort(mOrder.begin(), mOrder.end(),
+            [&](const std::size_t a, const std::size_t b) {
+                return lessState(mDraws[a], mDraws[b]);
+            });
+    }
+
+    std::size_t size = 0;
+    for(auto &&d : mDraws)
+    {
+        size += d.index_buffer
+            ? sizeof(vk::DrawIndexedIndirectCommand)
+            : sizeof(vk::DrawIndirectCommand);
+    }
+    const auto args = mDevice->transientBuffer()->allocate(size, 4);
+    auto dst = static_cast<char *>(args.mapped_address);
+    // the indirect first instance must be 0 without the feature, so those
+    // runs are drawn directly
+    const auto first_instance_supported = mDevice->capabilities()
+        ->enabledFeatures().drawIndirectFirstInstance;
+
+    std::size_t offset = 0;
+    for(std::size_t begin = 0; begin < mOrder.size();)
+    {
+        const auto &first = mDraws[mOrder[begin]];
+        auto end = begin + 1;
+        while(end < mOrder.size() && sameState(first, mDraws[mOrder[end]]))
+            ++end;
+
+        cmd.bindPipeline(first.pipeline);
+        if(!first.resources.empty())
+            cmd.bindResourceSet(first.resource_set, first.resources);
+        if(first.vertex_buffer)
+        {
+            cmd.bindVertexBuffer(0, first.vertex_buffer,
+                first.vertex_buffer_offset);
+        }
+
+        if(first.index_buffer)
+        {
+            cmd.bindIndexBuffer(first.index_buffer,
+                first.index_buffer_offset, first.index_type);
+        }
+
+        const auto indirect = first_instance_supported ||
+            std::all_of(mOrder.begin() + begin, mOrder.begin() + end,
+                [&](const std::size_t i) {
+                    return mDraws[i].first_instance == 0;
+                });
+        if(!indirect)
+        {
+            for(auto i = begin; i < end; ++i)
+            {
+                const auto &d = mDraws[mOrder[i]];
+                if(d.index_buffer)
+                {
+                    cmd.drawIndexedInstanced(d.count, d.instance_count,
+                        d.first, d.vertex_offset, d.first_instance);
+                }
+                else
+                {
+                    cmd.drawInstanced(d.count, d.instance_count,
+                        d.first, d.first_instance);
+                }
+            }
+            begin = end;
+            continue;
+        }
+
+        const auto draw_count = static_cast<std::uint32_t>(end - begin);
+        const auto run_offset = args.offset + offset;
+        if(first.index_buffer)
+        {
+            for(auto i = begin; i < end; ++i)
+            {
+                const auto &d = mDraws[mOrder[i]];
+                const vk::DrawIndexedIndirectCommand c {
+                    d.count, d.instance_count, d.first,
+                    d.vertex_offset, d.first_instance
+                };
+                std::memcpy(dst + offset, &c, sizeof c);
+                offset += sizeof c;
+            }
+            cmd.drawIndexedIndirect(args.buffer, run_offset, draw_count,
+                sizeof(vk::DrawIndexedIndirectCommand));
+        }
+        else
+        {
+            for(auto i = begin; i < end; ++i)
+            {
+                const auto &d = mDraws[mOrder[i]];
+                const vk::DrawIndirectCommand c {
+                    d.count, d.instance_count, d.first, d.first_instance
+                };
+                std::memcpy(dst + offset, &c, sizeof c);
+                offset += sizeof c;
+            }
+            cmd.drawIndirect(args.buffer, run_offset, draw_count,
+                sizeof(vk::DrawIndirectCommand));
+        }
+        begin = end;
+    }
+
+    mDraws.clear();
+}
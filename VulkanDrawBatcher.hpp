@@ -0,0 +1,94 @@
+﻿#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Runtime/Graphics/Enum/GraphicsIndexType.hpp>
+
+namespace usagi
+{
+class GpuBuffer;
+class GraphicsPipeline;
+class ShaderResource;
+class VulkanGpuDevice;
+class VulkanGraphicsCommandList;
+
+/**
+ * \brief Collects the draws of a subpass on the CPU and records them with as
+ * few state changes and draw calls as possible.
+ *
+ * Each run of consecutive draws sharing the pipeline, the resource set, and
+ * the vertex and index buffers becomes a single indirect draw whose
+ * arguments are packed into the transient buffer, so the states are bound
+ * once per run instead of once per draw.
+ *
+ * By default the draws are recorded in the order they are added, which is
+ * required for blending back to front. Draws that may be reordered, such as
+ * opaque ones with depth testing, can be sorted by their states first to
+ * form longer runs.
+ */
+class VulkanDrawBatcher
+{
+public:
+    enum class Ordering
+    {
+        // only the adjacent draws sharing the states are merged
+        SUBMISSION,
+        // the draws are sorted by the states. the order of the draws with
+        // the same states is kept.
+        STATE,
+    };
+
+    struct Draw
+    {
+        std::shared_ptr<GraphicsPipeline> pipeline;
+        // bound to the set unless empty
+        std::uint32_t resource_set = 0;
+        std::vector<std::shared_ptr<ShaderResource>> resources;
+        // bound to binding 0 unless null
+        std::shared_ptr<GpuBuffer> vertex_buffer;
+        std::size_t vertex_buffer_offset = 0;
+        // not indexed if null
+        std::shared_ptr<GpuBuffer> index_buffer;
+        std::size_t index_buffer_offset = 0;
+        GraphicsIndexType index_type = GraphicsIndexType::UINT16;
+
+        // the vertices or the indices
+        std::uint32_t count = 0;
+        std::uint32_t instance_count = 1;
+        std::uint32_t first = 0;
+        // added to the indices
+        std::int32_t vertex_offset = 0;
+        std::uint32_t first_instance = 0;
+    };
+
+private:
+    VulkanGpuDevice *mDevice = nullptr;
+    Ordering mOrdering = Ordering::SUBMISSION;
+    std::vector<Draw> mDraws;
+    // reused for sorting
+    std::vector<std::size_t> mOrder;
+
+    static bool lessState(const Draw &lhs, const Draw &rhs);
+    static bool sameState(const Draw &lhs, const Draw &rhs);
+
+public:
+    explicit VulkanDrawBatcher(
+        VulkanGpuDevice *device,
+        Ordering ordering = Ordering::SUBMISSION);
+
+    void add(Draw draw);
+
+    /**
+     * \brief Record the collected draws in the current subpass and clear
+     * them. The arguments are allocated from the transient buffer, so the
+     * command list must be submitted in the current frame.
+     */
+    void record(VulkanGraphicsCommandList &cmd);
+
+    std::size_t size() const { return mDraws.size(); }
+    void clear() { mDraws.clear(); }
+};
+}
@@ -52,35 +52,134 @@ VKAPI_ATTR void VKAPI_CALL vkDebugReportMessageEXT(
  * VK_EXT_debug_utils
  */
 
+namespace
+{
+// the functions taking device objects don't have the instance to load them
+// from, so they are loaded by loadDebugUtilsFunctions() when the instance is
+// created. the loader dispatches them by the objects, so they also work for
+// the other instances enabling the extension.
+struct
+{
+    PFN_vkSetDebugUtilsObjectNameEXT set_object_name = nullptr;
+    PFN_vkSetDebugUtilsObjectTagEXT set_object_tag = nullptr;
+    PFN_vkQueueBeginDebugUtilsLabelEXT queue_begin_label = nullptr;
+    PFN_vkQueueEndDebugUtilsLabelEXT queue_end_label = nullptr;
+    PFN_vkQueueInsertDebugUtilsLabelEXT queue_insert_label = nullptr;
+    PFN_vkCmdBeginDebugUtilsLabelEXT cmd_begin_label = nullptr;
+    PFN_vkCmdEndDebugUtilsLabelEXT cmd_end_label = nullptr;
+    PFN_vkCmdInsertDebugUtilsLabelEXT cmd_insert_label = nullptr;
+} gDebugUtils;
+
+template <typename Func>
+void loadInstanceFunction(VkInstance instance, Func &func, const char *name)
+{
+    func = reinterpret_cast<Func>(vkGetInstanceProcAddr(instance, name));
+}
+}
+
+namespace usagi::vulkan
+{
+void loadDebugUtilsFunctions(VkInstance instance)
+{
+    auto &f = gDebugUtils;
+    loadInstanceFunction(instance, f.set_object_name,
+        "vkSetDebugUtilsObjectNameEXT");
+    loadInstanceFunction(instance, f.set_object_tag,
+        "vkSetDebugUtilsObjectTagEXT");
+    loadInstanceFunction(instance, f.queue_begin_label,
+        "vkQueueBeginDebugUtilsLabelEXT");
+    loadInstanceFunction(instance, f.queue_end_label,
+        "vkQueueEndDebugUtilsLabelEXT");
+    loadInstanceFunction(instance, f.queue_insert_label,
+        "vkQueueInsertDebugUtilsLabelEXT");
+    loadInstanceFunction(instance, f.cmd_begin_label,
+        "vkCmdBeginDebugUtilsLabelEXT");
+    loadInstanceFunction(instance, f.cmd_end_label,
+        "vkCmdEndDebugUtilsLabelEXT");
+    loadInstanceFunction(instance, f.cmd_insert_label,
+        "vkCmdInsertDebugUtilsLabelEXT");
+}
+}
+
 VKAPI_ATTR VkResult VKAPI_CALL vkSetDebugUtilsObjectNameEXT(
     VkDevice device,
-    const VkDebugUtilsObjectNameInfoEXT *pNameInfo);
+    const VkDebugUtilsObjectNameInfoEXT *pNameInfo)
+{
+    if(const auto func = gDebugUtils.set_object_name)
+    {
+        return func(device, pNameInfo);
+    }
+    return VK_ERROR_EXTENSION_NOT_PRESENT;
+}
 
 VKAPI_ATTR VkResult VKAPI_CALL vkSetDebugUtilsObjectTagEXT(
     VkDevice device,
-    const VkDebugUtilsObjectTagInfoEXT *pTagInfo);
+    const VkDebugUtilsObjectTagInfoEXT *pTagInfo)
+{
+    if(const auto func = gDebugUtils.set_object_tag)
+    {
+        return func(device, pTagInfo);
+    }
+    return VK_ERROR_EXTENSION_NOT_PRESENT;
+}
 
 VKAPI_ATTR void VKAPI_CALL vkQueueBeginDebugUtilsLabelEXT(
     VkQueue queue,
-    const VkDebugUtilsLabelEXT *pLabelInfo);
+    const VkDebugUtilsLabelEXT *pLabelInfo)
+{
+    if(const auto func = gDebugUtils.queue_begin_label)
+    {
+        func(queue, pLabelInfo);
+    }
+}
 
 VKAPI_ATTR void VKAPI_CALL vkQueueEndDebugUtilsLabelEXT(
-    VkQueue queue);
+    VkQueue queue)
+{
+    if(const auto func = gDebugUtils.queue_end_label)
+    {
+        func(queue);
+    }
+}
 
 VKAPI_ATTR void VKAPI_CALL vkQueueInsertDebugUtilsLabelEXT(
     VkQueue queue,
-    const VkDebugUtilsLabelEXT *pLabelInfo);
+    const VkDebugUtilsLabelEXT *pLabelInfo)
+{
+    if(const auto func = gDebugUtils.queue_insert_label)
+    {
+        func(queue, pLabelInfo);
+    }
+}
 
 VKAPI_ATTR void VKAPI_CALL vkCmdBeginDebugUtilsLabelEXT(
     VkCommandBuffer commandBuffer,
-    const VkDebugUtilsLabelEXT *pLabelInfo);
+    const VkDebugUtilsLabelEXT *pLabelInfo)
+{
+    if(const auto func = gDebugUtils.cmd_begin_label)
+    {
+        func(commandBuffer, pLabelInfo);
+    }
+}
 
 VKAPI_ATTR void VKAPI_CALL vkCmdEndDebugUtilsLabelEXT(
-    VkCommandBuffer commandBuffer);
+    VkCommandBuffer commandBuffer)
+{
+    if(const auto func = gDebugUtils.cmd_end_label)
+    {
+        func(commandBuffer);
+    }
+}
 
 VKAPI_ATTR void VKAPI_CALL vkCmdInsertDebugUtilsLabelEXT(
     VkCommandBuffer commandBuffer,
-    const VkDebugUtilsLabelEXT *pLabelInfo);
+    const VkDebugUtilsLabelEXT *pLabelInfo)
+{
+    if(const auto func = gDebugUtils.cmd_insert_label)
+    {
+        func(commandBuffer, pLabelInfo);
+    }
+}
 
 VKAPI_ATTR VkResult VKAPI_CALL vkCreateDebugUtilsMessengerEXT(
     VkInstance instance,
@@ -112,4 +211,126 @@ VKAPI_ATTR void VKAPI_CALL vkSubmitDebugUtilsMessageEXT(
     VkInstance instance,
     VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
     VkDebugUtilsMessageTypeFlagsEXT messageTypes,
-    const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData);
+    const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData)
+{
+    if(const auto func = reinterpret_cast<PFN_vkSubmitDebugUtilsMessageEXT>(
+        vkGetInstanceProcAddr(instance, "vkSubmitDebugUtilsMessageEXT")))
+    {
+        func(instance, messageSeverity, messageTypes, pCallbackData);
+    }
+}
+
+/*
+ * VK_KHR_timeline_semaphore
+ */
+
+#ifdef VK_KHR_timeline_semaphore
+
+namespace
+{
+// the device functions are called every frame so they are cached. multiple
+// devices may be created, so the cache is only hit when the same device is
+// used again by the thread.
+template <typename Func>
+Func loadDeviceFunction(VkDevice device, const char *name)
+{
+    thread_local VkDevice cached_device = VK_NULL_HANDLE;
+    thread_local Func cached_func = nullptr;
+    if(cached_device != device)
+    {
+        cached_func = reinterpret_cast<Func>(
+            vkGetDeviceProcAddr(device, name));
+        cached_device = device;
+    }
+    return cached_func;
+}
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkGetSemaphoreCounterValueKHR(
+    VkDevice device,
+    VkSemaphore semaphore,
+    uint64_t *pValue)
+{
+    const auto func = loadDeviceFunction<PFN_vkGetSemaphoreCounterValueKHR>(
+        device, "vkGetSemaphoreCounterValueKHR");
+    if(func)
+    {
+        return func(device, semaphore, pValue);
+    }
+    return VK_ERROR_EXTENSION_NOT_PRESENT;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkWaitSemaphoresKHR(
+    VkDevice device,
+    const VkSemaphoreWaitInfoKHR *pWaitInfo,
+    uint64_t timeout)
+{
+    const auto func = loadDeviceFunction<PFN_vkWaitSemaphoresKHR>(
+        device, "vkWaitSemaphoresKHR");
+    if(func)
+    {
+        return func(device, pWaitInfo, timeout);
+    }
+    return VK_ERROR_EXTENSION_NOT_PRESENT;
+}
+
+#endif
+
+/*
+ * VK_KHR_draw_indirect_count
+ */
+
+#ifdef VK_KHR_draw_indirect_count
+
+namespace
+{
+// loaded through the instance by loadDrawIndirectCountFunctions() since the
+// commands don't have a device to load them from
+PFN_vkCmdDrawIndirectCountKHR gCmdDrawIndirectCount = nullptr;
+PFN_vkCmdDrawIndexedIndirectCountKHR gCmdDrawIndexedIndirectCount = nullptr;
+}
+
+namespace usagi::vulkan
+{
+void loadDrawIndirectCountFunctions(VkInstance instance)
+{
+    loadInstanceFunction(instance, gCmdDrawIndirectCount,
+        "vkCmdDrawIndirectCountKHR");
+    loadInstanceFunction(instance, gCmdDrawIndexedIndirectCount,
+        "vkCmdDrawIndexedIndirectCountKHR");
+}
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndirectCountKHR(
+    VkCommandBuffer commandBuffer,
+    VkBuffer buffer,
+    VkDeviceSize offset,
+    VkBuffer countBuffer,
+    VkDeviceSize countBufferOffset,
+    uint32_t maxDrawCount,
+    uint32_t stride)
+{
+    if(const auto func = gCmdDrawIndirectCount)
+    {
+        func(commandBuffer, buffer, offset, countBuffer, countBufferOffset,
+            maxDrawCount, stride);
+    }
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndexedIndirectCountKHR(
+    VkCommandBuffer commandBuffer,
+    VkBuffer buffer,
+    VkDeviceSize offset,
+    VkBuffer countBuffer,
+    VkDeviceSize countBufferOffset,
+    uint32_t maxDrawCount,
+    uint32_t stride)
+{
+    if(const auto func = gCmdDrawIndexedIndirectCount)
+    {
+        func(commandBuffer, buffer, offset, countBuffer, countBufferOffset,
+            maxDrawCount, stride);
+    }
+}
+
+#endif
@@ -0,0 +1,134 @@
+﻿#include "VulkanFormatInfo.hpp"
+
+#include "VulkanHelper.hpp"
+
+usagi::vulkan::FormatBlock usagi::vulkan::formatBlock(const vk::Format format)
+{
+    switch(format)
+    {
+        case vk::Format::eR8Unorm:
+            return { 1, 1, 1 };
+        case vk::Format::eR8G8Unorm:
+        case vk::Format::eD16Unorm:
+            return { 1, 1, 2 };
+        case vk::Format::eR8G8B8Unorm:
+        case vk::Format::eD16UnormS8Uint:
+            return { 1, 1, 3 };
+        case vk::Format::eR8G8B8A8Unorm:
+        case vk::Format::eR8G8B8A8Srgb:
+        case vk::Format::eB8G8R8A8Unorm:
+        case vk::Format::eB8G8R8A8Srgb:
+        case vk::Format::eR32Sfloat:
+        case vk::Format::eD32Sfloat:
+        case vk::Format::eD24UnormS8Uint:
+            return { 1, 1, 4 };
+        case vk::Format::eD32SfloatS8Uint:
+            return { 1, 1, 5 };
+        case vk::Format::eR32G32Sfloat:
+            return { 1, 1, 8 };
+        case vk::Format::eR32G32B32Sfloat:
+            return { 1, 1, 12 };
+        case vk::Format::eR32G32B32A32Sfloat:
+            return { 1, 1, 16 };
+
+        case vk::Format::eBc1RgbUnormBlock:
+        case vk::Format::eBc1RgbSrgbBlock:
+        case vk::Format::eBc1RgbaUnormBlock:
+        case vk::Format::eBc1RgbaSrgbBlock:
+        case vk::Format::eBc4UnormBlock:
+        case vk::Format::eBc4SnormBlock:
+            return { 4, 4, 8 };
+        case vk::Format::eBc2UnormBlock:
+        case vk::Format::eBc2SrgbBlock:
+        case vk::Format::eBc3UnormBlock:
+        case vk::Format::eBc3SrgbBlock:
+        case vk::Format::eBc5UnormBlock:
+        case vk::Format::eBc5SnormBlock:
+        case vk::Format::eBc6HUfloatBlock:
+        case vk::Format::eBc6HSfloatBlock:
+        case vk::Format::eBc7UnormBlock:
+        case vk::Format::eBc7SrgbBlock:
+            return { 4, 4, 16 };
+
+        case vk::Format::eEtc2R8G8B8UnormBlock:
+        case vk::Format::eEtc2R8G8B8SrgbBlock:
+        case vk::Format::eEtc2R8G8B8A1UnormBlock:
+        case vk::Format::eEtc2R8G8B8A1SrgbBlock:
+        case vk::Format::eEacR11UnormBlock:
+        case vk::Format::eEacR11SnormBlock:
+            return { 4, 4, 8 };
+        case vk::Format::eEtc2R8G8B8A8UnormBlock:
+        case vk::Format::eEtc2R8G8B8A8SrgbBlock:
+        case vk::Format::eEacR11G11UnormBlock:
+        case vk::Format::eEacR11G11SnormBlock:
+            return { 4, 4, 16 };
+
+        case vk::Format::eAstc4x4UnormBlock:
+        case vk::Format::eAstc4x4SrgbBlock:
+            return { 4, 4, 16 };
+        case vk::Format::eAstc5x4UnormBlock:
+        case vk::Format::eAstc5x4SrgbBlock:
+            return { 5, 4, 16 };
+        case vk::Format::eAstc5x5UnormBlock:
+        case vk::Format::eAstc5x5SrgbBlock:
+            return { 5, 5, 16 };
+        case vk::Format::eAstc6x5UnormBlock:
+        case vk::Format::eAstc6x5SrgbBlock:
+            return { 6, 5, 16 };
+        case vk::Format::eAstc6x6UnormBlock:
+        case vk::Format::eAstc6x6SrgbBlock:
+            return { 6, 6, 16 };
+        case vk::Format::eAstc8x5UnormBlock:
+        case vk::Format::eAstc8x5SrgbBlock:
+            return { 8, 5, 16 };
+        case vk::Format::eAstc8x6UnormBlock:
+        case vk::Format::eAstc8x6SrgbBlock:
+            return { 8, 6, 16 };
+        case vk::Format::eAstc8x8UnormBlock:
+        case vk::Format::eAstc8x8SrgbBlock:
+            return { 8, 8, 16 };
+        case vk::Format::eAstc10x5UnormBlock:
+        case vk::Format::eAstc10x5SrgbBlock:
+            return { 10, 5, 16 };
+        case vk::Format::eAstc10x6UnormBlock:
+        case vk::Format::eAstc10x6SrgbBlock:
+            return { 10, 6, 16 };
+        case vk::Format::eAstc10x8UnormBlock:
+        case vk::Format::eAstc10x8SrgbBlock:
+            return { 10, 8, 16 };
+        case vk::Format::eAstc10x10UnormBlock:
+        case vk::Format::eAstc10x10SrgbBlock:
+            return { 10, 10, 16 };
+        case vk::Format::eAstc12x10UnormBlock:
+        case vk::Format::eAstc12x10SrgbBlock:
+            return { 12, 10, 16 };
+        case vk::Format::eAstc12x12UnormBlock:
+        case vk::Format::eAstc12x12SrgbBlock:
+            return { 12, 12, 16 };
+
+        default:
+            return { };
+    }
+}
+
+std::uint32_t usagi::vulkan::fullMipCount(
+    const std::uint32_t width,
+    const std::uint32_t height)
+{
+    const auto extent = std::max(width, height);
+    return extent ? highestBit(extent) + 1 : 1;
+}
+
+std::size_t usagi::vulkan::mipDataSize(
+    const vk::Format format,
+    const std::uint32_t width,
+    const std::uint32_t height,
+    const std::uint32_t mip)
+{
+    const auto block = formatBlock(format);
+    const auto blocks_x = alignUp(mipExtent(width, mip), block.width) /
+        block.width;
+    const auto blocks_y = alignUp(mipExtent(height, mip), block.height) /
+        block.height;
+    return static_cast<std::size_t>(blocks_x) * blocks_y * block.size;
+}
@@ -0,0 +1,54 @@
+﻿#pragma once
+
+#include <cstdint>
+
+#include <vulkan/vulkan.hpp>
+
+namespace usagi::vulkan
+{
+/**
+ * \brief The memory layout of the texels of a format. Uncompressed formats
+ * have blocks of one texel. The BC, ETC2/EAC and ASTC formats are encoded in
+ * blocks of 4x4 texels or more.
+ */
+struct FormatBlock
+{
+    std::uint32_t width = 1;
+    std::uint32_t height = 1;
+    // 0 for the formats unknown to the backend
+    std::uint32_t size = 0;
+};
+
+FormatBlock formatBlock(vk::Format format);
+
+inline bool isBlockCompressed(const vk::Format format)
+{
+    return formatBlock(format).width > 1;
+}
+
+/**
+ * \brief The extent of a mip level, which is at least one texel.
+ */
+inline std::uint32_t mipExtent(
+    const std::uint32_t extent,
+    const std::uint32_t mip)
+{
+    const auto e = extent >> mip;
+    return e ? e : 1;
+}
+
+/**
+ * \brief The number of mip levels of a complete chain down to 1x1.
+ */
+std::uint32_t fullMipCount(std::uint32_t width, std::uint32_t height);
+
+/**
+ * \brief The size of the tightly packed data of a mip level, as expected by
+ * the buffer-to-image copies.
+ */
+std::size_t mipDataSize(
+    vk::Format format,
+    std::uint32_t width,
+    std::uint32_t height,
+    std::uint32_t mip);
+}
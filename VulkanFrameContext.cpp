@@ -0,0 +1,88 @@
+﻿#include "VulkanFrameContext.hpp"
+
+#include <iterator>
+
+#include "VulkanBatchResource.hpp"
+
+#include "VulkanGpuDevice.hpp"
+#include "VulkanSemaphore.hpp"
+#include "VulkanSwapchainImage.hpp"
+
+usagi::VulkanFrameContext::VulkanFrameContext(
+    VulkanGpuDevice *device,
+    const std::size_t index)
+    : mDevice(device)
+    , mIndex(index)
+{
+}
+
+void usagi::VulkanFrameContext::wait()
+{
+    if(mLastComputeSerial != 0)
+    {
+        mDevice->computeTimeline()->wait(mLastComputeSerial);
+        mLastComputeSerial = 0;
+    }
+
+    if(mLastSerial == 0) return;
+
+    mDevice->submissionTimeline()->wait(mLastSerial);
+    mLastSerial = 0;
+}
+
+void usagi::VulkanFrameContext::begin(const std::uint64_t frame_number)
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mRetainedMutex);
+        mFrameNumber = frame_number;
+        mRetainedResources.swap(mReleasedResources);
+    }
+    // releasing a command list may retain the resources used by it, which
+    // are then released as well since the frame number has changed.
+    mReleasedResources.clear();
+    // the frame presented from them was completed
+    mRetiredSwapchains.clear();
+    // the semaphores were waited on by the work of the previous frame
+    mUsedSemaphores = 0;
+}
+
+void usagi::VulkanFrameContext::end()
+{
+    mLastSerial = mDevice->submissionTimeline()->submitted();
+    if(const auto compute = mDevice->computeTimeline())
+        mLastComputeSerial = compute->submitted();
+}
+
+std::shared_ptr<usagi::VulkanSemaphore>
+    usagi::VulkanFrameContext::acquireSemaphore()
+{
+    if(mUsedSemaphores == mSemaphores.size())
+    {
+        mSemaphores.push_back(std::make_shared<VulkanSemaphore>(
+            mDevice->syncObjectPool()->acquireSemaphore()));
+    }
+    return mSemaphores[mUsedSemaphores++];
+}
+
+void usagi::VulkanFrameContext::retain(
+    const std::uint64_t frame_number,
+    std::vector<std::shared_ptr<VulkanBatchResource>> &resources)
+{
+    {
+        std::lock_guard<std::mutex> lock(mRetainedMutex);
+        if(frame_number == mFrameNumber)
+        {
+            mRetainedResources.insert(mRetainedResources.end(),
+                std::make_move_iterator(resources.begin()),
+                std::make_move_iterator(resources.end()));
+        }
+    }
+    resources.clear();
+}
+
+void usagi::VulkanFrameContext::retireSwapchain(
+    std::shared_ptr<VulkanSwapchainHandle> swapchain)
+{
+    mRetiredSwapchains.push_back(std::move(swapchain));
+}
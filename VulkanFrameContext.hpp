@@ -0,0 +1,91 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+class VulkanBatchResource;
+class VulkanGpuDevice;
+class VulkanSemaphore;
+struct VulkanSwapchainHandle;
+
+/**
+ * \brief The per-frame objects of one of the frames in flight. A context is
+ * reused every framesInFlight() frames, after the GPU finished executing
+ * the work submitted during its previous frame, so the objects handed out
+ * by it may be recycled without being destroyed.
+ *
+ * The objects acquired from a frame context are only valid until the
+ * context is reused.
+ */
+class VulkanFrameContext : Noncopyable
+{
+    VulkanGpuDevice *mDevice = nullptr;
+    const std::size_t mIndex;
+    std::uint64_t mFrameNumber = 0;
+
+    // the last batch submitted to the graphics queue before the end of the
+    // frame. 0 if the frame is not ended.
+    std::uint64_t mLastSerial = 0;
+    // same for the dedicated compute queue
+    std::uint64_t mLastComputeSerial = 0;
+
+    std::vector<std::shared_ptr<VulkanSemaphore>> mSemaphores;
+    std::size_t mUsedSemaphores = 0;
+
+    // the resources used by the command lists of the frame. released when
+    // the context is reused. the command lists may be recorded by other
+    // threads.
+    std::mutex mRetainedMutex;
+    std::vector<std::shared_ptr<VulkanBatchResource>> mRetainedResources;
+    // swapped with the retained resources to release them outside the lock
+    std::vector<std::shared_ptr<VulkanBatchResource>> mReleasedResources;
+
+    // the swapchains replaced while the context was in flight. the
+    // presentation of the frame may still use them.
+    std::vector<std::shared_ptr<VulkanSwapchainHandle>> mRetiredSwapchains;
+
+public:
+    VulkanFrameContext(VulkanGpuDevice *device, std::size_t index);
+
+    /**
+     * \brief Wait for the previous frame using this context and reset it.
+     */
+    void begin(std::uint64_t frame_number);
+    void end();
+    /**
+     * \brief Block until the frame is completed. Does nothing if the frame is
+     * not ended.
+     */
+    void wait();
+
+    /**
+     * \brief Get an unsignaled binary semaphore.
+     */
+    std::shared_ptr<VulkanSemaphore> acquireSemaphore();
+
+    /**
+     * \brief Keep the resources used by a command list of the frame alive
+     * until the frame is completed. If the context was already reused, the
+     * frame is completed and the resources are released immediately. The
+     * vector is left empty.
+     */
+    void retain(
+        std::uint64_t frame_number,
+        std::vector<std::shared_ptr<VulkanBatchResource>> &resources);
+
+    /**
+     * \brief Keep a replaced swapchain alive until the context is reused.
+     * Must be called by the thread beginning the frames.
+     */
+    void retireSwapchain(std::shared_ptr<VulkanSwapchainHandle> swapchain);
+
+    std::size_t index() const { return mIndex; }
+    std::uint64_t frameNumber() const { return mFrameNumber; }
+};
+}
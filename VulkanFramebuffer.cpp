@@ -15,25 +15,8 @@ usagi::VulkanFramebuffer::VulkanFramebuffer(
 {
 }
 
-void usagi::VulkanFramebuffer::create(
-    std::shared_ptr<VulkanRenderPass> render_pass)
+vk::Framebuffer usagi::VulkanFramebuffer::framebuffer(
+    const VulkanRenderPass &render_pass) const
 {
-    assert(!mFramebuffer);
-
-    auto vk_views = vulkan::transformObjects(mViews,
-        [&](auto &&v) {
-            return v->view();
-        }
-    );
-
-    vk::FramebufferCreateInfo fb_info;
-    fb_info.setRenderPass(render_pass->renderPass());
-    fb_info.setAttachmentCount(static_cast<uint32_t>(vk_views.size()));
-    fb_info.setPAttachments(vk_views.data());
-    fb_info.setWidth(mSize.x());
-    fb_info.setHeight(mSize.y());
-    fb_info.setLayers(1);
-
-    mRenderPass = std::move(render_pass);
-    mFramebuffer = mDevice->device().createFramebufferUnique(fb_info);
+    return mDevice->framebufferCache()->acquire(render_pass, *this);
 }
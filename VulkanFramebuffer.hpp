@@ -21,8 +21,6 @@ class VulkanFramebuffer
     VulkanGpuDevice *mDevice = nullptr;
     Vector2u32 mSize;
     std::vector<std::shared_ptr<VulkanGpuImageView>> mViews;
-    vk::UniqueFramebuffer mFramebuffer;
-    std::shared_ptr<VulkanRenderPass> mRenderPass;
 
 public:
     VulkanFramebuffer(
@@ -32,9 +30,11 @@ public:
 
     Vector2u32 size() const override { return mSize; }
 
-    void create(std::shared_ptr<VulkanRenderPass> render_pass);
-
-    vk::Framebuffer framebuffer() const { return mFramebuffer.get(); }
+    /**
+     * \brief Get the Vulkan framebuffer compatible with the render pass from
+     * the framebuffer cache of the device.
+     */
+    vk::Framebuffer framebuffer(const VulkanRenderPass &render_pass) const;
 
     const std::vector<std::shared_ptr<VulkanGpuImageView>> & views() const
     {
@@ -0,0 +1,120 @@
+﻿#include "VulkanFramebufferCache.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+#include "VulkanFramebuffer.hpp"
+#include "VulkanGpuDevice.hpp"
+#include "VulkanGpuImageView.hpp"
+#include "VulkanHelper.hpp"
+#include "VulkanRenderPass.hpp"
+
+using namespace usagi::vulkan;
+
+bool usagi::VulkanFramebufferCache::Key::operator==(const Key &rhs) const
+{
+    return width == rhs.width &&
+        height == rhs.height &&
+        views == rhs.views &&
+        render_pass == rhs.render_pass;
+}
+
+std::size_t usagi::VulkanFramebufferCache::KeyHasher::operator()(
+    const Key &key) const
+{
+    std::size_t seed = 0;
+    for(auto &&v : key.render_pass)
+        hashCombine(seed, v);
+    for(auto &&v : key.views)
+        hashCombine(seed, handleValue(v));
+    hashCombine(seed, key.width);
+    hashCombine(seed, key.height);
+    return seed;
+}
+
+usagi::VulkanFramebufferCache::VulkanFramebufferCache(VulkanGpuDevice *device)
+    : mDevice(device)
+{
+}
+
+vk::Framebuffer usagi::VulkanFramebufferCache::acquire(
+    const VulkanRenderPass &render_pass,
+    const VulkanFramebuffer &framebuffer)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    mLookupKey.render_pass = render_pass.compatibilityKey();
+    mLookupKey.views.clear();
+    for(auto &&v : framebuffer.views())
+        mLookupKey.views.push_back(v->view());
+    const auto size = framebuffer.size();
+    mLookupKey.width = size.x();
+    mLookupKey.height = size.y();
+
+    const auto iter = mFramebuffers.find(mLookupKey);
+    if(iter != mFramebuffers.end())
+        return iter->second.get();
+
+    vk::FramebufferCreateInfo fb_info;
+    fb_info.setRenderPass(render_pass.renderPass());
+    fb_info.setAttachmentCount(
+        static_cast<uint32_t>(mLookupKey.views.size()));
+    fb_info.setPAttachments(mLookupKey.views.data());
+    fb_info.setWidth(mLookupKey.width);
+    fb_info.setHeight(mLookupKey.height);
+    fb_info.setLayers(1);
+
+    const auto inserted = mFramebuffers.emplace(
+        mLookupKey, mDevice->device().createFramebufferUnique(fb_info)).first;
+    const auto key_ptr = &inserted->first;
+    for(auto &&v : key_ptr->views)
+    {
+        // a view may be used by multiple attachments
+        const auto range = mReferences.equal_range(handleValue(v));
+        if(std::none_of(range.first, range.second, [&](auto &&r) {
+            return r.second == key_ptr;
+        })) mReferences.emplace(handleValue(v), key_ptr);
+    }
+
+    return inserted->second.get();
+}
+
+void usagi::VulkanFramebufferCache::erase(const Key *key)
+{
+    const auto iter = mFramebuffers.find(*key);
+    assert(iter != mFramebuffers.end());
+
+    for(auto &&v : key->views)
+    {
+        const auto range = mReferences.equal_range(handleValue(v));
+        for(auto i = range.first; i != range.second; ++i)
+        {
+            if(i->second == key)
+            {
+                mReferences.erase(i);
+                break;
+            }
+        }
+    }
+    mFramebuffers.erase(iter);
+}
+
+void usagi::VulkanFramebufferCache::evict(const std::uint64_t view)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    const auto range = mReferences.equal_range(view);
+    if(range.first == range.second) return;
+
+    // the references are removed while erasing the framebuffers
+    mEvictList.clear();
+    for(auto i = range.first; i != range.second; ++i)
+        mEvictList.push_back(i->second);
+    for(auto &&key : mEvictList)
+        erase(key);
+}
+
+std::size_t usagi::VulkanFramebufferCache::size()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mFramebuffers.size();
+}
@@ -0,0 +1,77 @@
+﻿#pragma once
+
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+class VulkanGpuDevice;
+class VulkanFramebuffer;
+class VulkanRenderPass;
+
+/**
+ * \brief Keeps the Vulkan framebuffers created for the attachment views so
+ * that beginning a render pass with the same views only costs a lookup.
+ *
+ * A framebuffer may be used with any render pass compatible with the one it
+ * was created with, so the entries are keyed by the compatibility key of the
+ * render pass instead of its handle. An entry is destroyed when any of its
+ * views is destroyed, which only happens after the command lists using the
+ * views are completed. The views must call evict() before destroying their
+ * handles.
+ */
+class VulkanFramebufferCache : Noncopyable
+{
+    struct Key
+    {
+        std::vector<std::uint64_t> render_pass;
+        std::vector<vk::ImageView> views;
+        std::uint32_t width = 0;
+        std::uint32_t height = 0;
+
+        bool operator==(const Key &rhs) const;
+    };
+
+    struct KeyHasher
+    {
+        std::size_t operator()(const Key &key) const;
+    };
+
+    VulkanGpuDevice *mDevice = nullptr;
+    std::mutex mMutex;
+
+    using FramebufferMap =
+        std::unordered_map<Key, vk::UniqueFramebuffer, KeyHasher>;
+    FramebufferMap mFramebuffers;
+    // maps the views to the keys of the framebuffers using them
+    std::unordered_multimap<std::uint64_t, const Key *> mReferences;
+    std::vector<const Key *> mEvictList;
+    // reused for lookups
+    Key mLookupKey;
+
+    void erase(const Key *key);
+
+public:
+    explicit VulkanFramebufferCache(VulkanGpuDevice *device);
+
+    /**
+     * \brief Find or create the framebuffer of the views which is compatible
+     * with the render pass.
+     */
+    vk::Framebuffer acquire(
+        const VulkanRenderPass &render_pass,
+        const VulkanFramebuffer &framebuffer);
+
+    /**
+     * \brief Destroy the framebuffers using the image view.
+     */
+    void evict(std::uint64_t view);
+
+    std::size_t size();
+};
+}
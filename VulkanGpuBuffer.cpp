@@ -1,21 +1,42 @@
 ﻿#include "VulkanGpuBuffer.hpp"
 
+#include <cassert>
+
+#include <Usagi/Core/Exception.hpp>
 #include <Usagi/Utility/Rounding.hpp>
 
 #include "VulkanGpuDevice.hpp"
 #include "VulkanBufferAllocation.hpp"
-#include "VulkanMemoryPool.hpp"
+#include "VulkanGrowableMemoryPool.hpp"
+#include "VulkanResourceTracker.hpp"
 
 usagi::VulkanGpuBuffer::VulkanGpuBuffer(
-    VulkanBufferMemoryPoolBase *pool,
-    const GpuBufferUsage usage)
-    : mPool(pool)
+    VulkanGpuDevice *device,
+    VulkanGrowableBufferPool *pool,
+    const GpuBufferUsage usage,
+    const VulkanBufferPlacement placement)
+    : mDevice(device)
+    , mPool(pool)
     , mUsage(usage)
+    , mPlacement(placement)
 {
+    assert(mPool || mPlacement == VulkanBufferPlacement::TRANSIENT);
 }
 
 void usagi::VulkanGpuBuffer::allocate(std::size_t size)
 {
+    if(mPlacement == VulkanBufferPlacement::TRANSIENT)
+    {
+        const auto transient = mDevice->transientBuffer();
+        // the transient buffer flushes whole regions so no rounding is
+        // needed. 16 bytes covers the alignments of the vertex attributes
+        // and indices.
+        mTransientAllocation = mUsage == GpuBufferUsage::UNIFORM
+            ? transient->allocateUniform(size)
+            : transient->allocate(size, 16);
+        return;
+    }
+
     // the buffer allocation size must be flushable according to
     // VUID-VkMappedMemoryRange-size-01390:
     // If size is not equal to VK_WHOLE_SIZE, size must either be a multiple of
@@ -23,44 +44,105 @@ void usagi::VulkanGpuBuffer::allocate(std::size_t size)
     // equal the size of memory.
     const std::size_t flushable_size = utility::roundUpUnsigned(
         size,
-        mPool->device()->physicalDevice().getProperties()
-            .limits.nonCoherentAtomSize
+        mDevice->capabilities()->limits().nonCoherentAtomSize
     );
     mAllocation = mPool->allocate(flushable_size);
+    mStagingAllocation.reset();
+    mUploaded = false;
 }
 
 void * usagi::VulkanGpuBuffer::mappedMemory()
 {
-    return mAllocation->mappedAddress();
+    switch(mPlacement)
+    {
+        case VulkanBufferPlacement::HOST_VISIBLE:
+            return mAllocation->mappedAddress();
+        case VulkanBufferPlacement::DEVICE_LOCAL:
+            if(!mStagingAllocation)
+            {
+                mStagingAllocation = mDevice->allocateStageBuffer(
+                    mAllocation->size());
+            }
+            return mStagingAllocation->mappedAddress();
+        case VulkanBufferPlacement::TRANSIENT:
+            return mTransientAllocation.mapped_address;
+        default:
+            USAGI_THROW(std::runtime_error("Invalid VulkanBufferPlacement."));
+    }
 }
 
 void usagi::VulkanGpuBuffer::flush()
 {
+    // flushed by the device before submitting the graphics jobs
+    if(mPlacement == VulkanBufferPlacement::TRANSIENT)
+        return;
+
+    if(mPlacement == VulkanBufferPlacement::DEVICE_LOCAL)
+    {
+        if(!mStagingAllocation) return;
+        // the previous content may still be used by the GPU
+        if(mUploaded)
+            mAllocation = mPool->allocate(mAllocation->size());
+        // the staging memory is coherent. it is kept alive by the upload
+        // queue until copied.
+        mDevice->copyBuffer(mStagingAllocation, mAllocation);
+        mStagingAllocation.reset();
+        mUploaded = true;
+        return;
+    }
+
     vk::MappedMemoryRange range;
-    range.setMemory(mPool->memory());
+    range.setMemory(mAllocation->pool()->memory());
     range.setOffset(mAllocation->offset());
     range.setSize(mAllocation->size());
 
-    mPool->device()->device().flushMappedMemoryRanges({ range });
+    mDevice->device().flushMappedMemoryRanges({ range });
 }
 
 void usagi::VulkanGpuBuffer::release()
 {
     mAllocation.reset();
+    mStagingAllocation.reset();
+    mUploaded = false;
+    mTransientAllocation = { };
 }
 
 std::size_t usagi::VulkanGpuBuffer::size() const
 {
+    if(mPlacement == VulkanBufferPlacement::TRANSIENT)
+        return mTransientAllocation.size;
     return mAllocation ? mAllocation->size() : 0;
 }
 
+vk::Buffer usagi::VulkanGpuBuffer::buffer() const
+{
+    if(mPlacement == VulkanBufferPlacement::TRANSIENT)
+        return mTransientAllocation.buffer;
+    return mAllocation->pool()->buffer();
+}
+
+std::size_t usagi::VulkanGpuBuffer::offset() const
+{
+    if(mPlacement == VulkanBufferPlacement::TRANSIENT)
+        return mTransientAllocation.offset;
+    return mAllocation->offset();
+}
+
 void usagi::VulkanGpuBuffer::fillShaderResourceInfo(
     vk::WriteDescriptorSet &write,
     VulkanResourceInfo &info)
 {
+    info = vk::DescriptorBufferInfo { };
     auto &buffer_info = std::get<vk::DescriptorBufferInfo>(info);
-    buffer_info.setBuffer(mAllocation->pool()->buffer());
-    buffer_info.setOffset(mAllocation->offset());
-    buffer_info.setRange(mAllocation->size());
+    buffer_info.setBuffer(buffer());
+    buffer_info.setOffset(offset());
+    buffer_info.setRange(size());
     write.setPBufferInfo(&buffer_info);
 }
+
+void usagi::VulkanGpuBuffer::trackAdditionalResources(
+    VulkanResourceTracker &tracker)
+{
+    if(mAllocation)
+        tracker.track(mAllocation);
+}
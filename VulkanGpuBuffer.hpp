@@ -6,25 +6,48 @@
 #include <Usagi/Runtime/Graphics/Enum/GpuBufferUsage.hpp>
 
 #include "VulkanShaderResource.hpp"
+#include "VulkanBatchResource.hpp"
+#include "VulkanGpuDeviceConfig.hpp"
+#include "VulkanTransientBuffer.hpp"
 
 namespace usagi
 {
-class VulkanBufferMemoryPoolBase;
+class VulkanGrowableBufferPool;
 class VulkanGpuDevice;
 class VulkanBufferAllocation;
 
-// note that VulkanBufferAllocation is inherited from VulkanBatchResource,
-// but not this class, which is only a wrapper of the real resource.
+// note that this class is only a wrapper of the real resource, which is
+// VulkanBufferAllocation. the allocation may be replaced while the previous
+// one is still in use, so only the allocation is tracked.
+// staged buffers live in device-local memory. the host writes to a staging
+// allocation which is copied by the upload queue when flushed. a buffer which
+// was already uploaded gets a new allocation so that the copy never
+// overwrites the data being read by the GPU.
+// transient buffers are bump-allocated from the region of the current frame
+// and not tracked at all since the region outlives the work of the frame.
 class VulkanGpuBuffer
     : public GpuBuffer
+    , public VulkanBatchResource
     , public VulkanShaderResource
 {
-    VulkanBufferMemoryPoolBase * mPool = nullptr;
+    VulkanGpuDevice * mDevice = nullptr;
+    // null for transient buffers
+    VulkanGrowableBufferPool * mPool = nullptr;
     GpuBufferUsage mUsage;
+    const VulkanBufferPlacement mPlacement;
     std::shared_ptr<VulkanBufferAllocation> mAllocation;
+    // only used by staged buffers
+    std::shared_ptr<VulkanBufferAllocation> mStagingAllocation;
+    bool mUploaded = false;
+    // only used by transient buffers
+    VulkanTransientAllocation mTransientAllocation;
 
 public:
-    VulkanGpuBuffer(VulkanBufferMemoryPoolBase *pool, GpuBufferUsage usage);
+    VulkanGpuBuffer(
+        VulkanGpuDevice *device,
+        VulkanGrowableBufferPool *pool,
+        GpuBufferUsage usage,
+        VulkanBufferPlacement placement);
 
     void allocate(std::size_t size) override;
     void release() override;
@@ -37,10 +60,18 @@ public:
     void fillShaderResourceInfo(
         vk::WriteDescriptorSet &write,
         VulkanResourceInfo &info) override;
+    VulkanBatchResource & batchResource() override { return *this; }
+    void trackAdditionalResources(VulkanResourceTracker &tracker) override;
 
-    std::shared_ptr<VulkanBufferAllocation> allocation() const
+    /**
+     * \brief Null for transient buffers, which don't need to be tracked.
+     */
+    const std::shared_ptr<VulkanBufferAllocation> & allocation() const
     {
         return mAllocation;
     }
+    vk::Buffer buffer() const;
+    std::size_t offset() const;
+    VulkanBufferPlacement placement() const { return mPlacement; }
 };
 }
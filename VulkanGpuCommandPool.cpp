@@ -1,30 +1,130 @@
 ﻿#include "VulkanGpuCommandPool.hpp"
 
+#include "VulkanComputeCommandList.hpp"
 #include "VulkanGpuDevice.hpp"
 #include "VulkanGraphicsCommandList.hpp"
 
 usagi::VulkanGpuCommandPool::VulkanGpuCommandPool(VulkanGpuDevice *device)
     : mDevice { device }
+    , mFramePools(device->framesInFlight())
+    , mComputeFramePools(device->framesInFlight())
+{
+    mPool = createPool(mDevice->graphicsQueueFamily());
+}
+
+vk::UniqueCommandPool usagi::VulkanGpuCommandPool::createPool(
+    const std::uint32_t queue_family) const
 {
     vk::CommandPoolCreateInfo info;
 
-    info.setQueueFamilyIndex(mDevice->graphicsQueueFamily());
+    info.setQueueFamilyIndex(queue_family);
     // our command lists are freed immediately after each frame.
     info.setFlags(vk::CommandPoolCreateFlagBits::eTransient);
 
-    mPool = mDevice->device().createCommandPoolUnique(info);
+    return mDevice->device().createCommandPoolUnique(info);
+}
+
+vk::CommandBuffer usagi::VulkanGpuCommandPool::allocateFrameCommandBuffer(
+    std::vector<FramePool> &frame_pools,
+    const std::uint32_t queue_family,
+    const vk::CommandBufferLevel level)
+{
+    const auto frame = mDevice->currentFrame();
+    auto &pool = frame_pools[frame->index()];
+
+    if(!pool.pool)
+        pool.pool = createPool(queue_family);
+
+    if(pool.frame_number != frame->frameNumber())
+    {
+        // the previous frame using this pool was completed before the
+        // current frame began.
+        if(pool.used_counts[0] != 0 || pool.used_counts[1] != 0)
+            mDevice->device().resetCommandPool(pool.pool.get(), { });
+        pool.used_counts = { };
+        pool.frame_number = frame->frameNumber();
+    }
+
+    const auto level_index = static_cast<std::size_t>(level);
+    auto &command_buffers = pool.command_buffers[level_index];
+    auto &used_count = pool.used_counts[level_index];
+    if(used_count == command_buffers.size())
+    {
+        vk::CommandBufferAllocateInfo info;
+
+        info.setCommandBufferCount(1);
+        info.setCommandPool(pool.pool.get());
+        info.setLevel(level);
+
+        command_buffers.push_back(
+            mDevice->device().allocateCommandBuffers(info).front());
+    }
+
+    return command_buffers[used_count++];
+}
+
+std::shared_ptr<usagi::VulkanGraphicsCommandList>
+    usagi::VulkanGpuCommandPool::allocateCommandList(
+        const vk::CommandBufferLevel level)
+{
+    if(mDevice->currentFrame())
+    {
+        return std::make_shared<VulkanGraphicsCommandList>(
+            shared_from_this(),
+            allocateFrameCommandBuffer(
+                mFramePools, mDevice->graphicsQueueFamily(), level),
+            level
+        );
+    }
+
+    vk::CommandBufferAllocateInfo info;
+
+    info.setCommandBufferCount(1);
+    info.setCommandPool(mPool.get());
+    info.setLevel(level);
+
+    return std::make_shared<VulkanGraphicsCommandList>(
+        shared_from_this(),
+        std::move(mDevice->device().allocateCommandBuffersUnique(info).front()),
+        level
+    );
 }
 
 std::shared_ptr<usagi::GraphicsCommandList> usagi::VulkanGpuCommandPool::
     allocateGraphicsCommandList()
 {
+    return allocateCommandList(vk::CommandBufferLevel::ePrimary);
+}
+
+std::shared_ptr<usagi::VulkanGraphicsCommandList>
+    usagi::VulkanGpuCommandPool::allocateSecondaryCommandList()
+{
+    return allocateCommandList(vk::CommandBufferLevel::eSecondary);
+}
+
+std::shared_ptr<usagi::VulkanComputeCommandList>
+    usagi::VulkanGpuCommandPool::allocateComputeCommandList()
+{
+    const auto queue_family = mDevice->computeQueueFamily();
+    if(mDevice->currentFrame())
+    {
+        return std::make_shared<VulkanComputeCommandList>(
+            shared_from_this(),
+            allocateFrameCommandBuffer(mComputeFramePools, queue_family,
+                vk::CommandBufferLevel::ePrimary)
+        );
+    }
+
+    if(!mComputePool)
+        mComputePool = createPool(queue_family);
+
     vk::CommandBufferAllocateInfo info;
 
     info.setCommandBufferCount(1);
-    info.setCommandPool(mPool.get());
+    info.setCommandPool(mComputePool.get());
     info.setLevel(vk::CommandBufferLevel::ePrimary);
 
-    return std::make_shared<VulkanGraphicsCommandList>(
+    return std::make_shared<VulkanComputeCommandList>(
         shared_from_this(),
         std::move(mDevice->device().allocateCommandBuffersUnique(info).front())
     );
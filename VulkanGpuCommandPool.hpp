@@ -1,5 +1,7 @@
 ﻿#pragma once
 
+#include <array>
+
 #include <vulkan/vulkan.hpp>
 
 #include <Usagi/Runtime/Graphics/GpuCommandPool.hpp>
@@ -7,18 +9,65 @@
 namespace usagi
 {
 class VulkanGpuDevice;
+class VulkanGraphicsCommandList;
+class VulkanComputeCommandList;
 
+/**
+ * \brief Allocates the command lists recorded on one thread. Like the
+ * underlying Vulkan command pools, it must not be used by multiple threads at
+ * the same time. Each recording thread should get its own pool, such as the
+ * one from VulkanGpuDevice::threadCommandPool().
+ */
 class VulkanGpuCommandPool
     : public GpuCommandPool
     , public std::enable_shared_from_this<VulkanGpuCommandPool>
 {
     VulkanGpuDevice *mDevice;
+    // used when the device has not begun any frame
     vk::UniqueCommandPool mPool;
+    // created on the first compute command list, for the compute queue
+    // family
+    vk::UniqueCommandPool mComputePool;
+
+    /**
+     * \brief Command buffers recorded in one of the frames in flight. The
+     * whole pool is reset when it is used by a new frame instead of freeing
+     * individual command buffers.
+     */
+    struct FramePool
+    {
+        vk::UniqueCommandPool pool;
+        // indexed by vk::CommandBufferLevel
+        std::array<std::vector<vk::CommandBuffer>, 2> command_buffers;
+        std::array<std::size_t, 2> used_counts { };
+        std::uint64_t frame_number = 0;
+    };
+    std::vector<FramePool> mFramePools;
+    std::vector<FramePool> mComputeFramePools;
+
+    vk::UniqueCommandPool createPool(std::uint32_t queue_family) const;
+    vk::CommandBuffer allocateFrameCommandBuffer(
+        std::vector<FramePool> &frame_pools,
+        std::uint32_t queue_family,
+        vk::CommandBufferLevel level);
+    std::shared_ptr<VulkanGraphicsCommandList> allocateCommandList(
+        vk::CommandBufferLevel level);
 
 public:
     explicit VulkanGpuCommandPool(VulkanGpuDevice *device);
 
     std::shared_ptr<GraphicsCommandList> allocateGraphicsCommandList() override;
+    /**
+     * \brief Allocate a command list recorded with
+     * VulkanGraphicsCommandList::beginSecondaryRecording() and executed by a
+     * primary one inside a render pass.
+     */
+    std::shared_ptr<VulkanGraphicsCommandList> allocateSecondaryCommandList();
+    /**
+     * \brief Allocate a command list for the compute queue of the device,
+     * submitted with VulkanGpuDevice::submitComputeJobs().
+     */
+    std::shared_ptr<VulkanComputeCommandList> allocateComputeCommandList();
 
     VulkanGpuDevice * device() const { return mDevice; }
 };
@@ -1,19 +1,22 @@
-#include "VulkanGpuDevice.hpp"
+﻿#include "VulkanGpuDevice.hpp"
 
 #include <algorithm>
+#include <cassert>
+#include <cstring>
 
 #include <Usagi/Core/Logging.hpp>
 #include <Usagi/Runtime/Graphics/GpuImageView.hpp>
 #include <Usagi/Runtime/Graphics/GpuSamplerCreateInfo.hpp>
-#include <Usagi/Runtime/Memory/BitmapMemoryAllocator.hpp>
 #include <Usagi/Utility/Flag.hpp>
 #include <Usagi/Utility/TypeCast.hpp>
 #include <Usagi/Utility/String.hpp>
 
+#include "VulkanComputeCommandList.hpp"
 #include "VulkanFramebuffer.hpp"
 #include "VulkanGpuBuffer.hpp"
 #include "VulkanGpuCommandPool.hpp"
 #include "VulkanGpuImageView.hpp"
+#include "VulkanGpuProfiler.hpp"
 #include "VulkanGraphicsCommandList.hpp"
 #include "VulkanMemoryPool.hpp"
 #include "VulkanPooledImage.hpp"
@@ -22,10 +25,29 @@
 #include "VulkanEnumTranslation.hpp"
 #include "VulkanGraphicsPipelineCompiler.hpp"
 #include "VulkanHelper.hpp"
+#include "VulkanPhysicalDeviceSelector.hpp"
+#include "VulkanQueryManager.hpp"
 #include "VulkanRenderPass.hpp"
 
 using namespace usagi::vulkan;
 
+namespace usagi::vulkan
+{
+// defined in VulkanExtensions.cpp
+void loadDebugUtilsFunctions(VkInstance instance);
+void loadDrawIndirectCountFunctions(VkInstance instance);
+}
+
+bool usagi::VulkanGpuDevice::hasExtension(
+    const std::vector<vk::ExtensionProperties> &extensions,
+    const char *name)
+{
+    return std::any_of(extensions.begin(), extensions.end(),
+        [&](const vk::ExtensionProperties &e) {
+            return strcmp(e.extensionName, name) == 0;
+        });
+}
+
 VkBool32 usagi::VulkanGpuDevice::debugMessengerCallbackDispatcher(
     const VkDebugUtilsMessageSeverityFlagBitsEXT message_severity,
     const VkDebugUtilsMessageTypeFlagsEXT message_type,
@@ -133,6 +155,22 @@ uint32_t usagi::VulkanGpuDevice::selectQueue(
         "Could not find a queue family with required flags."));
 }
 
+uint32_t usagi::VulkanGpuDevice::findDedicatedQueue(
+    std::vector<vk::QueueFamilyProperties> &queue_family,
+    const vk::QueueFlags &queue_flags,
+    const vk::QueueFlags &excluded_flags)
+{
+    for(auto iter = queue_family.begin(); iter != queue_family.end(); ++iter)
+    {
+        if(utility::matchAllFlags(iter->queueFlags, queue_flags) &&
+            !(iter->queueFlags & excluded_flags))
+        {
+            return static_cast<uint32_t>(iter - queue_family.begin());
+        }
+    }
+    return -1;
+}
+
 void usagi::VulkanGpuDevice::createInstance()
 {
     LOG(info, "Creating Vulkan intance");
@@ -145,27 +183,23 @@ void usagi::VulkanGpuDevice::createInstance()
     application_info.setEngineVersion(VK_MAKE_VERSION(1, 0, 0));
     application_info.setApiVersion(VK_API_VERSION_1_0);
 
+    const bool validation =
+        mConfig.validation != VulkanValidationMode::DISABLED;
+    const bool verbose = mConfig.startup_log >= VulkanLogVerbosity::VERBOSE;
+
     // Extensions
+    const auto available_extensions =
+        vk::enumerateInstanceExtensionProperties();
+    if(verbose)
     {
         LOG(info, "Available instance extensions");
         LOG(info, "--------------------------------");
-        for(auto &&ext : vk::enumerateInstanceExtensionProperties())
+        for(auto &&ext : available_extensions)
         {
             LOG(info, ext.extensionName);
         }
         LOG(info, "--------------------------------");
     }
-    // Validation layers
-    {
-        LOG(info, "Available validation layers");
-        LOG(info, "--------------------------------");
-        for(auto &&layer : vk::enumerateInstanceLayerProperties())
-        {
-            LOG(info, "Name       : {}", layer.layerName);
-            LOG(info, "Description: {}", layer.description);
-            LOG(info, "--------------------------------");
-        }
-    }
 
     vk::InstanceCreateInfo instance_create_info;
     instance_create_info.setPApplicationInfo(&application_info);
@@ -174,36 +208,147 @@ void usagi::VulkanGpuDevice::createInstance()
     {
         // application window
         VK_KHR_SURFACE_EXTENSION_NAME,
-        // provide feedback from validation layer, etc.
-        VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
     };
     addPlatformSurfaceExtension(instance_extensions);
-    instance_create_info.setEnabledExtensionCount(
-        static_cast<uint32_t>(instance_extensions.size()));
-    instance_create_info.setPpEnabledExtensionNames(instance_extensions.data());
+    // provide feedback from validation layer, and name the objects for the
+    // debuggers
+    mDebugUtilsEnabled = (validation || mConfig.debug_labels) &&
+        hasExtension(available_extensions, VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+    if(mDebugUtilsEnabled)
+        instance_extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+    // required by VK_EXT_memory_budget on Vulkan 1.0
+    mPhysicalDeviceProperties2Enabled = hasExtension(available_extensions,
+        VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    if(mPhysicalDeviceProperties2Enabled)
+    {
+        instance_extensions.push_back(
+            VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    }
+#ifdef VK_KHR_external_memory_capabilities
+    // provides the device UUIDs used for selecting the physical device
+    mDeviceIdPropertiesEnabled = mPhysicalDeviceProperties2Enabled &&
+        hasExtension(available_extensions,
+            VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
+    if(mDeviceIdPropertiesEnabled)
+    {
+        instance_extensions.push_back(
+            VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
+    }
+#endif
 
-    // todo: enumerate layers first
-    // todo: disable in release
-    const std::vector<const char*> validation_layers
+    // Validation layers
+    std::vector<const char*> validation_layers;
+    if(validation)
     {
-        "VK_LAYER_LUNARG_standard_validation"
-    };
+        const auto available_layers = vk::enumerateInstanceLayerProperties();
+        if(verbose)
+        {
+            LOG(info, "Available validation layers");
+            LOG(info, "--------------------------------");
+            for(auto &&layer : available_layers)
+            {
+                LOG(info, "Name       : {}", layer.layerName);
+                LOG(info, "Description: {}", layer.description);
+                LOG(info, "--------------------------------");
+            }
+        }
+        // the latter is deprecated but used by older SDKs
+        for(auto &&name : {
+            "VK_LAYER_KHRONOS_validation",
+            "VK_LAYER_LUNARG_standard_validation"
+        })
+        {
+            const auto iter = std::find_if(
+                available_layers.begin(), available_layers.end(),
+                [&](const vk::LayerProperties &layer) {
+                    return strcmp(layer.layerName, name) == 0;
+                });
+            if(iter == available_layers.end()) continue;
+            validation_layers.push_back(name);
+            break;
+        }
+        if(validation_layers.empty())
+            LOG(warn, "Validation is requested but no layer is available.");
+        else
+            LOG(info, "Enabling validation layer {}", validation_layers[0]);
+    }
     instance_create_info.setEnabledLayerCount(
         static_cast<uint32_t>(validation_layers.size()));
     instance_create_info.setPpEnabledLayerNames(validation_layers.data());
 
+#ifdef VK_EXT_validation_features
+    // the extension is provided by the validation layer
+    std::vector<vk::ValidationFeatureEnableEXT> validation_features;
+    switch(mConfig.validation)
+    {
+        case VulkanValidationMode::GPU_ASSISTED:
+            validation_features.push_back(
+                vk::ValidationFeatureEnableEXT::eGpuAssisted);
+            validation_features.push_back(
+                vk::ValidationFeatureEnableEXT::eGpuAssistedReserveBindingSlot);
+            break;
+        case VulkanValidationMode::SYNCHRONIZATION:
+#if VK_EXT_VALIDATION_FEATURES_SPEC_VERSION >= 4
+            validation_features.push_back(
+                vk::ValidationFeatureEnableEXT::eSynchronizationValidation);
+#else
+            LOG(warn, "Synchronization validation is not supported by the "
+                "Vulkan headers.");
+#endif
+            break;
+        default: ;
+    }
+    vk::ValidationFeaturesEXT validation_features_info;
+    if(!validation_layers.empty() && !validation_features.empty())
+    {
+        const std::string layer_name = validation_layers[0];
+        if(!hasExtension(
+            vk::enumerateInstanceExtensionProperties(layer_name),
+            VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME))
+        {
+            // e.g. the deprecated layer or an old SDK
+            LOG(warn, "The validation layer {} doesn't provide {}, the "
+                "requested validation features are not enabled.",
+                layer_name, VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME);
+            validation_features.clear();
+        }
+    }
+    if(!validation_layers.empty() && !validation_features.empty())
+    {
+        instance_extensions.push_back(
+            VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME);
+        validation_features_info.setEnabledValidationFeatureCount(
+            static_cast<uint32_t>(validation_features.size()));
+        validation_features_info.setPEnabledValidationFeatures(
+            validation_features.data());
+        instance_create_info.setPNext(&validation_features_info);
+    }
+#endif
+
+    instance_create_info.setEnabledExtensionCount(
+        static_cast<uint32_t>(instance_extensions.size()));
+    instance_create_info.setPpEnabledExtensionNames(instance_extensions.data());
+
     mInstance = createInstanceUnique(instance_create_info);
+    if(mDebugUtilsEnabled)
+        loadDebugUtilsFunctions(mInstance.get());
 }
 
 void usagi::VulkanGpuDevice::createDebugReport()
 {
+    // no callback overhead when the validation is disabled
+    if(!mDebugUtilsEnabled ||
+        mConfig.validation == VulkanValidationMode::DISABLED)
+        return;
+
     vk::DebugUtilsMessengerCreateInfoEXT info;
     using Severity = vk::DebugUtilsMessageSeverityFlagBitsEXT;
     info.messageSeverity =
         // Severity::eVerbose |
-        Severity::eInfo |
         Severity::eWarning |
         Severity::eError;
+    if(mConfig.validation_info_messages)
+        info.messageSeverity |= Severity::eInfo;
     using Type = vk::DebugUtilsMessageTypeFlagBitsEXT;
     info.messageType =
         Type::eGeneral |
@@ -216,130 +361,288 @@ void usagi::VulkanGpuDevice::createDebugReport()
 
 void usagi::VulkanGpuDevice::selectPhysicalDevice()
 {
+    PFN_vkGetPhysicalDeviceProperties2KHR get_properties2 = nullptr;
+    if(mDeviceIdPropertiesEnabled)
     {
-        LOG(info, "Available physical devices");
-        LOG(info, "--------------------------------");
-        auto physical_devices = mInstance->enumeratePhysicalDevices();
-        for(auto &&dev : physical_devices)
-        {
-            const auto prop = dev.getProperties();
-            LOG(info, "Device Name   : {}", prop.deviceName);
-            LOG(info, "Device Type   : {}", to_string(prop.deviceType));
-            LOG(info, "Device ID     : {}", prop.deviceID);
-            LOG(info, "API Version   : {}", prop.apiVersion);
-            LOG(info, "Driver Version: {}", prop.vendorID);
-            LOG(info, "Vendor ID     : {}", prop.vendorID);
-            LOG(info, "--------------------------------");
-            // todo: select device based on features and score them / let the
-            // user choose
-            if(!mPhysicalDevice)
-                mPhysicalDevice = dev;
-            else if(prop.deviceType == vk::PhysicalDeviceType::eDiscreteGpu)
-                mPhysicalDevice = dev;
-        }
+        get_properties2 =
+            reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2KHR>(
+                mInstance->getProcAddr("vkGetPhysicalDeviceProperties2KHR"));
     }
-    if(!mPhysicalDevice)
-        USAGI_THROW(std::runtime_error("No available GPU supporting Vulkan."));
+
+    VulkanPhysicalDeviceSelector selector(
+        mInstance.get(), mConfig.physical_device, get_properties2);
+    mCapabilities = selector.select(
+        mConfig.startup_log >= VulkanLogVerbosity::VERBOSE);
+    mPhysicalDevice = mCapabilities->physicalDevice();
     LOG(info, "Using physical device: {}",
-        mPhysicalDevice.getProperties().deviceName);
+        mCapabilities->properties().deviceName);
 }
 
 void usagi::VulkanGpuDevice::createDeviceAndQueues()
 {
     LOG(info, "Creating device and queues");
 
-    auto queue_families = mPhysicalDevice.getQueueFamilyProperties();
-    LOG(info, "Supported queue families:");
-    for(std::size_t i = 0; i < queue_families.size(); ++i)
+    auto queue_families = mCapabilities->queueFamilies();
+    if(mConfig.startup_log >= VulkanLogVerbosity::VERBOSE)
     {
-        auto &qf = queue_families[i];
-        LOG(info, "#{}: {} * {}", i, to_string(qf.queueFlags), qf.queueCount);
+        LOG(info, "Supported queue families:");
+        for(std::size_t i = 0; i < queue_families.size(); ++i)
+        {
+            auto &qf = queue_families[i];
+            LOG(info, "#{}: {} * {}", i, to_string(qf.queueFlags),
+                qf.queueCount);
+        }
     }
 
     const auto graphics_queue_index = selectQueue(queue_families,
         vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eTransfer);
-    checkQueuePresentationCapacity(graphics_queue_index);
+    if(!mConfig.physical_device.headless)
+        checkQueuePresentationCapacity(graphics_queue_index);
 
     LOG(info, "Getting a queue from queue family {}.",
         graphics_queue_index);
 
+    // Dedicated transfer queues usually map to the DMA engines which can run
+    // in parallel with the graphics queue. Only use the ones that can copy
+    // arbitrary image regions since partial uploads are allowed.
+    auto transfer_queue_index = findDedicatedQueue(queue_families,
+        vk::QueueFlagBits::eTransfer,
+        vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute);
+    if(transfer_queue_index != -1)
+    {
+        const auto &granularity = queue_families[transfer_queue_index]
+            .minImageTransferGranularity;
+        if(granularity.width != 1 ||
+            granularity.height != 1 ||
+            granularity.depth != 1)
+        {
+            LOG(info, "Queue family {} has coarse image transfer granularity "
+                "and is not used for uploading.", transfer_queue_index);
+            transfer_queue_index = -1;
+        }
+    }
+    if(transfer_queue_index != -1)
+        LOG(info, "Getting a transfer queue from queue family {}.",
+            transfer_queue_index);
+    else
+        transfer_queue_index = graphics_queue_index;
+
+    // the compute queue families without graphics support usually map to
+    // the asynchronous compute engines.
+    auto compute_queue_index = mConfig.async_compute
+        ? findDedicatedQueue(queue_families,
+            vk::QueueFlagBits::eCompute, vk::QueueFlagBits::eGraphics)
+        : static_cast<uint32_t>(-1);
+    if(compute_queue_index != -1)
+        LOG(info, "Getting a compute queue from queue family {}.",
+            compute_queue_index);
+    else
+        compute_queue_index = graphics_queue_index;
+
     vk::DeviceCreateInfo device_create_info;
 
+    // only enable the optional features which are supported. the users
+    // check the enabled features to fall back.
+    const auto &supported_features = mCapabilities->supportedFeatures();
     vk::PhysicalDeviceFeatures features;
     device_create_info.setPEnabledFeatures(&features);
-    features.setFillModeNonSolid(true);
-    features.setLargePoints(true);
-    features.setWideLines(true);
-
-    vk::DeviceQueueCreateInfo queue_create_info[1];
+    features.setFillModeNonSolid(supported_features.fillModeNonSolid);
+    features.setLargePoints(supported_features.largePoints);
+    features.setWideLines(supported_features.wideLines);
+    features.setOcclusionQueryPrecise(
+        supported_features.occlusionQueryPrecise);
+    features.setPipelineStatisticsQuery(
+        supported_features.pipelineStatisticsQuery);
+    // multiple indirect draws are split into single ones if not supported
+    features.setMultiDrawIndirect(supported_features.multiDrawIndirect);
+    features.setDrawIndirectFirstInstance(
+        supported_features.drawIndirectFirstInstance);
+    // the compressed textures are loaded in the formats the device supports
+    features.setTextureCompressionBC(supported_features.textureCompressionBC);
+    features.setTextureCompressionETC2(
+        supported_features.textureCompressionETC2);
+    features.setTextureCompressionASTC_LDR(
+        supported_features.textureCompressionASTC_LDR);
+    if(!features.fillModeNonSolid)
+        LOG(warn, "fillModeNonSolid is not supported.");
+    if(!features.wideLines)
+        LOG(warn, "wideLines is not supported.");
+
+    vk::DeviceQueueCreateInfo queue_create_info[3];
+    uint32_t queue_create_info_count = 0;
     float queue_priority = 1;
-    queue_create_info[0].setQueueFamilyIndex(graphics_queue_index);
-    queue_create_info[0].setQueueCount(1);
-    queue_create_info[0].setPQueuePriorities(&queue_priority);
-    device_create_info.setQueueCreateInfoCount(1);
+    // the queues share the family if there is no dedicated one
+    const auto add_queue = [&](const uint32_t family) {
+        for(uint32_t i = 0; i < queue_create_info_count; ++i)
+            if(queue_create_info[i].queueFamilyIndex == family) return;
+        auto &info = queue_create_info[queue_create_info_count++];
+        info.setQueueFamilyIndex(family);
+        info.setQueueCount(1);
+        info.setPQueuePriorities(&queue_priority);
+    };
+    add_queue(graphics_queue_index);
+    add_queue(transfer_queue_index);
+    add_queue(compute_queue_index);
+    device_create_info.setQueueCreateInfoCount(queue_create_info_count);
     device_create_info.setPQueueCreateInfos(queue_create_info);
 
-    // todo: check device capacity
-    const std::vector<const char *> device_extensions
+    // the selector ensures the support unless rendering headless
+    std::vector<const char *> device_extensions;
+    if(mCapabilities->isExtensionSupported(VK_KHR_SWAPCHAIN_EXTENSION_NAME))
+        device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+#ifdef VK_EXT_memory_budget
+    mMemoryBudgetEnabled = mPhysicalDeviceProperties2Enabled &&
+        mCapabilities->isExtensionSupported(
+            VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if(mMemoryBudgetEnabled)
+        device_extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+#endif
+
+#ifdef VK_KHR_draw_indirect_count
+    // lets the culling on the GPU decide the number of draws
+    mDrawIndirectCountEnabled = mCapabilities->isExtensionSupported(
+        VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    if(mDrawIndirectCountEnabled)
     {
-        VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-    };
+        device_extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        loadDrawIndirectCountFunctions(mInstance.get());
+    }
+#endif
+
+#ifdef VK_KHR_timeline_semaphore
+    // the feature is required to be supported by the implementations
+    // exposing the extension, which depends on
+    // VK_KHR_get_physical_device_properties2.
+    vk::PhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features;
+    mTimelineSemaphoreEnabled = mPhysicalDeviceProperties2Enabled &&
+        mCapabilities->isExtensionSupported(
+            VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    if(mTimelineSemaphoreEnabled)
+    {
+        device_extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+        timeline_features.setTimelineSemaphore(true);
+        device_create_info.setPNext(&timeline_features);
+    }
+#endif
     device_create_info.setEnabledExtensionCount(static_cast<uint32_t>(
         device_extensions.size()));
     device_create_info.setPpEnabledExtensionNames(device_extensions.data());
 
     mDevice = mPhysicalDevice.createDeviceUnique(device_create_info);
+    mCapabilities->setEnabled(features, device_extensions);
 
     mGraphicsQueue = mDevice->getQueue(graphics_queue_index, 0);
     mGraphicsQueueFamilyIndex = graphics_queue_index;
+    mTransferQueue = mDevice->getQueue(transfer_queue_index, 0);
+    mTransferQueueFamilyIndex = transfer_queue_index;
+    mComputeQueue = mDevice->getQueue(compute_queue_index, 0);
+    mComputeQueueFamilyIndex = compute_queue_index;
+
+    setObjectName(vk::ObjectType::eQueue, handleValue(mGraphicsQueue),
+        "Graphics Queue");
+    if(hasDedicatedTransferQueue())
+    {
+        setObjectName(vk::ObjectType::eQueue, handleValue(mTransferQueue),
+            "Transfer Queue");
+    }
+    if(hasDedicatedComputeQueue())
+    {
+        setObjectName(vk::ObjectType::eQueue, handleValue(mComputeQueue),
+            "Compute Queue");
+    }
+}
+
+void usagi::VulkanGpuDevice::createPipelineCache()
+{
+    // todo from config
+    // the caches are only valid for the same kind of devices. separate files
+    // keep the devices on a multi-GPU machine from overwriting each other's.
+    const auto &prop = mCapabilities->properties();
+    mPipelineCache = std::make_unique<VulkanPipelineCache>(
+        mPhysicalDevice, mDevice.get(),
+        "vulkan_pipeline_cache_" + std::to_string(prop.vendorID) + "_" +
+        std::to_string(prop.deviceID) + ".bin");
+    mShaderReflectionCache = std::make_unique<VulkanShaderReflectionCache>();
+    mPipelineCompileQueue = std::make_unique<VulkanPipelineCompileQueue>();
 }
 
 void usagi::VulkanGpuDevice::createMemoryPools()
 {
-    const auto dyn_size = 1024 * 1024 * 64; // 64MiB  todo from config
-    const auto device_size = 1024 * 1024 * 512; // 512MiB  todo from config
-    LOG(info, "Allocating {} bytes for dynamic memory pool", dyn_size);
-    mDynamicBufferPool = std::make_unique<BitmapBufferPool>(
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR get_memory_properties2 =
+        nullptr;
+    if(mMemoryBudgetEnabled)
+    {
+        get_memory_properties2 =
+            reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(
+                mInstance->getProcAddr(
+                    "vkGetPhysicalDeviceMemoryProperties2KHR"));
+    }
+    LOG(info, "Tracking memory budget {}", get_memory_properties2
+        ? "using VK_EXT_memory_budget" : "by own allocations");
+    mMemoryBudget = std::make_unique<VulkanMemoryBudget>(
+        mPhysicalDevice, *mCapabilities, get_memory_properties2);
+
+    // the pools are made lazy so that no device memory is allocated before
+    // it is needed
+    const auto pool_config = [&](const char *name,
+        VulkanMemoryPoolConfig config) {
+        config.lazy = config.lazy || mConfig.fast_startup;
+        LOG(info, "Creating {} memory pool with {} bytes blocks using {} "
+            "allocator with {} bytes granularity{}", name, config.block_size,
+            to_string(config.allocator), config.granularity,
+            config.lazy ? ", allocated on first use" : "");
+        return std::move(config);
+    };
+
+    mDynamicBufferPool = std::make_unique<VulkanGrowableBufferPool>(
         this,
-        dyn_size,
+        "dynamic",
+        pool_config("dynamic", mConfig.dynamic_buffer_pool),
         vk::MemoryPropertyFlagBits::eHostVisible |
         vk::MemoryPropertyFlagBits::eHostCoherent,
+        // device-local host-visible memory (resizable BAR) spares the GPU
+        // from reading the buffers over the bus.
+        vk::MemoryPropertyFlagBits::eDeviceLocal,
         vk::BufferUsageFlagBits::eTransferSrc |
         vk::BufferUsageFlagBits::eVertexBuffer |
         vk::BufferUsageFlagBits::eIndexBuffer |
-        vk::BufferUsageFlagBits::eUniformBuffer,
-        [](const vk::MemoryRequirements &req) {
-            return std::make_unique<BitmapMemoryAllocator>(
-                nullptr,
-                req.size,
-                32 * 1024 /* 32 KiB */ // todo config
-            );
-        }
+        vk::BufferUsageFlagBits::eUniformBuffer |
+        vk::BufferUsageFlagBits::eStorageBuffer |
+        vk::BufferUsageFlagBits::eIndirectBuffer
     );
 
-    LOG(info, "Allocating {} bytes for device memory pool", device_size);
-    mDeviceImagePool = std::make_unique<BitmapImagePool>(
+    mDeviceBufferPool = std::make_unique<VulkanGrowableBufferPool>(
         this,
-        device_size,
+        "device buffer",
+        pool_config("device buffer", mConfig.device_buffer_pool),
         vk::MemoryPropertyFlagBits::eDeviceLocal,
+        { },
+        vk::BufferUsageFlagBits::eTransferDst |
+        vk::BufferUsageFlagBits::eVertexBuffer |
+        vk::BufferUsageFlagBits::eIndexBuffer |
+        vk::BufferUsageFlagBits::eUniformBuffer |
+        vk::BufferUsageFlagBits::eStorageBuffer |
+        vk::BufferUsageFlagBits::eIndirectBuffer
+    );
+
+    mDeviceImagePool = std::make_unique<VulkanGrowableImagePool>(
+        this,
+        "device",
+        pool_config("device", mConfig.device_image_pool),
+        vk::MemoryPropertyFlagBits::eDeviceLocal,
+        { },
+        vk::ImageUsageFlagBits::eTransferSrc |
         vk::ImageUsageFlagBits::eTransferDst |
-        vk::ImageUsageFlagBits::eSampled,
-        [](const vk::MemoryRequirements &req) {
-            return std::make_unique<BitmapMemoryAllocator>(
-                nullptr,
-                req.size,
-                32 * 1024 /* 32 KiB */ // todo config
-            );
-        }
+        vk::ImageUsageFlagBits::eSampled
     );
 
-    {
-        vk::CommandPoolCreateInfo info;
-        // todo use DMA queue
-        info.setQueueFamilyIndex(mGraphicsQueueFamilyIndex);
-        info.setFlags(vk::CommandPoolCreateFlagBits::eTransient);
-        mTransferCommandPool = mDevice->createCommandPoolUnique(info);
-    }
+    LOG(info, "Creating transient buffer with {} bytes per frame",
+        mConfig.transient_buffer_size);
+    mTransientBuffer = std::make_unique<VulkanTransientBuffer>(
+        this, mConfig.transient_buffer_size, framesInFlight());
+
+    mUploadQueue = std::make_unique<VulkanUploadQueue>(this);
 }
 
 void usagi::VulkanGpuDevice::createFallbackTexture()
@@ -348,17 +651,74 @@ void usagi::VulkanGpuDevice::createFallbackTexture()
     info.format = GpuBufferFormat::R8G8B8A8_UNORM;
     info.size = { 16, 16 };
     info.usage = GpuImageUsage::SAMPLED;
-    mFallbackTexture = createImage(info);
+    auto texture = createImage(info);
+
+    // magenta and black checkerboard. the upload is batched by the upload
+    // queue instead of waiting for the device.
+    std::vector<std::uint32_t> pixels(info.size.x() * info.size.y());
+    for(std::uint32_t y = 0; y < info.size.y(); ++y)
+    {
+        for(std::uint32_t x = 0; x < info.size.x(); ++x)
+        {
+            pixels[y * info.size.x() + x] =
+                (x / 4 + y / 4) % 2 ? 0xFF000000 : 0xFFFF00FF;
+        }
+    }
+    texture->upload(pixels.data(), pixels.size() * sizeof(std::uint32_t));
+    dynamic_cast_ref<VulkanGpuImage>(texture.get())
+        .setDebugName("Fallback Texture");
+
+    mFallbackTexture = std::move(texture);
 }
 
-usagi::VulkanGpuDevice::VulkanGpuDevice()
+usagi::VulkanGpuDevice::VulkanGpuDevice(VulkanGpuDeviceConfig config)
+    : mConfig(std::move(config))
 {
+    if(mConfig.frames_in_flight == 0)
+        USAGI_THROW(std::logic_error("At least one frame must be in flight."));
+
     createInstance();
     createDebugReport();
     selectPhysicalDevice();
     createDeviceAndQueues();
+    mSyncObjectPool = std::make_unique<VulkanSyncObjectPool>(mDevice.get());
+    mSubmissionTimeline = std::make_unique<VulkanSubmissionTimeline>(
+        mDevice.get(), mSyncObjectPool.get(), mTimelineSemaphoreEnabled);
+    if(hasDedicatedComputeQueue())
+    {
+        mComputeTimeline = std::make_unique<VulkanSubmissionTimeline>(
+            mDevice.get(), mSyncObjectPool.get(), mTimelineSemaphoreEnabled);
+    }
+    createPipelineCache();
+    mDescriptorSetCache = std::make_unique<VulkanDescriptorSetCache>(this);
+    mSamplerCache = std::make_unique<VulkanSamplerCache>(this);
+    mFramebufferCache = std::make_unique<VulkanFramebufferCache>(this);
+    mDescriptorPoolAllocator =
+        std::make_unique<VulkanDescriptorPoolAllocator>(this);
+    mLayoutRegistry = std::make_unique<VulkanLayoutRegistry>(this);
     createMemoryPools();
-    createFallbackTexture();
+    if(!mConfig.fast_startup)
+        createFallbackTexture();
+
+    for(std::size_t i = 0; i < framesInFlight(); ++i)
+        mFrames.push_back(std::make_unique<VulkanFrameContext>(this, i));
+
+    mQueryManager = std::make_unique<VulkanQueryManager>(
+        this, mConfig.queries);
+    if(mConfig.profiler.enabled)
+    {
+        if(mCapabilities->queueFamilies()[mGraphicsQueueFamilyIndex]
+            .timestampValidBits != 0)
+        {
+            mGpuProfiler = std::make_unique<VulkanGpuProfiler>(
+                this, mConfig.profiler);
+        }
+        else
+        {
+            LOG(warn, "The graphics queue doesn't support timestamps, "
+                "the GPU profiler is disabled.");
+        }
+    }
 }
 
 usagi::VulkanGpuDevice::~VulkanGpuDevice()
@@ -366,6 +726,10 @@ usagi::VulkanGpuDevice::~VulkanGpuDevice()
     // Wait till all operations are completed so it is safe to release the
     // resources.
     mDevice->waitIdle();
+
+    // wait for the running compilation jobs
+    mPipelineCompileQueue.reset();
+    mPipelineCache->save();
 }
 
 std::unique_ptr<usagi::GraphicsPipelineCompiler> usagi::VulkanGpuDevice::
@@ -374,18 +738,44 @@ std::unique_ptr<usagi::GraphicsPipelineCompiler> usagi::VulkanGpuDevice::
     return std::make_unique<VulkanGraphicsPipelineCompiler>(this);
 }
 
+std::unique_ptr<usagi::VulkanComputePipelineCompiler> usagi::VulkanGpuDevice::
+    createComputePipelineCompiler()
+{
+    return std::make_unique<VulkanComputePipelineCompiler>(this);
+}
+
 std::shared_ptr<usagi::GpuCommandPool>
     usagi::VulkanGpuDevice::createCommandPool()
 {
     return std::make_shared<VulkanGpuCommandPool>(this);
 }
 
+std::shared_ptr<usagi::VulkanGpuCommandPool>
+    usagi::VulkanGpuDevice::threadCommandPool()
+{
+    std::lock_guard<std::mutex> lock(mThreadCommandPoolsMutex);
+    auto &pool = mThreadCommandPools[std::this_thread::get_id()];
+    if(!pool)
+        pool = std::make_shared<VulkanGpuCommandPool>(this);
+    return pool;
+}
+
 std::shared_ptr<usagi::RenderPass> usagi::VulkanGpuDevice::createRenderPass(
     const RenderPassCreateInfo &info)
 {
     return std::make_shared<VulkanRenderPass>(this, info);
 }
 
+std::shared_ptr<usagi::VulkanRenderPass> usagi::VulkanGpuDevice::
+    createRenderPass(
+        const RenderPassCreateInfo &info,
+        const std::vector<VulkanSubpassInfo> &subpasses,
+        std::vector<vk::SubpassDependency> dependencies)
+{
+    return std::make_shared<VulkanRenderPass>(this, info, subpasses,
+        std::move(dependencies));
+}
+
 std::shared_ptr<usagi::Framebuffer> usagi::VulkanGpuDevice::createFramebuffer(
     const Vector2u32 &size,
     std::vector<std::shared_ptr<GpuImageView>> views)
@@ -399,26 +789,61 @@ std::shared_ptr<usagi::Framebuffer> usagi::VulkanGpuDevice::createFramebuffer(
     return std::make_shared<VulkanFramebuffer>(this, size, std::move(vk_views));
 }
 
-// todo sem pool
 std::shared_ptr<usagi::GpuSemaphore> usagi::VulkanGpuDevice::createSemaphore()
 {
-    auto sem = mDevice->createSemaphoreUnique(vk::SemaphoreCreateInfo { });
-    return std::make_unique<VulkanSemaphore>(std::move(sem));
+    return std::make_unique<VulkanSemaphore>(
+        mSyncObjectPool->acquireSemaphore(), mSyncObjectPool.get());
 }
 
 std::shared_ptr<usagi::GpuBuffer> usagi::VulkanGpuDevice::createBuffer(
     GpuBufferUsage usage)
 {
-    return std::make_shared<VulkanGpuBuffer>(mDynamicBufferPool.get(), usage);
+    switch(usage)
+    {
+        case GpuBufferUsage::VERTEX:
+            return createBuffer(usage, mConfig.vertex_buffer_placement);
+        case GpuBufferUsage::INDEX:
+            return createBuffer(usage, mConfig.index_buffer_placement);
+        case GpuBufferUsage::UNIFORM:
+            return createBuffer(usage, mConfig.uniform_buffer_placement);
+        default:
+            USAGI_THROW(std::runtime_error("Invalid GpuBufferUsage."));
+    }
+}
+
+std::shared_ptr<usagi::GpuBuffer> usagi::VulkanGpuDevice::createBuffer(
+    GpuBufferUsage usage,
+    const VulkanBufferPlacement placement)
+{
+    switch(placement)
+    {
+        case VulkanBufferPlacement::HOST_VISIBLE:
+            return std::make_shared<VulkanGpuBuffer>(
+                this, mDynamicBufferPool.get(), usage, placement);
+        case VulkanBufferPlacement::DEVICE_LOCAL:
+            return std::make_shared<VulkanGpuBuffer>(
+                this, mDeviceBufferPool.get(), usage, placement);
+        case VulkanBufferPlacement::TRANSIENT:
+            return std::make_shared<VulkanGpuBuffer>(
+                this, nullptr, usage, placement);
+        default:
+            USAGI_THROW(std::runtime_error("Invalid VulkanBufferPlacement."));
+    }
 }
 
 std::shared_ptr<usagi::GpuImage> usagi::VulkanGpuDevice::createImage(
     const GpuImageCreateInfo &info)
 {
-    // todo check format availability
     return mDeviceImagePool->createPooledImage(info);
 }
 
+std::shared_ptr<usagi::VulkanPooledImage> usagi::VulkanGpuDevice::createImage(
+    const GpuImageCreateInfo &info,
+    const VulkanImageCreateInfo &vk_info)
+{
+    return mDeviceImagePool->createPooledImage(info, vk_info);
+}
+
 std::shared_ptr<usagi::GpuSampler> usagi::VulkanGpuDevice::createSampler(
     const GpuSamplerCreateInfo &info)
 {
@@ -428,15 +853,20 @@ std::shared_ptr<usagi::GpuSampler> usagi::VulkanGpuDevice::createSampler(
     vk_info.setMipmapMode(vk::SamplerMipmapMode::eLinear);
     vk_info.setAddressModeU(translate(info.addressing_mode_u));
     vk_info.setAddressModeV(translate(info.addressing_mode_v));
+    // sample all the mips of the textures with mip chains
+    vk_info.setMaxLod(VK_LOD_CLAMP_NONE);
     // todo sampler setBorderColor
     // vk_info.setBorderColor({ });
-    return std::make_shared<VulkanSampler>(
-        mDevice->createSamplerUnique(vk_info));
+    return mSamplerCache->acquire(vk_info);
 }
 
 std::shared_ptr<usagi::GpuImage>
 usagi::VulkanGpuDevice::fallbackTexture() const
 {
+    // never null. the creation may be deferred by fast_startup.
+    std::lock_guard<std::mutex> lock(mFallbackTextureMutex);
+    if(!mFallbackTexture)
+        const_cast<VulkanGpuDevice *>(this)->createFallbackTexture();
     return mFallbackTexture;
 }
 
@@ -446,9 +876,12 @@ void usagi::VulkanGpuDevice::submitGraphicsJobs(
     std::initializer_list<GraphicsPipelineStage> wait_stages,
     std::initializer_list<std::shared_ptr<GpuSemaphore>> signal_semaphores)
 {
-    const auto vk_jobs = transformObjects(jobs, [&](auto &&j) {
+    auto vk_jobs = transformObjects(jobs, [&](auto &&j) {
         return dynamic_cast_ref<VulkanGraphicsCommandList>(j).commandBuffer();
     });
+    // the queries used by the jobs must be reset before them
+    if(const auto reset = mQueryManager->takeResetCommands())
+        vk_jobs.insert(vk_jobs.begin(), reset);
     const auto vk_wait_sems = transformObjects(wait_semaphores,
         [&](auto &&s) {
             return dynamic_cast_ref<VulkanSemaphore>(s).semaphore();
@@ -466,8 +899,9 @@ void usagi::VulkanGpuDevice::submitGraphicsJobs(
         }
     );
 
-    BatchResourceList batch_resources;
-    batch_resources.fence = mDevice->createFenceUnique(vk::FenceCreateInfo { });
+    // the jobs may use the resources being uploaded
+    mUploadQueue->flush();
+    mTransientBuffer->flush();
 
     vk::SubmitInfo info;
     info.setCommandBufferCount(static_cast<uint32_t>(vk_jobs.size()));
@@ -478,10 +912,11 @@ void usagi::VulkanGpuDevice::submitGraphicsJobs(
     info.setPSignalSemaphores(vk_signal_sems.data());
     info.setPWaitDstStageMask(vk_wait_stages.data());
 
+    std::vector<std::shared_ptr<VulkanBatchResource>> resources;
     const auto cast_append = [&](auto &&container) {
         std::transform(
             container.begin(), container.end(),
-            std::back_inserter(batch_resources.resources),
+            std::back_inserter(resources),
             [&](auto &&j) {
                 return dynamic_pointer_cast_throw<VulkanBatchResource>(j);
             }
@@ -491,24 +926,133 @@ void usagi::VulkanGpuDevice::submitGraphicsJobs(
     cast_append(wait_semaphores);
     cast_append(signal_semaphores);
 
-    mGraphicsQueue.submit({ info }, batch_resources.fence.get());
+    submitBatch(mGraphicsQueue, info, std::move(resources));
+}
+
+void usagi::VulkanGpuDevice::submitComputeJobs(
+    const std::vector<std::shared_ptr<VulkanComputeCommandList>> &jobs,
+    std::initializer_list<std::shared_ptr<GpuSemaphore>> wait_semaphores,
+    std::initializer_list<vk::PipelineStageFlags> wait_stages,
+    std::initializer_list<std::shared_ptr<GpuSemaphore>> signal_semaphores)
+{
+    assert(wait_semaphores.size() == wait_stages.size());
+
+    const auto vk_jobs = transformObjects(jobs, [&](auto &&j) {
+        return j->commandBuffer();
+    });
+    auto vk_wait_sems = transformObjects(wait_semaphores,
+        [&](auto &&s) {
+            return dynamic_cast_ref<VulkanSemaphore>(s).semaphore();
+        }
+    );
+    std::vector<vk::PipelineStageFlags> vk_wait_stages = wait_stages;
+    const auto vk_signal_sems = transformObjects(signal_semaphores,
+        [&](auto &&s) {
+            return dynamic_cast_ref<VulkanSemaphore>(s).semaphore();
+        }
+    );
+
+    // the jobs may use the resources being uploaded
+    mUploadQueue->flush();
+    mTransientBuffer->flush();
+
+    // the uploads are submitted to the graphics queue. a dedicated compute
+    // queue waits on a semaphore signaled by an empty batch after them.
+    std::vector<std::shared_ptr<VulkanBatchResource>> upload_resources;
+    const auto upload_serial = mUploadQueue->lastSerial();
+    if(hasDedicatedComputeQueue() && upload_serial > mComputeUploadSerial &&
+        !mSubmissionTimeline->isComplete(upload_serial))
+    {
+        auto sem = std::static_pointer_cast<VulkanSemaphore>(
+            createSemaphore());
+        const auto vk_sem = sem->semaphore();
+        vk::SubmitInfo signal_info;
+        signal_info.setSignalSemaphoreCount(1);
+        signal_info.setPSignalSemaphores(&vk_sem);
+        submitBatch(mGraphicsQueue, signal_info, { sem });
+
+        vk_wait_sems.push_back(vk_sem);
+        vk_wait_stages.push_back(vk::PipelineStageFlagBits::eAllCommands);
+        upload_resources.push_back(std::move(sem));
+        mComputeUploadSerial = upload_serial;
+    }
+
+    vk::SubmitInfo info;
+    info.setCommandBufferCount(static_cast<uint32_t>(vk_jobs.size()));
+    info.setPCommandBuffers(vk_jobs.data());
+    info.setWaitSemaphoreCount(static_cast<uint32_t>(vk_wait_sems.size()));
+    info.setPWaitSemaphores(vk_wait_sems.data());
+    info.setSignalSemaphoreCount(static_cast<uint32_t>(vk_signal_sems.size()));
+    info.setPSignalSemaphores(vk_signal_sems.data());
+    info.setPWaitDstStageMask(vk_wait_stages.data());
+
+    std::vector<std::shared_ptr<VulkanBatchResource>> resources(
+        jobs.begin(), jobs.end());
+    const auto cast_append = [&](auto &&container) {
+        std::transform(
+            container.begin(), container.end(),
+            std::back_inserter(resources),
+            [&](auto &&j) {
+                return dynamic_pointer_cast_throw<VulkanBatchResource>(j);
+            }
+        );
+    };
+    cast_append(wait_semaphores);
+    cast_append(signal_semaphores);
+    resources.insert(resources.end(),
+        upload_resources.begin(), upload_resources.end());
+
+    if(!hasDedicatedComputeQueue())
+    {
+        submitBatch(mGraphicsQueue, info, std::move(resources));
+        return;
+    }
+
+    BatchResourceList batch_resources;
+    batch_resources.serial = mComputeTimeline->submit(mComputeQueue, info);
+    batch_resources.resources = std::move(resources);
+    mComputeBatchResourceLists.push_back(std::move(batch_resources));
+}
+
+usagi::VulkanSubmissionTimeline::Serial usagi::VulkanGpuDevice::submitBatch(
+    const vk::Queue queue,
+    const vk::SubmitInfo &info,
+    std::vector<std::shared_ptr<VulkanBatchResource>> resources)
+{
+    assert(queue == mGraphicsQueue);
+
+    BatchResourceList batch_resources;
+    batch_resources.serial = mSubmissionTimeline->submit(queue, info);
+    batch_resources.resources = std::move(resources);
+    const auto serial = batch_resources.serial;
 
     mBatchResourceLists.push_back(std::move(batch_resources));
+
+    return serial;
 }
 
 void usagi::VulkanGpuDevice::reclaimResources()
 {
-    for(auto i = mBatchResourceLists.begin(); i != mBatchResourceLists.end();)
+    // the batches complete in submission order
+    const auto completed = mSubmissionTimeline->poll();
+    while(!mBatchResourceLists.empty() &&
+        mBatchResourceLists.front().serial <= completed)
     {
-        if(mDevice->getFenceStatus(i->fence.get()) == vk::Result::eSuccess)
-            i = mBatchResourceLists.erase(i);
-        else
-            ++i;
+        mBatchResourceLists.pop_front();
+    }
+
+    if(!mComputeTimeline) return;
+    const auto compute_completed = mComputeTimeline->poll();
+    while(!mComputeBatchResourceLists.empty() &&
+        mComputeBatchResourceLists.front().serial <= compute_completed)
+    {
+        mComputeBatchResourceLists.pop_front();
     }
 }
 
 void usagi::VulkanGpuDevice::waitIdle()
 {
+    mUploadQueue->flush();
     mDevice->waitIdle();
 }
 
@@ -517,6 +1061,74 @@ uint32_t usagi::VulkanGpuDevice::graphicsQueueFamily() const
     return mGraphicsQueueFamilyIndex;
 }
 
+usagi::VulkanSubAllocatorStatistics
+usagi::VulkanGpuDevice::dynamicBufferPoolStatistics() const
+{
+    return mDynamicBufferPool->statistics();
+}
+
+usagi::VulkanSubAllocatorStatistics
+usagi::VulkanGpuDevice::deviceBufferPoolStatistics() const
+{
+    return mDeviceBufferPool->statistics();
+}
+
+usagi::VulkanSubAllocatorStatistics
+usagi::VulkanGpuDevice::deviceImagePoolStatistics() const
+{
+    return mDeviceImagePool->statistics();
+}
+
+usagi::VulkanMemoryBudget * usagi::VulkanGpuDevice::memoryBudget() const
+{
+    return mMemoryBudget.get();
+}
+
+usagi::VulkanTransientBuffer * usagi::VulkanGpuDevice::transientBuffer() const
+{
+    return mTransientBuffer.get();
+}
+
+uint32_t usagi::VulkanGpuDevice::transferQueueFamily() const
+{
+    return mTransferQueueFamilyIndex;
+}
+
+bool usagi::VulkanGpuDevice::hasDedicatedTransferQueue() const
+{
+    return mTransferQueueFamilyIndex != mGraphicsQueueFamilyIndex;
+}
+
+vk::Queue usagi::VulkanGpuDevice::transferQueue() const
+{
+    return mTransferQueue;
+}
+
+uint32_t usagi::VulkanGpuDevice::computeQueueFamily() const
+{
+    return mComputeQueueFamilyIndex;
+}
+
+bool usagi::VulkanGpuDevice::hasDedicatedComputeQueue() const
+{
+    return mComputeQueueFamilyIndex != mGraphicsQueueFamilyIndex;
+}
+
+bool usagi::VulkanGpuDevice::sharesImagesConcurrently() const
+{
+    return hasDedicatedComputeQueue();
+}
+
+vk::Queue usagi::VulkanGpuDevice::computeQueue() const
+{
+    return mComputeQueue;
+}
+
+vk::Queue usagi::VulkanGpuDevice::graphicsQueue() const
+{
+    return mGraphicsQueue;
+}
+
 vk::Queue usagi::VulkanGpuDevice::presentQueue() const
 {
     return mGraphicsQueue;
@@ -532,89 +1144,219 @@ vk::PhysicalDevice usagi::VulkanGpuDevice::physicalDevice() const
     return mPhysicalDevice;
 }
 
+const usagi::VulkanDeviceCapabilities *
+    usagi::VulkanGpuDevice::capabilities() const
+{
+    return mCapabilities.get();
+}
+
+usagi::VulkanDescriptorSetCache *
+usagi::VulkanGpuDevice::descriptorSetCache() const
+{
+    return mDescriptorSetCache.get();
+}
+
+usagi::VulkanFramebufferCache *
+usagi::VulkanGpuDevice::framebufferCache() const
+{
+    return mFramebufferCache.get();
+}
+
+usagi::VulkanSamplerCache * usagi::VulkanGpuDevice::samplerCache() const
+{
+    return mSamplerCache.get();
+}
+
+void usagi::VulkanGpuDevice::setObjectName(
+    const vk::ObjectType type,
+    const std::uint64_t handle,
+    const char *name) const
+{
+    if(!mDebugUtilsEnabled) return;
+
+    vk::DebugUtilsObjectNameInfoEXT info;
+    info.setObjectType(type);
+    info.setObjectHandle(handle);
+    info.setPObjectName(name);
+    mDevice->setDebugUtilsObjectNameEXT(info);
+}
+
+usagi::VulkanGpuProfiler * usagi::VulkanGpuDevice::gpuProfiler() const
+{
+    return mGpuProfiler.get();
+}
+
+usagi::VulkanQueryManager * usagi::VulkanGpuDevice::queryManager() const
+{
+    return mQueryManager.get();
+}
+
+usagi::VulkanDescriptorPoolAllocator *
+usagi::VulkanGpuDevice::descriptorPoolAllocator() const
+{
+    return mDescriptorPoolAllocator.get();
+}
+
+usagi::VulkanSyncObjectPool * usagi::VulkanGpuDevice::syncObjectPool() const
+{
+    return mSyncObjectPool.get();
+}
+
+usagi::VulkanSubmissionTimeline *
+usagi::VulkanGpuDevice::submissionTimeline() const
+{
+    return mSubmissionTimeline.get();
+}
+
+usagi::VulkanSubmissionTimeline *
+usagi::VulkanGpuDevice::computeTimeline() const
+{
+    return mComputeTimeline.get();
+}
+
+usagi::VulkanLayoutRegistry * usagi::VulkanGpuDevice::layoutRegistry() const
+{
+    return mLayoutRegistry.get();
+}
+
+vk::PipelineCache usagi::VulkanGpuDevice::pipelineCache() const
+{
+    return mPipelineCache->cache();
+}
+
+usagi::VulkanPipelineCompileQueue *
+usagi::VulkanGpuDevice::pipelineCompileQueue() const
+{
+    return mPipelineCompileQueue.get();
+}
+
+usagi::VulkanShaderReflectionCache *
+usagi::VulkanGpuDevice::shaderReflectionCache() const
+{
+    return mShaderReflectionCache.get();
+}
+
+bool usagi::VulkanGpuDevice::savePipelineCache() const
+{
+    return mPipelineCache->save();
+}
+
 std::shared_ptr<usagi::VulkanBufferAllocation>
 usagi::VulkanGpuDevice::allocateStageBuffer(std::size_t size)
 {
-    return mDynamicBufferPool->allocate(size);
+    try
+    {
+        return mDynamicBufferPool->allocate(size);
+    }
+    catch(const std::bad_alloc &)
+    {
+        // the staging buffers of pending uploads are only released after
+        // being copied, so submit them and wait for the space.
+        LOG(warn, "Staging memory is exhausted, waiting for pending uploads.");
+        waitIdle();
+        reclaimResources();
+        return mDynamicBufferPool->allocate(size);
+    }
 }
 
-void usagi::VulkanGpuDevice::copyBufferToImage(
+usagi::VulkanUploadQueue::Token usagi::VulkanGpuDevice::copyBufferToImage(
     const std::shared_ptr<VulkanBufferAllocation> &buffer,
     VulkanGpuImage *image,
     const Vector2i &offset,
-    const Vector2u32 &size)
-{
-    vk::UniqueCommandBuffer cmd;
-    {
-        vk::CommandBufferAllocateInfo info;
-        info.setCommandBufferCount(1);
-        info.setCommandPool(mTransferCommandPool.get());
-        info.setLevel(vk::CommandBufferLevel::ePrimary);
-
-        cmd = std::move(mDevice->allocateCommandBuffersUnique(info).front());
-    }
-    {
-        vk::CommandBufferBeginInfo info;
-        info.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
-        cmd->begin(info);
-    }
-    vk::ImageSubresourceRange range;
-    range.setAspectMask(vk::ImageAspectFlagBits::eColor);
-    range.setBaseArrayLayer(0);
-    range.setLayerCount(1);
-    range.setBaseMipLevel(0);
-    range.setLevelCount(1);
-    {
-        vk::ImageMemoryBarrier barrier;
-        barrier.setImage(image->image());
-        barrier.setOldLayout(vk::ImageLayout::eUndefined);
-        barrier.setNewLayout(vk::ImageLayout::eTransferDstOptimal);
-        barrier.setSrcQueueFamilyIndex(mGraphicsQueueFamilyIndex);
-        barrier.setDstQueueFamilyIndex(mGraphicsQueueFamilyIndex);
-        barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferRead);
-        barrier.setDstAccessMask(vk::AccessFlagBits::eTransferWrite);
-        barrier.setSubresourceRange(range);
-        cmd->pipelineBarrier(
-            vk::PipelineStageFlagBits::eTransfer,
-            vk::PipelineStageFlagBits::eTransfer,
-            { }, { }, { }, { barrier });
-    }
-    {
-        vk::BufferImageCopy copy;
-        copy.setImageExtent({ size.x(), size.y(), 1 });
-        copy.setImageOffset({ offset.x(), offset.y(), 0 });
-        copy.setBufferOffset(buffer->offset());
-        copy.imageSubresource.setAspectMask(vk::ImageAspectFlagBits::eColor);
-        copy.imageSubresource.setLayerCount(1);
-        copy.imageSubresource.setBaseArrayLayer(0);
-        copy.imageSubresource.setMipLevel(0);
-        cmd->copyBufferToImage(
-            buffer->pool()->buffer(), image->image(),
-            vk::ImageLayout::eTransferDstOptimal, { copy });
-    }
-    {
-        vk::ImageMemoryBarrier barrier;
-        barrier.setImage(image->image());
-        barrier.setOldLayout(vk::ImageLayout::eTransferDstOptimal);
-        barrier.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
-        barrier.setSrcQueueFamilyIndex(mGraphicsQueueFamilyIndex);
-        barrier.setDstQueueFamilyIndex(mGraphicsQueueFamilyIndex);
-        barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
-        barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-        barrier.setSubresourceRange(range);
-        cmd->pipelineBarrier(
-            vk::PipelineStageFlagBits::eTransfer,
-            vk::PipelineStageFlagBits::eFragmentShader,
-            { }, { }, { }, { barrier });
-    }
-    cmd->end();
-    {
-        vk::SubmitInfo info;
-        const auto cmd_handle = cmd.get();
-        info.setCommandBufferCount(1);
-        info.setPCommandBuffers(&cmd_handle);
-        mGraphicsQueue.submit({ info }, { });
-    }
-    // todo batch uploads & manage dependencies
-    mDevice->waitIdle();
+    const Vector2u32 &size,
+    const std::uint32_t mip,
+    const std::uint32_t layer)
+{
+    return mUploadQueue->copyBufferToImage(
+        buffer, image, offset, size, mip, layer);
+}
+
+usagi::VulkanUploadQueue::Token usagi::VulkanGpuDevice::copyBufferToImage(
+    const std::shared_ptr<VulkanBufferAllocation> &buffer,
+    VulkanGpuImage *image,
+    const vk::BufferImageCopy &region)
+{
+    return mUploadQueue->copyBufferToImage(buffer, image, region);
+}
+
+usagi::VulkanUploadQueue::Token usagi::VulkanGpuDevice::streamToImage(
+    VulkanGpuImage *image,
+    const std::uint32_t mip,
+    const std::uint32_t layer,
+    const VulkanUploadReader &reader)
+{
+    return mUploadQueue->streamToImage(image, mip, layer, reader);
+}
+
+usagi::VulkanUploadQueue::Token usagi::VulkanGpuDevice::copyImage(
+    VulkanGpuImage *src,
+    const std::uint32_t src_mip,
+    VulkanGpuImage *dst,
+    const std::uint32_t dst_mip)
+{
+    return mUploadQueue->copyImage(src, src_mip, dst, dst_mip);
+}
+
+usagi::VulkanUploadQueue::Token usagi::VulkanGpuDevice::generateMipmaps(
+    VulkanGpuImage *image,
+    const std::uint32_t base_mip)
+{
+    return mUploadQueue->generateMipmaps(image, base_mip);
+}
+
+usagi::VulkanUploadQueue::Token usagi::VulkanGpuDevice::copyBuffer(
+    const std::shared_ptr<VulkanBufferAllocation> &src,
+    const std::shared_ptr<VulkanBufferAllocation> &dst)
+{
+    return mUploadQueue->copyBuffer(src, dst);
+}
+
+void usagi::VulkanGpuDevice::flushUploads()
+{
+    mUploadQueue->flush();
+}
+
+usagi::VulkanFrameContext * usagi::VulkanGpuDevice::beginFrame()
+{
+    if(const auto frame = currentFrame())
+        frame->end();
+
+    ++mFrameNumber;
+    auto &frame = *mFrames[mFrameNumber % framesInFlight()];
+    frame.begin(mFrameNumber);
+    mTransientBuffer->beginFrame(frame.index());
+    // create the texture deferred by fast_startup if not used yet
+    fallbackTexture();
+    // the batches of the frame which the context was used for are completed
+    reclaimResources();
+    if(mGpuProfiler)
+        mGpuProfiler->beginFrame(frame.index(), mFrameNumber);
+    mQueryManager->beginFrame(frame.index(), mFrameNumber);
+    mMemoryBudget->update();
+    mDynamicBufferPool->releaseEmptyBlocks(mFrameNumber);
+    mDeviceBufferPool->releaseEmptyBlocks(mFrameNumber);
+    mDeviceImagePool->releaseEmptyBlocks(mFrameNumber);
+    mDescriptorSetCache->beginFrame(mFrameNumber);
+
+    return &frame;
+}
+
+usagi::VulkanFrameContext * usagi::VulkanGpuDevice::currentFrame() const
+{
+    if(mFrameNumber == 0) return nullptr;
+    return mFrames[mFrameNumber % framesInFlight()].get();
+}
+
+void usagi::VulkanGpuDevice::retireSwapchain(
+    const std::shared_ptr<VulkanSwapchainHandle> &swapchain)
+{
+    // each context releases its reference after waiting for its frame
+    for(auto &&frame : mFrames)
+        frame->retireSwapchain(swapchain);
+}
+
+bool usagi::VulkanGpuDevice::isUploadComplete(
+    const VulkanUploadQueue::Token token) const
+{
+    return mUploadQueue->isComplete(token);
 }
@@ -1,35 +1,93 @@
 ﻿#pragma once
 
 #include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #include <vulkan/vulkan.hpp>
 
 #include <Usagi/Runtime/Graphics/GpuDevice.hpp>
 
-#include "VulkanMemoryPool.hpp"
+#include "VulkanComputePipelineCompiler.hpp"
+#include "VulkanDescriptorPoolAllocator.hpp"
+#include "VulkanDescriptorSetCache.hpp"
+#include "VulkanDeviceCapabilities.hpp"
+#include "VulkanFrameContext.hpp"
+#include "VulkanFramebufferCache.hpp"
+#include "VulkanGpuDeviceConfig.hpp"
+#include "VulkanLayoutRegistry.hpp"
+#include "VulkanMemoryBudget.hpp"
+#include "VulkanGrowableMemoryPool.hpp"
+#include "VulkanPipelineCache.hpp"
+#include "VulkanPipelineCompileQueue.hpp"
+#include "VulkanSamplerCache.hpp"
+#include "VulkanShaderReflection.hpp"
+#include "VulkanSubmissionTimeline.hpp"
+#include "VulkanSyncObjectPool.hpp"
+#include "VulkanTransientBuffer.hpp"
+#include "VulkanUploadQueue.hpp"
 
 namespace usagi
 {
-class BitmapMemoryAllocator;
 class VulkanMemoryPool;
 class VulkanBatchResource;
+class VulkanComputeCommandList;
+class VulkanGpuCommandPool;
+class VulkanRenderPass;
+class VulkanGpuProfiler;
+class VulkanQueryManager;
+struct VulkanSubpassInfo;
+struct VulkanSwapchainHandle;
 
 class VulkanGpuDevice : public GpuDevice
 {
+    const VulkanGpuDeviceConfig mConfig;
+
     vk::UniqueInstance mInstance;
     vk::UniqueDebugUtilsMessengerEXT mDebugUtilsMessenger;
     vk::PhysicalDevice mPhysicalDevice;
+    std::unique_ptr<VulkanDeviceCapabilities> mCapabilities;
     vk::UniqueDevice mDevice;
 
     static void addPlatformSurfaceExtension(
         std::vector<const char *> & extensions);
+    static bool hasExtension(
+        const std::vector<vk::ExtensionProperties> &extensions,
+        const char *name);
+    // VK_EXT_debug_utils is enabled on the instance for validation or the
+    // debug labels
+    bool mDebugUtilsEnabled = false;
+    // VK_KHR_get_physical_device_properties2 is enabled on the instance
+    bool mPhysicalDeviceProperties2Enabled = false;
+    // VK_KHR_external_memory_capabilities is enabled on the instance
+    bool mDeviceIdPropertiesEnabled = false;
+    // VK_EXT_memory_budget is enabled on the device
+    bool mMemoryBudgetEnabled = false;
+    // VK_KHR_draw_indirect_count is enabled on the device
+    bool mDrawIndirectCountEnabled = false;
 
     vk::Queue mGraphicsQueue;
     std::uint32_t mGraphicsQueueFamilyIndex = -1;
+    // same as the graphics queue if there is no dedicated transfer queue
+    vk::Queue mTransferQueue;
+    std::uint32_t mTransferQueueFamilyIndex = -1;
+    // same as the graphics queue if there is no dedicated compute queue
+    vk::Queue mComputeQueue;
+    std::uint32_t mComputeQueueFamilyIndex = -1;
 
     static uint32_t selectQueue(
         std::vector<vk::QueueFamilyProperties> &queue_family,
         const vk::QueueFlags &queue_flags);
+    /**
+     * \brief Find a queue family supporting the required flags but none of
+     * the excluded ones.
+     * \return The index of the queue family, or -1 if none is found.
+     */
+    static uint32_t findDedicatedQueue(
+        std::vector<vk::QueueFamilyProperties> &queue_family,
+        const vk::QueueFlags &queue_flags,
+        const vk::QueueFlags &excluded_flags);
     void checkQueuePresentationCapacity(uint32_t queue_family_index) const;
 
     static VKAPI_ATTR VkBool32 VKAPI_CALL debugMessengerCallbackDispatcher(
@@ -48,56 +106,169 @@ class VulkanGpuDevice : public GpuDevice
     void selectPhysicalDevice();
     void createDeviceAndQueues();
 
+    // Pipelines
+
+    /**
+     * \brief Shared by all pipeline compilers and saved when the device is
+     * destroyed.
+     */
+    std::unique_ptr<VulkanPipelineCache> mPipelineCache;
+    void createPipelineCache();
+    std::unique_ptr<VulkanShaderReflectionCache> mShaderReflectionCache;
+    // destroyed before the pipeline cache is saved
+    std::unique_ptr<VulkanPipelineCompileQueue> mPipelineCompileQueue;
+
+    // Descriptor Sets
+
+    // must outlive the resources which may be referenced by the cached sets
+    std::unique_ptr<VulkanDescriptorSetCache> mDescriptorSetCache;
+    // must outlive the set layouts holding immutable samplers
+    std::unique_ptr<VulkanSamplerCache> mSamplerCache;
+    // same for the views of the cached framebuffers
+    std::unique_ptr<VulkanFramebufferCache> mFramebufferCache;
+    // must outlive the command lists
+    std::unique_ptr<VulkanDescriptorPoolAllocator> mDescriptorPoolAllocator;
+    // shares the descriptor set layouts and pipeline layouts among pipelines
+    std::unique_ptr<VulkanLayoutRegistry> mLayoutRegistry;
+
+    // Synchronization
+
+    // must outlive the objects returning semaphores and fences to it
+    std::unique_ptr<VulkanSyncObjectPool> mSyncObjectPool;
+    // VK_KHR_timeline_semaphore is enabled on the device
+    bool mTimelineSemaphoreEnabled = false;
+    /**
+     * \brief Serializes the batches submitted to the graphics queue.
+     */
+    std::unique_ptr<VulkanSubmissionTimeline> mSubmissionTimeline;
+    /**
+     * \brief Serializes the batches submitted to the dedicated compute queue.
+     * Null if the compute jobs are submitted to the graphics queue.
+     */
+    std::unique_ptr<VulkanSubmissionTimeline> mComputeTimeline;
+
     // Memory Management
 
-    using BitmapBufferPool = VulkanBufferMemoryPool<BitmapMemoryAllocator>;
+    // must outlive the memory pools
+    std::unique_ptr<VulkanMemoryBudget> mMemoryBudget;
+
     /**
      * \brief Used for per-frame updated buffers and resource staging.
      */
-    std::unique_ptr<BitmapBufferPool> mDynamicBufferPool;
-
-    using BitmapImagePool = VulkanImageMemoryPool<BitmapMemoryAllocator>;
+    std::unique_ptr<VulkanGrowableBufferPool> mDynamicBufferPool;
+    /**
+     * \brief Used for static buffers filled through staging.
+     */
+    std::unique_ptr<VulkanGrowableBufferPool> mDeviceBufferPool;
     /**
      * \brief Used for device-local textures.
      */
-    std::unique_ptr<BitmapImagePool> mDeviceImagePool;
-
-    vk::UniqueCommandPool mTransferCommandPool;
+    std::unique_ptr<VulkanGrowableImagePool> mDeviceImagePool;
+    std::unique_ptr<VulkanTransientBuffer> mTransientBuffer;
 
     void createMemoryPools();
 
-    std::shared_ptr<GpuImage> mFallbackTexture;
+    /**
+     * \brief Batches the uploads from the staging buffers. Pending copies are
+     * submitted before graphics jobs.
+     */
+    std::unique_ptr<VulkanUploadQueue> mUploadQueue;
+    // the last upload batch waited on by the dedicated compute queue
+    VulkanSubmissionTimeline::Serial mComputeUploadSerial = 0;
+
+    // deferred to the first use or frame with fast_startup. changed by
+    // fallbackTexture(), which is const to the users of the device.
+    mutable std::mutex mFallbackTextureMutex;
+    mutable std::shared_ptr<GpuImage> mFallbackTexture;
     void createFallbackTexture();
 
+    // Frames
+
+    std::vector<std::unique_ptr<VulkanFrameContext>> mFrames;
+    // 0 before the first frame begins
+    std::uint64_t mFrameNumber = 0;
+    // null if disabled
+    std::unique_ptr<VulkanGpuProfiler> mGpuProfiler;
+    std::unique_ptr<VulkanQueryManager> mQueryManager;
+
+    std::mutex mThreadCommandPoolsMutex;
+    std::unordered_map<std::thread::id,
+        std::shared_ptr<VulkanGpuCommandPool>> mThreadCommandPools;
+
     // Resource Tracking
 
     struct BatchResourceList
     {
-        vk::UniqueFence fence;
+        VulkanSubmissionTimeline::Serial serial;
         std::vector<std::shared_ptr<VulkanBatchResource>> resources;
     };
     // must be the first to be destructed in dtor since it may refer to other
-    // members.
+    // members. ordered by serial.
     std::deque<BatchResourceList> mBatchResourceLists;
+    // the batches submitted to the dedicated compute queue
+    std::deque<BatchResourceList> mComputeBatchResourceLists;
+
+    friend class VulkanUploadQueue;
+    friend class VulkanGpuProfiler;
+
+    /**
+     * \brief Submit the work to the queue and keep the resources alive till
+     * the GPU finishes executing it. The queue must be the graphics queue
+     * since the batches are tracked on a single timeline.
+     */
+    VulkanSubmissionTimeline::Serial submitBatch(
+        vk::Queue queue,
+        const vk::SubmitInfo &info,
+        std::vector<std::shared_ptr<VulkanBatchResource>> resources);
 
 public:
-    VulkanGpuDevice();
+    explicit VulkanGpuDevice(VulkanGpuDeviceConfig config = { });
     ~VulkanGpuDevice();
 
     std::unique_ptr<GraphicsPipelineCompiler> createPipelineCompiler() override;
+    std::unique_ptr<VulkanComputePipelineCompiler>
+        createComputePipelineCompiler();
     std::shared_ptr<Swapchain> createSwapchain(Window *window) override;
     std::shared_ptr<GpuCommandPool> createCommandPool() override;
+    /**
+     * \brief The command pool of the calling thread, created on first use.
+     * Used for recording command lists on multiple threads.
+     */
+    std::shared_ptr<VulkanGpuCommandPool> threadCommandPool();
     std::shared_ptr<RenderPass> createRenderPass(
         const RenderPassCreateInfo &info) override;
+    /**
+     * \brief Create a render pass with multiple subpasses. See
+     * VulkanRenderPass.
+     */
+    std::shared_ptr<VulkanRenderPass> createRenderPass(
+        const RenderPassCreateInfo &info,
+        const std::vector<VulkanSubpassInfo> &subpasses,
+        std::vector<vk::SubpassDependency> dependencies = { });
     std::shared_ptr<Framebuffer> createFramebuffer(
         const Vector2u32 &size,
         std::vector<std::shared_ptr<GpuImageView>> views) override;
     std::shared_ptr<GpuSemaphore> createSemaphore() override;
     std::shared_ptr<GpuBuffer> createBuffer(GpuBufferUsage usage) override;
+    std::shared_ptr<GpuBuffer> createBuffer(
+        GpuBufferUsage usage,
+        VulkanBufferPlacement placement);
     std::shared_ptr<GpuImage> createImage(const GpuImageCreateInfo &info)
         override;
+    /**
+     * \brief Create an image in a format not expressible by GpuBufferFormat,
+     * such as a block-compressed one, or with multiple array layers.
+     * info.format is ignored if vk_info has a format.
+     */
+    std::shared_ptr<VulkanPooledImage> createImage(
+        const GpuImageCreateInfo &info,
+        const VulkanImageCreateInfo &vk_info);
     std::shared_ptr<GpuSampler> createSampler(const GpuSamplerCreateInfo &info)
         override;
+    /**
+     * \brief Never null. Created by the first call if fast_startup deferred
+     * it and no frame has begun.
+     */
     std::shared_ptr<GpuImage> fallbackTexture() const override;
 
     void submitGraphicsJobs(
@@ -106,23 +277,190 @@ public:
         std::initializer_list<GraphicsPipelineStage> wait_stages,
         std::initializer_list<std::shared_ptr<GpuSemaphore>> signal_semaphores
     ) override;
+    /**
+     * \brief Submit the compute jobs to the compute queue. If it is a
+     * dedicated one, the jobs may overlap with the graphics jobs, and the
+     * order between them is only given by the semaphores. The uploads are
+     * only ordered with the graphics queue, so the compute jobs using newly
+     * uploaded resources should wait for a graphics job submitted after the
+     * uploads.
+     */
+    void submitComputeJobs(
+        const std::vector<std::shared_ptr<VulkanComputeCommandList>> &jobs,
+        std::initializer_list<std::shared_ptr<GpuSemaphore>> wait_semaphores,
+        std::initializer_list<vk::PipelineStageFlags> wait_stages,
+        std::initializer_list<std::shared_ptr<GpuSemaphore>> signal_semaphores
+    );
 
     void reclaimResources() override;
     void waitIdle() override;
 
     vk::Device device() const;
     vk::PhysicalDevice physicalDevice() const;
+    /**
+     * \brief The properties, limits, and format support of the physical
+     * device, and the features and extensions enabled on the device.
+     */
+    const VulkanDeviceCapabilities * capabilities() const;
+    VulkanDescriptorSetCache * descriptorSetCache() const;
+    VulkanFramebufferCache * framebufferCache() const;
+    VulkanSamplerCache * samplerCache() const;
+    VulkanDescriptorPoolAllocator * descriptorPoolAllocator() const;
+    VulkanSyncObjectPool * syncObjectPool() const;
+    /**
+     * \brief The serials of the batches submitted to the graphics queue. Can
+     * be used to check whether the GPU has finished some work.
+     */
+    VulkanSubmissionTimeline * submissionTimeline() const;
+    /**
+     * \brief The serials of the batches submitted to the dedicated compute
+     * queue, or nullptr if there is none.
+     */
+    VulkanSubmissionTimeline * computeTimeline() const;
+    vk::PipelineCache pipelineCache() const;
+    VulkanLayoutRegistry * layoutRegistry() const;
+    VulkanPipelineCompileQueue * pipelineCompileQueue() const;
+    VulkanShaderReflectionCache * shaderReflectionCache() const;
+    /**
+     * \brief Write the pipeline cache to disk without waiting for the device
+     * to be destroyed.
+     */
+    bool savePipelineCache() const;
     uint32_t graphicsQueueFamily() const;
+    const VulkanGpuDeviceConfig & config() const { return mConfig; }
+    /**
+     * \brief Whether the objects can be named and the commands labelled for
+     * the debuggers and profilers.
+     */
+    bool debugUtilsEnabled() const { return mDebugUtilsEnabled; }
+    /**
+     * \brief Whether the number of indirect draws can be read from a buffer.
+     */
+    bool drawIndirectCountEnabled() const
+    {
+        return mDrawIndirectCountEnabled;
+    }
+    /**
+     * \brief Name the object in the validation messages and the captures of
+     * the graphics debuggers. Does nothing if debug utils are disabled.
+     * \param handle The value of the handle, see vulkan::handleValue().
+     */
+    void setObjectName(
+        vk::ObjectType type,
+        std::uint64_t handle,
+        const char *name) const;
+    /**
+     * \brief The number of frames the CPU may record ahead of the GPU.
+     */
+    std::size_t framesInFlight() const { return mConfig.frames_in_flight; }
+    /**
+     * \brief The timestamp profiler, or nullptr if it is disabled or the
+     * graphics queue doesn't support timestamps.
+     */
+    VulkanGpuProfiler * gpuProfiler() const;
+    /**
+     * \brief The occlusion and pipeline statistics queries.
+     */
+    VulkanQueryManager * queryManager() const;
+    VulkanSubAllocatorStatistics dynamicBufferPoolStatistics() const;
+    VulkanSubAllocatorStatistics deviceBufferPoolStatistics() const;
+    VulkanSubAllocatorStatistics deviceImagePoolStatistics() const;
+    /**
+     * \brief The budgets of the memory heaps, updated every frame. Streaming
+     * should check the available space before uploading more resources.
+     */
+    VulkanMemoryBudget * memoryBudget() const;
+    /**
+     * \brief Bump allocator for the data only used during the current frame.
+     */
+    VulkanTransientBuffer * transientBuffer() const;
+    uint32_t transferQueueFamily() const;
+    bool hasDedicatedTransferQueue() const;
+    uint32_t computeQueueFamily() const;
+    bool hasDedicatedComputeQueue() const;
+    /**
+     * \brief Whether the pooled images are created with concurrent sharing
+     * among the graphics queue family and the dedicated ones, which is the
+     * case when the compute jobs use them on a dedicated compute queue.
+     */
+    bool sharesImagesConcurrently() const;
 
+    vk::Queue graphicsQueue() const;
+    vk::Queue transferQueue() const;
+    vk::Queue computeQueue() const;
     vk::Queue presentQueue() const;
 
     std::shared_ptr<VulkanBufferAllocation> allocateStageBuffer(
         std::size_t size);
-    void copyBufferToImage(
+    /**
+     * \brief Queue a copy from the staging buffer to a mip level of the
+     * image. The copy is submitted along with the next graphics jobs or
+     * flushUploads().
+     */
+    VulkanUploadQueue::Token copyBufferToImage(
         const std::shared_ptr<VulkanBufferAllocation> &buffer,
         VulkanGpuImage *image,
         const Vector2i &offset,
-        const Vector2u32 &size
+        const Vector2u32 &size,
+        std::uint32_t mip = 0,
+        std::uint32_t layer = 0
     );
+    VulkanUploadQueue::Token copyBufferToImage(
+        const std::shared_ptr<VulkanBufferAllocation> &buffer,
+        VulkanGpuImage *image,
+        const vk::BufferImageCopy &region);
+    /**
+     * \brief Upload a mip level of a layer from the reader in chunks. See
+     * VulkanUploadQueue::streamToImage().
+     */
+    VulkanUploadQueue::Token streamToImage(
+        VulkanGpuImage *image,
+        std::uint32_t mip,
+        std::uint32_t layer,
+        const VulkanUploadReader &reader);
+    /**
+     * \brief Queue a copy of a mip level between images. See
+     * VulkanUploadQueue::copyImage().
+     */
+    VulkanUploadQueue::Token copyImage(
+        VulkanGpuImage *src,
+        std::uint32_t src_mip,
+        VulkanGpuImage *dst,
+        std::uint32_t dst_mip);
+    /**
+     * \brief Queue blits filling the mip levels after the base one.
+     */
+    VulkanUploadQueue::Token generateMipmaps(
+        VulkanGpuImage *image,
+        std::uint32_t base_mip = 0);
+    /**
+     * \brief Queue a copy from the staging buffer to a device-local buffer.
+     */
+    VulkanUploadQueue::Token copyBuffer(
+        const std::shared_ptr<VulkanBufferAllocation> &src,
+        const std::shared_ptr<VulkanBufferAllocation> &dst);
+    void flushUploads();
+    bool isUploadComplete(VulkanUploadQueue::Token token) const;
+
+    /**
+     * \brief End the current frame and begin the next one. Blocks if the CPU
+     * is framesInFlight() frames ahead of the GPU. The command lists
+     * allocated during a frame and the objects acquired from its context are
+     * recycled when the context is reused. The command lists must be
+     * submitted during the frame since the resources used by them are only
+     * kept alive until the frame is completed.
+     */
+    VulkanFrameContext * beginFrame();
+    /**
+     * \return The context of the current frame, or nullptr if no frame has
+     * begun.
+     */
+    VulkanFrameContext * currentFrame() const;
+    /**
+     * \brief Keep a swapchain replaced by recreation alive until all the
+     * frames in flight, which may have presented from it, are completed.
+     */
+    void retireSwapchain(
+        const std::shared_ptr<VulkanSwapchainHandle> &swapchain);
 };
 }
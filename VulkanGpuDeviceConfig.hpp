@@ -0,0 +1,245 @@
+﻿#pragma once
+
+#include <string>
+
+#include "VulkanSubAllocator.hpp"
+
+namespace usagi
+{
+enum class VulkanValidationMode
+{
+    /**
+     * \brief No validation layer and no debug messenger.
+     */
+    DISABLED,
+    STANDARD,
+    /**
+     * \brief Also instruments the shaders to check the descriptor accesses
+     * on the GPU. Much slower.
+     */
+    GPU_ASSISTED,
+    /**
+     * \brief Also checks the hazards between commands caused by missing or
+     * wrong barriers.
+     */
+    SYNCHRONIZATION,
+};
+
+enum class VulkanLogVerbosity
+{
+    NORMAL,
+    /**
+     * \brief Also logs the enumerated instance extensions, layers, physical
+     * devices and queue families.
+     */
+    VERBOSE,
+};
+
+/**
+ * \brief Overrides the automatic selection of the physical device. The first
+ * of the index, the UUID, and the name which is given and matches a suitable
+ * device is used. Otherwise the device with the highest score is selected.
+ */
+struct VulkanPhysicalDevicePreference
+{
+    // the index in the enumeration order of the driver, -1 if not used
+    int index = -1;
+    // the hex digits of the device UUID, the dashes are ignored. only
+    // available with VK_KHR_external_memory_capabilities.
+    std::string uuid;
+    // a case-insensitive substring of the device name
+    std::string name;
+    // prefer the integrated GPUs to the discrete ones, e.g. to save power
+    bool prefer_integrated = false;
+    // don't require presentation support, for headless rendering
+    bool headless = false;
+};
+
+enum class VulkanBufferPlacement
+{
+    /**
+     * \brief Written by the host directly. Suits data updated every frame.
+     */
+    HOST_VISIBLE,
+    /**
+     * \brief Written through a staging buffer and copied by the upload
+     * queue. Suits static data. The whole content must be rewritten before
+     * each flush.
+     */
+    DEVICE_LOCAL,
+    /**
+     * \brief Bump-allocated from the transient buffer. The allocation is only
+     * valid during the current frame, so allocate() must be called again
+     * each frame before writing. Suits per-draw data.
+     */
+    TRANSIENT,
+};
+
+enum class VulkanPresentMode
+{
+    /**
+     * \brief Present without waiting for the vertical blank. The lowest
+     * latency, but tears.
+     */
+    IMMEDIATE,
+    /**
+     * \brief Replace the image waiting for the vertical blank with the newer
+     * one. Low latency without tearing, but renders frames never shown.
+     */
+    MAILBOX,
+    /**
+     * \brief Queue the images and present one per vertical blank. Always
+     * supported, the highest latency.
+     */
+    FIFO,
+    /**
+     * \brief Same as FIFO, but present immediately if the image is late for
+     * the vertical blank, which may tear.
+     */
+    FIFO_RELAXED,
+};
+
+struct VulkanSwapchainConfig
+{
+    // falls back to FIFO if not supported by the surface
+    VulkanPresentMode present_mode = VulkanPresentMode::MAILBOX;
+    // 0 uses one more than the minimum with mailbox for triple buffering and
+    // the minimum otherwise. clamped to the limits of the surface.
+    std::uint32_t image_count = 0;
+};
+
+struct VulkanGpuProfilerConfig
+{
+    // measure the GPU time of the command lists with timestamp queries
+    bool enabled = false;
+    // the scopes beyond this number in a frame are not measured
+    std::uint32_t max_scopes_per_frame = 512;
+    // the oldest timings are dropped if not cleared
+    std::size_t max_kept_timings = 64 * 1024;
+};
+
+struct VulkanQueryConfig
+{
+    // the queries beyond these numbers in a frame are not recorded. 0
+    // disables the type.
+    std::uint32_t max_occlusion_queries_per_frame = 1024;
+    std::uint32_t max_statistics_queries_per_frame = 64;
+    // the oldest results of each type are dropped if not taken
+    std::size_t max_kept_results = 64 * 1024;
+};
+
+struct VulkanGpuDeviceConfig
+{
+    // validation roughly halves the CPU throughput so it is off in release
+    // builds by default
+#ifdef NDEBUG
+    VulkanValidationMode validation = VulkanValidationMode::DISABLED;
+#else
+    VulkanValidationMode validation = VulkanValidationMode::STANDARD;
+#endif
+    // also report the informational messages of the validation layer
+    bool validation_info_messages = false;
+    /**
+     * \brief Enable VK_EXT_debug_utils without validation so that the object
+     * names and the command labels show up in the captures of RenderDoc,
+     * Nsight, RGP, etc. Always enabled along with validation. Defining
+     * USAGI_VULKAN_NO_DEBUG_LABELS removes the labels from the command lists
+     * at compile time.
+     */
+#ifdef NDEBUG
+    bool debug_labels = false;
+#else
+    bool debug_labels = true;
+#endif
+
+#ifdef NDEBUG
+    VulkanLogVerbosity startup_log = VulkanLogVerbosity::NORMAL;
+#else
+    VulkanLogVerbosity startup_log = VulkanLogVerbosity::VERBOSE;
+#endif
+    /**
+     * \brief Shorten the time to the first frame. The memory pools allocate
+     * their first blocks on the first use, and the fallback texture is
+     * created when the first frame begins, along with the other uploads of
+     * the frame.
+     */
+    bool fast_startup = false;
+
+    VulkanPhysicalDevicePreference physical_device;
+
+    VulkanSwapchainConfig swapchain;
+    /**
+     * \brief The number of frames the CPU may record ahead of the GPU. Fewer
+     * frames lower the input latency, more frames absorb the spikes of the
+     * CPU time.
+     */
+    std::size_t frames_in_flight = 2;
+    /**
+     * \brief Submit the compute jobs to a queue family without graphics
+     * support if the device has one, so that they may run alongside the
+     * graphics jobs. Otherwise they are submitted to the graphics queue.
+     */
+    bool async_compute = true;
+
+    VulkanGpuProfilerConfig profiler;
+    VulkanQueryConfig queries;
+
+    /**
+     * \brief Host-visible memory for per-frame updated buffers and resource
+     * staging. Mostly small allocations.
+     */
+    VulkanMemoryPoolConfig dynamic_buffer_pool
+    {
+        1024 * 1024 * 32, // 32 MiB
+        VulkanSubAllocatorType::TLSF,
+        256,
+    };
+
+    /**
+     * \brief Device-local memory for static vertex, index and uniform
+     * buffers.
+     */
+    VulkanMemoryPoolConfig device_buffer_pool
+    {
+        1024 * 1024 * 64, // 64 MiB
+        VulkanSubAllocatorType::TLSF,
+        256,
+    };
+
+    /**
+     * \brief The placement of the buffers created by createBuffer() by their
+     * usages.
+     */
+    VulkanBufferPlacement vertex_buffer_placement =
+        VulkanBufferPlacement::DEVICE_LOCAL;
+    VulkanBufferPlacement index_buffer_placement =
+        VulkanBufferPlacement::DEVICE_LOCAL;
+    // uniform buffers are usually updated every frame
+    VulkanBufferPlacement uniform_buffer_placement =
+        VulkanBufferPlacement::HOST_VISIBLE;
+
+    /**
+     * \brief The size of the transient buffer region of each frame in
+     * flight.
+     */
+    std::size_t transient_buffer_size = 1024 * 1024 * 4; // 4 MiB
+
+    /**
+     * \brief The size of the staging chunks which streamed uploads read into,
+     * and the staging memory they may occupy before waiting for the GPU to
+     * copy the earlier chunks.
+     */
+    std::size_t upload_chunk_size = 1024 * 1024 * 4; // 4 MiB
+    std::size_t max_streaming_staging_size = 1024 * 1024 * 32; // 32 MiB
+
+    /**
+     * \brief Device-local memory for textures.
+     */
+    VulkanMemoryPoolConfig device_image_pool
+    {
+        1024 * 1024 * 128, // 128 MiB
+        VulkanSubAllocatorType::TLSF,
+        4 * 1024, // 4 KiB
+    };
+};
+}
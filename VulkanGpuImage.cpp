@@ -3,14 +3,16 @@
 #include <Usagi/Runtime/Graphics/GpuImageViewCreateInfo.hpp>
 
 #include "VulkanEnumTranslation.hpp"
+#include "VulkanGpuDevice.hpp"
 #include "VulkanGpuImageView.hpp"
+#include "VulkanHelper.hpp"
 
 using namespace usagi::vulkan;
 
 vk::ImageAspectFlags usagi::VulkanGpuImage::getAspectsFromFormat() const
 {
     vk::ImageAspectFlags aspects;
-    switch(translate(mFormat.format)) {
+    switch(mImageFormat) {
         case vk::Format::eD16Unorm:
         case vk::Format::eD32Sfloat:
             aspects = vk::ImageAspectFlagBits::eDepth;
@@ -28,34 +30,64 @@ vk::ImageAspectFlags usagi::VulkanGpuImage::getAspectsFromFormat() const
     return aspects;
 }
 
+vk::ImageViewType usagi::VulkanGpuImage::viewType() const
+{
+    return mArrayLayers > 1
+        ? vk::ImageViewType::e2DArray
+        : vk::ImageViewType::e2D;
+}
+
+vk::ImageSubresourceRange usagi::VulkanGpuImage::fullRange() const
+{
+    vk::ImageSubresourceRange range;
+    range.setAspectMask(getAspectsFromFormat());
+    range.setBaseArrayLayer(0);
+    range.setLayerCount(mArrayLayers);
+    range.setBaseMipLevel(0);
+    range.setLevelCount(mMipLevels);
+    return range;
+}
+
 void usagi::VulkanGpuImage::createBaseView()
 {
     vk::ImageViewCreateInfo info;
     info.setImage(image());
-    info.setViewType(vk::ImageViewType::e2D);
-    info.setFormat(translate(mFormat.format));
+    info.setViewType(viewType());
+    info.setFormat(mImageFormat);
     info.setComponents(vk::ComponentMapping { });
-    vk::ImageSubresourceRange subresource_range;
-    subresource_range.setAspectMask(getAspectsFromFormat());
-    subresource_range.setBaseArrayLayer(0);
-    subresource_range.setLayerCount(1);
-    subresource_range.setBaseMipLevel(0);
-    subresource_range.setLevelCount(1);
-    info.setSubresourceRange(subresource_range);
+    info.setSubresourceRange(fullRange());
 
     mBaseView = std::make_shared<VulkanGpuImageView>(
-        this, mDevice.createImageViewUnique(info));
+        this, mDevice->device().createImageViewUnique(info));
 }
 
 usagi::VulkanGpuImage::VulkanGpuImage(
     GpuImageFormat format,
     const Vector2u32 &size,
-    vk::Device vk_device)
+    VulkanGpuDevice *device,
+    const std::uint32_t mip_levels,
+    const std::uint32_t array_layers,
+    const vk::Format image_format)
     : GpuImage(format, size)
-    , mDevice(vk_device)
+    , mDevice(device)
+    , mMipLevels(mip_levels)
+    , mArrayLayers(array_layers)
+    , mImageFormat(image_format == vk::Format::eUndefined
+        ? translate(format.format) : image_format)
+    , mSubresourceStates(mip_levels * array_layers)
 {
 }
 
+void usagi::VulkanGpuImage::setDebugName(const char *name)
+{
+    mDevice->setObjectName(vk::ObjectType::eImage, handleValue(image()), name);
+    if(mBaseView)
+    {
+        mDevice->setObjectName(vk::ObjectType::eImageView,
+            handleValue(mBaseView->view()), name);
+    }
+}
+
 std::shared_ptr<usagi::GpuImageView> usagi::VulkanGpuImage::baseView()
 {
     return mBaseView;
@@ -66,20 +98,14 @@ std::shared_ptr<usagi::GpuImageView> usagi::VulkanGpuImage::createView(
 {
     vk::ImageViewCreateInfo vk_info;
     vk_info.setImage(image());
-    vk_info.setViewType(vk::ImageViewType::e2D);
-    vk_info.setFormat(translate(mFormat.format));
+    vk_info.setViewType(viewType());
+    vk_info.setFormat(mImageFormat);
     vk_info.components.r = translate(info.components.r);
     vk_info.components.g = translate(info.components.g);
     vk_info.components.b = translate(info.components.b);
     vk_info.components.a = translate(info.components.a);
-    vk::ImageSubresourceRange subresource_range;
-    subresource_range.setAspectMask(getAspectsFromFormat());
-    subresource_range.setBaseArrayLayer(0);
-    subresource_range.setLayerCount(1);
-    subresource_range.setBaseMipLevel(0);
-    subresource_range.setLevelCount(1);
-    vk_info.setSubresourceRange(subresource_range);
+    vk_info.setSubresourceRange(fullRange());
 
     return std::make_shared<VulkanGpuImageView>(
-        this, mDevice.createImageViewUnique(vk_info));
+        this, mDevice->device().createImageViewUnique(vk_info));
 }
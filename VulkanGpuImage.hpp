@@ -1,5 +1,7 @@
 ﻿#pragma once
 
+#include <vector>
+
 #include <vulkan/vulkan.hpp>
 
 #include <Usagi/Runtime/Graphics/GpuImage.hpp>
@@ -9,6 +11,23 @@
 namespace usagi
 {
 class VulkanGpuImageView;
+class VulkanGpuDevice;
+
+/**
+ * \brief The layout of an image subresource and the last accesses which the
+ * later ones must be synchronized with, as recorded into the command lists.
+ */
+struct VulkanImageSubresourceState
+{
+    vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+    // the destination of the last barrier, or the stages which wrote the
+    // subresource without one. empty if never accessed.
+    vk::PipelineStageFlags stages;
+    // the writes not made available yet
+    vk::AccessFlags access;
+    // the stages which may read the subresource without another barrier
+    vk::PipelineStageFlags read_stages;
+};
 
 class VulkanGpuImage
     : public GpuImage
@@ -16,22 +35,60 @@ class VulkanGpuImage
     , public std::enable_shared_from_this<VulkanGpuImage>
 {
 protected:
-    vk::Device mDevice;
+    VulkanGpuDevice *mDevice = nullptr;
     std::shared_ptr<VulkanGpuImageView> mBaseView;
+    const std::uint32_t mMipLevels;
+    const std::uint32_t mArrayLayers;
+    // may be a format which GpuBufferFormat can't express, such as the
+    // block-compressed ones
+    const vk::Format mImageFormat;
+    // indexed by layer * mMipLevels + mip. the states are assumed to be
+    // changed in the order of submission, so command lists using the same
+    // image should be submitted in the order they are recorded.
+    std::vector<VulkanImageSubresourceState> mSubresourceStates;
 
     vk::ImageAspectFlags getAspectsFromFormat() const;
+    vk::ImageViewType viewType() const;
+    /**
+     * \brief All the mip levels and layers. Framebuffer attachments need
+     * views of a single mip level, so render targets are created without
+     * mip chains.
+     */
+    vk::ImageSubresourceRange fullRange() const;
     virtual void createBaseView();
 
 public:
     VulkanGpuImage(
         GpuImageFormat format,
         const Vector2u32 &size,
-        vk::Device vk_device);
+        VulkanGpuDevice *device,
+        std::uint32_t mip_levels = 1,
+        std::uint32_t array_layers = 1,
+        vk::Format image_format = vk::Format::eUndefined);
 
     std::shared_ptr<GpuImageView> baseView() override;
     std::shared_ptr<GpuImageView> createView(
         const GpuImageViewCreateInfo &info) override;
 
     virtual vk::Image image() const = 0;
+
+    /**
+     * \brief Name the image and its base view for the debuggers. Does
+     * nothing if debug utils are disabled.
+     */
+    void setDebugName(const char *name);
+
+    VulkanGpuDevice * device() const { return mDevice; }
+    vk::Format imageFormat() const { return mImageFormat; }
+    vk::ImageAspectFlags aspects() const { return getAspectsFromFormat(); }
+    std::uint32_t mipLevels() const { return mMipLevels; }
+    std::uint32_t arrayLayers() const { return mArrayLayers; }
+
+    VulkanImageSubresourceState & subresourceState(
+        const std::uint32_t mip,
+        const std::uint32_t layer)
+    {
+        return mSubresourceStates[layer * mMipLevels + mip];
+    }
 };
 }
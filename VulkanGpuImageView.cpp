@@ -3,6 +3,9 @@
 #include <Usagi/Core/Exception.hpp>
 
 #include "VulkanGpuImage.hpp"
+#include "VulkanGpuDevice.hpp"
+#include "VulkanHelper.hpp"
+#include "VulkanResourceTracker.hpp"
 
 usagi::VulkanGpuImageView::VulkanGpuImageView(
     VulkanGpuImage *image,
@@ -12,6 +15,13 @@ usagi::VulkanGpuImageView::VulkanGpuImageView(
 {
 }
 
+usagi::VulkanGpuImageView::~VulkanGpuImageView()
+{
+    const auto handle = vulkan::handleValue(mImageView.get());
+    mImage->device()->descriptorSetCache()->evict(handle);
+    mImage->device()->framebufferCache()->evict(handle);
+}
+
 void usagi::VulkanGpuImageView::fillShaderResourceInfo(
     vk::WriteDescriptorSet &write,
     VulkanResourceInfo &info)
@@ -22,6 +32,9 @@ void usagi::VulkanGpuImageView::fillShaderResourceInfo(
         case vk::DescriptorType::eSampledImage:
             image_info.setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
             break;
+        case vk::DescriptorType::eStorageImage:
+            image_info.setImageLayout(vk::ImageLayout::eGeneral);
+            break;
         default:
             USAGI_THROW(std::runtime_error("Unsupported image usage."));
     }
@@ -29,8 +42,9 @@ void usagi::VulkanGpuImageView::fillShaderResourceInfo(
     write.setPImageInfo(&image_info);
 }
 
-void usagi::VulkanGpuImageView::appendAdditionalResources(
-    std::vector<std::shared_ptr<usagi::VulkanBatchResource>> &resources)
+void usagi::VulkanGpuImageView::trackAdditionalResources(
+    VulkanResourceTracker &tracker)
 {
-    resources.push_back(mImage->shared_from_this());
+    if(tracker.needsReference(*mImage))
+        tracker.retain(mImage->shared_from_this());
 }
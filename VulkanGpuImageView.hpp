@@ -23,12 +23,13 @@ public:
     VulkanGpuImageView(
         VulkanGpuImage *image,
         vk::UniqueImageView vk_image_view);
+    ~VulkanGpuImageView();
 
     void fillShaderResourceInfo(
         vk::WriteDescriptorSet &write,
         VulkanResourceInfo &info) override;
-    void appendAdditionalResources(
-        std::vector<std::shared_ptr<VulkanBatchResource>> &resources) override;
+    VulkanBatchResource & batchResource() override { return *this; }
+    void trackAdditionalResources(VulkanResourceTracker &tracker) override;
 
     vk::ImageView view() const { return mImageView.get(); }
     VulkanGpuImage * image() const { return mImage; }
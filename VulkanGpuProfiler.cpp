@@ -0,0 +1,295 @@
+﻿#include "VulkanGpuProfiler.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <ostream>
+
+#include <Usagi/Core/Logging.hpp>
+
+#include "VulkanGpuDevice.hpp"
+
+namespace
+{
+double cpuTimeUs()
+{
+    using namespace std::chrono;
+    return duration<double, std::micro>(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+void writeJsonString(std::ostream &out, const std::string &str)
+{
+    out << '"';
+    for(auto &&c : str)
+    {
+        switch(c)
+        {
+            case '"': out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            default:
+                if(static_cast<unsigned char>(c) >= 0x20) out << c;
+        }
+    }
+    out << '"';
+}
+}
+
+usagi::VulkanGpuProfiler::VulkanGpuProfiler(
+    VulkanGpuDevice *device,
+    VulkanGpuProfilerConfig config)
+    : mDevice(device)
+    , mConfig(std::move(config))
+{
+    const auto caps = mDevice->capabilities();
+    mTimestampPeriod = caps->limits().timestampPeriod;
+    for(auto &&qf : caps->queueFamilies())
+    {
+        // vkCmdResetQueryPool needs a graphics or compute queue, so no scope
+        // is recorded on the transfer-only families
+        const auto bits = qf.queueFlags &
+            (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)
+            ? qf.timestampValidBits : 0;
+        mTimestampMasks.push_back(bits >= 64
+            ? ~std::uint64_t(0) : (std::uint64_t(1) << bits) - 1);
+    }
+
+    const auto vk_device = mDevice->device();
+    vk::CommandPoolCreateInfo pool_info;
+    pool_info.setQueueFamilyIndex(mDevice->graphicsQueueFamily());
+    mCommandPool = vk_device.createCommandPoolUnique(pool_info);
+
+    const auto query_count = mConfig.max_scopes_per_frame * 2;
+    for(std::size_t i = 0; i < mDevice->framesInFlight(); ++i)
+    {
+        FramePool pool;
+        pool.pool = createQueryPool(query_count);
+        pool.scopes.reserve(mConfig.max_scopes_per_frame);
+
+        vk::CommandBufferAllocateInfo alloc_info;
+        alloc_info.setCommandPool(mCommandPool.get());
+        alloc_info.setLevel(vk::CommandBufferLevel::ePrimary);
+        alloc_info.setCommandBufferCount(1);
+        pool.reset_commands = std::move(
+            vk_device.allocateCommandBuffersUnique(alloc_info).front());
+        const auto cmd = pool.reset_commands.get();
+        cmd.begin(vk::CommandBufferBeginInfo { });
+        cmd.resetQueryPool(pool.pool.get(), 0, query_count);
+        cmd.end();
+
+        mFramePools.push_back(std::move(pool));
+    }
+
+    calibrate();
+}
+
+vk::UniqueQueryPool usagi::VulkanGpuProfiler::createQueryPool(
+    const std::uint32_t count) const
+{
+    vk::QueryPoolCreateInfo info;
+    info.setQueryType(vk::QueryType::eTimestamp);
+    info.setQueryCount(count);
+    return mDevice->device().createQueryPoolUnique(info);
+}
+
+double usagi::VulkanGpuProfiler::toCpuTime(
+    const std::uint64_t timestamp,
+    const std::uint64_t mask) const
+{
+    return static_cast<double>(timestamp & mask) * mTimestampPeriod / 1000.0
+        + mCpuOffsetUs;
+}
+
+bool usagi::VulkanGpuProfiler::isSupported(
+    const std::uint32_t queue_family) const
+{
+    // the queries are only reset on the graphics queue
+    return queue_family == mDevice->graphicsQueueFamily() &&
+        mTimestampMasks[queue_family] != 0;
+}
+
+void usagi::VulkanGpuProfiler::calibrate()
+{
+    const auto family = mDevice->graphicsQueueFamily();
+    if(!isSupported(family)) return;
+
+    const auto vk_device = mDevice->device();
+    vk::CommandPoolCreateInfo pool_info;
+    pool_info.setQueueFamilyIndex(family);
+    pool_info.setFlags(vk::CommandPoolCreateFlagBits::eTransient);
+    const auto cmd_pool = vk_device.createCommandPoolUnique(pool_info);
+
+    vk::CommandBufferAllocateInfo alloc_info;
+    alloc_info.setCommandPool(cmd_pool.get());
+    alloc_info.setLevel(vk::CommandBufferLevel::ePrimary);
+    alloc_info.setCommandBufferCount(1);
+    auto cmd = std::move(
+        vk_device.allocateCommandBuffersUnique(alloc_info).front());
+
+    const auto query_pool = createQueryPool(1);
+    vk::CommandBufferBeginInfo begin_info;
+    begin_info.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+    cmd->begin(begin_info);
+    cmd->resetQueryPool(query_pool.get(), 0, 1);
+    cmd->writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe,
+        query_pool.get(), 0);
+    cmd->end();
+
+    const auto cmd_handle = cmd.get();
+    vk::SubmitInfo info;
+    info.setCommandBufferCount(1);
+    info.setPCommandBuffers(&cmd_handle);
+
+    // the timestamp is written somewhere between the submission and the
+    // completion, so assume the middle
+    const auto cpu_begin = cpuTimeUs();
+    const auto serial = mDevice->submitBatch(
+        mDevice->graphicsQueue(), info, { });
+    mDevice->submissionTimeline()->wait(serial);
+    const auto cpu_end = cpuTimeUs();
+
+    std::uint64_t timestamp = 0;
+    const auto result = vk_device.getQueryPoolResults(query_pool.get(), 0, 1,
+        sizeof timestamp, &timestamp, sizeof timestamp,
+        vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+    if(result != vk::Result::eSuccess)
+    {
+        LOG(warn, "Could not read the calibration timestamp: {}",
+            vk::to_string(result));
+        return;
+    }
+    mCpuOffsetUs = 0;
+    mCpuOffsetUs = (cpu_begin + cpu_end) / 2 -
+        toCpuTime(timestamp, mTimestampMasks[family]);
+    LOG(info, "GPU profiler calibrated, uncertainty {:.1f} us",
+        (cpu_end - cpu_begin) / 2);
+}
+
+void usagi::VulkanGpuProfiler::beginFrame(
+    const std::size_t frame_index,
+    const std::uint64_t frame_number)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    auto &frame = mFramePools[frame_index];
+    const auto count = static_cast<std::uint32_t>(frame.scopes.size()) * 2;
+    if(count != 0)
+    {
+        // each query is followed by its availability. the queries of the
+        // command lists never submitted are not available since the whole
+        // pool was reset before the frame.
+        mQueryResults.resize(count * 2);
+        const auto result = mDevice->device().getQueryPoolResults(
+            frame.pool.get(), 0, count,
+            mQueryResults.size() * sizeof(std::uint64_t),
+            mQueryResults.data(), sizeof(std::uint64_t) * 2,
+            vk::QueryResultFlagBits::e64 |
+            vk::QueryResultFlagBits::eWithAvailability);
+        if(result == vk::Result::eSuccess || result == vk::Result::eNotReady)
+        {
+            for(std::size_t i = 0; i < frame.scopes.size(); ++i)
+            {
+                const auto r = &mQueryResults[i * 4];
+                if(!r[1] || !r[3]) continue;
+                auto &scope = frame.scopes[i];
+                const auto mask = mTimestampMasks[scope.queue_family];
+                Timing t;
+                t.name = std::move(scope.name);
+                t.track = scope.track;
+                t.frame = frame.frame_number;
+                t.begin_us = toCpuTime(r[0], mask);
+                t.end_us = toCpuTime(r[2], mask);
+                mTimings.push_back(std::move(t));
+            }
+            while(mTimings.size() > mConfig.max_kept_timings)
+                mTimings.pop_front();
+        }
+        else
+        {
+            LOG(warn, "Could not read the GPU timestamps: {}",
+                vk::to_string(result));
+        }
+    }
+    frame.scopes.clear();
+    frame.frame_number = frame_number;
+
+    // the pools start in an undefined state, so they are reset before their
+    // first frame as well. submitted ahead of the jobs of the frame, which
+    // are executed after it on the same queue.
+    const auto cmd_handle = frame.reset_commands.get();
+    vk::SubmitInfo info;
+    info.setCommandBufferCount(1);
+    info.setPCommandBuffers(&cmd_handle);
+    mDevice->submitBatch(mDevice->graphicsQueue(), info, { });
+}
+
+usagi::VulkanGpuProfiler::ScopeId usagi::VulkanGpuProfiler::beginScope(
+    const vk::CommandBuffer cmd,
+    std::string name,
+    const std::uint32_t queue_family,
+    const char *track)
+{
+    const auto context = mDevice->currentFrame();
+    if(!context || !isSupported(queue_family)) return INVALID_SCOPE;
+
+    ScopeId id;
+    vk::QueryPool pool;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto &frame = mFramePools[context->index()];
+        if(frame.scopes.size() >= mConfig.max_scopes_per_frame)
+            return INVALID_SCOPE;
+        id = static_cast<ScopeId>(frame.scopes.size());
+        frame.scopes.push_back({ std::move(name), track, queue_family });
+        pool = frame.pool.get();
+    }
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, pool, id * 2);
+    return id;
+}
+
+void usagi::VulkanGpuProfiler::endScope(
+    const vk::CommandBuffer cmd,
+    const ScopeId scope)
+{
+    if(scope == INVALID_SCOPE) return;
+
+    // the pool is only replaced when the next frame begins
+    const auto pool = mFramePools[mDevice->currentFrame()->index()].pool.get();
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+        pool, scope * 2 + 1);
+}
+
+std::vector<usagi::VulkanGpuProfiler::Timing>
+    usagi::VulkanGpuProfiler::timings()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return { mTimings.begin(), mTimings.end() };
+}
+
+void usagi::VulkanGpuProfiler::clearTimings()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mTimings.clear();
+}
+
+void usagi::VulkanGpuProfiler::exportChromeTrace(std::ostream &out)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // complete events with the queues as threads of one process
+    out << "{\"traceEvents\":[";
+    auto first = true;
+    for(auto &&t : mTimings)
+    {
+        if(!first) out << ',';
+        first = false;
+        out << "{\"name\":";
+        writeJsonString(out, t.name);
+        out << ",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":\"GPU\",\"tid\":";
+        writeJsonString(out, t.track ? t.track : "GPU");
+        out << ",\"ts\":" << std::fixed << t.begin_us
+            << ",\"dur\":" << t.end_us - t.begin_us
+            << ",\"args\":{\"frame\":" << t.frame << "}}";
+    }
+    out << "],\"displayTimeUnit\":\"ms\"}";
+}
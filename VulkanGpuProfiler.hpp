@@ -0,0 +1,140 @@
+﻿#pragma once
+
+#include <deque>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+#include "VulkanGpuDeviceConfig.hpp"
+
+namespace usagi
+{
+class VulkanGpuDevice;
+
+/**
+ * \brief Measures the GPU time of the scopes recorded into command buffers
+ * with timestamp queries.
+ *
+ * Each frame context has its own query pool. The results of a frame are read
+ * when its context is reused, after the GPU completed the frame, so reading
+ * never stalls. The whole pool is then reset by a command buffer submitted
+ * to the graphics queue ahead of the jobs of the frame, so the scopes must be
+ * executed on the graphics queue. The timestamps are converted to the CPU
+ * steady clock with an offset measured by calibrate().
+ */
+class VulkanGpuProfiler : Noncopyable
+{
+public:
+    using ScopeId = std::uint32_t;
+    static constexpr ScopeId INVALID_SCOPE = ~0u;
+
+    struct Timing
+    {
+        std::string name;
+        // the queue the scope was executed on
+        const char *track = nullptr;
+        std::uint64_t frame = 0;
+        // microseconds of std::chrono::steady_clock
+        double begin_us = 0;
+        double end_us = 0;
+    };
+
+private:
+    VulkanGpuDevice *mDevice = nullptr;
+    const VulkanGpuProfilerConfig mConfig;
+    // nanoseconds per tick
+    double mTimestampPeriod = 1;
+    // the valid bits of the timestamps of each queue family. 0 if the scopes
+    // can't be recorded on it.
+    std::vector<std::uint64_t> mTimestampMasks;
+    // added to the GPU time to get the CPU time
+    double mCpuOffsetUs = 0;
+
+    struct Scope
+    {
+        std::string name;
+        const char *track = nullptr;
+        std::uint32_t queue_family = 0;
+    };
+
+    struct FramePool
+    {
+        vk::UniqueQueryPool pool;
+        // resets all the queries. resubmitted each time the context is
+        // reused, after the last submission completed.
+        vk::UniqueCommandBuffer reset_commands;
+        std::uint64_t frame_number = 0;
+        // scope i uses the queries 2i and 2i+1
+        std::vector<Scope> scopes;
+    };
+    std::mutex mMutex;
+    vk::UniqueCommandPool mCommandPool;
+    std::vector<FramePool> mFramePools;
+    std::deque<Timing> mTimings;
+    std::vector<std::uint64_t> mQueryResults;
+
+    vk::UniqueQueryPool createQueryPool(std::uint32_t count) const;
+    double toCpuTime(std::uint64_t timestamp, std::uint64_t mask) const;
+
+public:
+    VulkanGpuProfiler(
+        VulkanGpuDevice *device,
+        VulkanGpuProfilerConfig config);
+
+    /**
+     * \brief Whether the scopes can be executed on the queue family, which
+     * must be the graphics one and write timestamps. The scopes begun for
+     * the other families are invalid.
+     */
+    bool isSupported(std::uint32_t queue_family) const;
+
+    /**
+     * \brief Measure the offset between the GPU and CPU clocks by waiting for
+     * a timestamp written by the graphics queue. Stalls the queue, but may be
+     * called again if the clocks drift apart.
+     */
+    void calibrate();
+
+    /**
+     * \brief Collect the results of the last frame which used the context
+     * and submit the resets of its queries. Must be called after the frame
+     * is completed and before any job of the new frame is submitted.
+     */
+    void beginFrame(std::size_t frame_index, std::uint64_t frame_number);
+
+    /**
+     * \brief Write the beginning timestamp of a scope. The command buffer
+     * must be submitted to the graphics queue during the current frame.
+     * \return INVALID_SCOPE if the scope is not measured, e.g. the queue
+     * family doesn't support timestamps or no frame has begun.
+     */
+    ScopeId beginScope(
+        vk::CommandBuffer cmd,
+        std::string name,
+        std::uint32_t queue_family,
+        const char *track);
+    /**
+     * \brief Write the ending timestamp of the scope. Must be recorded during
+     * the same frame as the beginning.
+     */
+    void endScope(vk::CommandBuffer cmd, ScopeId scope);
+
+    /**
+     * \brief The completed scopes ordered by frames, at most
+     * max_kept_timings of them.
+     */
+    std::vector<Timing> timings();
+    void clearTimings();
+
+    /**
+     * \brief Write the kept timings as a JSON trace which can be opened by
+     * chrome://tracing or Perfetto.
+     */
+    void exportChromeTrace(std::ostream &out);
+};
+}
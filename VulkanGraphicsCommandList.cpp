@@ -1,5 +1,8 @@
 ﻿#include "VulkanGraphicsCommandList.hpp"
 
+#include <algorithm>
+
+#include <Usagi/Core/Logging.hpp>
 #include <Usagi/Utility/TypeCast.hpp>
 
 #include "VulkanGpuDevice.hpp"
@@ -14,30 +17,162 @@
 #include "VulkanMemoryPool.hpp"
 #include "VulkanGraphicsPipeline.hpp"
 #include "VulkanGpuImageView.hpp"
+#include "VulkanGpuProfiler.hpp"
 #include "VulkanShaderResource.hpp"
 
 using namespace usagi::vulkan;
 
 usagi::VulkanGraphicsCommandList::VulkanGraphicsCommandList(
     std::shared_ptr<VulkanGpuCommandPool> pool,
-    vk::UniqueCommandBuffer vk_command_buffer)
+    vk::UniqueCommandBuffer vk_command_buffer,
+    const vk::CommandBufferLevel level)
     : mCommandPool(std::move(pool))
-    , mCommandBuffer(std::move(vk_command_buffer))
+    , mOwnedCommandBuffer(std::move(vk_command_buffer))
+    , mCommandBuffer(mOwnedCommandBuffer.get())
+    , mLevel(level)
+    , mDescriptors(mCommandPool->device())
+    , mResources(nullptr)
+    , mDebugLabels(mCommandPool->device()->debugUtilsEnabled())
+{
+}
+
+usagi::VulkanGraphicsCommandList::VulkanGraphicsCommandList(
+    std::shared_ptr<VulkanGpuCommandPool> pool,
+    const vk::CommandBuffer vk_command_buffer,
+    const vk::CommandBufferLevel level)
+    : mCommandPool(std::move(pool))
+    , mCommandBuffer(vk_command_buffer)
+    , mLevel(level)
+    , mDescriptors(mCommandPool->device())
+    // the command buffer is recycled with the frame so the command list is
+    // submitted during it
+    , mResources(mCommandPool->device()->currentFrame())
+    , mDebugLabels(mCommandPool->device()->debugUtilsEnabled())
 {
 }
 
 void usagi::VulkanGraphicsCommandList::beginRecording()
 {
+    assert(mLevel == vk::CommandBufferLevel::ePrimary);
+
+    mDescriptors.reset();
+    mConstants.clear();
+    mState.reset();
+
     vk::CommandBufferBeginInfo command_buffer_begin_info;
     command_buffer_begin_info.setFlags(
         vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
 
-    mCommandBuffer->begin(command_buffer_begin_info);
+    mCommandBuffer.begin(command_buffer_begin_info);
+}
+
+void usagi::VulkanGraphicsCommandList::beginSecondaryRecording(
+    const std::shared_ptr<RenderPass> &render_pass,
+    const std::shared_ptr<Framebuffer> &framebuffer,
+    const std::uint32_t subpass)
+{
+    assert(mLevel == vk::CommandBufferLevel::eSecondary);
+
+    mDescriptors.reset();
+    mConstants.clear();
+    mState.reset();
+
+    const auto &vk_renderpass = dynamic_cast_ref<VulkanRenderPass>(
+        render_pass.get());
+    vk::CommandBufferInheritanceInfo inheritance_info;
+    inheritance_info.setRenderPass(vk_renderpass.renderPass());
+    inheritance_info.setSubpass(subpass);
+    // the render pass, the framebuffer, and the views are tracked by the
+    // primary command list
+    if(framebuffer)
+    {
+        inheritance_info.setFramebuffer(
+            dynamic_cast_ref<VulkanFramebuffer>(framebuffer.get())
+                .framebuffer(vk_renderpass));
+    }
+
+    vk::CommandBufferBeginInfo command_buffer_begin_info;
+    command_buffer_begin_info.setFlags(
+        vk::CommandBufferUsageFlagBits::eOneTimeSubmit |
+        vk::CommandBufferUsageFlagBits::eRenderPassContinue);
+    command_buffer_begin_info.setPInheritanceInfo(&inheritance_info);
+
+    mCommandBuffer.begin(command_buffer_begin_info);
 }
 
 void usagi::VulkanGraphicsCommandList::endRecording()
 {
-    mCommandBuffer->end();
+    assert(mProfileScopes.empty());
+    // the transitions for the next command lists, e.g. for presenting
+    mBarriers.record(mCommandBuffer);
+    mCommandBuffer.end();
+    mResources.flush();
+}
+
+void usagi::VulkanGraphicsCommandList::beginOcclusionQuery(
+    const std::uint64_t user_data,
+    const bool precise)
+{
+    assert(mLevel == vk::CommandBufferLevel::ePrimary);
+    assert(mOcclusionQuery == VulkanQueryManager::INVALID_QUERY);
+
+    mOcclusionQuery = mCommandPool->device()->queryManager()->beginOcclusion(
+        mCommandBuffer, user_data, precise);
+}
+
+void usagi::VulkanGraphicsCommandList::endOcclusionQuery()
+{
+    mCommandPool->device()->queryManager()->endOcclusion(
+        mCommandBuffer, mOcclusionQuery);
+    mOcclusionQuery = VulkanQueryManager::INVALID_QUERY;
+}
+
+void usagi::VulkanGraphicsCommandList::beginPipelineStatistics(
+    const char *name)
+{
+    assert(mLevel == vk::CommandBufferLevel::ePrimary);
+    assert(mStatisticsQuery == VulkanQueryManager::INVALID_QUERY);
+
+    mStatisticsQuery =
+        mCommandPool->device()->queryManager()->beginStatistics(
+            mCommandBuffer, name);
+}
+
+void usagi::VulkanGraphicsCommandList::endPipelineStatistics()
+{
+    mCommandPool->device()->queryManager()->endStatistics(
+        mCommandBuffer, mStatisticsQuery);
+    mStatisticsQuery = VulkanQueryManager::INVALID_QUERY;
+}
+
+vk::DebugUtilsLabelEXT usagi::VulkanGraphicsCommandList::makeLabel(
+    const char *name,
+    const Color4f *color)
+{
+    vk::DebugUtilsLabelEXT label;
+    label.setPLabelName(name);
+    // all zero uses the color chosen by the tools
+    if(color)
+    {
+        label.setColor(std::array<float, 4> {
+            color->x(), color->y(), color->z(), color->w()
+        });
+    }
+    return label;
+}
+
+void usagi::VulkanGraphicsCommandList::beginDebugLabel(
+    const char *name,
+    const Color4f *color)
+{
+    mCommandBuffer.beginDebugUtilsLabelEXT(makeLabel(name, color));
+}
+
+void usagi::VulkanGraphicsCommandList::insertDebugLabel(
+    const char *name,
+    const Color4f *color)
+{
+    mCommandBuffer.insertDebugUtilsLabelEXT(makeLabel(name, color));
 }
 
 void usagi::VulkanGraphicsCommandList::imageTransition(
@@ -48,80 +183,34 @@ void usagi::VulkanGraphicsCommandList::imageTransition(
     GraphicsPipelineStage dest_stage)
 {
     auto &vk_image = dynamic_cast_ref<VulkanGpuImage>(image);
+    const auto layout = translate(new_layout);
 
-    vk::ImageMemoryBarrier barrier;
-    barrier.setImage(vk_image.image());
-    barrier.setOldLayout(translate(old_layout));
-    barrier.setNewLayout(translate(new_layout));
-    const auto queue_family_index =
-        mCommandPool->device()->graphicsQueueFamily();
-    barrier.setSrcQueueFamilyIndex(queue_family_index);
-    barrier.setDstQueueFamilyIndex(queue_family_index);
-
-    // modified from
-    // https://harrylovescode.gitbooks.io/vulkan-api/content/chap07/chap07.html
-    // todo: not reliable
-    using vk::AccessFlagBits;
-    switch(barrier.oldLayout)
-    {
-        case vk::ImageLayout::ePreinitialized:
-            barrier.srcAccessMask =
-                AccessFlagBits::eHostWrite;
-            break;
-        case vk::ImageLayout::eColorAttachmentOptimal:
-            barrier.srcAccessMask =
-                AccessFlagBits::eColorAttachmentWrite;
-            break;
-        case vk::ImageLayout::eDepthStencilAttachmentOptimal:
-            barrier.srcAccessMask =
-                AccessFlagBits::eDepthStencilAttachmentWrite;
-            break;
-        case vk::ImageLayout::eTransferSrcOptimal:
-            barrier.srcAccessMask = AccessFlagBits::eTransferRead;
-            break;
-        case vk::ImageLayout::eShaderReadOnlyOptimal:
-            barrier.srcAccessMask = AccessFlagBits::eShaderRead;
-            break;
-        //case vk::ImageLayout::ePresentSrcKHR:
-        //    barrier.srcAccessMask = AccessFlagBits::eMemoryRead;
-        //    break;
-        default: ;
-    }
-    switch(barrier.newLayout)
-    {
-        case vk::ImageLayout::eTransferDstOptimal:
-            barrier.dstAccessMask = AccessFlagBits::eTransferWrite;
-            break;
-        case vk::ImageLayout::eTransferSrcOptimal:
-            barrier.srcAccessMask |= AccessFlagBits::eTransferRead;
-            barrier.dstAccessMask = AccessFlagBits::eTransferRead;
-            break;
-        case vk::ImageLayout::eColorAttachmentOptimal:
-            barrier.dstAccessMask = AccessFlagBits::eColorAttachmentWrite;
-            barrier.srcAccessMask = AccessFlagBits::eTransferRead;
-            break;
-        case vk::ImageLayout::eDepthAttachmentStencilReadOnlyOptimal:
-            barrier.dstAccessMask |=
-                AccessFlagBits::eDepthStencilAttachmentWrite;
-            break;
-        case vk::ImageLayout::eShaderReadOnlyOptimal:
-            barrier.dstAccessMask = AccessFlagBits::eShaderRead;
-            break;
-        //case vk::ImageLayout::ePresentSrcKHR:
-        //    barrier.dstAccessMask = AccessFlagBits::eMemoryRead;
-        //    break;
-        default:;
-    }
-    barrier.subresourceRange.setAspectMask(vk::ImageAspectFlagBits::eColor);
-    barrier.subresourceRange.setBaseArrayLayer(0);
-    barrier.subresourceRange.setLayerCount(1);
-    barrier.subresourceRange.setBaseMipLevel(0);
-    barrier.subresourceRange.setLevelCount(1);
-
-    mCommandBuffer->pipelineBarrier(
-        translate(src_stage), translate(dest_stage),
-        { }, { }, { }, { barrier }
-    );
+    mBarriers.transition(vk_image, layout, translate(dest_stage),
+        VulkanBarrierBatch::layoutAccesses(layout),
+        old_layout == GpuImageLayout::UNDEFINED, translate(src_stage));
+}
+
+void usagi::VulkanGraphicsCommandList::transition(
+    VulkanGpuImage &image,
+    const vk::ImageLayout layout,
+    const vk::PipelineStageFlags stages,
+    const vk::AccessFlags access,
+    const bool discard,
+    const vk::PipelineStageFlags untracked_src_stages)
+{
+    mBarriers.transition(image, layout, stages, access, discard,
+        untracked_src_stages);
+}
+
+void usagi::VulkanGraphicsCommandList::flushBarriers()
+{
+    mBarriers.record(mCommandBuffer);
+}
+
+void usagi::VulkanGraphicsCommandList::trackResource(
+    const std::shared_ptr<VulkanBatchResource> &resource)
+{
+    mResources.track(resource);
 }
 
 // note: bad performance on tile-based GPUs
@@ -132,6 +221,11 @@ void usagi::VulkanGraphicsCommandList::clearColorImage(
     Color4f color)
 {
     auto &vk_image = dynamic_cast_ref<VulkanGpuImage>(image);
+    mBarriers.transition(vk_image, 0, 1, 0, 1, translate(layout),
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::AccessFlagBits::eTransferWrite);
+    mBarriers.record(mCommandBuffer);
+
     // todo: depending on image format, float/uint/int should be used
     const vk::ClearColorValue color_value { std::array<float, 4> {
         color.x(), color.y(), color.z(), color.w()
@@ -142,7 +236,7 @@ void usagi::VulkanGraphicsCommandList::clearColorImage(
     subresource_range.setLayerCount(1);
     subresource_range.setBaseMipLevel(0);
     subresource_range.setLevelCount(1);
-    mCommandBuffer->clearColorImage(
+    mCommandBuffer.clearColorImage(
         vk_image.image(), translate(layout),
         color_value, { subresource_range }
     );
@@ -152,161 +246,201 @@ void usagi::VulkanGraphicsCommandList::beginRendering(
     std::shared_ptr<RenderPass> render_pass,
     std::shared_ptr<Framebuffer> framebuffer)
 {
-    auto vk_framebuffer =
-        dynamic_pointer_cast_throw<VulkanFramebuffer>(framebuffer);
-    const auto vk_renderpass =
-        dynamic_pointer_cast_throw<VulkanRenderPass>(render_pass);
+    beginRendering(std::move(render_pass), std::move(framebuffer),
+        vk::SubpassContents::eInline);
+}
+
+void usagi::VulkanGraphicsCommandList::beginRendering(
+    std::shared_ptr<RenderPass> render_pass,
+    std::shared_ptr<Framebuffer> framebuffer,
+    const vk::SubpassContents contents)
+{
+    auto &vk_framebuffer = backendCast<VulkanFramebuffer>(framebuffer.get());
+    auto &vk_renderpass = backendCast<VulkanRenderPass>(render_pass.get());
 
-    // todo reuse framebuffers?
     // todo unmatched view amount?
-    vk_framebuffer->create(vk_renderpass);
+    const auto &layouts = vk_renderpass.attachmentLayouts();
+    const auto &views = vk_framebuffer.views();
+    for(std::size_t i = 0; i < views.size() && i < layouts.size(); ++i)
+    {
+        const auto &l = layouts[i];
+        // not referenced by any subpass
+        if(!l.stages) continue;
+        auto &image = *views[i]->image();
+        // the render pass discards the content if the initial layout is
+        // undefined. still wait for the previous accesses before that.
+        const auto discard = l.initial == vk::ImageLayout::eUndefined;
+        const auto layout = discard ? l.subpass : l.initial;
+        mBarriers.transition(image, 0, 1, 0, 1, layout, l.stages, l.access,
+            discard, l.stages);
+    }
+    mBarriers.record(mCommandBuffer);
+
+    // the scope covers the whole render pass
+    beginScope("Render Pass");
+    mInRenderPass = true;
 
     vk::RenderPassBeginInfo begin_info;
     // todo support clear values
-    const auto s = vk_framebuffer->size();
+    const auto s = vk_framebuffer.size();
     begin_info.renderArea.extent.width = s.x();
     begin_info.renderArea.extent.height = s.y();
-    begin_info.setFramebuffer(vk_framebuffer->framebuffer());
-    begin_info.setRenderPass(vk_renderpass->renderPass());
-    const auto &clear_values = vk_renderpass->clearValues();
+    begin_info.setFramebuffer(vk_framebuffer.framebuffer(vk_renderpass));
+    begin_info.setRenderPass(vk_renderpass.renderPass());
+    const auto &clear_values = vk_renderpass.clearValues();
     begin_info.setClearValueCount(static_cast<uint32_t>(clear_values.size()));
     begin_info.setPClearValues(clear_values.data());
     // assuming that only one render pass is used
-    mCommandBuffer->beginRenderPass(begin_info, vk::SubpassContents::eInline);
+    mCommandBuffer.beginRenderPass(begin_info, contents);
 
-    for(auto &&view : vk_framebuffer->views())
+    // the render pass leaves the attachments in the final layouts
+    for(std::size_t i = 0; i < views.size() && i < layouts.size(); ++i)
     {
-        // todo: merge into ...->appendResources?
-        mResources.push_back(view);
-        view->appendAdditionalResources(mResources);
+        const auto &l = layouts[i];
+        if(!l.stages) continue;
+        auto &state = views[i]->image()->subresourceState(0, 0);
+        state.layout = l.final;
+        state.stages = l.stages;
+        state.access = l.access & VulkanBarrierBatch::WRITE_ACCESSES;
+        state.read_stages = { };
     }
-    mResources.push_back(std::move(vk_framebuffer));
+
+    for(auto &&view : views)
+        mResources.track(view);
+    // the cached framebuffer is kept alive by the views
+    mResources.track(vk_framebuffer, framebuffer);
+    mResources.track(vk_renderpass, render_pass);
 }
 
-void usagi::VulkanGraphicsCommandList::endRendering()
+void usagi::VulkanGraphicsCommandList::nextSubpass(
+    const vk::SubpassContents contents)
 {
-    mCurrentPipeline.reset();
-    mCommandBuffer->endRenderPass();
+    // the pipelines are created for a specific subpass
+    flushConstants();
+    mCurrentPipeline = nullptr;
+    mCommandBuffer.nextSubpass(contents);
 }
 
-void usagi::VulkanGraphicsCommandList::bindPipeline(
-    std::shared_ptr<GraphicsPipeline> pipeline)
+void usagi::VulkanGraphicsCommandList::endRendering()
 {
-    auto vk_pipeline =
-        dynamic_pointer_cast_throw<VulkanGraphicsPipeline>(pipeline);
-
-    if(mCurrentPipeline == vk_pipeline) return;
-
-    mCommandBuffer->bindPipeline(vk::PipelineBindPoint::eGraphics,
-        vk_pipeline->pipeline());
-    mCurrentPipeline = vk_pipeline;
-    mResources.push_back(std::move(vk_pipeline));
+    flushConstants();
+    mCurrentPipeline = nullptr;
+    mCommandBuffer.endRenderPass();
+    mInRenderPass = false;
+    endScope();
 }
 
-void usagi::VulkanGraphicsCommandList::createDescriptorPool()
+void usagi::VulkanGraphicsCommandList::beginScope(const char *name)
 {
-    // todo: precise control over allocation size
-    vk::DescriptorPoolCreateInfo info;
-    info.setMaxSets(16);
-    std::initializer_list<vk::DescriptorPoolSize> sizes {
-        { vk::DescriptorType::eSampler, 16 },
-        { vk::DescriptorType::eSampledImage, 16 },
-        { vk::DescriptorType::eUniformBuffer, 16 },
-    };
-    info.setPoolSizeCount(static_cast<uint32_t>(sizes.size()));
-    info.setPPoolSizes(sizes.begin());
-    mDescriptorPools.push_back(
-        mCommandPool->device()->device().createDescriptorPoolUnique(info));
+    const auto device = mCommandPool->device();
+    const auto profiler = device->gpuProfiler();
+    if(!profiler || mInRenderPass ||
+        mLevel != vk::CommandBufferLevel::ePrimary)
+    {
+        mProfileScopes.push_back(VulkanGpuProfiler::INVALID_SCOPE);
+        return;
+    }
+    mProfileScopes.push_back(profiler->beginScope(mCommandBuffer, name,
+        device->graphicsQueueFamily(), "Graphics"));
 }
 
-vk::DescriptorSet usagi::VulkanGraphicsCommandList::
-    allocateDescriptorSet(const std::uint32_t set_id)
+void usagi::VulkanGraphicsCommandList::endScope()
 {
-    assert(mCurrentPipeline);
-
-    // todo whats the logic??
-    auto allow_new_pool = true;
+    assert(!mProfileScopes.empty());
+    const auto scope = mProfileScopes.back();
+    mProfileScopes.pop_back();
+    if(scope == VulkanGpuProfiler::INVALID_SCOPE) return;
+    mCommandPool->device()->gpuProfiler()->endScope(mCommandBuffer, scope);
+}
 
-    if(mDescriptorPools.empty())
-    {
-        createDescriptorPool();
-        allow_new_pool = false;
-    }
+void usagi::VulkanGraphicsCommandList::executeCommands(
+    const std::vector<std::shared_ptr<VulkanGraphicsCommandList>> &lists)
+{
+    const auto vk_lists = transformObjects(lists, [](auto &&l) {
+        assert(l->level() == vk::CommandBufferLevel::eSecondary);
+        return l->commandBuffer();
+    });
+    flushConstants();
+    mCommandBuffer.executeCommands(vk_lists);
+
+    // the secondary command lists hold the descriptor sets they use
+    for(auto &&l : lists)
+        mResources.track(l);
+    // the states bound by them are not inherited
+    mCurrentPipeline = nullptr;
+    mDescriptors.reset();
+    mState.reset();
+}
 
-    while(true) try
-    {
-        vk::DescriptorSetAllocateInfo info;
-        info.setDescriptorPool(mDescriptorPools.back().get());
-        info.setDescriptorSetCount(1);
-        const auto layout = { mCurrentPipeline->descriptorSetLayout(set_id) };
-        info.setPSetLayouts(layout.begin());
-
-        mDescriptorSets.push_back(mCommandPool->device()->device()
-            .allocateDescriptorSets(info).front());
-        return mDescriptorSets.back();
-    }
-    catch(const vk::SystemError &e)
-    {
-        switch(static_cast<vk::Result>(e.code().value()))
-        {
-            case vk::Result::eErrorFragmentedPool:
-            case vk::Result::eErrorOutOfPoolMemory:
-                if(!allow_new_pool) throw;
-                createDescriptorPool();
-                allow_new_pool = false;
-            default: break;
-        }
-    }
+void usagi::VulkanGraphicsCommandList::bindPipeline(
+    std::shared_ptr<GraphicsPipeline> pipeline)
+{
+    auto &vk_pipeline = backendCast<VulkanGraphicsPipeline>(pipeline.get());
+
+    if(mCurrentPipeline == &vk_pipeline) return;
+
+    // the constants set for the previous pipeline stay valid if the layouts
+    // are compatible
+    flushConstants();
+    mCommandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+        vk_pipeline.pipeline());
+    // the layouts are kept alive by the tracked pipelines
+    mDescriptors.setPipelineLayout(vk_pipeline.pipelineLayout());
+    mCurrentPipeline = &vk_pipeline;
+    mResources.track(vk_pipeline, pipeline);
 }
 
-// todo performance
 void usagi::VulkanGraphicsCommandList::bindResourceSet(
     const std::uint32_t set_id,
     std::initializer_list<std::shared_ptr<ShaderResource>> resources)
 {
-    auto vk_resources = vulkan::transformObjects(resources, [](auto &&r) {
-        return dynamic_pointer_cast_throw<VulkanShaderResource>(r);
-    });
+    bindResourceSetImpl(set_id, resources);
+}
 
-    const auto desc_set = allocateDescriptorSet(set_id);
-    std::vector<vk::WriteDescriptorSet> writes {
-        vk_resources.size(), vk::WriteDescriptorSet {}
-    };
-    std::vector<VulkanResourceInfo> res_infos {
-        vk_resources.size(), VulkanResourceInfo { }
-    };
-    for(std::size_t i = 0; i < writes.size(); ++i)
+void usagi::VulkanGraphicsCommandList::bindResourceSet(
+    const std::uint32_t set_id,
+    const std::vector<std::shared_ptr<ShaderResource>> &resources)
+{
+    bindResourceSetImpl(set_id, resources);
+}
+
+template <typename Container>
+void usagi::VulkanGraphicsCommandList::bindResourceSetImpl(
+    const std::uint32_t set_id,
+    Container &resources)
+{
+    assert(mCurrentPipeline);
+
+    // the interfaces of the engine are unrelated to VulkanShaderResource so
+    // only this cross cast needs RTTI.
+    mShaderResources.clear();
+    for(auto &&r : resources)
     {
-        auto &res = vk_resources[i];
-        auto batch_res = dynamic_pointer_cast_throw<VulkanBatchResource>(res);
-        auto &write = writes[i];
-        write.setDescriptorType(mCurrentPipeline->descriptorType(
-            set_id, static_cast<uint32_t>(i)));
-        write.setDstSet(desc_set);
-        write.setDstBinding(static_cast<uint32_t>(i));
-        write.setDstArrayElement(0);
-        write.setDescriptorCount(1);
-        res->fillShaderResourceInfo(write, res_infos[i]);
-        batch_res->appendAdditionalResources(mResources);
-        mResources.push_back(std::move(batch_res));
+        mShaderResources.push_back(r
+            ? &dynamic_cast_ref<VulkanShaderResource>(r.get())
+            : nullptr);
     }
+    if(!mDescriptors.bind(mCommandBuffer, vk::PipelineBindPoint::eGraphics,
+        set_id, mShaderResources))
+        return;
 
-    mCommandPool->device()->device().updateDescriptorSets(writes, { });
-    mCommandBuffer->bindDescriptorSets(
-        vk::PipelineBindPoint::eGraphics,
-        mCurrentPipeline->layout(),
-        set_id, { desc_set }, { }
-    );
+    auto iter = resources.begin();
+    for(auto &&r : mShaderResources)
+    {
+        // the immutable samplers are kept alive by the pipeline
+        if(r) mResources.track(r->batchResource(), *iter);
+        ++iter;
+    }
 }
 
 void usagi::VulkanGraphicsCommandList::setViewport(
     const std::uint32_t index,
     Vector2f origin, Vector2f size)
 {
-    vk::Viewport viewports[] = {
-        { origin.x(), origin.y(), size.x(), size.y(), 0.f, 1.f }
+    const vk::Viewport viewport {
+        origin.x(), origin.y(), size.x(), size.y(), 0.f, 1.f
     };
-    mCommandBuffer->setViewport(index, 1, viewports);
+    mState.setViewport(mCommandBuffer, index, viewport);
 }
 
 void usagi::VulkanGraphicsCommandList::setScissor(
@@ -318,12 +452,23 @@ void usagi::VulkanGraphicsCommandList::setScissor(
         { origin.x(), origin.y() },
         { size.x(), size.y() }
     };
-    mCommandBuffer->setScissor(viewport_index, 1, &scissor);
+    mState.setScissor(mCommandBuffer, viewport_index, scissor);
 }
 
 void usagi::VulkanGraphicsCommandList::setLineWidth(float width)
 {
-    mCommandBuffer->setLineWidth(width);
+    const auto caps = mCommandPool->device()->capabilities();
+    // only 1.0 is valid without the wideLines feature
+    if(!caps->enabledFeatures().wideLines)
+    {
+        width = 1.f;
+    }
+    else
+    {
+        const auto &range = caps->limits().lineWidthRange;
+        width = std::clamp(width, range[0], range[1]);
+    }
+    mState.setLineWidth(mCommandBuffer, width);
 }
 
 void usagi::VulkanGraphicsCommandList::setConstant(
@@ -341,12 +486,32 @@ void usagi::VulkanGraphicsCommandList::setConstant(
     if(size != constant_info.size)
         USAGI_THROW(std::runtime_error("Unmatched constant size."));
 
-    mCommandBuffer->pushConstants(
-        mCurrentPipeline->layout(),
-        translate(stage),
-        constant_info.offset, constant_info.size,
-        data
-    );
+    setConstant(constant_info, data);
+}
+
+void usagi::VulkanGraphicsCommandList::setConstant(
+    const VulkanPushConstantField &field,
+    const void *data)
+{
+    assert(mCurrentPipeline);
+    assert(field.offset + field.size <=
+        mCurrentPipeline->pipelineLayout()->pushConstantSize());
+    mConstants.set(field, data);
+}
+
+void usagi::VulkanGraphicsCommandList::flushDrawState()
+{
+    mState.flushVertexBuffers(mCommandBuffer);
+    flushConstants();
+}
+
+void usagi::VulkanGraphicsCommandList::flushConstants()
+{
+    if(mCurrentPipeline)
+    {
+        mConstants.flush(mCommandBuffer,
+            *mCurrentPipeline->pipelineLayout());
+    }
 }
 
 void usagi::VulkanGraphicsCommandList::bindIndexBuffer(
@@ -354,15 +519,16 @@ void usagi::VulkanGraphicsCommandList::bindIndexBuffer(
     const std::size_t offset,
     const GraphicsIndexType type)
 {
-    auto &vk_buffer = dynamic_cast_ref<VulkanGpuBuffer>(buffer.get());
-    auto allocation = vk_buffer.allocation();
+    auto &vk_buffer = backendCast<VulkanGpuBuffer>(buffer.get());
 
-    mCommandBuffer->bindIndexBuffer(
-        allocation->pool()->buffer(), allocation->offset() + offset,
+    mState.bindIndexBuffer(mCommandBuffer,
+        vk_buffer.buffer(), vk_buffer.offset() + offset,
         translate(type)
     );
 
-    mResources.push_back(std::move(allocation));
+    // transient buffers are reclaimed with the frame
+    if(const auto &allocation = vk_buffer.allocation())
+        mResources.track(allocation);
 }
 
 void usagi::VulkanGraphicsCommandList::bindVertexBuffer(
@@ -370,15 +536,14 @@ void usagi::VulkanGraphicsCommandList::bindVertexBuffer(
     const std::shared_ptr<GpuBuffer> &buffer,
     const std::size_t offset)
 {
-    auto &vk_buffer = dynamic_cast_ref<VulkanGpuBuffer>(buffer.get());
-    auto allocation = vk_buffer.allocation();
-
-    vk::Buffer buffers[] = { allocation->pool()->buffer() };
-    vk::DeviceSize sizes[] = { allocation->offset() + offset };
+    auto &vk_buffer = backendCast<VulkanGpuBuffer>(buffer.get());
 
-    mCommandBuffer->bindVertexBuffers(binding_index, 1, buffers, sizes);
+    // merged with the adjacent bindings before the next draw
+    mState.bindVertexBuffer(binding_index,
+        vk_buffer.buffer(), vk_buffer.offset() + offset);
 
-    mResources.push_back(std::move(allocation));
+    if(const auto &allocation = vk_buffer.allocation())
+        mResources.track(allocation);
 }
 
 void usagi::VulkanGraphicsCommandList::drawInstanced(
@@ -387,7 +552,8 @@ void usagi::VulkanGraphicsCommandList::drawInstanced(
     const std::uint32_t first_vertex,
     const std::uint32_t first_instance)
 {
-    mCommandBuffer->draw(vertex_count, instance_count, first_vertex,
+    flushDrawState();
+    mCommandBuffer.draw(vertex_count, instance_count, first_vertex,
         first_instance);
 }
 
@@ -398,6 +564,123 @@ void usagi::VulkanGraphicsCommandList::drawIndexedInstanced(
     const std::int32_t vertex_offset,
     const std::uint32_t first_instance)
 {
-    mCommandBuffer->drawIndexed(index_count, instance_count, first_index,
+    flushDrawState();
+    mCommandBuffer.drawIndexed(index_count, instance_count, first_index,
         vertex_offset, first_instance);
 }
+
+vk::Buffer usagi::VulkanGraphicsCommandList::trackIndirectBuffer(
+    const std::shared_ptr<GpuBuffer> &buffer,
+    std::size_t &offset)
+{
+    auto &vk_buffer = backendCast<VulkanGpuBuffer>(buffer.get());
+    offset += vk_buffer.offset();
+    if(const auto &allocation = vk_buffer.allocation())
+        mResources.track(allocation);
+    return vk_buffer.buffer();
+}
+
+void usagi::VulkanGraphicsCommandList::drawIndirect(
+    const std::shared_ptr<GpuBuffer> &buffer,
+    std::size_t offset,
+    const std::uint32_t draw_count,
+    const std::uint32_t stride)
+{
+    const auto vk_buffer = trackIndirectBuffer(buffer, offset);
+    drawIndirect(vk_buffer, offset, draw_count, stride);
+}
+
+void usagi::VulkanGraphicsCommandList::drawIndexedIndirect(
+    const std::shared_ptr<GpuBuffer> &buffer,
+    std::size_t offset,
+    const std::uint32_t draw_count,
+    const std::uint32_t stride)
+{
+    const auto vk_buffer = trackIndirectBuffer(buffer, offset);
+    drawIndexedIndirect(vk_buffer, offset, draw_count, stride);
+}
+
+void usagi::VulkanGraphicsCommandList::drawIndirect(
+    const vk::Buffer buffer,
+    const vk::DeviceSize offset,
+    const std::uint32_t draw_count,
+    const std::uint32_t stride)
+{
+    flushDrawState();
+    const auto device = mCommandPool->device();
+    if(draw_count <= 1 ||
+        device->capabilities()->enabledFeatures().multiDrawIndirect)
+    {
+        mCommandBuffer.drawIndirect(buffer, offset, draw_count, stride);
+        return;
+    }
+    for(std::uint32_t i = 0; i < draw_count; ++i)
+        mCommandBuffer.drawIndirect(buffer, offset + i * stride, 1, stride);
+}
+
+void usagi::VulkanGraphicsCommandList::drawIndexedIndirect(
+    const vk::Buffer buffer,
+    const vk::DeviceSize offset,
+    const std::uint32_t draw_count,
+    const std::uint32_t stride)
+{
+    flushDrawState();
+    const auto device = mCommandPool->device();
+    if(draw_count <= 1 ||
+        device->capabilities()->enabledFeatures().multiDrawIndirect)
+    {
+        mCommandBuffer.drawIndexedIndirect(buffer, offset, draw_count, stride);
+        return;
+    }
+    for(std::uint32_t i = 0; i < draw_count; ++i)
+    {
+        mCommandBuffer.drawIndexedIndirect(
+            buffer, offset + i * stride, 1, stride);
+    }
+}
+
+void usagi::VulkanGraphicsCommandList::drawIndirectCount(
+    const std::shared_ptr<GpuBuffer> &buffer,
+    std::size_t offset,
+    const std::shared_ptr<GpuBuffer> &count_buffer,
+    std::size_t count_offset,
+    const std::uint32_t max_draw_count,
+    const std::uint32_t stride)
+{
+    if(!mCommandPool->device()->drawIndirectCountEnabled())
+    {
+        USAGI_THROW(std::runtime_error(
+            "VK_KHR_draw_indirect_count is not enabled."));
+    }
+#ifdef VK_KHR_draw_indirect_count
+    const auto vk_buffer = trackIndirectBuffer(buffer, offset);
+    const auto vk_count_buffer = trackIndirectBuffer(
+        count_buffer, count_offset);
+    flushDrawState();
+    mCommandBuffer.drawIndirectCountKHR(vk_buffer, offset,
+        vk_count_buffer, count_offset, max_draw_count, stride);
+#endif
+}
+
+void usagi::VulkanGraphicsCommandList::drawIndexedIndirectCount(
+    const std::shared_ptr<GpuBuffer> &buffer,
+    std::size_t offset,
+    const std::shared_ptr<GpuBuffer> &count_buffer,
+    std::size_t count_offset,
+    const std::uint32_t max_draw_count,
+    const std::uint32_t stride)
+{
+    if(!mCommandPool->device()->drawIndirectCountEnabled())
+    {
+        USAGI_THROW(std::runtime_error(
+            "VK_KHR_draw_indirect_count is not enabled."));
+    }
+#ifdef VK_KHR_draw_indirect_count
+    const auto vk_buffer = trackIndirectBuffer(buffer, offset);
+    const auto vk_count_buffer = trackIndirectBuffer(
+        count_buffer, count_offset);
+    flushDrawState();
+    mCommandBuffer.drawIndexedIndirectCountKHR(vk_buffer, offset,
+        vk_count_buffer, count_offset, max_draw_count, stride);
+#endif
+}
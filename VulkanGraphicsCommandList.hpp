@@ -4,12 +4,20 @@
 
 #include <Usagi/Runtime/Graphics/GraphicsCommandList.hpp>
 
+#include "VulkanBarrierBatch.hpp"
 #include "VulkanBatchResource.hpp"
+#include "VulkanDescriptorBinder.hpp"
+#include "VulkanGraphicsStateCache.hpp"
+#include "VulkanPushConstantBuffer.hpp"
+#include "VulkanQueryManager.hpp"
+#include "VulkanResourceTracker.hpp"
 
 namespace usagi
 {
 class VulkanGpuCommandPool;
+class VulkanGpuImage;
 class VulkanGraphicsPipeline;
+class VulkanShaderResource;
 
 class VulkanGraphicsCommandList
     : public GraphicsCommandList
@@ -18,30 +26,187 @@ class VulkanGraphicsCommandList
     // this shared_ptr is used to ensure that the pool won't be freed before
     // command lists.
     std::shared_ptr<VulkanGpuCommandPool> mCommandPool;
-    vk::UniqueCommandBuffer mCommandBuffer;
-    std::shared_ptr<VulkanGraphicsPipeline> mCurrentPipeline;
-    std::vector<vk::UniqueDescriptorPool> mDescriptorPools;
-    // whole pool is discarded after use, so unique handles are not used.
-    std::vector<vk::DescriptorSet> mDescriptorSets;
-    std::vector<std::shared_ptr<VulkanBatchResource>> mResources;
+    // null if the command buffer is recycled by the frame context
+    vk::UniqueCommandBuffer mOwnedCommandBuffer;
+    vk::CommandBuffer mCommandBuffer;
+    const vk::CommandBufferLevel mLevel;
+    // kept alive by the tracked resources
+    VulkanGraphicsPipeline *mCurrentPipeline = nullptr;
+    // sets bound with compatible pipeline layouts are not rebound
+    VulkanDescriptorBinder mDescriptors;
+    VulkanResourceTracker mResources;
+    // scratch buffer for the resources of bindResourceSet()
+    std::vector<VulkanShaderResource *> mShaderResources;
+    // recorded before the next command depending on them
+    VulkanPushConstantBuffer mConstants;
+    // drops the redundant dynamic states and buffer bindings
+    VulkanGraphicsStateCache mState;
 
-    void createDescriptorPool();
-    vk::DescriptorSet allocateDescriptorSet(std::uint32_t set_id);
+    // image transitions recorded before the next command using the images.
+    // barriers are not allowed inside render passes so the transitions must
+    // be requested outside them.
+    VulkanBarrierBatch mBarriers;
+
+    bool mInRenderPass = false;
+    // VK_EXT_debug_utils is enabled on the device
+    const bool mDebugLabels;
+    // the timestamp scopes being recorded, INVALID_SCOPE if not measured
+    std::vector<std::uint32_t> mProfileScopes;
+    // the active queries, INVALID_QUERY if not recorded
+    VulkanQueryManager::QueryId mOcclusionQuery =
+        VulkanQueryManager::INVALID_QUERY;
+    VulkanQueryManager::QueryId mStatisticsQuery =
+        VulkanQueryManager::INVALID_QUERY;
+
+    template <typename Container>
+    void bindResourceSetImpl(std::uint32_t set_id, Container &resources);
+    void flushConstants();
+    // the vertex buffers and constants before a draw
+    void flushDrawState();
+    vk::Buffer trackIndirectBuffer(
+        const std::shared_ptr<GpuBuffer> &buffer,
+        std::size_t &offset);
+
+    static vk::DebugUtilsLabelEXT makeLabel(
+        const char *name,
+        const Color4f *color);
+    void beginDebugLabel(const char *name, const Color4f *color);
+    void insertDebugLabel(const char *name, const Color4f *color);
 
 public:
     VulkanGraphicsCommandList(
         std::shared_ptr<VulkanGpuCommandPool> pool,
-        vk::UniqueCommandBuffer vk_command_buffer);
+        vk::UniqueCommandBuffer vk_command_buffer,
+        vk::CommandBufferLevel level);
+    /**
+     * \brief Use a command buffer owned by the pool of a frame context. The
+     * command list must not be used after the context is reused.
+     */
+    VulkanGraphicsCommandList(
+        std::shared_ptr<VulkanGpuCommandPool> pool,
+        vk::CommandBuffer vk_command_buffer,
+        vk::CommandBufferLevel level);
 
     void beginRecording() override;
+    /**
+     * \brief Begin recording a secondary command list which continues the
+     * subpass of the render pass. The framebuffer may be null or not created
+     * yet if it is unknown when recording, which may be slower on some
+     * implementations.
+     */
+    void beginSecondaryRecording(
+        const std::shared_ptr<RenderPass> &render_pass,
+        const std::shared_ptr<Framebuffer> &framebuffer,
+        std::uint32_t subpass = 0);
     void endRecording() override;
 
+    /**
+     * \brief The source stages and the old layout are taken from the tracked
+     * states of the image. The given old layout is only used to discard the
+     * content when it is undefined, and the source stage is only used if the
+     * image is not accessed by any tracked command yet. The transition is
+     * batched with the others until the next command.
+     */
     void imageTransition(
         GpuImage *image,
         GpuImageLayout old_layout,
         GpuImageLayout new_layout,
         GraphicsPipelineStage src_stage,
         GraphicsPipelineStage dest_stage) override;
+    /**
+     * \brief Request a transition of all the subresources of the image in
+     * the same way as imageTransition(). The barriers are recorded by the
+     * next command using images or by flushBarriers().
+     */
+    void transition(
+        VulkanGpuImage &image,
+        vk::ImageLayout layout,
+        vk::PipelineStageFlags stages,
+        vk::AccessFlags access,
+        bool discard = false,
+        vk::PipelineStageFlags untracked_src_stages =
+            vk::PipelineStageFlagBits::eTopOfPipe);
+    /**
+     * \brief Record the pending transitions. Must be called before
+     * recording commands outside render passes which access the images
+     * without going through this command list.
+     */
+    void flushBarriers();
+    /**
+     * \brief Keep the resource alive until the GPU finished executing the
+     * command list, see VulkanResourceTracker.
+     */
+    void trackResource(const std::shared_ptr<VulkanBatchResource> &resource);
+    /**
+     * \brief Measure the GPU time of the commands until the matching
+     * endScope() with the profiler of the device. The scopes may be nested.
+     * Only measured in primary command lists outside render passes, since
+     * the queries are reset before use. The name must outlive the call only.
+     */
+    void beginScope(const char *name);
+    void endScope();
+
+    /**
+     * \brief Count the samples passing the depth and stencil tests during
+     * the draws until endOcclusionQuery(). The result is collected by the
+     * query manager of the device along with the user data, after the frame
+     * is completed. Only one occlusion query may be active at a time, and a
+     * query begun inside a subpass must end in it. Only supported by primary
+     * command lists.
+     * \param precise Count the exact samples if supported. Otherwise the
+     * result is only non-zero if any sample passed, which may be cheaper.
+     */
+    void beginOcclusionQuery(std::uint64_t user_data, bool precise = false);
+    void endOcclusionQuery();
+    /**
+     * \brief Count the vertices, primitives and shader invocations of the
+     * commands until endPipelineStatistics(), e.g. for measuring overdraw.
+     * Does nothing if the device doesn't support pipeline statistics. The
+     * same rules as occlusion queries apply.
+     */
+    void beginPipelineStatistics(const char *name);
+    void endPipelineStatistics();
+
+    /**
+     * \brief Label the commands until the matching popLabel() so that they
+     * are grouped in the captures of the graphics debuggers and profilers.
+     * The labels may be nested and must be balanced within the command list.
+     * Does nothing if debug utils are disabled on the device, and compiled
+     * out with USAGI_VULKAN_NO_DEBUG_LABELS.
+     */
+    void pushLabel(const char *name)
+    {
+#ifndef USAGI_VULKAN_NO_DEBUG_LABELS
+        if(mDebugLabels) beginDebugLabel(name, nullptr);
+#endif
+    }
+    void pushLabel(const char *name, const Color4f &color)
+    {
+#ifndef USAGI_VULKAN_NO_DEBUG_LABELS
+        if(mDebugLabels) beginDebugLabel(name, &color);
+#endif
+    }
+    void popLabel()
+    {
+#ifndef USAGI_VULKAN_NO_DEBUG_LABELS
+        if(mDebugLabels) mCommandBuffer.endDebugUtilsLabelEXT();
+#endif
+    }
+    /**
+     * \brief Mark a single point between the commands.
+     */
+    void insertLabel(const char *name)
+    {
+#ifndef USAGI_VULKAN_NO_DEBUG_LABELS
+        if(mDebugLabels) insertDebugLabel(name, nullptr);
+#endif
+    }
+    void insertLabel(const char *name, const Color4f &color)
+    {
+#ifndef USAGI_VULKAN_NO_DEBUG_LABELS
+        if(mDebugLabels) insertDebugLabel(name, &color);
+#endif
+    }
     void clearColorImage(
         GpuImage *image,
         GpuImageLayout layout,
@@ -50,15 +215,38 @@ public:
     void beginRendering(
         std::shared_ptr<RenderPass> render_pass,
         std::shared_ptr<Framebuffer> framebuffer) override;
+    /**
+     * \param contents With eSecondaryCommandBuffers, the subpass may only be
+     * recorded by executeCommands().
+     */
+    void beginRendering(
+        std::shared_ptr<RenderPass> render_pass,
+        std::shared_ptr<Framebuffer> framebuffer,
+        vk::SubpassContents contents);
+    /**
+     * \brief Advance to the next subpass of the render pass. The pipelines
+     * used by it must be compiled for the subpass.
+     */
+    void nextSubpass(
+        vk::SubpassContents contents = vk::SubpassContents::eInline);
     void endRendering() override;
 
+    /**
+     * \brief Execute recorded secondary command lists in the current
+     * subpass. They are kept alive along with this command list.
+     */
+    void executeCommands(
+        const std::vector<std::shared_ptr<VulkanGraphicsCommandList>> &lists);
+
     void bindPipeline(std::shared_ptr<GraphicsPipeline> pipeline) override;
 
-    // todo optimize out binding the same set of resources
     void bindResourceSet(
         std::uint32_t set_id,
         std::initializer_list<std::shared_ptr<ShaderResource>> resources
     ) override;
+    void bindResourceSet(
+        std::uint32_t set_id,
+        const std::vector<std::shared_ptr<ShaderResource>> &resources);
 
     void setViewport(
         std::uint32_t index,
@@ -70,11 +258,21 @@ public:
         Vector2u32 size) override;
     void setLineWidth(float width) override;
 
+    /**
+     * \brief Looks up the field by name, see the overload below.
+     */
     void setConstant(
         ShaderStage stage,
         const char *name,
         const void *data,
         std::size_t size) override;
+    /**
+     * \brief Set a push constant field resolved by
+     * VulkanGraphicsPipeline::queryConstantInfo() from the bound pipeline or
+     * another one sharing its layout. The fields set before a draw are
+     * pushed together for all the stages declaring them.
+     */
+    void setConstant(const VulkanPushConstantField &field, const void *data);
     void bindIndexBuffer(
         const std::shared_ptr<GpuBuffer> &buffer,
         std::size_t offset,
@@ -96,6 +294,66 @@ public:
         std::int32_t vertex_offset,
         std::uint32_t first_instance) override;
 
-    vk::CommandBuffer commandBuffer() const { return mCommandBuffer.get(); }
+    /**
+     * \brief Draw with the arguments read by the GPU from the buffer as
+     * vk::DrawIndirectCommand structures, e.g. written by culling on the
+     * GPU. Multiple draws are split into single ones if multiDrawIndirect is
+     * not supported.
+     */
+    void drawIndirect(
+        const std::shared_ptr<GpuBuffer> &buffer,
+        std::size_t offset,
+        std::uint32_t draw_count,
+        std::uint32_t stride = sizeof(vk::DrawIndirectCommand));
+    /**
+     * \brief Same as drawIndirect() with vk::DrawIndexedIndirectCommand.
+     */
+    void drawIndexedIndirect(
+        const std::shared_ptr<GpuBuffer> &buffer,
+        std::size_t offset,
+        std::uint32_t draw_count,
+        std::uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand));
+    /**
+     * \brief Draw with the number of draws also read from a buffer, as a
+     * 32-bit integer clamped to max_draw_count. Requires
+     * VK_KHR_draw_indirect_count, see
+     * VulkanGpuDevice::drawIndirectCountEnabled().
+     */
+    void drawIndirectCount(
+        const std::shared_ptr<GpuBuffer> &buffer,
+        std::size_t offset,
+        const std::shared_ptr<GpuBuffer> &count_buffer,
+        std::size_t count_offset,
+        std::uint32_t max_draw_count,
+        std::uint32_t stride = sizeof(vk::DrawIndirectCommand));
+    void drawIndexedIndirectCount(
+        const std::shared_ptr<GpuBuffer> &buffer,
+        std::size_t offset,
+        const std::shared_ptr<GpuBuffer> &count_buffer,
+        std::size_t count_offset,
+        std::uint32_t max_draw_count,
+        std::uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand));
+    /**
+     * \brief Draw with the arguments in a buffer which is not tracked, e.g.
+     * a region of the transient buffer.
+     */
+    void drawIndirect(
+        vk::Buffer buffer,
+        vk::DeviceSize offset,
+        std::uint32_t draw_count,
+        std::uint32_t stride);
+    void drawIndexedIndirect(
+        vk::Buffer buffer,
+        vk::DeviceSize offset,
+        std::uint32_t draw_count,
+        std::uint32_t stride);
+
+    /**
+     * \brief The dynamic states and bindings recorded directly into the
+     * command buffer are not known by the command list, which may then skip
+     * setting them again.
+     */
+    vk::CommandBuffer commandBuffer() const { return mCommandBuffer; }
+    vk::CommandBufferLevel level() const { return mLevel; }
 };
 }
@@ -1,48 +1,65 @@
 ﻿#include "VulkanGraphicsPipeline.hpp"
 
+#include <Usagi/Core/Exception.hpp>
 #include <Usagi/Core/Logging.hpp>
 
 #include "VulkanRenderPass.hpp"
+#include "VulkanGpuDevice.hpp"
+#include "VulkanHelper.hpp"
 
 usagi::VulkanRenderPass * usagi::VulkanGraphicsPipeline::renderPass() const
 {
     return mRenderPass.get();
 }
 
-vk::DescriptorSetLayout usagi::VulkanGraphicsPipeline::descriptorSetLayout(
+void usagi::VulkanGraphicsPipeline::setDebugName(const char *name)
+{
+    mDevice->setObjectName(vk::ObjectType::ePipeline,
+        vulkan::handleValue(mPipeline.get()), name);
+}
+
+usagi::VulkanDescriptorSetLayout & usagi::VulkanGraphicsPipeline::setLayout(
     const std::uint32_t set_id) const
 {
-    const auto i = mLayouts.find(set_id);
-    if(i == mLayouts.end())
+    const auto layout = mPipelineLayout->setLayout(set_id);
+    if(!layout)
     {
         LOG(error, "Nonexisting descriptor set id = {}", set_id);
         USAGI_THROW(std::logic_error("Referenced invalid resource."));
     }
-    return mLayouts.find(set_id)->second.get();
+    return *layout;
+}
+
+vk::DescriptorSetLayout usagi::VulkanGraphicsPipeline::descriptorSetLayout(
+    const std::uint32_t set_id) const
+{
+    return setLayout(set_id).layout();
 }
 
 vk::DescriptorType usagi::VulkanGraphicsPipeline::descriptorType(
     const std::uint32_t set_id,
     const std::uint32_t binding) const
 {
-    auto &bindings = mLayoutBindings.find(set_id)->second;
-    // access by index if no binding is skipped
-    if(binding < bindings.size())
-    {
-        auto &vk_binding = bindings[binding];
-        if(vk_binding.binding == binding)
-            return vk_binding.descriptorType;
-    }
-    // fallback to linear search
-    const auto iter = std::find_if(bindings.begin(), bindings.end(),
-        [&](auto &&b) { return b.binding == binding; });
-    return iter->descriptorType;
+    return setLayout(set_id).descriptorType(binding);
+}
+
+usagi::VulkanDescriptorCounts usagi::VulkanGraphicsPipeline::descriptorCounts(
+    const std::uint32_t set_id) const
+{
+    return setLayout(set_id).descriptorCounts();
 }
 
 usagi::VulkanPushConstantField usagi::VulkanGraphicsPipeline::queryConstantInfo(
-    ShaderStage stage,
-    const std::string &name) const
+    const ShaderStage stage,
+    const char *name) const
 {
-    // todo error handling
-    return mConstantFieldMap.at(stage).at(name);
+    const auto stage_iter = mConstantFieldMap.find(stage);
+    if(stage_iter != mConstantFieldMap.end())
+    {
+        const auto iter = stage_iter->second.find(name);
+        if(iter != stage_iter->second.end())
+            return iter->second;
+    }
+    LOG(error, "Nonexisting push constant field: {}", name);
+    USAGI_THROW(std::logic_error("Referenced invalid resource."));
 }
@@ -1,6 +1,8 @@
 ﻿#pragma once
 
+#include <functional>
 #include <map>
+#include <string>
 
 #include <vulkan/vulkan.hpp>
 
@@ -8,65 +10,80 @@
 #include <Usagi/Runtime/Graphics/Shader/ShaderStage.hpp>
 
 #include "VulkanBatchResource.hpp"
+#include "VulkanDescriptorPoolAllocator.hpp"
+#include "VulkanLayoutRegistry.hpp"
+#include "VulkanPushConstantBuffer.hpp"
 
 namespace usagi
 {
 class VulkanRenderPass;
-
-struct VulkanPushConstantField
-{
-    std::uint32_t offset = 0, size = 0;
-};
+class VulkanGpuDevice;
 
 class VulkanGraphicsPipeline
     : public GraphicsPipeline
     , public VulkanBatchResource
 {
 public:
-    using DescriptorSetLayoutBindingMap =
-        std::map<std::uint32_t, std::vector<vk::DescriptorSetLayoutBinding>>;
-    using DescriptorSetLayoutMap =
-        std::map<std::uint32_t, vk::UniqueDescriptorSetLayout>;
-    using PushConstantFieldMap =
-        std::map<ShaderStage, std::map<std::string, VulkanPushConstantField>>;
+    // the names are looked up without constructing strings
+    using PushConstantFieldMap = std::map<ShaderStage,
+        std::map<std::string, VulkanPushConstantField, std::less<>>>;
 
 private:
+    VulkanGpuDevice *mDevice = nullptr;
     vk::UniquePipeline mPipeline;
-    vk::UniquePipelineLayout mPipelineLayout;
+    // shared with the pipelines having the same layout
+    const std::shared_ptr<VulkanPipelineLayout> mPipelineLayout;
     std::shared_ptr<VulkanRenderPass> mRenderPass;
 
-    const DescriptorSetLayoutBindingMap mLayoutBindings;
-    const DescriptorSetLayoutMap mLayouts;
     const PushConstantFieldMap mConstantFieldMap;
 
+    VulkanDescriptorSetLayout & setLayout(std::uint32_t set_id) const;
+
 public:
     VulkanGraphicsPipeline(
+        VulkanGpuDevice *device,
         vk::UniquePipeline vk_pipeline,
-        vk::UniquePipelineLayout vk_pipeline_layout,
+        std::shared_ptr<VulkanPipelineLayout> pipeline_layout,
         std::shared_ptr<VulkanRenderPass> vulkan_render_pass,
-        DescriptorSetLayoutBindingMap layout_bindings,
-        DescriptorSetLayoutMap layout,
         PushConstantFieldMap constant_field_map)
-        : mPipeline { std::move(vk_pipeline) }
-        , mPipelineLayout { std::move(vk_pipeline_layout) }
+        : mDevice { device }
+        , mPipeline { std::move(vk_pipeline) }
+        , mPipelineLayout { std::move(pipeline_layout) }
         , mRenderPass { std::move(vulkan_render_pass) }
-        , mLayoutBindings(std::move(layout_bindings))
-        , mLayouts { std::move(layout) }
         , mConstantFieldMap { std::move(constant_field_map) }
     {
     }
 
     vk::Pipeline pipeline() const { return mPipeline.get(); }
-    vk::PipelineLayout layout() const { return mPipelineLayout.get(); }
+    /**
+     * \brief Name the pipeline for the debuggers. Does nothing if debug
+     * utils are disabled.
+     */
+    void setDebugName(const char *name);
+    vk::PipelineLayout layout() const { return mPipelineLayout->layout(); }
+    VulkanPipelineLayout * pipelineLayout() const
+    {
+        return mPipelineLayout.get();
+    }
     VulkanRenderPass * renderPass() const;
 
     vk::DescriptorSetLayout descriptorSetLayout(std::uint32_t set_id) const;
     vk::DescriptorType descriptorType(
         std::uint32_t set_id,
         std::uint32_t binding) const;
+    /**
+     * \brief The amount of descriptors required to allocate one set of the
+     * specified layout.
+     */
+    VulkanDescriptorCounts descriptorCounts(std::uint32_t set_id) const;
 
+    /**
+     * \brief Find the push constant field declared by the shader stage. The
+     * field may be resolved once and passed to
+     * VulkanGraphicsCommandList::setConstant() for every draw.
+     */
     VulkanPushConstantField queryConstantInfo(
         ShaderStage stage,
-        const std::string &name) const;
+        const char *name) const;
 };
 }
@@ -9,9 +9,10 @@
 #include "VulkanGpuDevice.hpp"
 #include "VulkanEnumTranslation.hpp"
 #include "VulkanRenderPass.hpp"
+#include "VulkanSampler.hpp"
 #include "VulkanGraphicsPipeline.hpp"
+#include "VulkanShaderReflection.hpp"
 
-using namespace spirv_cross;
 using namespace usagi::vulkan;
 
 vk::UniqueShaderModule usagi::VulkanGraphicsPipelineCompiler::
@@ -92,13 +93,21 @@ void usagi::VulkanGraphicsPipelineCompiler::setRenderPass(
     mPipelineCreateInfo.setRenderPass(mRenderPass->renderPass());
 }
 
+void usagi::VulkanGraphicsPipelineCompiler::setSubpass(
+    const std::uint32_t subpass)
+{
+    mPipelineCreateInfo.setSubpass(subpass);
+}
+
 struct usagi::VulkanGraphicsPipelineCompiler::Context
 {
     // Descriptor Set Layouts
-    VulkanGraphicsPipeline::DescriptorSetLayoutBindingMap
+    std::map<std::uint32_t, std::vector<vk::DescriptorSetLayoutBinding>>
         desc_set_layout_bindings;
-    VulkanGraphicsPipeline::DescriptorSetLayoutMap desc_set_layouts;
-    std::vector<vk::DescriptorSetLayout> desc_set_layout_array;
+    std::map<std::uint32_t, std::vector<std::shared_ptr<VulkanSampler>>>
+        immutable_samplers;
+    // indexed by set numbers
+    std::vector<std::shared_ptr<VulkanDescriptorSetLayout>> desc_set_layouts;
 
     // Push Constants
     std::vector<vk::PushConstantRange> push_constants;
@@ -116,184 +125,89 @@ struct usagi::VulkanGraphicsPipelineCompiler::ReflectionHelper
 {
     Context &ctx;
     VulkanGraphicsPipelineCompiler *p = nullptr;
-    const ShaderMap::value_type &shader;
-    const Compiler & compiler;
-    ShaderResources resources;
-    std::size_t push_constant_offset = 0;
-    std::size_t push_constant_size = 0;
-    VulkanGraphicsPipeline::PushConstantFieldMap::value_type::second_type &
-        push_constant_fields;
-
-    ReflectionHelper(
-        Context &ctx,
-        VulkanGraphicsPipelineCompiler *pipeline_compiler,
-        const ShaderMap::value_type &shader)
-        : ctx { ctx }
-        , p { pipeline_compiler }
-        , shader { shader }
-        , compiler { shader.second.binary->reflectionCompiler() }
-        , resources { compiler.get_shader_resources() }
-        , push_constant_fields { ctx.push_constant_field_map[shader.first] }
-    {
-    }
+    const ShaderStage stage;
+    const VulkanShaderReflection &reflection;
 
-    void reflectPushConstantField(
-        const Resource &resource, const SPIRType &type, unsigned i)
+    void applyPushConstantRanges()
     {
-        const auto &member_name =
-            compiler.get_member_name(type.self, i);
-        const auto member_offset =
-            compiler.type_struct_member_offset(type, i);
-        const auto member_size =
-            compiler.get_declared_struct_member_size(type, i);
-
-        // if first member is named padding, it is considered as offset hint
-        // and is ignored.
-        if(i == 0 && member_name == "padding")
+        auto &fields = ctx.push_constant_field_map[stage];
+        for(auto &&f : reflection.push_constant_fields)
         {
-            push_constant_offset = member_size;
-            return;
+            VulkanPushConstantField field;
+            field.offset = f.offset;
+            field.size = f.size;
+            fields[f.name] = field;
         }
 
-        LOG(info, "{}: offset={}, size={}",
-            member_name, member_offset, member_size);
-
-        VulkanPushConstantField field;
-        field.size = static_cast<uint32_t>(member_size);
-        field.offset = static_cast<uint32_t>(member_offset);
-
-        // add to reflection record
-        // todo: if multiple constant buffers are allowed in the
-        // future, member name may not uniquely identify the fields.
-        // use struct_name.field_name instead?
-        push_constant_fields[member_name] = field;
-    }
-
-    std::size_t reflectPushConstantBuffer(
-        const Resource &resource)
-    {
-        const auto &type = compiler.get_type(resource.base_type_id);
-        const auto size = compiler.get_declared_struct_size(type);
-
-        const auto member_count = type.member_types.size();
-        for(unsigned i = 0; i < member_count; i++)
-            reflectPushConstantField(resource, type, i);
-
-        return size;
-    }
-
-    void reflectPushConstantRanges()
-    {
-        for(const auto &resource : resources.push_constant_buffers)
-            push_constant_size += reflectPushConstantBuffer(resource);
-
-        if(push_constant_size == 0) return;
+        if(reflection.push_constant_size == 0) return;
 
         vk::PushConstantRange range;
         // todo allow multiple stages in one shader source
-        range.setOffset(static_cast<uint32_t>(push_constant_offset));
-        range.setSize(static_cast<uint32_t>(
-            push_constant_size - push_constant_offset));
-        range.setStageFlags(translate(shader.first));
+        range.setOffset(reflection.push_constant_offset);
+        range.setSize(
+            reflection.push_constant_size - reflection.push_constant_offset);
+        range.setStageFlags(translate(stage));
         ctx.push_constants.push_back(range);
 
-        ctx.max_push_constant_size = std::max(
+        ctx.max_push_constant_size = std::max<std::size_t>(
             ctx.max_push_constant_size,
-            push_constant_size
+            reflection.push_constant_size
         );
     }
 
-    void reflectVertexInputAttributes()
+    void applyVertexInputAttributes()
     {
         LOG(info, "Vertex input attribtues:");
 
-        for(auto &&resource : resources.stage_inputs)
+        for(auto &&input : reflection.vertex_inputs)
         {
-            const auto location = compiler.get_decoration(
-                resource.id, spv::DecorationLocation);
-
-            LOG(info, "{}: location={}", resource.name, location);
+            LOG(info, "{}: location={}", input.name, input.location);
 
             // normalize to location-based indexing
-            const auto it = p->mVertexAttributeNameMap.find(resource.name);
+            const auto it = p->mVertexAttributeNameMap.find(input.name);
             if(it != p->mVertexAttributeNameMap.end())
             {
-                it->second.location = location;
+                it->second.location = input.location;
                 p->mVertexAttributeLocationArray.push_back(it->second);
                 p->mVertexAttributeNameMap.erase(it);
             }
         }
     }
 
-    void addResource(std::vector<Resource>::value_type &resource,
-        const vk::DescriptorType resource_type) const
+    void applyDescriptorSets()
     {
         // todo: ensure different stages uses different set indices
-        const auto set = compiler.get_decoration(
-            resource.id, spv::DecorationDescriptorSet);
-        const auto binding = compiler.get_decoration(
-            resource.id, spv::DecorationBinding);
-        const auto &type = compiler.get_type(resource.type_id);
-
-        vk::DescriptorSetLayoutBinding layout_binding;
-        layout_binding.setStageFlags(translate(shader.first));
-        layout_binding.setBinding(binding);
-        layout_binding.setDescriptorCount(type.vecsize);
-        layout_binding.setDescriptorType(resource_type);
-
-        ctx.desc_set_layout_bindings[set].push_back(layout_binding);
-    }
-
-    void ignoreResource(std::vector<Resource>::value_type &resource,
-        const vk::DescriptorType resource_type) const
-    {
-        const auto set = compiler.get_decoration(
-            resource.id, spv::DecorationDescriptorSet);
-        const auto binding = compiler.get_decoration(
-            resource.id, spv::DecorationBinding);
-
-        LOG(warn, "{type} {name} (set={},binding={}) is ignored.",
-            to_string(resource_type), resource.name, set, binding);
-    }
-
-    void reflectDescriptorSets()
-    {
-        LOG(info, "Descriptor set layouts:");
-
-        // todo: deal with others resource types
-
-        for(auto &&resource : resources.storage_buffers)
-            ignoreResource(resource, vk::DescriptorType::eStorageBuffer);
-
-        // sampler2D is not supported in HLSL so not included here.
-        // don't use them in shaders.
-        for(auto &&resource : resources.sampled_images)
-            ignoreResource(resource, vk::DescriptorType::eSampledImage);
-
-        for(auto &&resource : resources.separate_images)
-            addResource(resource, vk::DescriptorType::eSampledImage);
-
-        for(auto &&resource : resources.separate_samplers)
-            addResource(resource, vk::DescriptorType::eSampler);
-
-        for(auto &&resource : resources.uniform_buffers)
-            addResource(resource, vk::DescriptorType::eUniformBuffer);
+        for(auto &&b : reflection.descriptor_bindings)
+        {
+            vk::DescriptorSetLayoutBinding layout_binding;
+            layout_binding.setStageFlags(translate(stage));
+            layout_binding.setBinding(b.binding);
+            layout_binding.setDescriptorCount(b.count);
+            auto type = b.type;
+            if(type == vk::DescriptorType::eUniformBuffer &&
+                p->mDynamicUniformBuffers.count({ b.set, b.binding }))
+                type = vk::DescriptorType::eUniformBufferDynamic;
+            layout_binding.setDescriptorType(type);
+            const auto sampler = p->mImmutableSamplers.find({
+                b.set, b.binding });
+            if(type == vk::DescriptorType::eSampler &&
+                sampler != p->mImmutableSamplers.end())
+            {
+                if(b.count != 1)
+                {
+                    LOG(error, "Immutable sampler at set {} binding {} is "
+                        "an array.", b.set, b.binding);
+                    USAGI_THROW(std::logic_error(
+                        "Unsupported immutable sampler."));
+                }
+                layout_binding.setPImmutableSamplers(
+                    sampler->second->samplerPointer());
+                ctx.immutable_samplers[b.set].push_back(sampler->second);
+            }
 
-        // note that only one subpass is used to maintain compatibility
-        // for shader cross-compiling
-        for(auto &&resource : resources.subpass_inputs)
-            addResource(resource, vk::DescriptorType::eInputAttachment);
+            ctx.desc_set_layout_bindings[b.set].push_back(layout_binding);
+        }
     }
-
-    // todo auto get render targets?
-    //void reflectRenderTargets()
-    //{
-    //    for(const auto &resource : resources.stage_outputs)
-    //    {
-    //        const auto attachment_index = compiler.get_decoration(
-    //            resource.id, spv::DecorationInputAttachmentIndex);
-    //    }
-    //}
 };
 
 std::shared_ptr<usagi::GraphicsPipeline>
@@ -312,54 +226,54 @@ std::shared_ptr<usagi::GraphicsPipeline>
     {
         LOG(info, "Reflecting {} shader", to_string(shader.first));
 
-        ReflectionHelper helper { ctx, this, shader };
+        const auto reflection = mDevice->shaderReflectionCache()->reflect(
+            *shader.second.binary);
+        ReflectionHelper helper { ctx, this, shader.first, *reflection };
         if(shader.first == ShaderStage::VERTEX)
-            helper.reflectVertexInputAttributes();
-        // todo
-        //if(shader.first == ShaderStage::FRAGMENT)
-        //    helper.reflectRenderTargets();
-        helper.reflectPushConstantRanges();
-        helper.reflectDescriptorSets();
+            helper.applyVertexInputAttributes();
+        helper.applyPushConstantRanges();
+        helper.applyDescriptorSets();
     }
 
-    vk::UniquePipelineLayout compatible_pipeline_layout;
+    std::shared_ptr<VulkanPipelineLayout> compatible_pipeline_layout;
     {
-        vk::PipelineLayoutCreateInfo info;
+        const auto registry = mDevice->layoutRegistry();
 
+        // the set layouts are indexed by set numbers in the pipeline layout,
+        // so the unused set numbers are filled with empty layouts.
         for(auto &&layout : ctx.desc_set_layout_bindings)
         {
-            vk::DescriptorSetLayoutCreateInfo layout_info;
-            layout_info.setBindingCount(
-                static_cast<uint32_t>(layout.second.size()));
-            layout_info.setPBindings(layout.second.data());
-            auto l = mDevice->device().createDescriptorSetLayoutUnique(
-                layout_info);
-            ctx.desc_set_layout_array.push_back(l.get());
-            ctx.desc_set_layouts[layout.first] = std::move(l);
+            while(ctx.desc_set_layouts.size() < layout.first)
+                ctx.desc_set_layouts.push_back(
+                    registry->descriptorSetLayout({ }));
+            ctx.desc_set_layouts.push_back(registry->descriptorSetLayout(
+                std::move(layout.second),
+                std::move(ctx.immutable_samplers[layout.first])));
         }
-        info.setSetLayoutCount(
-            static_cast<uint32_t>(ctx.desc_set_layout_array.size()));
-        info.setPSetLayouts(ctx.desc_set_layout_array.data());
 
-        info.setPushConstantRangeCount(
-            static_cast<uint32_t>(ctx.push_constants.size()));
-        info.setPPushConstantRanges(ctx.push_constants.data());
-
-        compatible_pipeline_layout =
-            mDevice->device().createPipelineLayoutUnique(info);
-        mPipelineCreateInfo.setLayout(compatible_pipeline_layout.get());
+        compatible_pipeline_layout = registry->pipelineLayout(
+            std::move(ctx.desc_set_layouts), std::move(ctx.push_constants));
+        mPipelineCreateInfo.setLayout(compatible_pipeline_layout->layout());
     }
 
     setupVertexInput();
 
+    // all the color attachments are blended in the same way
+    mColorBlendAttachmentStates.assign(
+        mRenderPass->colorAttachmentCount(mPipelineCreateInfo.subpass),
+        mColorBlendAttachmentState);
+    mColorBlendStateCreateInfo.setAttachmentCount(
+        static_cast<uint32_t>(mColorBlendAttachmentStates.size()));
+    mColorBlendStateCreateInfo.setPAttachments(
+        mColorBlendAttachmentStates.data());
+
     auto pipeline = mDevice->device().createGraphicsPipelineUnique(
-        { }, mPipelineCreateInfo);
+        mDevice->pipelineCache(), mPipelineCreateInfo);
     auto wrapped_pipeline = std::make_shared<VulkanGraphicsPipeline>(
+        mDevice,
         std::move(pipeline),
         std::move(compatible_pipeline_layout),
         mRenderPass,
-        std::move(ctx.desc_set_layout_bindings),
-        std::move(ctx.desc_set_layouts),
         std::move(ctx.push_constant_field_map)
     );
 
@@ -376,6 +290,66 @@ std::shared_ptr<usagi::GraphicsPipeline>
     return std::move(wrapped_pipeline);
 }
 
+std::unique_ptr<usagi::VulkanGraphicsPipelineCompiler>
+    usagi::VulkanGraphicsPipelineCompiler::snapshot() const
+{
+    auto copy = std::make_unique<VulkanGraphicsPipelineCompiler>(mDevice);
+
+    for(auto &&shader : mShaders)
+    {
+        ShaderInfo info;
+        info.entry_point = shader.second.entry_point;
+        info.binary = shader.second.binary;
+        copy->mShaders[shader.first] = std::move(info);
+    }
+
+    copy->mVertexInputBindings = mVertexInputBindings;
+    copy->mVertexAttributeNameMap = mVertexAttributeNameMap;
+    copy->mVertexAttributeLocationArray = mVertexAttributeLocationArray;
+    copy->mDynamicUniformBuffers = mDynamicUniformBuffers;
+    copy->mImmutableSamplers = mImmutableSamplers;
+
+    // these states don't contain pointers to the members
+    copy->mInputAssemblyStateCreateInfo = mInputAssemblyStateCreateInfo;
+    copy->mRasterizationStateCreateInfo = mRasterizationStateCreateInfo;
+    copy->mMultisampleStateCreateInfo = mMultisampleStateCreateInfo;
+    copy->mDepthStencilStateCreateInfo = mDepthStencilStateCreateInfo;
+    copy->mColorBlendAttachmentState = mColorBlendAttachmentState;
+    // the logic op and blend constants are kept. the attachments point to
+    // the members of the copy.
+    copy->mColorBlendAttachmentStates = mColorBlendAttachmentStates;
+    copy->mColorBlendStateCreateInfo = mColorBlendStateCreateInfo;
+    if(copy->mColorBlendAttachmentStates.empty())
+    {
+        copy->mColorBlendStateCreateInfo.setAttachmentCount(1);
+        copy->mColorBlendStateCreateInfo.setPAttachments(
+            &copy->mColorBlendAttachmentState);
+    }
+    else
+    {
+        copy->mColorBlendStateCreateInfo.setPAttachments(
+            copy->mColorBlendAttachmentStates.data());
+    }
+
+    copy->mRenderPass = mRenderPass;
+    copy->mPipelineCreateInfo.setRenderPass(mPipelineCreateInfo.renderPass);
+    copy->mPipelineCreateInfo.setSubpass(mPipelineCreateInfo.subpass);
+    copy->mParentPipeline = mParentPipeline;
+    copy->mPipelineCreateInfo.setFlags(mPipelineCreateInfo.flags);
+    copy->mPipelineCreateInfo.setBasePipelineHandle(
+        mPipelineCreateInfo.basePipelineHandle);
+    copy->mPipelineCreateInfo.setBasePipelineIndex(
+        mPipelineCreateInfo.basePipelineIndex);
+
+    return std::move(copy);
+}
+
+std::future<std::shared_ptr<usagi::GraphicsPipeline>>
+    usagi::VulkanGraphicsPipelineCompiler::compileAsync()
+{
+    return mDevice->pipelineCompileQueue()->submit(snapshot());
+}
+
 usagi::VulkanGraphicsPipelineCompiler::VulkanGraphicsPipelineCompiler(
     VulkanGpuDevice *device)
     : mDevice { device }
@@ -406,7 +380,7 @@ usagi::VulkanGraphicsPipelineCompiler::VulkanGraphicsPipelineCompiler(
     setDepthStencilState({ });
 
     // Blending
-    // todo: multiple attachments
+    // repeated for all the color attachments of the subpass when compiling
     mColorBlendStateCreateInfo.setAttachmentCount(1);
     mColorBlendStateCreateInfo.setPAttachments(&mColorBlendAttachmentState);
     mPipelineCreateInfo.setPColorBlendState(&mColorBlendStateCreateInfo);
@@ -501,7 +475,14 @@ void usagi::VulkanGraphicsPipelineCompiler::setInputAssemblyState(
 void usagi::VulkanGraphicsPipelineCompiler::rsSetPolygonMode(
     const PolygonMode mode)
 {
-    mRasterizationStateCreateInfo.setPolygonMode(translate(mode));
+    auto vk_mode = translate(mode);
+    if(vk_mode != vk::PolygonMode::eFill &&
+        !mDevice->capabilities()->enabledFeatures().fillModeNonSolid)
+    {
+        LOG(warn, "fillModeNonSolid is not enabled, using filled polygons.");
+        vk_mode = vk::PolygonMode::eFill;
+    }
+    mRasterizationStateCreateInfo.setPolygonMode(vk_mode);
 }
 
 void usagi::VulkanGraphicsPipelineCompiler::rsSetFaceCullingMode(
@@ -566,3 +547,19 @@ void usagi::VulkanGraphicsPipelineCompiler::setColorBlendState(
         vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
         vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
 }
+
+void usagi::VulkanGraphicsPipelineCompiler::setDynamicUniformBuffer(
+    const std::uint32_t set,
+    const std::uint32_t binding)
+{
+    mDynamicUniformBuffers.emplace(set, binding);
+}
+
+void usagi::VulkanGraphicsPipelineCompiler::setImmutableSampler(
+    const std::uint32_t set,
+    const std::uint32_t binding,
+    std::shared_ptr<GpuSampler> sampler)
+{
+    mImmutableSamplers[{ set, binding }] =
+        dynamic_pointer_cast_throw<VulkanSampler>(std::move(sampler));
+}
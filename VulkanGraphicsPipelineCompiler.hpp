@@ -1,6 +1,8 @@
 ﻿#pragma once
 
 #include <map>
+#include <set>
+#include <future>
 
 #include <vulkan/vulkan.hpp>
 
@@ -8,9 +10,11 @@
 
 namespace usagi
 {
+class GpuSampler;
 class VulkanGraphicsPipeline;
 class VulkanRenderPass;
 class VulkanGpuDevice;
+class VulkanSampler;
 
 class VulkanGraphicsPipelineCompiler final : public GraphicsPipelineCompiler
 {
@@ -37,6 +41,9 @@ class VulkanGraphicsPipelineCompiler final : public GraphicsPipelineCompiler
     vk::PipelineMultisampleStateCreateInfo mMultisampleStateCreateInfo;
     vk::PipelineDepthStencilStateCreateInfo mDepthStencilStateCreateInfo;
     vk::PipelineColorBlendAttachmentState mColorBlendAttachmentState;
+    // the state above repeated for each color attachment of the subpass
+    std::vector<vk::PipelineColorBlendAttachmentState>
+        mColorBlendAttachmentStates;
     vk::PipelineColorBlendStateCreateInfo mColorBlendStateCreateInfo;
     std::shared_ptr<VulkanRenderPass> mRenderPass;
 
@@ -58,6 +65,12 @@ class VulkanGraphicsPipelineCompiler final : public GraphicsPipelineCompiler
         vk::VertexInputAttributeDescription>;
     VertexAttributeLocationArray mVertexAttributeLocationArray;
 
+    // (set, binding) of the uniform buffers using dynamic offsets
+    std::set<std::pair<std::uint32_t, std::uint32_t>> mDynamicUniformBuffers;
+    // (set, binding) of the samplers baked into the set layouts
+    std::map<std::pair<std::uint32_t, std::uint32_t>,
+        std::shared_ptr<VulkanSampler>> mImmutableSamplers;
+
     void setupShaderStages();
     void setupVertexInput();
     void setupDynamicStates();
@@ -68,10 +81,21 @@ class VulkanGraphicsPipelineCompiler final : public GraphicsPipelineCompiler
     VertexInputBindingArray::iterator findVertexBufferBinding(
             std::uint32_t binding_index);
 
+    /**
+     * \brief Copy the pipeline states and shaders into a new compiler.
+     * Shader modules are not shared and will be created by the copy.
+     */
+    std::unique_ptr<VulkanGraphicsPipelineCompiler> snapshot() const;
+
 public:
     explicit VulkanGraphicsPipelineCompiler(VulkanGpuDevice *device);
 
     void setRenderPass(std::shared_ptr<RenderPass> render_pass) override;
+    /**
+     * \brief The subpass of the render pass the pipeline is used in.
+     * Defaults to the first one.
+     */
+    void setSubpass(std::uint32_t subpass);
 
     void setShader(
         ShaderStage stage,
@@ -106,6 +130,32 @@ public:
     void omSetColorBlendEnabled(bool enabled) override;
     void setColorBlendState(const ColorBlendState &state) override;
 
+    /**
+     * \brief Declare the uniform buffer as dynamic. Its offset is given when
+     * the resource set is bound, so the descriptor set can be reused by the
+     * draws using different regions of the same buffer, such as the
+     * allocations from the transient buffer.
+     */
+    void setDynamicUniformBuffer(std::uint32_t set, std::uint32_t binding);
+    /**
+     * \brief Bake the sampler into the set layout as an immutable sampler.
+     * The binding must be a single sampler. Its descriptor is never written,
+     * so the resource given for it when binding the resource set is ignored
+     * and may be null. The samplers are shared by the sampler cache of the
+     * device, so the pipelines using the same samplers share the layouts.
+     */
+    void setImmutableSampler(
+        std::uint32_t set,
+        std::uint32_t binding,
+        std::shared_ptr<GpuSampler> sampler);
+
     std::shared_ptr<GraphicsPipeline> compile() override;
+    /**
+     * \brief Compile a snapshot of the current states on the worker threads
+     * of the device. Later changes to this compiler do not affect the result.
+     * Pipelines compiled this way don't become the parent of the pipelines
+     * compiled later by this compiler.
+     */
+    std::future<std::shared_ptr<GraphicsPipeline>> compileAsync();
 };
 }
@@ -0,0 +1,115 @@
+﻿#include "VulkanGraphicsStateCache.hpp"
+
+#include <cassert>
+
+#include "VulkanHelper.hpp"
+
+using namespace usagi::vulkan;
+
+void usagi::VulkanGraphicsStateCache::reset()
+{
+    mViewportMask = 0;
+    mScissorMask = 0;
+    mLineWidthSet = false;
+    mIndexBuffer = nullptr;
+    mVertexBuffers.fill(nullptr);
+    mDirtyVertexBuffers = 0;
+}
+
+void usagi::VulkanGraphicsStateCache::setViewport(
+    const vk::CommandBuffer cmd,
+    const std::uint32_t index,
+    const vk::Viewport &viewport)
+{
+    assert(index < 32);
+
+    const auto bit = 1u << index;
+    if(mViewports.size() <= index)
+        mViewports.resize(index + 1);
+    if((mViewportMask & bit) && mViewports[index] == viewport) return;
+
+    cmd.setViewport(index, 1, &viewport);
+    mViewports[index] = viewport;
+    mViewportMask |= bit;
+}
+
+void usagi::VulkanGraphicsStateCache::setScissor(
+    const vk::CommandBuffer cmd,
+    const std::uint32_t index,
+    const vk::Rect2D &scissor)
+{
+    assert(index < 32);
+
+    const auto bit = 1u << index;
+    if(mScissors.size() <= index)
+        mScissors.resize(index + 1);
+    if((mScissorMask & bit) && mScissors[index] == scissor) return;
+
+    cmd.setScissor(index, 1, &scissor);
+    mScissors[index] = scissor;
+    mScissorMask |= bit;
+}
+
+void usagi::VulkanGraphicsStateCache::setLineWidth(
+    const vk::CommandBuffer cmd,
+    const float width)
+{
+    if(mLineWidthSet && mLineWidth == width) return;
+
+    cmd.setLineWidth(width);
+    mLineWidth = width;
+    mLineWidthSet = true;
+}
+
+void usagi::VulkanGraphicsStateCache::bindIndexBuffer(
+    const vk::CommandBuffer cmd,
+    const vk::Buffer buffer,
+    const vk::DeviceSize offset,
+    const vk::IndexType type)
+{
+    if(mIndexBuffer == buffer && mIndexOffset == offset && mIndexType == type)
+        return;
+
+    cmd.bindIndexBuffer(buffer, offset, type);
+    mIndexBuffer = buffer;
+    mIndexOffset = offset;
+    mIndexType = type;
+}
+
+void usagi::VulkanGraphicsStateCache::bindVertexBuffer(
+    const std::uint32_t binding,
+    const vk::Buffer buffer,
+    const vk::DeviceSize offset)
+{
+    assert(binding < MAX_VERTEX_BINDINGS);
+    assert(buffer);
+
+    if(mVertexBuffers[binding] == buffer && mVertexOffsets[binding] == offset)
+        return;
+
+    mVertexBuffers[binding] = buffer;
+    mVertexOffsets[binding] = offset;
+    mDirtyVertexBuffers |= 1u << binding;
+}
+
+void usagi::VulkanGraphicsStateCache::recordVertexBuffers(
+    const vk::CommandBuffer cmd)
+{
+    // the unchanged bindings between the changed ones are recorded again so
+    // that the bindings are merged into fewer commands
+    const auto last = highestBit(mDirtyVertexBuffers);
+    auto first = lowestBit(mDirtyVertexBuffers);
+    while(first <= last)
+    {
+        auto end = first;
+        while(end <= last && mVertexBuffers[end])
+            ++end;
+        cmd.bindVertexBuffers(first, end - first,
+            &mVertexBuffers[first], &mVertexOffsets[first]);
+        // skip the unbound ones
+        first = end;
+        while(first <= last && !mVertexBuffers[first])
+            ++first;
+    }
+    mDirtyVertexBuffers = 0;
+}
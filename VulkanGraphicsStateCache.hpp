@@ -0,0 +1,84 @@
+﻿#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+namespace usagi
+{
+/**
+ * \brief The dynamic states and buffer bindings last recorded into a graphics
+ * command buffer, so that setting the same states again records nothing.
+ * The vertex buffer bindings are deferred until the next draw and recorded
+ * with one vkCmdBindVertexBuffers for each run of adjacent bindings.
+ *
+ * The states persist across render passes and pipelines within a command
+ * buffer, since all the pipelines are created with the same dynamic states.
+ * They are undefined at the beginning of the command buffer and after
+ * executing secondary command buffers, where reset() must be called.
+ */
+class VulkanGraphicsStateCache
+{
+public:
+    static constexpr std::uint32_t MAX_VERTEX_BINDINGS = 32;
+
+private:
+    std::vector<vk::Viewport> mViewports;
+    std::vector<vk::Rect2D> mScissors;
+    // bit i is set if the state i is recorded
+    std::uint32_t mViewportMask = 0;
+    std::uint32_t mScissorMask = 0;
+    float mLineWidth = 0.f;
+    bool mLineWidthSet = false;
+
+    vk::Buffer mIndexBuffer;
+    vk::DeviceSize mIndexOffset = 0;
+    vk::IndexType mIndexType = vk::IndexType::eUint16;
+
+    // null buffers are not bound
+    std::array<vk::Buffer, MAX_VERTEX_BINDINGS> mVertexBuffers;
+    std::array<vk::DeviceSize, MAX_VERTEX_BINDINGS> mVertexOffsets { };
+    // the bindings changed since the last draw
+    std::uint32_t mDirtyVertexBuffers = 0;
+
+    void recordVertexBuffers(vk::CommandBuffer cmd);
+
+public:
+    /**
+     * \brief Forget all the states.
+     */
+    void reset();
+
+    void setViewport(
+        vk::CommandBuffer cmd,
+        std::uint32_t index,
+        const vk::Viewport &viewport);
+    void setScissor(
+        vk::CommandBuffer cmd,
+        std::uint32_t index,
+        const vk::Rect2D &scissor);
+    void setLineWidth(vk::CommandBuffer cmd, float width);
+    void bindIndexBuffer(
+        vk::CommandBuffer cmd,
+        vk::Buffer buffer,
+        vk::DeviceSize offset,
+        vk::IndexType type);
+
+    /**
+     * \brief Recorded by the next flushVertexBuffers().
+     */
+    void bindVertexBuffer(
+        std::uint32_t binding,
+        vk::Buffer buffer,
+        vk::DeviceSize offset);
+    /**
+     * \brief Record the changed vertex buffer bindings before a draw.
+     */
+    void flushVertexBuffers(const vk::CommandBuffer cmd)
+    {
+        if(mDirtyVertexBuffers) recordVertexBuffers(cmd);
+    }
+};
+}
@@ -0,0 +1,92 @@
+﻿#include "VulkanGrowableMemoryPool.hpp"
+
+#include <string>
+
+#include "VulkanGpuDevice.hpp"
+#include "VulkanHelper.hpp"
+
+usagi::VulkanGrowableBufferPool::VulkanGrowableBufferPool(
+    VulkanGpuDevice *device,
+    const char *name,
+    VulkanMemoryPoolConfig config,
+    const vk::MemoryPropertyFlags mem_properties,
+    const vk::MemoryPropertyFlags preferred_properties,
+    const vk::BufferUsageFlags usages)
+    : VulkanGrowableMemoryPool(device, name, std::move(config))
+    , mMemoryProperties(mem_properties)
+    , mPreferredProperties(preferred_properties)
+    , mUsages(usages)
+{
+    // allocate the first block eagerly so that exhausting the device memory
+    // is detected at startup.
+    if(!mConfig.lazy)
+        mBlocks.push_back({ createBlock(mConfig.block_size) });
+}
+
+std::unique_ptr<usagi::VulkanBufferMemoryPool<usagi::VulkanSubAllocator>>
+    usagi::VulkanGrowableBufferPool::createBlock(const std::size_t size)
+{
+    auto block =
+        std::make_unique<VulkanBufferMemoryPool<VulkanSubAllocator>>(
+            mDevice, size, mMemoryProperties, mPreferredProperties, mUsages,
+            [&](const vk::MemoryRequirements &req) {
+                return createSubAllocator(mConfig, req);
+            }
+        );
+    // the buffers are sub-allocated so only the blocks can be named
+    if(mDevice->debugUtilsEnabled())
+    {
+        const auto name = std::string(mName) + " memory pool block";
+        mDevice->setObjectName(vk::ObjectType::eBuffer,
+            vulkan::handleValue(block->buffer()), name.c_str());
+    }
+    return std::move(block);
+}
+
+std::shared_ptr<usagi::VulkanBufferAllocation>
+    usagi::VulkanGrowableBufferPool::allocate(const std::size_t size)
+{
+    return allocateFromBlocks(size, [&](auto &&block) {
+        return block.allocate(size);
+    });
+}
+
+usagi::VulkanGrowableImagePool::VulkanGrowableImagePool(
+    VulkanGpuDevice *device,
+    const char *name,
+    VulkanMemoryPoolConfig config,
+    const vk::MemoryPropertyFlags mem_properties,
+    const vk::MemoryPropertyFlags preferred_properties,
+    const vk::ImageUsageFlags usages)
+    : VulkanGrowableMemoryPool(device, name, std::move(config))
+    , mMemoryProperties(mem_properties)
+    , mPreferredProperties(preferred_properties)
+    , mUsages(usages)
+{
+    if(!mConfig.lazy)
+        mBlocks.push_back({ createBlock(mConfig.block_size) });
+}
+
+std::unique_ptr<usagi::VulkanImageMemoryPool<usagi::VulkanSubAllocator>>
+    usagi::VulkanGrowableImagePool::createBlock(const std::size_t size)
+{
+    return std::make_unique<VulkanImageMemoryPool<VulkanSubAllocator>>(
+        mDevice, size, mMemoryProperties, mPreferredProperties, mUsages,
+        [&](const vk::MemoryRequirements &req) {
+            return createSubAllocator(mConfig, req);
+        }
+    );
+}
+
+std::shared_ptr<usagi::VulkanPooledImage>
+    usagi::VulkanGrowableImagePool::createPooledImage(
+        const GpuImageCreateInfo &info,
+        const VulkanImageCreateInfo &vk_info)
+{
+    // the image is created once and bound to whichever block has the space
+    auto image = VulkanMemoryPool::createImage(mDevice, info, vk_info);
+    const auto req = mDevice->device().getImageMemoryRequirements(image.get());
+    return allocateFromBlocks(req.size + req.alignment, [&](auto &&block) {
+        return block.createPooledImage(image, req, info, vk_info);
+    });
+}
@@ -0,0 +1,203 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Core/Logging.hpp>
+#include <Usagi/Utility/Noncopyable.hpp>
+
+#include "VulkanMemoryPool.hpp"
+#include "VulkanSubAllocator.hpp"
+
+namespace usagi
+{
+/**
+ * \brief A list of memory pools each owning one device memory block. Blocks
+ * are added when the existing ones cannot satisfy an allocation and released
+ * after being empty for a number of frames. The first block is always kept.
+ * It is allocated when the pool is created unless the pool is lazy.
+ *
+ * Allocations larger than the configured block size get a block of their
+ * own.
+ *
+ * The pools are shared by the threads recording command lists, so the block
+ * list is guarded by a mutex and each block guards its own sub-allocator.
+ */
+template <typename BlockPool>
+class VulkanGrowableMemoryPool : Noncopyable
+{
+protected:
+    VulkanGpuDevice *mDevice = nullptr;
+    const char * const mName;
+    const VulkanMemoryPoolConfig mConfig;
+
+    struct Block
+    {
+        std::unique_ptr<BlockPool> pool;
+        // the frame when the block was first seen empty. 0 if it is in use.
+        std::uint64_t empty_since = 0;
+    };
+    std::vector<Block> mBlocks;
+    mutable std::mutex mMutex;
+
+    virtual std::unique_ptr<BlockPool> createBlock(std::size_t size) = 0;
+
+    /**
+     * \brief Try the blocks in order and add a new one if none of them has
+     * enough space. The earlier blocks are filled first so that the later
+     * ones are more likely to become empty.
+     */
+    template <typename AllocFunc>
+    auto allocateFromBlocks(const std::size_t size, AllocFunc func)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for(auto &&b : mBlocks)
+        {
+            try
+            {
+                auto allocation = func(*b.pool);
+                b.empty_since = 0;
+                return std::move(allocation);
+            }
+            catch(const std::bad_alloc &)
+            {
+            }
+        }
+
+        if(mConfig.max_blocks != 0 && mBlocks.size() >= mConfig.max_blocks)
+        {
+            LOG(warn, "The {} memory pool reached its limit of {} blocks.",
+                mName, mConfig.max_blocks);
+            USAGI_THROW(std::bad_alloc());
+        }
+
+        const auto block_size = std::max(mConfig.block_size, size);
+        LOG(info, "Growing the {} memory pool by {} bytes to {} blocks.",
+            mName, block_size, mBlocks.size() + 1);
+        Block block;
+        block.pool = createBlock(block_size);
+        auto allocation = func(*block.pool);
+        mBlocks.push_back(std::move(block));
+        return std::move(allocation);
+    }
+
+public:
+    VulkanGrowableMemoryPool(
+        VulkanGpuDevice *device,
+        const char *name,
+        VulkanMemoryPoolConfig config)
+        : mDevice(device)
+        , mName(name)
+        , mConfig(std::move(config))
+    {
+    }
+
+    virtual ~VulkanGrowableMemoryPool() = default;
+
+    /**
+     * \brief Free the blocks which have been empty for the configured number
+     * of frames.
+     */
+    void releaseEmptyBlocks(const std::uint64_t frame_number)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for(std::size_t i = 1; i < mBlocks.size();)
+        {
+            auto &b = mBlocks[i];
+            if(b.pool->allocator()->usedSize() != 0)
+            {
+                b.empty_since = 0;
+                ++i;
+                continue;
+            }
+            if(b.empty_since == 0)
+                b.empty_since = frame_number;
+            if(frame_number - b.empty_since >= mConfig.release_delay)
+            {
+                LOG(info, "Releasing an empty block of the {} memory pool.",
+                    mName);
+                mBlocks.erase(mBlocks.begin() + i);
+                continue;
+            }
+            ++i;
+        }
+    }
+
+    VulkanSubAllocatorStatistics statistics() const
+    {
+        VulkanSubAllocatorStatistics stats;
+        std::lock_guard<std::mutex> lock(mMutex);
+        for(auto &&b : mBlocks)
+        {
+            const auto s = b.pool->allocator()->statistics();
+            stats.total_size += s.total_size;
+            stats.used_size += s.used_size;
+            stats.free_size += s.free_size;
+            stats.largest_free_block = std::max(
+                stats.largest_free_block, s.largest_free_block);
+            stats.allocation_count += s.allocation_count;
+            stats.free_block_count += s.free_block_count;
+            stats.wasted_size += s.wasted_size;
+        }
+        return stats;
+    }
+
+    VulkanGpuDevice * device() const { return mDevice; }
+    std::size_t blockCount() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mBlocks.size();
+    }
+};
+
+class VulkanGrowableBufferPool
+    : public VulkanGrowableMemoryPool<VulkanBufferMemoryPool<VulkanSubAllocator>>
+{
+    const vk::MemoryPropertyFlags mMemoryProperties;
+    const vk::MemoryPropertyFlags mPreferredProperties;
+    const vk::BufferUsageFlags mUsages;
+
+protected:
+    std::unique_ptr<VulkanBufferMemoryPool<VulkanSubAllocator>> createBlock(
+        std::size_t size) override;
+
+public:
+    VulkanGrowableBufferPool(
+        VulkanGpuDevice *device,
+        const char *name,
+        VulkanMemoryPoolConfig config,
+        vk::MemoryPropertyFlags mem_properties,
+        vk::MemoryPropertyFlags preferred_properties,
+        vk::BufferUsageFlags usages);
+
+    std::shared_ptr<VulkanBufferAllocation> allocate(std::size_t size);
+};
+
+class VulkanGrowableImagePool
+    : public VulkanGrowableMemoryPool<VulkanImageMemoryPool<VulkanSubAllocator>>
+{
+    const vk::MemoryPropertyFlags mMemoryProperties;
+    const vk::MemoryPropertyFlags mPreferredProperties;
+    const vk::ImageUsageFlags mUsages;
+
+protected:
+    std::unique_ptr<VulkanImageMemoryPool<VulkanSubAllocator>> createBlock(
+        std::size_t size) override;
+
+public:
+    VulkanGrowableImagePool(
+        VulkanGpuDevice *device,
+        const char *name,
+        VulkanMemoryPoolConfig config,
+        vk::MemoryPropertyFlags mem_properties,
+        vk::MemoryPropertyFlags preferred_properties,
+        vk::ImageUsageFlags usages);
+
+    std::shared_ptr<VulkanPooledImage> createPooledImage(
+        const GpuImageCreateInfo &info,
+        const VulkanImageCreateInfo &vk_info = { });
+};
+}
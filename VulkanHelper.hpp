@@ -3,6 +3,15 @@
 #include <vector>
 #include <algorithm>
 #include <type_traits>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include <Usagi/Utility/TypeCast.hpp>
 
 namespace usagi::vulkan
 {
@@ -19,4 +28,75 @@ auto transformObjects(SrcContainer &src, TransFunc func)
     std::transform(src.begin(), src.end(), std::back_inserter(dest), func);
     return dest;
 }
+
+/**
+ * \brief Get the value of a Vulkan handle as an integer so that it can be
+ * used as a key. Non-dispatchable handles are pointers on 64-bit platforms
+ * and 64-bit integers otherwise.
+ */
+template <typename Handle>
+std::uint64_t handleValue(const Handle &handle)
+{
+    static_assert(sizeof(Handle) <= sizeof(std::uint64_t));
+    std::uint64_t value = 0;
+    std::memcpy(&value, &handle, sizeof(Handle));
+    return value;
+}
+
+inline void hashCombine(std::size_t &seed, const std::uint64_t value)
+{
+    // from boost::hash_combine
+    seed ^= std::hash<std::uint64_t>()(value) +
+        0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+/**
+ * \brief The index of the lowest set bit. The value must not be 0.
+ */
+inline std::uint32_t lowestBit(const std::uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+/**
+ * \brief The index of the highest set bit. The value must not be 0.
+ */
+inline std::uint32_t highestBit(const std::uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+/**
+ * \brief Downcast an object of the engine interfaces to the Vulkan type
+ * implementing it. The objects passed to the backend are created by it, so
+ * the type is only checked in debug builds or with
+ * USAGI_VULKAN_CHECKED_CASTS, sparing the RTTI lookup on the hot paths.
+ * Cross casts between the interfaces still need dynamic_cast.
+ */
+template <typename Derived, typename Base>
+Derived & backendCast(Base *object)
+{
+#if !defined(NDEBUG) || defined(USAGI_VULKAN_CHECKED_CASTS)
+    return dynamic_cast_ref<Derived>(object);
+#else
+    return *static_cast<Derived *>(object);
+#endif
+}
+
+inline std::size_t alignUp(const std::size_t value, const std::size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
 }
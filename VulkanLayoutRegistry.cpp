@@ -0,0 +1,348 @@
+﻿#include "VulkanLayoutRegistry.hpp"
+
+#include <algorithm>
+
+#include <Usagi/Core/Logging.hpp>
+
+#include "VulkanGpuDevice.hpp"
+#include "VulkanHelper.hpp"
+#include "VulkanSampler.hpp"
+
+using namespace usagi::vulkan;
+
+usagi::VulkanDescriptorSetLayout::VulkanDescriptorSetLayout(
+    VulkanLayoutRegistry *registry,
+    const std::size_t hash,
+    vk::UniqueDescriptorSetLayout layout,
+    std::vector<vk::DescriptorSetLayoutBinding> bindings,
+    std::vector<std::shared_ptr<VulkanSampler>> immutable_samplers)
+    : mRegistry(registry)
+    , mHash(hash)
+    , mLayout(std::move(layout))
+    , mBindings(std::move(bindings))
+    , mImmutableSamplers(std::move(immutable_samplers))
+{
+    mCounts.sets = 1;
+    for(auto &&b : mBindings)
+        mCounts.add(b.descriptorType, b.descriptorCount);
+}
+
+usagi::VulkanDescriptorSetLayout::~VulkanDescriptorSetLayout()
+{
+    mRegistry->remove(this);
+    // the cached descriptor sets allocated using the layout can't be used
+    // anymore.
+    mRegistry->device()->descriptorSetCache()->evict(
+        handleValue(mLayout.get()));
+}
+
+const vk::DescriptorSetLayoutBinding &
+    usagi::VulkanDescriptorSetLayout::binding(
+        const std::uint32_t binding) const
+{
+    // access by index if no binding is skipped
+    if(binding < mBindings.size())
+    {
+        auto &vk_binding = mBindings[binding];
+        if(vk_binding.binding == binding)
+            return vk_binding;
+    }
+    const auto iter = std::lower_bound(mBindings.begin(), mBindings.end(),
+        binding, [](auto &&b, auto &&v) { return b.binding < v; });
+    if(iter == mBindings.end() || iter->binding != binding)
+    {
+        LOG(error, "Nonexisting descriptor binding = {}", binding);
+        USAGI_THROW(std::logic_error("Referenced invalid resource."));
+    }
+    return *iter;
+}
+
+usagi::VulkanPipelineLayout::VulkanPipelineLayout(
+    VulkanLayoutRegistry *registry,
+    const std::size_t hash,
+    vk::UniquePipelineLayout layout,
+    std::vector<std::shared_ptr<VulkanDescriptorSetLayout>> set_layouts,
+    std::vector<vk::PushConstantRange> push_constant_ranges)
+    : mRegistry(registry)
+    , mHash(hash)
+    , mLayout(std::move(layout))
+    , mSetLayouts(std::move(set_layouts))
+    , mPushConstantRanges(std::move(push_constant_ranges))
+{
+    buildPushConstantSpans();
+}
+
+void usagi::VulkanPipelineLayout::buildPushConstantSpans()
+{
+    std::vector<std::uint32_t> bounds;
+    for(auto &&r : mPushConstantRanges)
+    {
+        bounds.push_back(r.offset);
+        bounds.push_back(r.offset + r.size);
+        mPushConstantSize = std::max(mPushConstantSize, r.offset + r.size);
+    }
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+    for(std::size_t i = 1; i < bounds.size(); ++i)
+    {
+        const auto begin = bounds[i - 1], end = bounds[i];
+        vk::ShaderStageFlags stages;
+        for(auto &&r : mPushConstantRanges)
+        {
+            if(r.offset <= begin && r.offset + r.size >= end)
+                stages |= r.stageFlags;
+        }
+        // a gap between the ranges
+        if(!stages) continue;
+        if(!mPushConstantSpans.empty())
+        {
+            auto &last = mPushConstantSpans.back();
+            if(last.offset + last.size == begin && last.stageFlags == stages)
+            {
+                last.size += end - begin;
+                continue;
+            }
+        }
+        mPushConstantSpans.emplace_back(stages, begin, end - begin);
+    }
+}
+
+usagi::VulkanPipelineLayout::~VulkanPipelineLayout()
+{
+    mRegistry->remove(this);
+}
+
+usagi::VulkanDescriptorSetLayout * usagi::VulkanPipelineLayout::setLayout(
+    const std::uint32_t set_id) const
+{
+    if(set_id >= mSetLayouts.size()) return nullptr;
+    return mSetLayouts[set_id].get();
+}
+
+std::uint32_t usagi::VulkanPipelineLayout::compatibleSetCount(
+    const VulkanPipelineLayout &other) const
+{
+    if(this == &other) return setCount();
+
+    // layouts are compatible for set N only if they were created with the
+    // same push constant ranges and identical set layouts for sets 0 to N.
+    if(mPushConstantRanges != other.mPushConstantRanges)
+        return 0;
+
+    std::uint32_t count = 0;
+    const auto n = std::min(setCount(), other.setCount());
+    while(count < n && mSetLayouts[count] == other.mSetLayouts[count])
+        ++count;
+    return count;
+}
+
+void usagi::VulkanPipelineLayout::pushConstants(
+    const vk::CommandBuffer cmd,
+    const std::uint32_t offset,
+    const std::uint32_t size,
+    const void *block) const
+{
+    const auto bytes = static_cast<const char *>(block);
+    const auto end = offset + size;
+    for(auto &&s : mPushConstantSpans)
+    {
+        const auto span_begin = std::max(offset, s.offset);
+        const auto span_end = std::min(end, s.offset + s.size);
+        if(span_begin >= span_end) continue;
+        cmd.pushConstants(mLayout.get(), s.stageFlags, span_begin,
+            span_end - span_begin, bytes + span_begin);
+    }
+}
+
+usagi::VulkanLayoutRegistry::VulkanLayoutRegistry(VulkanGpuDevice *device)
+    : mDevice(device)
+{
+}
+
+namespace
+{
+std::size_t hashBindings(
+    const std::vector<vk::DescriptorSetLayoutBinding> &bindings)
+{
+    std::size_t seed = 0;
+    for(auto &&b : bindings)
+    {
+        hashCombine(seed, b.binding);
+        hashCombine(seed, static_cast<std::uint64_t>(b.descriptorType));
+        hashCombine(seed, b.descriptorCount);
+        hashCombine(seed, static_cast<VkShaderStageFlags>(b.stageFlags));
+        hashCombine(seed,
+            reinterpret_cast<std::uintptr_t>(b.pImmutableSamplers));
+    }
+    return seed;
+}
+
+void canonicalizeBindings(
+    std::vector<vk::DescriptorSetLayoutBinding> &bindings)
+{
+    std::stable_sort(bindings.begin(), bindings.end(),
+        [](auto &&l, auto &&r) { return l.binding < r.binding; });
+
+    // merge the bindings used by multiple stages
+    auto out = bindings.begin();
+    for(auto i = bindings.begin(); i != bindings.end(); ++i)
+    {
+        if(out != bindings.begin())
+        {
+            auto &prev = *(out - 1);
+            if(prev.binding == i->binding)
+            {
+                if(prev.descriptorType != i->descriptorType ||
+                    prev.descriptorCount != i->descriptorCount ||
+                    prev.pImmutableSamplers != i->pImmutableSamplers)
+                {
+                    LOG(error, "Binding {} is declared differently in "
+                        "multiple shader stages.", i->binding);
+                    USAGI_THROW(std::logic_error(
+                        "Conflicting descriptor bindings."));
+                }
+                prev.stageFlags |= i->stageFlags;
+                continue;
+            }
+        }
+        *out++ = *i;
+    }
+    bindings.erase(out, bindings.end());
+}
+}
+
+std::shared_ptr<usagi::VulkanDescriptorSetLayout>
+    usagi::VulkanLayoutRegistry::descriptorSetLayout(
+        std::vector<vk::DescriptorSetLayoutBinding> bindings,
+        std::vector<std::shared_ptr<VulkanSampler>> immutable_samplers)
+{
+    canonicalizeBindings(bindings);
+    const auto hash = hashBindings(bindings);
+
+    // the last references to the layouts may be dropped here, which must
+    // happen after releasing the lock since the destructors lock it, too.
+    std::vector<std::shared_ptr<VulkanDescriptorSetLayout>> candidates;
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    const auto range = mSetLayouts.equal_range(hash);
+    for(auto i = range.first; i != range.second; ++i)
+    {
+        // the layout may be being destroyed on another thread
+        auto layout = i->second.weak.lock();
+        if(layout && layout->mBindings == bindings)
+            return std::move(layout);
+        candidates.push_back(std::move(layout));
+    }
+
+    vk::DescriptorSetLayoutCreateInfo info;
+    info.setBindingCount(static_cast<uint32_t>(bindings.size()));
+    info.setPBindings(bindings.data());
+    auto vk_layout = mDevice->device().createDescriptorSetLayoutUnique(info);
+
+    auto layout = std::make_shared<VulkanDescriptorSetLayout>(
+        this, hash, std::move(vk_layout), std::move(bindings),
+        std::move(immutable_samplers));
+    Entry<VulkanDescriptorSetLayout> entry;
+    entry.object = layout.get();
+    entry.weak = layout;
+    mSetLayouts.emplace(hash, std::move(entry));
+
+    return std::move(layout);
+}
+
+std::shared_ptr<usagi::VulkanPipelineLayout>
+    usagi::VulkanLayoutRegistry::pipelineLayout(
+        std::vector<std::shared_ptr<VulkanDescriptorSetLayout>> set_layouts,
+        std::vector<vk::PushConstantRange> push_constant_ranges)
+{
+    std::size_t hash = 0;
+    for(auto &&l : set_layouts)
+        hashCombine(hash, handleValue(l->layout()));
+    for(auto &&r : push_constant_ranges)
+    {
+        hashCombine(hash, static_cast<VkShaderStageFlags>(r.stageFlags));
+        hashCombine(hash, r.offset);
+        hashCombine(hash, r.size);
+    }
+
+    std::vector<std::shared_ptr<VulkanPipelineLayout>> candidates;
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    const auto range = mPipelineLayouts.equal_range(hash);
+    for(auto i = range.first; i != range.second; ++i)
+    {
+        auto layout = i->second.weak.lock();
+        if(layout &&
+            layout->mSetLayouts == set_layouts &&
+            layout->mPushConstantRanges == push_constant_ranges)
+            return std::move(layout);
+        candidates.push_back(std::move(layout));
+    }
+
+    const auto vk_set_layouts = transformObjects(set_layouts,
+        [](auto &&l) { return l->layout(); });
+
+    vk::PipelineLayoutCreateInfo info;
+    info.setSetLayoutCount(static_cast<uint32_t>(vk_set_layouts.size()));
+    info.setPSetLayouts(vk_set_layouts.data());
+    info.setPushConstantRangeCount(
+        static_cast<uint32_t>(push_constant_ranges.size()));
+    info.setPPushConstantRanges(push_constant_ranges.data());
+    auto vk_layout = mDevice->device().createPipelineLayoutUnique(info);
+
+    auto layout = std::make_shared<VulkanPipelineLayout>(
+        this, hash, std::move(vk_layout),
+        std::move(set_layouts), std::move(push_constant_ranges));
+    Entry<VulkanPipelineLayout> entry;
+    entry.object = layout.get();
+    entry.weak = layout;
+    mPipelineLayouts.emplace(hash, std::move(entry));
+
+    return std::move(layout);
+}
+
+void usagi::VulkanLayoutRegistry::remove(
+    const VulkanDescriptorSetLayout *layout)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // a new layout with the same content may have been registered after
+    // this one expired, so match the object address.
+    const auto range = mSetLayouts.equal_range(layout->mHash);
+    for(auto i = range.first; i != range.second; ++i)
+    {
+        if(i->second.object == layout)
+        {
+            mSetLayouts.erase(i);
+            return;
+        }
+    }
+}
+
+void usagi::VulkanLayoutRegistry::remove(const VulkanPipelineLayout *layout)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    const auto range = mPipelineLayouts.equal_range(layout->mHash);
+    for(auto i = range.first; i != range.second; ++i)
+    {
+        if(i->second.object == layout)
+        {
+            mPipelineLayouts.erase(i);
+            return;
+        }
+    }
+}
+
+std::size_t usagi::VulkanLayoutRegistry::descriptorSetLayoutCount()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSetLayouts.size();
+}
+
+std::size_t usagi::VulkanLayoutRegistry::pipelineLayoutCount()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mPipelineLayouts.size();
+}
@@ -0,0 +1,187 @@
+﻿#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+#include "VulkanDescriptorPoolAllocator.hpp"
+
+namespace usagi
+{
+class VulkanGpuDevice;
+class VulkanLayoutRegistry;
+class VulkanSampler;
+
+/**
+ * \brief A descriptor set layout shared by all pipelines using the same
+ * bindings. The bindings are sorted by the binding numbers.
+ *
+ * The sampler bindings may have immutable samplers baked in, which are kept
+ * alive by the layout and never written to the descriptor sets.
+ */
+class VulkanDescriptorSetLayout : Noncopyable
+{
+    friend class VulkanLayoutRegistry;
+
+    VulkanLayoutRegistry *mRegistry = nullptr;
+    std::size_t mHash = 0;
+    vk::UniqueDescriptorSetLayout mLayout;
+    std::vector<vk::DescriptorSetLayoutBinding> mBindings;
+    // referenced by the pImmutableSamplers of the bindings
+    std::vector<std::shared_ptr<VulkanSampler>> mImmutableSamplers;
+    VulkanDescriptorCounts mCounts;
+
+public:
+    VulkanDescriptorSetLayout(
+        VulkanLayoutRegistry *registry,
+        std::size_t hash,
+        vk::UniqueDescriptorSetLayout layout,
+        std::vector<vk::DescriptorSetLayoutBinding> bindings,
+        std::vector<std::shared_ptr<VulkanSampler>> immutable_samplers);
+    ~VulkanDescriptorSetLayout();
+
+    vk::DescriptorSetLayout layout() const { return mLayout.get(); }
+    const std::vector<vk::DescriptorSetLayoutBinding> & bindings() const
+    {
+        return mBindings;
+    }
+    /**
+     * \brief Throws if the layout has no such binding.
+     */
+    const vk::DescriptorSetLayoutBinding & binding(
+        std::uint32_t binding) const;
+    vk::DescriptorType descriptorType(std::uint32_t binding) const
+    {
+        return this->binding(binding).descriptorType;
+    }
+    /**
+     * \brief The amount of descriptors required by one set of this layout.
+     */
+    const VulkanDescriptorCounts & descriptorCounts() const { return mCounts; }
+};
+
+/**
+ * \brief A pipeline layout shared by all pipelines using the same set layouts
+ * and push constant ranges. The set layouts are indexed by set numbers.
+ */
+class VulkanPipelineLayout : Noncopyable
+{
+    friend class VulkanLayoutRegistry;
+
+    VulkanLayoutRegistry *mRegistry = nullptr;
+    std::size_t mHash = 0;
+    vk::UniquePipelineLayout mLayout;
+    std::vector<std::shared_ptr<VulkanDescriptorSetLayout>> mSetLayouts;
+    std::vector<vk::PushConstantRange> mPushConstantRanges;
+    // the push constant bytes split into disjoint ranges by the stages
+    // declaring them, sorted by the offsets
+    std::vector<vk::PushConstantRange> mPushConstantSpans;
+    std::uint32_t mPushConstantSize = 0;
+
+    void buildPushConstantSpans();
+
+public:
+    VulkanPipelineLayout(
+        VulkanLayoutRegistry *registry,
+        std::size_t hash,
+        vk::UniquePipelineLayout layout,
+        std::vector<std::shared_ptr<VulkanDescriptorSetLayout>> set_layouts,
+        std::vector<vk::PushConstantRange> push_constant_ranges);
+    ~VulkanPipelineLayout();
+
+    vk::PipelineLayout layout() const { return mLayout.get(); }
+    std::uint32_t setCount() const
+    {
+        return static_cast<std::uint32_t>(mSetLayouts.size());
+    }
+    /**
+     * \return The set layout, or nullptr if the set number is out of range.
+     */
+    VulkanDescriptorSetLayout * setLayout(std::uint32_t set_id) const;
+
+    /**
+     * \brief The number of leading sets for which the two layouts are
+     * compatible, whose descriptor sets stay valid after switching between
+     * the pipelines using the layouts.
+     */
+    std::uint32_t compatibleSetCount(const VulkanPipelineLayout &other) const;
+
+    /**
+     * \brief The end of the last push constant range.
+     */
+    std::uint32_t pushConstantSize() const { return mPushConstantSize; }
+    /**
+     * \brief Record the bytes [offset, offset + size) of the push constant
+     * block. vkCmdPushConstants must name the stages of all the ranges
+     * overlapping the bytes, so the bytes are pushed with as few commands
+     * as the stages declaring them allow, usually one.
+     * \param block The whole push constant block, not only the bytes pushed.
+     */
+    void pushConstants(
+        vk::CommandBuffer cmd,
+        std::uint32_t offset,
+        std::uint32_t size,
+        const void *block) const;
+};
+
+/**
+ * \brief Interns the descriptor set layouts and pipeline layouts by their
+ * contents, so that pipelines with the same layouts share the layout objects.
+ * Sharing the set layouts allows the cached descriptor sets to be used across
+ * pipelines, and sharing the pipeline layouts allows command lists to keep the
+ * bound sets when switching pipelines.
+ *
+ * The registry does not own the layouts. A layout is destroyed when the last
+ * pipeline using it is released. Thread-safe.
+ */
+class VulkanLayoutRegistry : Noncopyable
+{
+    VulkanGpuDevice *mDevice = nullptr;
+
+    std::mutex mMutex;
+    template <typename T>
+    struct Entry
+    {
+        T *object = nullptr;
+        std::weak_ptr<T> weak;
+    };
+    std::unordered_multimap<std::size_t, Entry<VulkanDescriptorSetLayout>>
+        mSetLayouts;
+    std::unordered_multimap<std::size_t, Entry<VulkanPipelineLayout>>
+        mPipelineLayouts;
+
+    friend class VulkanDescriptorSetLayout;
+    friend class VulkanPipelineLayout;
+
+    void remove(const VulkanDescriptorSetLayout *layout);
+    void remove(const VulkanPipelineLayout *layout);
+
+public:
+    explicit VulkanLayoutRegistry(VulkanGpuDevice *device);
+
+    VulkanGpuDevice * device() const { return mDevice; }
+
+    /**
+     * \brief Find or create the set layout with the bindings. The bindings
+     * of the same binding number from different shader stages are merged.
+     * \param immutable_samplers The samplers whose handles are referenced by
+     * the pImmutableSamplers of the bindings. Layouts are told apart by the
+     * addresses of the handles, which are unique while the samplers live.
+     */
+    std::shared_ptr<VulkanDescriptorSetLayout> descriptorSetLayout(
+        std::vector<vk::DescriptorSetLayoutBinding> bindings,
+        std::vector<std::shared_ptr<VulkanSampler>> immutable_samplers = { });
+
+    std::shared_ptr<VulkanPipelineLayout> pipelineLayout(
+        std::vector<std::shared_ptr<VulkanDescriptorSetLayout>> set_layouts,
+        std::vector<vk::PushConstantRange> push_constant_ranges);
+
+    std::size_t descriptorSetLayoutCount();
+    std::size_t pipelineLayoutCount();
+};
+}
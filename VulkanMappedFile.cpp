@@ -0,0 +1,91 @@
+﻿#include "VulkanMappedFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Core/Logging.hpp>
+
+usagi::VulkanMappedFile::VulkanMappedFile(const std::filesystem::path &path)
+{
+    const auto fail = [&]() {
+        LOG(error, "Could not map file {}", path.u8string());
+        USAGI_THROW(std::runtime_error("Failed to map file."));
+    };
+
+#ifdef _WIN32
+    const auto file = CreateFileW(path.c_str(), GENERIC_READ,
+        FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE) fail();
+    mFile = file;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size))
+    {
+        CloseHandle(file);
+        fail();
+    }
+    mSize = static_cast<std::size_t>(size.QuadPart);
+    if(mSize == 0) return;
+
+    mMapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(!mMapping)
+    {
+        CloseHandle(file);
+        fail();
+    }
+    mData = static_cast<const std::byte *>(
+        MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    if(!mData)
+    {
+        CloseHandle(mMapping);
+        CloseHandle(file);
+        fail();
+    }
+#else
+    const auto fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) fail();
+
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        close(fd);
+        fail();
+    }
+    mSize = static_cast<std::size_t>(st.st_size);
+    if(mSize != 0)
+    {
+        const auto addr = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(addr == MAP_FAILED)
+        {
+            close(fd);
+            fail();
+        }
+        // the pages are read in order by the uploads
+        madvise(addr, mSize, MADV_SEQUENTIAL);
+        mData = static_cast<const std::byte *>(addr);
+    }
+    // the mapping stays valid after closing the file
+    close(fd);
+#endif
+}
+
+usagi::VulkanMappedFile::~VulkanMappedFile()
+{
+#ifdef _WIN32
+    if(mData) UnmapViewOfFile(mData);
+    if(mMapping) CloseHandle(mMapping);
+    if(mFile) CloseHandle(mFile);
+#else
+    if(mData) munmap(const_cast<std::byte *>(mData), mSize);
+#endif
+}
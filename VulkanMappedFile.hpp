@@ -0,0 +1,35 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+/**
+ * \brief A read-only memory mapping of a whole file. The pages are loaded by
+ * the OS when first accessed, so the data can be copied straight into the
+ * staging buffers without reading the file into another buffer first.
+ */
+class VulkanMappedFile : Noncopyable
+{
+    const std::byte *mData = nullptr;
+    std::size_t mSize = 0;
+#ifdef _WIN32
+    void *mFile = nullptr;
+    void *mMapping = nullptr;
+#endif
+
+public:
+    /**
+     * \brief Throws std::runtime_error if the file can't be mapped.
+     */
+    explicit VulkanMappedFile(const std::filesystem::path &path);
+    ~VulkanMappedFile();
+
+    // null if the file is empty
+    const std::byte * data() const { return mData; }
+    std::size_t size() const { return mSize; }
+};
+}
@@ -0,0 +1,146 @@
+﻿#include "VulkanMemoryBudget.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cassert>
+
+#include <Usagi/Core/Logging.hpp>
+
+#include "VulkanDeviceCapabilities.hpp"
+
+usagi::VulkanMemoryBudget::VulkanMemoryBudget(
+    const vk::PhysicalDevice physical_device,
+    const VulkanDeviceCapabilities &capabilities,
+    const PFN_vkGetPhysicalDeviceMemoryProperties2KHR get_memory_properties2)
+    : mPhysicalDevice(physical_device)
+    , mGetMemoryProperties2(get_memory_properties2)
+{
+    mProperties = capabilities.memoryProperties();
+    mMaxAllocationCount = capabilities.limits().maxMemoryAllocationCount;
+    mHeaps.resize(mProperties.memoryHeapCount);
+    mAllocatedSizes.resize(mProperties.memoryHeapCount, 0);
+    update();
+
+    for(std::uint32_t i = 0; i < heapCount(); ++i)
+    {
+        LOG(info, "Memory heap #{}: {} bytes, budget {} bytes, {}",
+            i, mHeaps[i].size, mHeaps[i].budget, to_string(mHeaps[i].flags));
+    }
+    for(std::uint32_t i = 0; i < mProperties.memoryTypeCount; ++i)
+    {
+        LOG(info, "Memory type #{}: heap #{}, {}", i,
+            mProperties.memoryTypes[i].heapIndex,
+            to_string(mProperties.memoryTypes[i].propertyFlags));
+    }
+}
+
+void usagi::VulkanMemoryBudget::update()
+{
+#ifdef VK_EXT_memory_budget
+    if(mGetMemoryProperties2)
+    {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget { };
+        budget.sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2KHR properties { };
+        properties.sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+        properties.pNext = &budget;
+        mGetMemoryProperties2(mPhysicalDevice, &properties);
+
+        for(std::uint32_t i = 0; i < heapCount(); ++i)
+        {
+            auto &h = mHeaps[i];
+            h.size = mProperties.memoryHeaps[i].size;
+            h.flags = mProperties.memoryHeaps[i].flags;
+            h.budget = budget.heapBudget[i];
+            h.usage = budget.heapUsage[i];
+        }
+        return;
+    }
+#endif
+    for(std::uint32_t i = 0; i < heapCount(); ++i)
+    {
+        auto &h = mHeaps[i];
+        h.size = mProperties.memoryHeaps[i].size;
+        h.flags = mProperties.memoryHeaps[i].flags;
+        h.budget = h.size / 10 * 8;
+        h.usage = mAllocatedSizes[i];
+    }
+}
+
+std::vector<std::uint32_t> usagi::VulkanMemoryBudget::rankMemoryTypes(
+    const std::uint32_t memory_type_bits,
+    const vk::MemoryPropertyFlags &required,
+    const vk::MemoryPropertyFlags &preferred,
+    const vk::DeviceSize size) const
+{
+    const auto count_bits = [](const vk::MemoryPropertyFlags &flags) {
+        return static_cast<int>(std::bitset<32>(
+            static_cast<VkMemoryPropertyFlags>(flags)).count());
+    };
+    // the memory types which need device features
+    const vk::MemoryPropertyFlags special =
+        vk::MemoryPropertyFlagBits::eProtected |
+        vk::MemoryPropertyFlagBits::eLazilyAllocated;
+
+    std::vector<std::pair<int, std::uint32_t>> candidates;
+    for(std::uint32_t i = 0; i < mProperties.memoryTypeCount; ++i)
+    {
+        // the i-th bit is set only when that memory type is supported.
+        // https://www.khronos.org/registry/vulkan/specs/1.0/man/html/VkMemoryRequirements.html
+        if(!(memory_type_bits & 1u << i)) continue;
+        const auto flags = mProperties.memoryTypes[i].propertyFlags;
+        if((flags & required) != required) continue;
+        if(flags & special & ~(required | preferred)) continue;
+
+        int score = 0;
+        if(mHeaps[heapIndex(i)].available() < size)
+            score -= 1000;
+        score += 10 * count_bits(flags & preferred);
+        score -= count_bits(flags & ~(required | preferred));
+        candidates.emplace_back(score, i);
+    }
+    // the types are listed by the driver in the order of performance when
+    // the flags are the same
+    std::stable_sort(candidates.begin(), candidates.end(),
+        [](auto &&l, auto &&r) { return l.first > r.first; });
+
+    std::vector<std::uint32_t> types;
+    types.reserve(candidates.size());
+    for(auto &&c : candidates)
+        types.push_back(c.second);
+    return std::move(types);
+}
+
+bool usagi::VulkanMemoryBudget::acquireAllocationSlot()
+{
+    if(mAllocationCount >= mMaxAllocationCount)
+        return false;
+    ++mAllocationCount;
+    return true;
+}
+
+void usagi::VulkanMemoryBudget::releaseAllocationSlot()
+{
+    assert(mAllocationCount > 0);
+    --mAllocationCount;
+}
+
+void usagi::VulkanMemoryBudget::onAllocated(
+    const std::uint32_t memory_type,
+    const vk::DeviceSize size)
+{
+    mAllocatedSizes[heapIndex(memory_type)] += size;
+    update();
+}
+
+void usagi::VulkanMemoryBudget::onFreed(
+    const std::uint32_t memory_type,
+    const vk::DeviceSize size)
+{
+    auto &allocated = mAllocatedSizes[heapIndex(memory_type)];
+    assert(allocated >= size);
+    allocated -= size;
+    update();
+}
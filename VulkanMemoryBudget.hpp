@@ -0,0 +1,109 @@
+﻿#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+class VulkanDeviceCapabilities;
+
+struct VulkanMemoryHeapBudget
+{
+    vk::DeviceSize size = 0;
+    vk::MemoryHeapFlags flags;
+    /**
+     * \brief How much memory the process can use from the heap without
+     * causing paging or allocation failures.
+     */
+    vk::DeviceSize budget = 0;
+    vk::DeviceSize usage = 0;
+
+    vk::DeviceSize available() const
+    {
+        return budget > usage ? budget - usage : 0;
+    }
+};
+
+/**
+ * \brief Tracks the usage of the memory heaps and selects memory types for
+ * allocations.
+ *
+ * With VK_EXT_memory_budget the budgets and usages reported by the driver
+ * are used, which account for other processes. Otherwise the budget of each
+ * heap is assumed to be 80% of its size and only the allocations made by the
+ * device are counted.
+ */
+class VulkanMemoryBudget : Noncopyable
+{
+    vk::PhysicalDevice mPhysicalDevice;
+    // null if VK_EXT_memory_budget is not enabled
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR mGetMemoryProperties2 =
+        nullptr;
+
+    vk::PhysicalDeviceMemoryProperties mProperties;
+    std::vector<VulkanMemoryHeapBudget> mHeaps;
+    // by the heap index
+    std::vector<vk::DeviceSize> mAllocatedSizes;
+
+    std::uint32_t mMaxAllocationCount = 0;
+    std::uint32_t mAllocationCount = 0;
+
+public:
+    VulkanMemoryBudget(
+        vk::PhysicalDevice physical_device,
+        const VulkanDeviceCapabilities &capabilities,
+        PFN_vkGetPhysicalDeviceMemoryProperties2KHR get_memory_properties2);
+
+    /**
+     * \brief Query the current budgets. Cheap enough to be called every frame.
+     */
+    void update();
+
+    /**
+     * \brief The memory types which can be used for the allocation, from the
+     * most to the least suitable. The types having all the required flags are
+     * ranked by whether the heap has enough budget left, how many of the
+     * preferred flags they have, and how few other flags they have.
+     */
+    std::vector<std::uint32_t> rankMemoryTypes(
+        std::uint32_t memory_type_bits,
+        const vk::MemoryPropertyFlags &required,
+        const vk::MemoryPropertyFlags &preferred,
+        vk::DeviceSize size) const;
+
+    /**
+     * \brief Count a vk::DeviceMemory object against
+     * maxMemoryAllocationCount.
+     * \return false if the limit is reached.
+     */
+    bool acquireAllocationSlot();
+    void releaseAllocationSlot();
+
+    void onAllocated(std::uint32_t memory_type, vk::DeviceSize size);
+    void onFreed(std::uint32_t memory_type, vk::DeviceSize size);
+
+    const vk::PhysicalDeviceMemoryProperties & properties() const
+    {
+        return mProperties;
+    }
+    const VulkanMemoryHeapBudget & heap(std::uint32_t index) const
+    {
+        return mHeaps[index];
+    }
+    std::uint32_t heapCount() const
+    {
+        return static_cast<std::uint32_t>(mHeaps.size());
+    }
+    std::uint32_t heapIndex(std::uint32_t memory_type) const
+    {
+        return mProperties.memoryTypes[memory_type].heapIndex;
+    }
+    bool usesBudgetExtension() const
+    {
+        return mGetMemoryProperties2 != nullptr;
+    }
+};
+}
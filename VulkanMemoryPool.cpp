@@ -6,6 +6,7 @@
 
 #include "VulkanGpuDevice.hpp"
 #include "VulkanEnumTranslation.hpp"
+#include "VulkanHelper.hpp"
 
 using namespace usagi::vulkan;
 
@@ -25,64 +26,113 @@ void usagi::VulkanMemoryPool::unmapMemory()
 }
 
 void usagi::VulkanMemoryPool::allocateDeviceMemory(
-    const vk::MemoryPropertyFlags &mem_properties)
+    const vk::MemoryPropertyFlags &mem_properties,
+    const vk::MemoryPropertyFlags &preferred_properties)
 {
-    const auto memory_properties =
-        mDevice->physicalDevice().getMemoryProperties();
+    auto *budget = mDevice->memoryBudget();
 
-    // find first heap supporting our needs and has enough space
-    for(uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i)
+    // each pool is a separate allocation and the count is limited
+    if(!budget->acquireAllocationSlot())
     {
-        // the i-th bit is set only when that memory type is supported.
-        // https://www.khronos.org/registry/vulkan/specs/1.0/man/html/VkMemoryRequirements.html
-        if((mMemoryRequirements.memoryTypeBits & 1 << i) &&
-            (memory_properties.memoryTypes[i].propertyFlags & mem_properties))
+        LOG(warn, "The number of device memory allocations reached "
+            "maxMemoryAllocationCount.");
+        USAGI_THROW(std::bad_alloc());
+    }
+
+    const auto types = budget->rankMemoryTypes(
+        mMemoryRequirements.memoryTypeBits,
+        mem_properties, preferred_properties,
+        mMemoryRequirements.size);
+    for(auto &&i : types)
+    {
+        vk::MemoryAllocateInfo info;
+        info.setAllocationSize(mMemoryRequirements.size);
+        info.setMemoryTypeIndex(i);
+        try
         {
-            vk::MemoryAllocateInfo info;
-            info.setAllocationSize(mMemoryRequirements.size);
-            info.setMemoryTypeIndex(i);
-            try
-            {
-                mMemory = mDevice->device().allocateMemoryUnique(info);
-                if(mem_properties & vk::MemoryPropertyFlagBits::eHostVisible)
-                    mapMemory();
-                return;
-            }
-            catch(const vk::OutOfHostMemoryError &e)
-            {
-                LOG(warn, "Host memory is exhausted: {}", e.what());
-            }
-            catch(const vk::OutOfDeviceMemoryError &e)
-            {
-                LOG(warn, "GPU memory heap {} is exhausted: {}",
-                    memory_properties.memoryTypes[i].heapIndex, e.what());
-            }
+            mMemory = mDevice->device().allocateMemoryUnique(info);
+            mMemoryType = i;
+            budget->onAllocated(i, mMemoryRequirements.size);
+            if(mem_properties & vk::MemoryPropertyFlagBits::eHostVisible)
+                mapMemory();
+            return;
+        }
+        catch(const vk::OutOfHostMemoryError &e)
+        {
+            LOG(warn, "Host memory is exhausted: {}", e.what());
+        }
+        catch(const vk::OutOfDeviceMemoryError &e)
+        {
+            LOG(warn, "GPU memory heap {} is exhausted: {}",
+                budget->heapIndex(i), e.what());
         }
     }
+    budget->releaseAllocationSlot();
     USAGI_THROW(std::bad_alloc());
 }
 
 vk::UniqueImage usagi::VulkanMemoryPool::createImage(
-    const GpuImageCreateInfo &info) const
+    VulkanGpuDevice *device,
+    const GpuImageCreateInfo &info,
+    const VulkanImageCreateInfo &vk_info)
 {
-    vk::ImageCreateInfo vk_info;
-    vk_info.setImageType(vk::ImageType::e2D);
-    vk_info.setFormat(translate(info.format));
-    vk_info.extent.width = info.size.x();
-    vk_info.extent.height = info.size.y();
-    vk_info.extent.depth = 1;
-    vk_info.setMipLevels(info.mip_levels);
-    vk_info.setArrayLayers(1);
-    vk_info.setSamples(translateSampleCount(info.sample_count));
-    // todo optimal tiling support have to be checked using vkGetPhysicalDeviceImageFormatProperties before use
-    vk_info.setTiling(vk::ImageTiling::eOptimal);
-    vk_info.setUsage(
-        translate(info.usage) |
+    const auto format = vk_info.format == vk::Format::eUndefined
+        ? translate(info.format) : vk_info.format;
+    const auto usages = translate(info.usage);
+    if(!device->capabilities()->isFormatFamilyEnabled(format))
+    {
+        LOG(error, "The device feature for {} is not enabled.",
+            vk::to_string(format));
+        USAGI_THROW(std::runtime_error("Unsupported compressed format."));
+    }
+    if(!device->capabilities()->supportsOptimalTiling(format,
+        VulkanDeviceCapabilities::requiredFormatFeatures(usages)))
+    {
+        USAGI_THROW(std::runtime_error(
+            "The image format does not support the usages with optimal "
+            "tiling."));
+    }
+
+    vk::ImageCreateInfo create_info;
+    create_info.setImageType(vk::ImageType::e2D);
+    create_info.setFormat(format);
+    create_info.extent.width = info.size.x();
+    create_info.extent.height = info.size.y();
+    create_info.extent.depth = 1;
+    create_info.setMipLevels(info.mip_levels);
+    create_info.setArrayLayers(vk_info.array_layers);
+    create_info.setSamples(translateSampleCount(info.sample_count));
+    create_info.setTiling(vk::ImageTiling::eOptimal);
+    // the images are sources of the mip generation and of the copies done
+    // when the texture streamer resizes them
+    create_info.setUsage(usages |
+        vk::ImageUsageFlagBits::eTransferSrc |
         vk::ImageUsageFlagBits::eTransferDst);
-    vk_info.setSharingMode(vk::SharingMode::eExclusive);
-    vk_info.setInitialLayout(vk::ImageLayout::eUndefined);
+    // the compute jobs on a dedicated queue use the images without
+    // ownership transfers
+    std::uint32_t queue_families[3] = { device->graphicsQueueFamily() };
+    std::uint32_t queue_family_count = 1;
+    if(device->sharesImagesConcurrently())
+    {
+        // the family indices must be unique
+        if(device->hasDedicatedTransferQueue() &&
+            device->transferQueueFamily() != device->computeQueueFamily())
+        {
+            queue_families[queue_family_count++] =
+                device->transferQueueFamily();
+        }
+        queue_families[queue_family_count++] = device->computeQueueFamily();
+        create_info.setSharingMode(vk::SharingMode::eConcurrent);
+        create_info.setQueueFamilyIndexCount(queue_family_count);
+        create_info.setPQueueFamilyIndices(queue_families);
+    }
+    else
+    {
+        create_info.setSharingMode(vk::SharingMode::eExclusive);
+    }
+    create_info.setInitialLayout(vk::ImageLayout::eUndefined);
 
-    return mDevice->device().createImageUnique(vk_info);
+    return device->device().createImageUnique(create_info);
 }
 
 vk::MemoryRequirements usagi::VulkanMemoryPool::getImageRequirements(
@@ -106,6 +156,7 @@ void usagi::VulkanMemoryPool::createImageBaseView(VulkanPooledImage *image)
 void usagi::VulkanMemoryPool::allocateDeviceMemoryForBuffer(
     const std::size_t size,
     const vk::MemoryPropertyFlags &mem_properties,
+    const vk::MemoryPropertyFlags &preferred_properties,
     const vk::BufferUsageFlags &usages,
     vk::UniqueBuffer &buffer)
 {
@@ -113,19 +164,38 @@ void usagi::VulkanMemoryPool::allocateDeviceMemoryForBuffer(
 
     buffer_create_info.setSize(size);
     buffer_create_info.setUsage(usages);
-    buffer_create_info.setSharingMode(vk::SharingMode::eExclusive);
+    // different allocations in the buffer may be used by the graphics queue
+    // and the dedicated transfer and compute queues, but the ownership can
+    // only be transferred for the whole buffer.
+    std::uint32_t queue_families[3] = { mDevice->graphicsQueueFamily() };
+    std::uint32_t queue_family_count = 1;
+    if(mDevice->hasDedicatedTransferQueue())
+        queue_families[queue_family_count++] = mDevice->transferQueueFamily();
+    if(mDevice->hasDedicatedComputeQueue())
+        queue_families[queue_family_count++] = mDevice->computeQueueFamily();
+    if(queue_family_count > 1)
+    {
+        buffer_create_info.setSharingMode(vk::SharingMode::eConcurrent);
+        buffer_create_info.setQueueFamilyIndexCount(queue_family_count);
+        buffer_create_info.setPQueueFamilyIndices(queue_families);
+    }
+    else
+    {
+        buffer_create_info.setSharingMode(vk::SharingMode::eExclusive);
+    }
 
     auto vk_device = mDevice->device();
     buffer = vk_device.createBufferUnique(buffer_create_info);
 
     mMemoryRequirements = vk_device.getBufferMemoryRequirements(buffer.get());
-    allocateDeviceMemory(mem_properties);
+    allocateDeviceMemory(mem_properties, preferred_properties);
     vk_device.bindBufferMemory(buffer.get(), mMemory.get(), 0);
 }
 
 void usagi::VulkanMemoryPool::allocateDeviceMemoryForImage(
     std::size_t total_size,
     const vk::MemoryPropertyFlags &mem_properties,
+    const vk::MemoryPropertyFlags &preferred_properties,
     const vk::ImageUsageFlags &usages)
 {
     vk::ImageCreateInfo vk_info;
@@ -150,7 +220,7 @@ void usagi::VulkanMemoryPool::allocateDeviceMemoryForImage(
     mMemoryRequirements.size =
         utility::roundUpUnsigned(total_size, mMemoryRequirements.alignment);
 
-    allocateDeviceMemory(mem_properties);
+    allocateDeviceMemory(mem_properties, preferred_properties);
 }
 
 usagi::VulkanMemoryPool::VulkanMemoryPool(VulkanGpuDevice *device)
@@ -161,4 +231,16 @@ usagi::VulkanMemoryPool::VulkanMemoryPool(VulkanGpuDevice *device)
 usagi::VulkanMemoryPool::~VulkanMemoryPool()
 {
     unmapMemory();
+    if(mMemory)
+    {
+        mMemory.reset();
+        auto *budget = mDevice->memoryBudget();
+        budget->onFreed(mMemoryType, mMemoryRequirements.size);
+        budget->releaseAllocationSlot();
+    }
+}
+
+usagi::VulkanBufferMemoryPoolBase::~VulkanBufferMemoryPoolBase()
+{
+    mDevice->descriptorSetCache()->evict(handleValue(mBuffer.get()));
 }
@@ -1,5 +1,7 @@
 ﻿#pragma once
 
+#include <mutex>
+
 #include <vulkan/vulkan.hpp>
 
 #include <Usagi/Utility/Noncopyable.hpp>
@@ -20,6 +22,7 @@ class VulkanMemoryPool : Noncopyable
 protected:
     VulkanGpuDevice *mDevice = nullptr;
     vk::UniqueDeviceMemory mMemory;
+    std::uint32_t mMemoryType = 0;
     vk::MemoryRequirements mMemoryRequirements { };
     // the memory will be automatically mapped if has eHostVisible flag
     char *mMappedMemory = nullptr;
@@ -27,9 +30,14 @@ protected:
     void mapMemory();
     void unmapMemory();
 
-    void allocateDeviceMemory(const vk::MemoryPropertyFlags &mem_properties);
+    /**
+     * \brief Allocate from the most suitable memory type having all the
+     * required flags, falling back to the others on failure.
+     */
+    void allocateDeviceMemory(
+        const vk::MemoryPropertyFlags &mem_properties,
+        const vk::MemoryPropertyFlags &preferred_properties);
 
-    vk::UniqueImage createImage(const GpuImageCreateInfo &info) const;
     vk::MemoryRequirements getImageRequirements(vk::Image image) const;
     void bindImageMemory(VulkanPooledImage *image);
     static void createImageBaseView(VulkanPooledImage *image);
@@ -37,22 +45,35 @@ protected:
     void allocateDeviceMemoryForBuffer(
         std::size_t size,
         const vk::MemoryPropertyFlags &mem_properties,
+        const vk::MemoryPropertyFlags &preferred_properties,
         const vk::BufferUsageFlags &usages,
         vk::UniqueBuffer &buffer);
 
     void allocateDeviceMemoryForImage(
         std::size_t total_size,
         const vk::MemoryPropertyFlags &mem_properties,
+        const vk::MemoryPropertyFlags &preferred_properties,
         const vk::ImageUsageFlags &usages);
 
 public:
     VulkanMemoryPool(VulkanGpuDevice *device);
     virtual ~VulkanMemoryPool();
 
+    /**
+     * \brief Create an image with the format and the array layers of vk_info
+     * and the other properties of info. Throws if the format is not supported
+     * for the usages.
+     */
+    static vk::UniqueImage createImage(
+        VulkanGpuDevice *device,
+        const GpuImageCreateInfo &info,
+        const VulkanImageCreateInfo &vk_info = { });
+
     virtual void deallocate(std::size_t offset) = 0;
 
     VulkanGpuDevice * device() const { return mDevice; }
     vk::DeviceMemory memory() const { return mMemory.get(); }
+    std::uint32_t memoryType() const { return mMemoryType; }
 };
 
 class VulkanBufferMemoryPoolBase : public VulkanMemoryPool
@@ -62,6 +83,7 @@ protected:
 
 public:
     using VulkanMemoryPool::VulkanMemoryPool;
+    ~VulkanBufferMemoryPoolBase();
 
     virtual std::shared_ptr<VulkanBufferAllocation> allocate(
         std::size_t size) = 0;
@@ -73,6 +95,14 @@ template <typename Allocator>
 class VulkanBufferMemoryPool : public VulkanBufferMemoryPoolBase
 {
     std::unique_ptr<Allocator> mAllocator;
+    // the allocations may be made and freed by the recording threads
+    std::mutex mMutex;
+
+    std::size_t allocateOffset(const std::size_t size)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return reinterpret_cast<std::size_t>(mAllocator->allocate(size));
+    }
 
 public:
     template <typename AllocCreateFunc>
@@ -80,23 +110,27 @@ public:
         VulkanGpuDevice *device,
         const std::size_t size,
         const vk::MemoryPropertyFlags &mem_properties,
+        const vk::MemoryPropertyFlags &preferred_properties,
         const vk::BufferUsageFlags &usages,
         AllocCreateFunc alloc_create_func)
         : VulkanBufferMemoryPoolBase(device)
     {
-        allocateDeviceMemoryForBuffer(size, mem_properties, usages, mBuffer);
+        allocateDeviceMemoryForBuffer(size, mem_properties,
+            preferred_properties, usages, mBuffer);
         mAllocator = alloc_create_func(mMemoryRequirements);
     }
 
     ~VulkanBufferMemoryPool()
     {
         // all memory all freed
-        assert(mAllocator || mAllocator->usedSize() == 0);
+        assert(!mAllocator || mAllocator->usedSize() == 0);
     }
 
+    const Allocator * allocator() const { return mAllocator.get(); }
+
     std::shared_ptr<VulkanBufferAllocation> allocate(std::size_t size) override
     {
-        auto offset = reinterpret_cast<std::size_t>(mAllocator->allocate(size));
+        const auto offset = allocateOffset(size);
         try
         {
             auto alloc = std::make_shared<VulkanBufferAllocation>(
@@ -115,6 +149,7 @@ public:
 
     void deallocate(const std::size_t offset) override
     {
+        std::lock_guard<std::mutex> lock(mMutex);
         mAllocator->deallocate(reinterpret_cast<void*>(offset));
     }
 };
@@ -123,6 +158,15 @@ template <typename Allocator>
 class VulkanImageMemoryPool : public VulkanMemoryPool
 {
     std::unique_ptr<Allocator> mAllocator;
+    // the images may be created and freed by the recording threads
+    std::mutex mMutex;
+
+    std::size_t allocateOffset(const vk::MemoryRequirements &req)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return reinterpret_cast<std::size_t>(mAllocator->allocate(
+            req.size, req.alignment));
+    }
 
 public:
     template <typename AllocCreateFunc>
@@ -130,33 +174,50 @@ public:
         VulkanGpuDevice *device,
         std::size_t size,
         const vk::MemoryPropertyFlags &mem_properties,
+        const vk::MemoryPropertyFlags &preferred_properties,
         const vk::ImageUsageFlags &usages,
         AllocCreateFunc alloc_create_func)
         : VulkanMemoryPool(device)
     {
-        allocateDeviceMemoryForImage(size, mem_properties, usages);
+        allocateDeviceMemoryForImage(size, mem_properties,
+            preferred_properties, usages);
         mAllocator = alloc_create_func(mMemoryRequirements);
     }
 
     ~VulkanImageMemoryPool()
     {
         // all memory all freed
-        assert(mAllocator || mAllocator->usedSize() == 0);
+        assert(!mAllocator || mAllocator->usedSize() == 0);
     }
 
+    const Allocator * allocator() const { return mAllocator.get(); }
+
     std::shared_ptr<VulkanPooledImage> createPooledImage(
-        const GpuImageCreateInfo &info)
+        const GpuImageCreateInfo &info,
+        const VulkanImageCreateInfo &vk_info = { })
     {
-        auto image = createImage(info);
+        auto image = createImage(mDevice, info, vk_info);
         const auto req = getImageRequirements(image.get());
-        auto offset = reinterpret_cast<std::size_t>(mAllocator->allocate(
-            req.size, req.alignment));
+        return createPooledImage(image, req, info, vk_info);
+    }
+
+    /**
+     * \brief Bind the image to the memory of the pool. Throws std::bad_alloc
+     * and leaves the image untouched if there is not enough space left.
+     */
+    std::shared_ptr<VulkanPooledImage> createPooledImage(
+        vk::UniqueImage &image,
+        const vk::MemoryRequirements &req,
+        const GpuImageCreateInfo &info,
+        const VulkanImageCreateInfo &vk_info = { })
+    {
+        const auto offset = allocateOffset(req);
         try
         {
             auto wrapper = std::make_shared<VulkanPooledImage>(
                 std::move(image),
                 GpuImageFormat { info.format, info.sample_count }, info.size,
-                this, offset, req.size
+                this, offset, req.size, info.mip_levels, vk_info
             );
             bindImageMemory(wrapper.get());
             createImageBaseView(wrapper.get());
@@ -171,6 +232,7 @@ public:
 
     void deallocate(const std::size_t offset) override
     {
+        std::lock_guard<std::mutex> lock(mMutex);
         mAllocator->deallocate(reinterpret_cast<void*>(offset));
     }
 };
@@ -0,0 +1,231 @@
+﻿#include "VulkanPhysicalDeviceSelector.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Core/Logging.hpp>
+
+namespace
+{
+std::string toLower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](const char c) {
+        return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    });
+    return std::move(str);
+}
+
+std::string normalizeUuid(const std::string &uuid)
+{
+    std::string result;
+    for(auto &&c : uuid)
+        if(c != '-') result.push_back(c);
+    return toLower(std::move(result));
+}
+
+std::string readUuid(
+    const vk::PhysicalDevice device,
+    const PFN_vkGetPhysicalDeviceProperties2KHR get_properties2)
+{
+#ifdef VK_KHR_external_memory_capabilities
+    if(!get_properties2) return { };
+
+    VkPhysicalDeviceIDPropertiesKHR id { };
+    id.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES_KHR;
+    VkPhysicalDeviceProperties2KHR properties { };
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    properties.pNext = &id;
+    get_properties2(device, &properties);
+
+    std::string uuid;
+    char digits[3];
+    for(auto &&byte : id.deviceUUID)
+    {
+        std::snprintf(digits, sizeof digits, "%02x", byte);
+        uuid += digits;
+    }
+    return std::move(uuid);
+#else
+    return { };
+#endif
+}
+
+std::int64_t typeScore(
+    const vk::PhysicalDeviceType type,
+    const bool prefer_integrated)
+{
+    switch(type)
+    {
+        case vk::PhysicalDeviceType::eDiscreteGpu:
+            return prefer_integrated ? 2000 : 4000;
+        case vk::PhysicalDeviceType::eIntegratedGpu:
+            return prefer_integrated ? 4000 : 2000;
+        case vk::PhysicalDeviceType::eVirtualGpu: return 1000;
+        case vk::PhysicalDeviceType::eCpu: return 100;
+        default: return 0;
+    }
+}
+
+void logCandidate(const usagi::VulkanPhysicalDeviceSelector::Candidate &c)
+{
+    const auto &prop = c.capabilities->properties();
+    LOG(info, "Index         : {}", c.index);
+    LOG(info, "Device Name   : {}", prop.deviceName);
+    LOG(info, "Device Type   : {}", to_string(prop.deviceType));
+    LOG(info, "Device ID     : {}", prop.deviceID);
+    LOG(info, "Device UUID   : {}", c.uuid.empty() ? "unknown" : c.uuid);
+    LOG(info, "API Version   : {}", prop.apiVersion);
+    LOG(info, "Driver Version: {}", prop.driverVersion);
+    LOG(info, "Vendor ID     : {}", prop.vendorID);
+    LOG(info, "Local Memory  : {} bytes",
+        c.capabilities->deviceLocalMemorySize());
+    if(c.rejection.empty())
+        LOG(info, "Score         : {}", c.score);
+    else
+        LOG(info, "Rejected      : {}", c.rejection);
+    LOG(info, "--------------------------------");
+}
+}
+
+usagi::VulkanPhysicalDeviceSelector::VulkanPhysicalDeviceSelector(
+    const vk::Instance instance,
+    VulkanPhysicalDevicePreference preference,
+    const PFN_vkGetPhysicalDeviceProperties2KHR get_properties2)
+    : mPreference(std::move(preference))
+{
+    const auto devices = instance.enumeratePhysicalDevices();
+    for(std::size_t i = 0; i < devices.size(); ++i)
+    {
+        Candidate c;
+        c.index = static_cast<std::uint32_t>(i);
+        c.capabilities = std::make_unique<VulkanDeviceCapabilities>(
+            devices[i]);
+        c.uuid = readUuid(devices[i], get_properties2);
+        evaluate(c);
+        mCandidates.push_back(std::move(c));
+    }
+}
+
+void usagi::VulkanPhysicalDeviceSelector::evaluate(Candidate &candidate) const
+{
+    const auto &caps = *candidate.capabilities;
+    const auto &queue_families = caps.queueFamilies();
+
+    const auto has_graphics_queue = std::any_of(
+        queue_families.begin(), queue_families.end(),
+        [](const vk::QueueFamilyProperties &qf) {
+            return (qf.queueFlags & vk::QueueFlagBits::eGraphics) &&
+                (qf.queueFlags & vk::QueueFlagBits::eTransfer);
+        });
+    if(!has_graphics_queue)
+    {
+        candidate.rejection = "no graphics queue";
+        return;
+    }
+    if(!mPreference.headless &&
+        !caps.isExtensionSupported(VK_KHR_SWAPCHAIN_EXTENSION_NAME))
+    {
+        candidate.rejection = "VK_KHR_swapchain is not supported";
+        return;
+    }
+
+    std::int64_t score = typeScore(caps.properties().deviceType,
+        mPreference.prefer_integrated);
+    // one point per 64 MiB
+    score += static_cast<std::int64_t>(
+        caps.deviceLocalMemorySize() / (1024 * 1024 * 64));
+    // same criteria as the device uses for uploading
+    const auto has_transfer_queue = std::any_of(
+        queue_families.begin(), queue_families.end(),
+        [](const vk::QueueFamilyProperties &qf) {
+            const auto &g = qf.minImageTransferGranularity;
+            return (qf.queueFlags & vk::QueueFlagBits::eTransfer) &&
+                !(qf.queueFlags & (vk::QueueFlagBits::eGraphics |
+                    vk::QueueFlagBits::eCompute)) &&
+                g.width == 1 && g.height == 1 && g.depth == 1;
+        });
+    if(has_transfer_queue)
+        score += 100;
+#ifdef VK_KHR_timeline_semaphore
+    if(caps.isExtensionSupported(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME))
+        score += 50;
+#endif
+#ifdef VK_EXT_memory_budget
+    if(caps.isExtensionSupported(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+        score += 10;
+#endif
+    score += caps.limits().maxImageDimension2D / 1024;
+
+    candidate.score = score;
+}
+
+usagi::VulkanPhysicalDeviceSelector::Candidate *
+    usagi::VulkanPhysicalDeviceSelector::findPreferred()
+{
+    const auto find = [&](auto &&pred) -> Candidate * {
+        for(auto &&c : mCandidates)
+            if(c.rejection.empty() && pred(c)) return &c;
+        return nullptr;
+    };
+
+    if(mPreference.index >= 0)
+    {
+        if(const auto c = find([&](const Candidate &candidate) {
+            return candidate.index ==
+                static_cast<std::uint32_t>(mPreference.index);
+        })) return c;
+        LOG(warn, "The preferred physical device #{} is not suitable or "
+            "does not exist.", mPreference.index);
+    }
+    if(!mPreference.uuid.empty())
+    {
+        const auto uuid = normalizeUuid(mPreference.uuid);
+        if(const auto c = find([&](const Candidate &candidate) {
+            return !candidate.uuid.empty() && candidate.uuid == uuid;
+        })) return c;
+        LOG(warn, "No suitable physical device has the UUID {}.",
+            mPreference.uuid);
+    }
+    if(!mPreference.name.empty())
+    {
+        const auto name = toLower(mPreference.name);
+        if(const auto c = find([&](const Candidate &candidate) {
+            return toLower(candidate.capabilities->properties().deviceName)
+                .find(name) != std::string::npos;
+        })) return c;
+        LOG(warn, "No suitable physical device has a name containing {}.",
+            mPreference.name);
+    }
+    return nullptr;
+}
+
+std::unique_ptr<usagi::VulkanDeviceCapabilities>
+    usagi::VulkanPhysicalDeviceSelector::select(const bool log_candidates)
+{
+    if(log_candidates)
+    {
+        LOG(info, "Available physical devices");
+        LOG(info, "--------------------------------");
+        for(auto &&c : mCandidates)
+            logCandidate(c);
+    }
+
+    auto selected = findPreferred();
+    if(!selected)
+    {
+        for(auto &&c : mCandidates)
+        {
+            // ties are broken by the enumeration order
+            if(c.rejection.empty() && (!selected || c.score > selected->score))
+                selected = &c;
+        }
+    }
+    if(!selected)
+        USAGI_THROW(std::runtime_error("No available GPU supporting Vulkan."));
+
+    LOG(info, "Selected physical device #{} with score {}",
+        selected->index, selected->score);
+    return std::move(selected->capabilities);
+}
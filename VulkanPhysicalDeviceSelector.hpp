@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+#include "VulkanDeviceCapabilities.hpp"
+#include "VulkanGpuDeviceConfig.hpp"
+
+namespace usagi
+{
+/**
+ * \brief Scores the physical devices by their types, the sizes of the
+ * device-local heaps, and the optional queues and extensions used by the
+ * device, after rejecting the ones lacking the required capabilities. The
+ * preference in the config may override the scores.
+ */
+class VulkanPhysicalDeviceSelector : Noncopyable
+{
+public:
+    struct Candidate
+    {
+        std::uint32_t index = 0;
+        std::unique_ptr<VulkanDeviceCapabilities> capabilities;
+        // empty if unknown
+        std::string uuid;
+        // empty if the device is suitable
+        std::string rejection;
+        std::int64_t score = 0;
+    };
+
+private:
+    const VulkanPhysicalDevicePreference mPreference;
+    std::vector<Candidate> mCandidates;
+
+    void evaluate(Candidate &candidate) const;
+    Candidate * findPreferred();
+
+public:
+    /**
+     * \param get_properties2 Used for reading the device UUIDs. May be null.
+     */
+    VulkanPhysicalDeviceSelector(
+        vk::Instance instance,
+        VulkanPhysicalDevicePreference preference,
+        PFN_vkGetPhysicalDeviceProperties2KHR get_properties2);
+
+    /**
+     * \brief Take the capabilities of the selected device. Throws if no
+     * device is suitable.
+     * \param log_candidates Log the properties and the score of every
+     * device.
+     */
+    std::unique_ptr<VulkanDeviceCapabilities> select(bool log_candidates);
+
+    const std::vector<Candidate> & candidates() const { return mCandidates; }
+};
+}
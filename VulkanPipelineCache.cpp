@@ -0,0 +1,134 @@
+﻿#include "VulkanPipelineCache.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include <Usagi/Core/Logging.hpp>
+
+namespace
+{
+// layout of VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+struct PipelineCacheHeader
+{
+    std::uint32_t header_size;
+    std::uint32_t header_version;
+    std::uint32_t vendor_id;
+    std::uint32_t device_id;
+    std::uint8_t uuid[VK_UUID_SIZE];
+};
+static_assert(sizeof(PipelineCacheHeader) == 16 + VK_UUID_SIZE);
+}
+
+usagi::VulkanPipelineCache::VulkanPipelineCache(
+    const vk::PhysicalDevice physical_device,
+    const vk::Device device,
+    std::string path)
+    : mDevice(device)
+    , mPath(std::move(path))
+    , mProperties(physical_device.getProperties())
+{
+    auto data = loadFile();
+    if(!data.empty() && !validateHeader(data))
+        data.clear();
+
+    vk::PipelineCacheCreateInfo info;
+    info.setInitialDataSize(data.size());
+    info.setPInitialData(data.data());
+    mCache = mDevice.createPipelineCacheUnique(info);
+
+    if(data.empty())
+        LOG(info, "Created empty pipeline cache");
+    else
+        LOG(info, "Loaded pipeline cache from {} ({} bytes)",
+            mPath, data.size());
+}
+
+std::vector<char> usagi::VulkanPipelineCache::loadFile() const
+{
+    std::vector<char> data;
+
+    std::ifstream file(mPath, std::ios::binary | std::ios::ate);
+    if(!file) return data;
+
+    const auto size = static_cast<std::size_t>(file.tellg());
+    data.resize(size);
+    file.seekg(0);
+    if(!file.read(data.data(), size))
+    {
+        LOG(warn, "Failed to read pipeline cache from {}", mPath);
+        data.clear();
+    }
+    return std::move(data);
+}
+
+bool usagi::VulkanPipelineCache::validateHeader(
+    const std::vector<char> &data) const
+{
+    PipelineCacheHeader header;
+    if(data.size() < sizeof(header))
+    {
+        LOG(warn, "Pipeline cache file is truncated, ignored.");
+        return false;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    if(header.header_size < sizeof(header) ||
+        header.header_version != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+    {
+        LOG(warn, "Unknown pipeline cache header version, ignored.");
+        return false;
+    }
+    if(header.vendor_id != mProperties.vendorID ||
+        header.device_id != mProperties.deviceID ||
+        std::memcmp(header.uuid, mProperties.pipelineCacheUUID,
+            VK_UUID_SIZE) != 0)
+    {
+        LOG(info, "Pipeline cache was created by another device or driver, "
+            "ignored.");
+        return false;
+    }
+    return true;
+}
+
+bool usagi::VulkanPipelineCache::save() const
+{
+    const auto data = mDevice.getPipelineCacheData(mCache.get());
+
+    const auto temp_path = mPath + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        if(!file.write(reinterpret_cast<const char*>(data.data()),
+            data.size()))
+        {
+            LOG(warn, "Failed to write pipeline cache to {}", temp_path);
+            return false;
+        }
+    }
+    // replace the old file atomically so that a crash leaves either of them.
+    // rename() doesn't replace existing files on Windows.
+#ifdef _WIN32
+    const auto replaced = MoveFileExW(
+        std::filesystem::u8path(temp_path).c_str(),
+        std::filesystem::u8path(mPath).c_str(),
+        MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    const auto replaced =
+        std::rename(temp_path.c_str(), mPath.c_str()) == 0;
+#endif
+    if(!replaced)
+    {
+        LOG(warn, "Failed to replace pipeline cache {}", mPath);
+        return false;
+    }
+
+    LOG(info, "Saved pipeline cache to {} ({} bytes)", mPath, data.size());
+    return true;
+}
@@ -0,0 +1,50 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+/**
+ * \brief Wraps a pipeline cache which is loaded from a file on creation and
+ * may be written back later, so that the driver does not have to compile
+ * the same pipelines again in the next run.
+ *
+ * The file is only used if its header matches the vendor, device, and
+ * pipeline cache UUID of the physical device. Otherwise the cache starts
+ * empty and the file is overwritten on saving.
+ *
+ * The pipeline cache is internally synchronized by the driver so it can be
+ * shared by multiple pipeline compilers.
+ */
+class VulkanPipelineCache : Noncopyable
+{
+    vk::Device mDevice;
+    vk::UniquePipelineCache mCache;
+    std::string mPath;
+    vk::PhysicalDeviceProperties mProperties;
+
+    bool validateHeader(const std::vector<char> &data) const;
+    std::vector<char> loadFile() const;
+
+public:
+    VulkanPipelineCache(
+        vk::PhysicalDevice physical_device,
+        vk::Device device,
+        std::string path);
+
+    /**
+     * \brief Write the cache data to the file. The data is written to a
+     * temporary file first, so the old file is kept if writing fails.
+     * \return Whether the cache is saved.
+     */
+    bool save() const;
+
+    vk::PipelineCache cache() const { return mCache.get(); }
+    const std::string & path() const { return mPath; }
+};
+}
@@ -0,0 +1,85 @@
+﻿#include "VulkanPipelineCompileQueue.hpp"
+
+#include <algorithm>
+
+#include <Usagi/Core/Logging.hpp>
+#include <Usagi/Runtime/Graphics/GraphicsPipeline.hpp>
+
+#include "VulkanGraphicsPipelineCompiler.hpp"
+
+usagi::VulkanPipelineCompileQueue::VulkanPipelineCompileQueue(
+    const std::size_t thread_count)
+    : mThreadCount(thread_count)
+{
+    if(mThreadCount == 0)
+    {
+        // leave one core for the thread submitting the jobs
+        mThreadCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+        mThreadCount = std::max<std::size_t>(1, mThreadCount);
+    }
+}
+
+usagi::VulkanPipelineCompileQueue::~VulkanPipelineCompileQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mCondition.notify_all();
+    for(auto &&worker : mWorkers)
+        worker.join();
+}
+
+void usagi::VulkanPipelineCompileQueue::startWorkers()
+{
+    LOG(info, "Starting {} pipeline compilation threads", mThreadCount);
+
+    for(std::size_t i = 0; i < mThreadCount; ++i)
+        mWorkers.emplace_back(&VulkanPipelineCompileQueue::workerMain, this);
+}
+
+void usagi::VulkanPipelineCompileQueue::workerMain()
+{
+    while(true)
+    {
+        std::packaged_task<Result()> job;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock, [&]() {
+                return mStopping || !mJobs.empty();
+            });
+            if(mStopping) return;
+            job = std::move(mJobs.front());
+            mJobs.pop_front();
+        }
+        // exceptions are stored in the future
+        job();
+    }
+}
+
+std::future<usagi::VulkanPipelineCompileQueue::Result>
+    usagi::VulkanPipelineCompileQueue::submit(
+        std::unique_ptr<VulkanGraphicsPipelineCompiler> compiler)
+{
+    // the packaged_task of msvc requires a copyable callable
+    std::shared_ptr<VulkanGraphicsPipelineCompiler> shared_compiler =
+        std::move(compiler);
+    std::packaged_task<Result()> job([c = std::move(shared_compiler)]() {
+        return c->compile();
+    });
+    auto future = job.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(mWorkers.empty())
+            startWorkers();
+        mJobs.push_back(std::move(job));
+    }
+    mCondition.notify_one();
+    return std::move(future);
+}
+
+std::size_t usagi::VulkanPipelineCompileQueue::pendingJobCount()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mJobs.size();
+}
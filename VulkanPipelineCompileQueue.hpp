@@ -0,0 +1,57 @@
+﻿#pragma once
+
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+class GraphicsPipeline;
+class VulkanGraphicsPipelineCompiler;
+
+/**
+ * \brief Compiles graphics pipelines on worker threads. Each job owns a
+ * snapshot of a pipeline compiler so it does not share mutable state with
+ * other jobs or the thread which submitted it.
+ *
+ * The worker threads are created on the first submission. Jobs not started
+ * when the queue is destroyed are abandoned and their futures will throw
+ * std::future_error.
+ */
+class VulkanPipelineCompileQueue : Noncopyable
+{
+public:
+    using Result = std::shared_ptr<GraphicsPipeline>;
+
+private:
+    std::size_t mThreadCount = 0;
+    std::vector<std::thread> mWorkers;
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<std::packaged_task<Result()>> mJobs;
+    bool mStopping = false;
+
+    void startWorkers();
+    void workerMain();
+
+public:
+    /**
+     * \param thread_count The number of worker threads. If zero, one less
+     * than the hardware concurrency is used.
+     */
+    explicit VulkanPipelineCompileQueue(std::size_t thread_count = 0);
+    ~VulkanPipelineCompileQueue();
+
+    std::future<Result> submit(
+        std::unique_ptr<VulkanGraphicsPipelineCompiler> compiler);
+
+    std::size_t pendingJobCount();
+};
+}
@@ -1,5 +1,6 @@
 ﻿#include "VulkanPooledImage.hpp"
 
+#include "VulkanFormatInfo.hpp"
 #include "VulkanGpuDevice.hpp"
 #include "VulkanMemoryPool.hpp"
 
@@ -9,8 +10,11 @@ usagi::VulkanPooledImage::VulkanPooledImage(
     const Vector2u32 &size,
     VulkanMemoryPool *pool,
     const std::size_t buffer_offset,
-    const std::size_t buffer_size)
-    : VulkanGpuImage(format, size, vk_image.getOwner())
+    const std::size_t buffer_size,
+    const std::uint32_t mip_levels,
+    const VulkanImageCreateInfo &vk_info)
+    : VulkanGpuImage(format, size, pool->device(), mip_levels,
+        vk_info.array_layers, vk_info.format)
     , mImage(std::move(vk_image))
     , mPool(pool)
     , mBufferOffset(buffer_offset)
@@ -41,5 +45,47 @@ void usagi::VulkanPooledImage::uploadRegion(
     auto device = mPool->device();
     const auto buffer = device->allocateStageBuffer(buf_size);
     memcpy(buffer->mappedAddress(), buf_data, buf_size);
-    device->copyBufferToImage(buffer, this, tex_offset, tex_size);
+    mUploadToken = device->copyBufferToImage(
+        buffer, this, tex_offset, tex_size);
+    if(mMipLevels > 1 && canGenerateMipmaps())
+        generateMipmaps();
+}
+
+void usagi::VulkanPooledImage::uploadMip(
+    const std::uint32_t mip,
+    const void *buf_data,
+    const std::size_t buf_size)
+{
+    using namespace vulkan;
+
+    assert(mip < mMipLevels);
+    assert(buf_size <= mBufferSize);
+
+    auto device = mPool->device();
+    const auto buffer = device->allocateStageBuffer(buf_size);
+    memcpy(buffer->mappedAddress(), buf_data, buf_size);
+    mUploadToken = device->copyBufferToImage(
+        buffer, this, Vector2i::Zero(),
+        { mipExtent(mSize.x(), mip), mipExtent(mSize.y(), mip) }, mip);
+}
+
+void usagi::VulkanPooledImage::uploadMip(
+    const std::uint32_t mip,
+    const std::uint32_t layer,
+    const VulkanUploadReader &reader)
+{
+    mUploadToken = mPool->device()->streamToImage(this, mip, layer, reader);
+}
+
+bool usagi::VulkanPooledImage::canGenerateMipmaps() const
+{
+    return mPool->device()->capabilities()->supportsOptimalTiling(
+        mImageFormat,
+        vk::FormatFeatureFlagBits::eBlitSrc |
+        vk::FormatFeatureFlagBits::eBlitDst);
+}
+
+void usagi::VulkanPooledImage::generateMipmaps(const std::uint32_t base_mip)
+{
+    mUploadToken = mPool->device()->generateMipmaps(this, base_mip);
 }
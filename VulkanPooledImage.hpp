@@ -1,17 +1,31 @@
 ﻿#pragma once
 
 #include "VulkanGpuImage.hpp"
+#include "VulkanUploadQueue.hpp"
 
 namespace usagi
 {
 class VulkanMemoryPool;
 
+/**
+ * \brief The properties of the pooled images which GpuImageCreateInfo can't
+ * describe.
+ */
+struct VulkanImageCreateInfo
+{
+    // replaces the format of GpuImageCreateInfo unless undefined, e.g. with
+    // a block-compressed format
+    vk::Format format = vk::Format::eUndefined;
+    std::uint32_t array_layers = 1;
+};
+
 class VulkanPooledImage : public VulkanGpuImage
 {
     vk::UniqueImage mImage;
     VulkanMemoryPool *mPool = nullptr;
     std::size_t mBufferOffset;
     std::size_t mBufferSize;
+    VulkanUploadQueue::Token mUploadToken = 0;
 
     friend class VulkanMemoryPool;
 
@@ -22,9 +36,17 @@ public:
         const Vector2u32 &size,
         VulkanMemoryPool *pool,
         std::size_t buffer_offset,
-        std::size_t buffer_size);
+        std::size_t buffer_size,
+        std::uint32_t mip_levels,
+        const VulkanImageCreateInfo &vk_info = { });
     ~VulkanPooledImage();
 
+    /**
+     * \brief Upload the mip 0. The other mips are generated from it by the
+     * GPU if the image has a mip chain, which is the same for
+     * uploadRegion(). Block-compressed formats can't be blitted so their
+     * mips must be uploaded with uploadMip().
+     */
     void upload(const void *buf_data, std::size_t buf_size) override;
 
     void uploadRegion(
@@ -33,7 +55,40 @@ public:
         const Vector2i &tex_offset,
         const Vector2u32 &tex_size) override;
 
+    /**
+     * \brief Upload the tightly packed data of a whole mip level, e.g. a mip
+     * chain generated offline. No mip is generated.
+     */
+    void uploadMip(
+        std::uint32_t mip,
+        const void *buf_data,
+        std::size_t buf_size);
+    /**
+     * \brief Stream the tightly packed data of a mip level of a layer from
+     * the reader into the staging memory in chunks, e.g. straight from a
+     * file with makeFileReader(). No mip is generated.
+     */
+    void uploadMip(
+        std::uint32_t mip,
+        std::uint32_t layer,
+        const VulkanUploadReader &reader);
+    /**
+     * \brief Regenerate the mips after the base one from its content.
+     */
+    void generateMipmaps(std::uint32_t base_mip = 0);
+    /**
+     * \brief Whether the format supports the blits used by
+     * generateMipmaps().
+     */
+    bool canGenerateMipmaps() const;
+
     vk::Image image() const override { return mImage.get(); }
     std::size_t offset() const { return mBufferOffset; }
+
+    /**
+     * \brief The token of the last upload to this image, can be checked with
+     * VulkanGpuDevice::isUploadComplete().
+     */
+    VulkanUploadQueue::Token uploadToken() const { return mUploadToken; }
 };
 }
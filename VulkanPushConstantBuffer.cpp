@@ -0,0 +1,37 @@
+﻿#include "VulkanPushConstantBuffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "VulkanLayoutRegistry.hpp"
+
+void usagi::VulkanPushConstantBuffer::set(
+    const VulkanPushConstantField &field,
+    const void *data)
+{
+    const auto end = field.offset + field.size;
+    if(mBlock.size() < end)
+        mBlock.resize(end);
+    std::memcpy(mBlock.data() + field.offset, data, field.size);
+
+    if(mDirtyBegin == mDirtyEnd)
+    {
+        mDirtyBegin = field.offset;
+        mDirtyEnd = end;
+    }
+    else
+    {
+        // the bytes in between are pushed again with their last values
+        mDirtyBegin = std::min(mDirtyBegin, field.offset);
+        mDirtyEnd = std::max(mDirtyEnd, end);
+    }
+}
+
+void usagi::VulkanPushConstantBuffer::record(
+    const vk::CommandBuffer cmd,
+    const VulkanPipelineLayout &layout)
+{
+    layout.pushConstants(cmd, mDirtyBegin, mDirtyEnd - mDirtyBegin,
+        mBlock.data());
+    clear();
+}
@@ -0,0 +1,52 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+namespace usagi
+{
+class VulkanPipelineLayout;
+
+/**
+ * \brief The offset and size of a push constant field in the push constant
+ * block of a pipeline. Resolved once from the field name by the pipeline and
+ * valid for all the pipelines sharing its layout.
+ */
+struct VulkanPushConstantField
+{
+    std::uint32_t offset = 0, size = 0;
+};
+
+/**
+ * \brief A CPU copy of the push constant block of a command list. The fields
+ * set between two commands are recorded together by flush(), so setting
+ * several fields or a field declared by multiple stages only records one
+ * vkCmdPushConstants in the common case.
+ */
+class VulkanPushConstantBuffer
+{
+    std::vector<char> mBlock;
+    // the bytes set since the last flush
+    std::uint32_t mDirtyBegin = 0;
+    std::uint32_t mDirtyEnd = 0;
+
+public:
+    void set(const VulkanPushConstantField &field, const void *data);
+
+    /**
+     * \brief Record the fields set since the last flush with the layout of
+     * the bound pipeline.
+     */
+    void flush(vk::CommandBuffer cmd, const VulkanPipelineLayout &layout)
+    {
+        if(mDirtyBegin != mDirtyEnd) record(cmd, layout);
+    }
+    void record(vk::CommandBuffer cmd, const VulkanPipelineLayout &layout);
+    /**
+     * \brief Forget the fields not recorded yet.
+     */
+    void clear() { mDirtyBegin = mDirtyEnd = 0; }
+};
+}
@@ -0,0 +1,291 @@
+﻿#include "VulkanQueryManager.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+#include <Usagi/Core/Logging.hpp>
+
+#include "VulkanGpuDevice.hpp"
+
+namespace
+{
+// the order of the values in the results follows the bits
+const vk::QueryPipelineStatisticFlags STATISTICS_FLAGS =
+    vk::QueryPipelineStatisticFlagBits::eInputAssemblyVertices |
+    vk::QueryPipelineStatisticFlagBits::eInputAssemblyPrimitives |
+    vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations |
+    vk::QueryPipelineStatisticFlagBits::eClippingInvocations |
+    vk::QueryPipelineStatisticFlagBits::eClippingPrimitives |
+    vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+constexpr std::size_t STATISTICS_COUNT = 6;
+}
+
+usagi::VulkanQueryManager::VulkanQueryManager(
+    VulkanGpuDevice *device,
+    VulkanQueryConfig config)
+    : mDevice(device)
+    , mConfig(std::move(config))
+{
+    const auto &features = mDevice->capabilities()->enabledFeatures();
+    mPreciseOcclusion = features.occlusionQueryPrecise;
+    mStatisticsSupported = features.pipelineStatisticsQuery &&
+        mConfig.max_statistics_queries_per_frame != 0;
+
+    const auto vk_device = mDevice->device();
+    for(std::size_t i = 0; i < mDevice->framesInFlight(); ++i)
+    {
+        FramePools frame;
+        if(mConfig.max_occlusion_queries_per_frame != 0)
+        {
+            vk::QueryPoolCreateInfo info;
+            info.setQueryType(vk::QueryType::eOcclusion);
+            info.setQueryCount(mConfig.max_occlusion_queries_per_frame);
+            frame.occlusion = vk_device.createQueryPoolUnique(info);
+            frame.occlusion_dirty = mConfig.max_occlusion_queries_per_frame;
+        }
+        if(mStatisticsSupported)
+        {
+            vk::QueryPoolCreateInfo info;
+            info.setQueryType(vk::QueryType::ePipelineStatistics);
+            info.setQueryCount(mConfig.max_statistics_queries_per_frame);
+            info.setPipelineStatistics(STATISTICS_FLAGS);
+            frame.statistics = vk_device.createQueryPoolUnique(info);
+            frame.statistics_dirty = mConfig.max_statistics_queries_per_frame;
+        }
+        vk::CommandPoolCreateInfo pool_info;
+        pool_info.setQueueFamilyIndex(mDevice->graphicsQueueFamily());
+        pool_info.setFlags(vk::CommandPoolCreateFlagBits::eTransient);
+        frame.command_pool = vk_device.createCommandPoolUnique(pool_info);
+        mFramePools.push_back(std::move(frame));
+    }
+}
+
+void usagi::VulkanQueryManager::collectResults(FramePools &frame)
+{
+    const auto vk_device = mDevice->device();
+    // each result is followed by its availability. the queries of the
+    // command lists never submitted are not available.
+    constexpr auto flags = vk::QueryResultFlagBits::e64 |
+        vk::QueryResultFlagBits::eWithAvailability;
+
+    if(const auto count = static_cast<std::uint32_t>(
+        frame.occlusion_user_data.size()))
+    {
+        mQueryResults.resize(count * 2);
+        const auto result = vk_device.getQueryPoolResults(
+            frame.occlusion.get(), 0, count,
+            mQueryResults.size() * sizeof(std::uint64_t),
+            mQueryResults.data(), sizeof(std::uint64_t) * 2, flags);
+        if(result == vk::Result::eSuccess || result == vk::Result::eNotReady)
+        {
+            for(std::uint32_t i = 0; i < count; ++i)
+            {
+                const auto r = &mQueryResults[i * 2];
+                if(!r[1]) continue;
+                mOcclusionResults.push_back({
+                    frame.occlusion_user_data[i], frame.frame_number, r[0]
+                });
+            }
+            while(mOcclusionResults.size() > mConfig.max_kept_results)
+                mOcclusionResults.pop_front();
+        }
+        else
+        {
+            LOG(warn, "Could not read the occlusion queries: {}",
+                vk::to_string(result));
+        }
+    }
+
+    if(const auto count = static_cast<std::uint32_t>(
+        frame.statistics_names.size()))
+    {
+        constexpr auto stride = STATISTICS_COUNT + 1;
+        mQueryResults.resize(count * stride);
+        const auto result = vk_device.getQueryPoolResults(
+            frame.statistics.get(), 0, count,
+            mQueryResults.size() * sizeof(std::uint64_t),
+            mQueryResults.data(), sizeof(std::uint64_t) * stride, flags);
+        if(result == vk::Result::eSuccess || result == vk::Result::eNotReady)
+        {
+            for(std::uint32_t i = 0; i < count; ++i)
+            {
+                const auto r = &mQueryResults[i * stride];
+                if(!r[STATISTICS_COUNT]) continue;
+                StatisticsResult s;
+                s.name = std::move(frame.statistics_names[i]);
+                s.frame = frame.frame_number;
+                s.statistics.input_assembly_vertices = r[0];
+                s.statistics.input_assembly_primitives = r[1];
+                s.statistics.vertex_shader_invocations = r[2];
+                s.statistics.clipping_invocations = r[3];
+                s.statistics.clipping_primitives = r[4];
+                s.statistics.fragment_shader_invocations = r[5];
+                mStatisticsResults.push_back(std::move(s));
+            }
+            while(mStatisticsResults.size() > mConfig.max_kept_results)
+                mStatisticsResults.pop_front();
+        }
+        else
+        {
+            LOG(warn, "Could not read the pipeline statistics queries: {}",
+                vk::to_string(result));
+        }
+    }
+
+    frame.occlusion_dirty = std::max(frame.occlusion_dirty,
+        static_cast<std::uint32_t>(frame.occlusion_user_data.size()));
+    frame.statistics_dirty = std::max(frame.statistics_dirty,
+        static_cast<std::uint32_t>(frame.statistics_names.size()));
+    frame.occlusion_user_data.clear();
+    frame.statistics_names.clear();
+}
+
+void usagi::VulkanQueryManager::recordResets(FramePools &frame)
+{
+    if(frame.occlusion_dirty == 0 && frame.statistics_dirty == 0)
+        return;
+
+    const auto vk_device = mDevice->device();
+    // the last reset commands of the context are completed or never
+    // submitted
+    frame.reset_commands.reset();
+    vk_device.resetCommandPool(frame.command_pool.get(), { });
+
+    vk::CommandBufferAllocateInfo alloc_info;
+    alloc_info.setCommandPool(frame.command_pool.get());
+    alloc_info.setLevel(vk::CommandBufferLevel::ePrimary);
+    alloc_info.setCommandBufferCount(1);
+    frame.reset_commands = std::move(
+        vk_device.allocateCommandBuffersUnique(alloc_info).front());
+
+    const auto cmd = frame.reset_commands.get();
+    vk::CommandBufferBeginInfo begin_info;
+    begin_info.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+    cmd.begin(begin_info);
+    if(frame.occlusion_dirty)
+        cmd.resetQueryPool(frame.occlusion.get(), 0, frame.occlusion_dirty);
+    if(frame.statistics_dirty)
+        cmd.resetQueryPool(frame.statistics.get(), 0, frame.statistics_dirty);
+    cmd.end();
+
+    mPendingReset = &frame;
+}
+
+void usagi::VulkanQueryManager::beginFrame(
+    const std::size_t frame_index,
+    const std::uint64_t frame_number)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    auto &frame = mFramePools[frame_index];
+    // the resets are taken by the first jobs of a frame. if the previous
+    // frame submitted none, its queries were not used either and are still
+    // marked as dirty.
+    mPendingReset = nullptr;
+    collectResults(frame);
+    recordResets(frame);
+    frame.frame_number = frame_number;
+}
+
+vk::CommandBuffer usagi::VulkanQueryManager::takeResetCommands()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(!mPendingReset) return nullptr;
+
+    const auto frame = mPendingReset;
+    mPendingReset = nullptr;
+    frame->occlusion_dirty = 0;
+    frame->statistics_dirty = 0;
+    return frame->reset_commands.get();
+}
+
+usagi::VulkanQueryManager::FramePools *
+    usagi::VulkanQueryManager::currentPools()
+{
+    const auto context = mDevice->currentFrame();
+    if(!context) return nullptr;
+    return &mFramePools[context->index()];
+}
+
+usagi::VulkanQueryManager::QueryId usagi::VulkanQueryManager::beginOcclusion(
+    const vk::CommandBuffer cmd,
+    const std::uint64_t user_data,
+    const bool precise)
+{
+    QueryId id;
+    vk::QueryPool pool;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const auto frame = currentPools();
+        if(!frame || frame->occlusion_user_data.size() >=
+            mConfig.max_occlusion_queries_per_frame)
+            return INVALID_QUERY;
+        id = static_cast<QueryId>(frame->occlusion_user_data.size());
+        frame->occlusion_user_data.push_back(user_data);
+        pool = frame->occlusion.get();
+    }
+    cmd.beginQuery(pool, id, precise && mPreciseOcclusion
+        ? vk::QueryControlFlagBits::ePrecise
+        : vk::QueryControlFlags { });
+    return id;
+}
+
+void usagi::VulkanQueryManager::endOcclusion(
+    const vk::CommandBuffer cmd,
+    const QueryId query)
+{
+    if(query == INVALID_QUERY) return;
+
+    // the pools are only changed when the next frame begins
+    cmd.endQuery(currentPools()->occlusion.get(), query);
+}
+
+usagi::VulkanQueryManager::QueryId usagi::VulkanQueryManager::beginStatistics(
+    const vk::CommandBuffer cmd,
+    std::string name)
+{
+    if(!mStatisticsSupported) return INVALID_QUERY;
+
+    QueryId id;
+    vk::QueryPool pool;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const auto frame = currentPools();
+        if(!frame || frame->statistics_names.size() >=
+            mConfig.max_statistics_queries_per_frame)
+            return INVALID_QUERY;
+        id = static_cast<QueryId>(frame->statistics_names.size());
+        frame->statistics_names.push_back(std::move(name));
+        pool = frame->statistics.get();
+    }
+    cmd.beginQuery(pool, id, { });
+    return id;
+}
+
+void usagi::VulkanQueryManager::endStatistics(
+    const vk::CommandBuffer cmd,
+    const QueryId query)
+{
+    if(query == INVALID_QUERY) return;
+
+    cmd.endQuery(currentPools()->statistics.get(), query);
+}
+
+void usagi::VulkanQueryManager::takeOcclusionResults(
+    std::vector<OcclusionResult> &results)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    results.insert(results.end(),
+        mOcclusionResults.begin(), mOcclusionResults.end());
+    mOcclusionResults.clear();
+}
+
+void usagi::VulkanQueryManager::takeStatisticsResults(
+    std::vector<StatisticsResult> &results)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    results.insert(results.end(),
+        std::make_move_iterator(mStatisticsResults.begin()),
+        std::make_move_iterator(mStatisticsResults.end()));
+    mStatisticsResults.clear();
+}
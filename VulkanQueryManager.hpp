@@ -0,0 +1,145 @@
+﻿#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+#include "VulkanGpuDeviceConfig.hpp"
+
+namespace usagi
+{
+class VulkanGpuDevice;
+
+/**
+ * \brief The counters collected by a pipeline statistics query.
+ */
+struct VulkanPipelineStatistics
+{
+    std::uint64_t input_assembly_vertices = 0;
+    std::uint64_t input_assembly_primitives = 0;
+    std::uint64_t vertex_shader_invocations = 0;
+    std::uint64_t clipping_invocations = 0;
+    std::uint64_t clipping_primitives = 0;
+    std::uint64_t fragment_shader_invocations = 0;
+};
+
+/**
+ * \brief Hands out the occlusion and pipeline statistics queries recorded
+ * into the command lists and collects their results.
+ *
+ * Each frame context has its own query pools. The results of a frame are
+ * read without waiting when its context is reused, after the batches of the
+ * frame have retired, so they arrive framesInFlight() frames later. The
+ * queries used by the frame are reset by a command buffer submitted before
+ * the first graphics jobs of the next frame using the context, so that the
+ * queries may be begun inside render passes.
+ */
+class VulkanQueryManager : Noncopyable
+{
+public:
+    using QueryId = std::uint32_t;
+    static constexpr QueryId INVALID_QUERY = ~0u;
+
+    struct OcclusionResult
+    {
+        std::uint64_t user_data = 0;
+        std::uint64_t frame = 0;
+        // the number of samples passing the depth and stencil tests, or
+        // non-zero for any passing sample if the query is not precise
+        std::uint64_t samples = 0;
+    };
+
+    struct StatisticsResult
+    {
+        std::string name;
+        std::uint64_t frame = 0;
+        VulkanPipelineStatistics statistics;
+    };
+
+private:
+    VulkanGpuDevice *mDevice = nullptr;
+    const VulkanQueryConfig mConfig;
+    bool mPreciseOcclusion = false;
+    bool mStatisticsSupported = false;
+
+    struct FramePools
+    {
+        std::uint64_t frame_number = 0;
+        vk::UniqueQueryPool occlusion;
+        vk::UniqueQueryPool statistics;
+        // one per query in use
+        std::vector<std::uint64_t> occlusion_user_data;
+        std::vector<std::string> statistics_names;
+        // the queries used since the last submitted reset. all of them
+        // before the first reset.
+        std::uint32_t occlusion_dirty = 0;
+        std::uint32_t statistics_dirty = 0;
+        vk::UniqueCommandPool command_pool;
+        vk::UniqueCommandBuffer reset_commands;
+    };
+    std::mutex mMutex;
+    std::vector<FramePools> mFramePools;
+    // the frame whose reset commands are recorded but not submitted yet
+    FramePools *mPendingReset = nullptr;
+    std::deque<OcclusionResult> mOcclusionResults;
+    std::deque<StatisticsResult> mStatisticsResults;
+    std::vector<std::uint64_t> mQueryResults;
+
+    void collectResults(FramePools &frame);
+    void recordResets(FramePools &frame);
+    FramePools * currentPools();
+
+public:
+    VulkanQueryManager(VulkanGpuDevice *device, VulkanQueryConfig config);
+
+    /**
+     * \brief Whether the device counts the exact samples instead of only
+     * reporting whether any sample passed.
+     */
+    bool isPreciseOcclusionSupported() const { return mPreciseOcclusion; }
+    bool isStatisticsSupported() const { return mStatisticsSupported; }
+
+    /**
+     * \brief Collect the results of the last frame which used the context
+     * and record the resets of its queries. Must be called after the frame
+     * is completed.
+     */
+    void beginFrame(std::size_t frame_index, std::uint64_t frame_number);
+    /**
+     * \brief The resets to be submitted before the jobs using the queries
+     * of the current frame, or null if there is none.
+     */
+    vk::CommandBuffer takeResetCommands();
+
+    /**
+     * \brief Begin an occlusion query in a primary command buffer.
+     * \param user_data Returned with the result, e.g. to identify the object.
+     * \return INVALID_QUERY if the pool of the frame is used up or no frame
+     * has begun.
+     */
+    QueryId beginOcclusion(
+        vk::CommandBuffer cmd,
+        std::uint64_t user_data,
+        bool precise);
+    void endOcclusion(vk::CommandBuffer cmd, QueryId query);
+
+    /**
+     * \return INVALID_QUERY if pipeline statistics are not supported, the
+     * pool of the frame is used up, or no frame has begun.
+     */
+    QueryId beginStatistics(vk::CommandBuffer cmd, std::string name);
+    void endStatistics(vk::CommandBuffer cmd, QueryId query);
+
+    /**
+     * \brief Move out the collected results, ordered by frames. At most
+     * max_kept_results of each type are kept if not taken.
+     */
+    void takeOcclusionResults(std::vector<OcclusionResult> &results);
+    void takeStatisticsResults(std::vector<StatisticsResult> &results);
+};
+}
@@ -0,0 +1,664 @@
+﻿#include "VulkanRenderGraph.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Core/Logging.hpp>
+#include <Usagi/Utility/Rounding.hpp>
+
+#include "VulkanAliasedImage.hpp"
+#include "VulkanBarrierBatch.hpp"
+#include "VulkanEnumTranslation.hpp"
+#include "VulkanGpuDevice.hpp"
+#include "VulkanGraphicsCommandList.hpp"
+
+using namespace usagi::vulkan;
+
+namespace
+{
+vk::ImageUsageFlags layoutUsage(const vk::ImageLayout layout)
+{
+    using vk::ImageUsageFlagBits;
+    switch(layout)
+    {
+        case vk::ImageLayout::eGeneral: return ImageUsageFlagBits::eStorage;
+        case vk::ImageLayout::eColorAttachmentOptimal:
+            return ImageUsageFlagBits::eColorAttachment;
+        case vk::ImageLayout::eDepthStencilAttachmentOptimal:
+            return ImageUsageFlagBits::eDepthStencilAttachment;
+        case vk::ImageLayout::eDepthStencilReadOnlyOptimal:
+            return ImageUsageFlagBits::eDepthStencilAttachment |
+                ImageUsageFlagBits::eSampled;
+        case vk::ImageLayout::eShaderReadOnlyOptimal:
+            return ImageUsageFlagBits::eSampled;
+        case vk::ImageLayout::eTransferSrcOptimal:
+            return ImageUsageFlagBits::eTransferSrc;
+        case vk::ImageLayout::eTransferDstOptimal:
+            return ImageUsageFlagBits::eTransferDst;
+        default: return { };
+    }
+}
+
+bool isWrite(const vk::AccessFlags access)
+{
+    using usagi::VulkanBarrierBatch;
+    return static_cast<bool>(access & VulkanBarrierBatch::WRITE_ACCESSES);
+}
+
+bool lifetimesOverlap(
+    const std::size_t first0, const std::size_t last0,
+    const std::size_t first1, const std::size_t last1)
+{
+    return first0 <= last1 && first1 <= last0;
+}
+}
+
+usagi::VulkanRenderGraph::VulkanRenderGraph(VulkanGpuDevice *device)
+    : mDevice(device)
+{
+}
+
+usagi::VulkanRenderGraph::~VulkanRenderGraph() = default;
+
+void usagi::VulkanRenderGraph::reset()
+{
+    mPasses.clear();
+    mResources.clear();
+    mSchedule.clear();
+    mCompiled = false;
+}
+
+usagi::VulkanRenderGraph::ResourceHandle usagi::VulkanRenderGraph::
+    createImage(std::string name, const TransientImageInfo &info)
+{
+    assert(!mCompiled);
+
+    Resource res;
+    res.name = std::move(name);
+    res.info = info;
+    mResources.push_back(std::move(res));
+    return static_cast<ResourceHandle>(mResources.size() - 1);
+}
+
+usagi::VulkanRenderGraph::ResourceHandle usagi::VulkanRenderGraph::
+    importImage(std::string name, std::shared_ptr<VulkanGpuImage> image)
+{
+    assert(!mCompiled);
+    assert(image);
+
+    Resource res;
+    res.name = std::move(name);
+    res.image = std::move(image);
+    res.imported = true;
+    mResources.push_back(std::move(res));
+    return static_cast<ResourceHandle>(mResources.size() - 1);
+}
+
+void usagi::VulkanRenderGraph::exportImage(
+    const ResourceHandle resource,
+    const vk::ImageLayout layout,
+    const vk::PipelineStageFlags stages,
+    const vk::AccessFlags access)
+{
+    assert(!mCompiled);
+
+    auto &res = mResources[resource];
+    res.exported = true;
+    res.final_access = { resource, layout, stages, access };
+}
+
+usagi::VulkanRenderGraph::PassHandle usagi::VulkanRenderGraph::addPass(
+    std::string name,
+    ExecuteFunc execute)
+{
+    assert(!mCompiled);
+    assert(execute);
+
+    Pass pass;
+    pass.name = std::move(name);
+    pass.execute = std::move(execute);
+    mPasses.push_back(std::move(pass));
+    return static_cast<PassHandle>(mPasses.size() - 1);
+}
+
+void usagi::VulkanRenderGraph::setSideEffects(const PassHandle pass)
+{
+    mPasses[pass].side_effects = true;
+}
+
+void usagi::VulkanRenderGraph::access(
+    const PassHandle pass,
+    const ResourceHandle resource,
+    const vk::ImageLayout layout,
+    const vk::PipelineStageFlags stages,
+    const vk::AccessFlags access,
+    const vk::ImageUsageFlags usage)
+{
+    assert(!mCompiled);
+
+    mPasses[pass].accesses.push_back({ resource, layout, stages, access });
+    mResources[resource].usage |= usage;
+}
+
+void usagi::VulkanRenderGraph::read(
+    const PassHandle pass,
+    const ResourceHandle resource,
+    const vk::ImageLayout layout,
+    const vk::PipelineStageFlags stages)
+{
+    access(pass, resource, layout, stages,
+        VulkanBarrierBatch::layoutAccesses(layout) &
+        ~VulkanBarrierBatch::WRITE_ACCESSES, layoutUsage(layout));
+}
+
+void usagi::VulkanRenderGraph::write(
+    const PassHandle pass,
+    const ResourceHandle resource,
+    const vk::ImageLayout layout,
+    const vk::PipelineStageFlags stages)
+{
+    const auto accesses = VulkanBarrierBatch::layoutAccesses(layout);
+    // the layout must allow writing
+    assert(isWrite(accesses));
+    access(pass, resource, layout, stages, accesses, layoutUsage(layout));
+}
+
+void usagi::VulkanRenderGraph::readTexture(
+    const PassHandle pass,
+    const ResourceHandle resource)
+{
+    read(pass, resource, vk::ImageLayout::eShaderReadOnlyOptimal,
+        vk::PipelineStageFlagBits::eFragmentShader);
+}
+
+void usagi::VulkanRenderGraph::readInputAttachment(
+    const PassHandle pass,
+    const ResourceHandle resource)
+{
+    access(pass, resource, vk::ImageLayout::eShaderReadOnlyOptimal,
+        vk::PipelineStageFlagBits::eFragmentShader,
+        vk::AccessFlagBits::eInputAttachmentRead,
+        vk::ImageUsageFlagBits::eInputAttachment);
+}
+
+void usagi::VulkanRenderGraph::writeColorAttachment(
+    const PassHandle pass,
+    const ResourceHandle resource)
+{
+    write(pass, resource, vk::ImageLayout::eColorAttachmentOptimal,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput);
+}
+
+void usagi::VulkanRenderGraph::writeDepthAttachment(
+    const PassHandle pass,
+    const ResourceHandle resource)
+{
+    write(pass, resource, vk::ImageLayout::eDepthStencilAttachmentOptimal,
+        vk::PipelineStageFlagBits::eEarlyFragmentTests |
+        vk::PipelineStageFlagBits::eLateFragmentTests);
+}
+
+void usagi::VulkanRenderGraph::buildDependencies()
+{
+    // the last writer of each resource and the readers after it
+    const auto none = static_cast<PassHandle>(mPasses.size());
+    std::vector<PassHandle> last_writers(mResources.size(), none);
+    std::vector<std::vector<PassHandle>> readers(mResources.size());
+
+    for(PassHandle p = 0; p < mPasses.size(); ++p)
+    {
+        auto &pass = mPasses[p];
+        pass.producers.clear();
+        pass.dependencies.clear();
+        const auto depend = [&](std::vector<PassHandle> &list, PassHandle d) {
+            if(d != p && std::find(list.begin(), list.end(), d) == list.end())
+                list.push_back(d);
+        };
+        for(auto &&a : pass.accesses)
+        {
+            // a write may keep the previous content depending on the load
+            // operation of the render pass, so it also needs the producer
+            const auto writer = last_writers[a.resource];
+            if(writer != none)
+            {
+                depend(pass.producers, writer);
+                depend(pass.dependencies, writer);
+            }
+            if(isWrite(a.access))
+            {
+                // the earlier reads must be done before overwriting
+                for(auto &&r : readers[a.resource])
+                    depend(pass.dependencies, r);
+            }
+        }
+        // update after all the accesses so that a pass reading and writing
+        // the same resource does not depend on itself
+        for(auto &&a : pass.accesses)
+        {
+            if(isWrite(a.access))
+            {
+                last_writers[a.resource] = p;
+                readers[a.resource].clear();
+            }
+        }
+        for(auto &&a : pass.accesses)
+        {
+            if(!isWrite(a.access))
+                readers[a.resource].push_back(p);
+        }
+    }
+}
+
+void usagi::VulkanRenderGraph::cullPasses()
+{
+    // a pass is needed if it has effects visible outside the graph or
+    // produces the content used by a needed pass
+    std::vector<PassHandle> stack;
+    for(PassHandle p = 0; p < mPasses.size(); ++p)
+    {
+        auto &pass = mPasses[p];
+        pass.culled = !pass.side_effects && std::none_of(
+            pass.accesses.begin(), pass.accesses.end(), [&](auto &&a) {
+                const auto &res = mResources[a.resource];
+                return isWrite(a.access) && (res.imported || res.exported);
+            });
+        if(!pass.culled) stack.push_back(p);
+    }
+    while(!stack.empty())
+    {
+        const auto p = stack.back();
+        stack.pop_back();
+        for(auto &&d : mPasses[p].producers)
+        {
+            if(!mPasses[d].culled) continue;
+            mPasses[d].culled = false;
+            stack.push_back(d);
+        }
+    }
+}
+
+void usagi::VulkanRenderGraph::schedulePasses()
+{
+    mSchedule.clear();
+
+    std::vector<std::size_t> pending(mPasses.size(), 0);
+    std::vector<std::vector<PassHandle>> dependents(mPasses.size());
+    std::vector<PassHandle> ready;
+    for(PassHandle p = 0; p < mPasses.size(); ++p)
+    {
+        const auto &pass = mPasses[p];
+        if(pass.culled) continue;
+        for(auto &&d : pass.dependencies)
+        {
+            if(mPasses[d].culled) continue;
+            ++pending[p];
+            dependents[d].push_back(p);
+        }
+        if(pending[p] == 0) ready.push_back(p);
+    }
+
+    // prefer the passes not depending on the one just scheduled, so that
+    // the GPU may overlap the passes instead of waiting at each barrier.
+    // otherwise keep the declaration order.
+    while(!ready.empty())
+    {
+        auto pick = ready.end();
+        for(auto i = ready.begin(); i != ready.end(); ++i)
+        {
+            if(!mSchedule.empty())
+            {
+                const auto &deps = mPasses[*i].dependencies;
+                if(std::find(deps.begin(), deps.end(), mSchedule.back())
+                    != deps.end()) continue;
+            }
+            if(pick == ready.end() || *i < *pick) pick = i;
+        }
+        if(pick == ready.end())
+            pick = std::min_element(ready.begin(), ready.end());
+
+        const auto p = *pick;
+        ready.erase(pick);
+        mSchedule.push_back(p);
+        for(auto &&d : dependents[p])
+            if(--pending[d] == 0) ready.push_back(d);
+    }
+}
+
+void usagi::VulkanRenderGraph::computeLifetimes()
+{
+    for(std::size_t i = 0; i < mSchedule.size(); ++i)
+    {
+        for(auto &&a : mPasses[mSchedule[i]].accesses)
+        {
+            auto &res = mResources[a.resource];
+            if(!res.used)
+            {
+                res.used = true;
+                res.first_use = i;
+                if(!res.imported && !isWrite(a.access))
+                {
+                    LOG(warn, "Render graph: transient image {} is read by "
+                        "pass {} before written.", res.name,
+                        mPasses[mSchedule[i]].name);
+                }
+            }
+            res.last_use = i;
+        }
+    }
+    // the content of exported images is used after the graph
+    for(auto &&res : mResources)
+    {
+        if(res.exported && !res.imported)
+        {
+            res.used = true;
+            res.last_use = mSchedule.size();
+        }
+    }
+}
+
+bool usagi::VulkanRenderGraph::reuseTransientImages()
+{
+    std::size_t slot = 0;
+    for(auto &&res : mResources)
+    {
+        if(res.imported || !res.used) continue;
+        if(slot == mTransientSlots.size()) return false;
+        const auto &s = mTransientSlots[slot];
+        if(s.info.format.format != res.info.format.format ||
+            s.info.format.sample_count != res.info.format.sample_count ||
+            s.info.size != res.info.size ||
+            s.info.lazily_allocated != res.info.lazily_allocated ||
+            s.usage != res.usage ||
+            s.first_use != res.first_use ||
+            s.last_use != res.last_use)
+            return false;
+        ++slot;
+    }
+    if(slot != mTransientSlots.size()) return false;
+
+    slot = 0;
+    for(auto &&res : mResources)
+    {
+        if(res.imported || !res.used) continue;
+        res.slot = slot;
+        res.image = mTransientSlots[slot].image;
+        ++slot;
+    }
+    return true;
+}
+
+void usagi::VulkanRenderGraph::allocateTransientImages()
+{
+    // the old images are kept alive by the command lists using them
+    mTransientSlots.clear();
+    mHeaps.clear();
+
+    struct Placement
+    {
+        ResourceHandle resource;
+        vk::UniqueImage image;
+        vk::MemoryRequirements requirements;
+        std::size_t offset = 0;
+        bool lazy = false;
+    };
+    std::vector<Placement> placements;
+
+    const auto vk_device = mDevice->device();
+    const vk::ImageUsageFlags attachment_usages =
+        vk::ImageUsageFlagBits::eColorAttachment |
+        vk::ImageUsageFlagBits::eDepthStencilAttachment |
+        vk::ImageUsageFlagBits::eInputAttachment;
+    // the storage images may be written by the compute queue and read by
+    // the graphics queue, so they are shared instead of transferring the
+    // ownership.
+    const std::uint32_t storage_queue_families[] = {
+        mDevice->graphicsQueueFamily(),
+        mDevice->computeQueueFamily(),
+    };
+    for(ResourceHandle r = 0; r < mResources.size(); ++r)
+    {
+        auto &res = mResources[r];
+        if(res.imported || !res.used) continue;
+
+        auto usage = res.usage;
+        if(res.info.lazily_allocated)
+        {
+            if(usage & ~attachment_usages)
+            {
+                LOG(warn, "Render graph: image {} is not only used as "
+                    "attachments and cannot be lazily allocated.", res.name);
+            }
+            else
+            {
+                usage |= vk::ImageUsageFlagBits::eTransientAttachment;
+            }
+        }
+
+        const auto format = translate(res.info.format.format);
+        if(!mDevice->capabilities()->supportsOptimalTiling(format,
+            VulkanDeviceCapabilities::requiredFormatFeatures(usage)))
+        {
+            USAGI_THROW(std::runtime_error(
+                "The image format does not support the usages with optimal "
+                "tiling."));
+        }
+
+        vk::ImageCreateInfo vk_info;
+        vk_info.setImageType(vk::ImageType::e2D);
+        vk_info.setFormat(format);
+        vk_info.extent.width = res.info.size.x();
+        vk_info.extent.height = res.info.size.y();
+        vk_info.extent.depth = 1;
+        vk_info.setMipLevels(1);
+        vk_info.setArrayLayers(1);
+        vk_info.setSamples(translateSampleCount(res.info.format.sample_count));
+        vk_info.setTiling(vk::ImageTiling::eOptimal);
+        vk_info.setUsage(usage);
+        if(mDevice->hasDedicatedComputeQueue() &&
+            (usage & vk::ImageUsageFlagBits::eStorage))
+        {
+            vk_info.setSharingMode(vk::SharingMode::eConcurrent);
+            vk_info.setQueueFamilyIndexCount(2);
+            vk_info.setPQueueFamilyIndices(storage_queue_families);
+        }
+        else
+        {
+            vk_info.setSharingMode(vk::SharingMode::eExclusive);
+        }
+        vk_info.setInitialLayout(vk::ImageLayout::eUndefined);
+
+        Placement p;
+        p.resource = r;
+        p.lazy = static_cast<bool>(
+            usage & vk::ImageUsageFlagBits::eTransientAttachment);
+        p.image = vk_device.createImageUnique(vk_info);
+        p.requirements = vk_device.getImageMemoryRequirements(p.image.get());
+        res.slot = mTransientSlots.size();
+        placements.push_back(std::move(p));
+
+        TransientSlot slot;
+        slot.info = res.info;
+        slot.usage = res.usage;
+        slot.first_use = res.first_use;
+        slot.last_use = res.last_use;
+        mTransientSlots.push_back(std::move(slot));
+    }
+
+    // the images sharing a heap must all accept its memory type. most
+    // implementations use the same types for all the optimal images, and
+    // the transient attachments additionally accept the lazily allocated
+    // ones.
+    std::vector<std::vector<Placement *>> groups;
+    for(auto &&p : placements)
+    {
+        const auto group = std::find_if(groups.begin(), groups.end(),
+            [&](auto &&g) {
+                return g.front()->lazy == p.lazy &&
+                    g.front()->requirements.memoryTypeBits ==
+                    p.requirements.memoryTypeBits;
+            });
+        if(group == groups.end())
+            groups.push_back({ &p });
+        else
+            group->push_back(&p);
+    }
+
+    std::size_t unaliased_size = 0;
+    for(auto &&group : groups)
+    {
+        // place the large images first at the lowest offset not used by
+        // the images alive at the same time
+        std::stable_sort(group.begin(), group.end(), [](auto &&a, auto &&b) {
+            return a->requirements.size > b->requirements.size;
+        });
+        vk::MemoryRequirements heap_req;
+        heap_req.memoryTypeBits = group.front()->requirements.memoryTypeBits;
+        for(std::size_t i = 0; i < group.size(); ++i)
+        {
+            auto &p = *group[i];
+            const auto &res = mResources[p.resource];
+            const auto conflicts = [&](const Placement &q) {
+                const auto &other = mResources[q.resource];
+                return lifetimesOverlap(res.first_use, res.last_use,
+                    other.first_use, other.last_use);
+            };
+            std::size_t offset = 0;
+            for(auto placed = false; !placed; )
+            {
+                placed = true;
+                for(std::size_t j = 0; j < i; ++j)
+                {
+                    const auto &q = *group[j];
+                    if(!conflicts(q)) continue;
+                    const auto end = q.offset + q.requirements.size;
+                    if(offset < end && q.offset < offset + p.requirements.size)
+                    {
+                        offset = utility::roundUpUnsigned(
+                            end, p.requirements.alignment);
+                        placed = false;
+                    }
+                }
+            }
+            p.offset = offset;
+            heap_req.size = std::max(heap_req.size,
+                offset + p.requirements.size);
+            heap_req.alignment = std::max(heap_req.alignment,
+                p.requirements.alignment);
+            unaliased_size += p.requirements.size;
+        }
+
+        // falls back to the ordinary memory if there is no lazily
+        // allocated memory, which is common on desktop GPUs
+        auto heap = std::make_shared<VulkanImageHeap>(mDevice, heap_req,
+            vk::MemoryPropertyFlagBits::eDeviceLocal,
+            group.front()->lazy
+                ? vk::MemoryPropertyFlags(
+                    vk::MemoryPropertyFlagBits::eLazilyAllocated)
+                : vk::MemoryPropertyFlags { });
+        for(auto &&p : group)
+        {
+            auto &res = mResources[p->resource];
+            res.image = std::make_shared<VulkanAliasedImage>(
+                std::move(p->image), res.info.format, res.info.size,
+                heap, p->offset);
+            // named after the first resource using the slot
+            res.image->setDebugName(res.name.c_str());
+            auto &slot = mTransientSlots[res.slot];
+            slot.image = res.image;
+            for(auto &&q : group)
+            {
+                if(q == p) continue;
+                if(p->offset < q->offset + q->requirements.size &&
+                    q->offset < p->offset + p->requirements.size)
+                    slot.aliases.push_back(mResources[q->resource].slot);
+            }
+        }
+        mHeaps.push_back(std::move(heap));
+    }
+
+    LOG(info, "Render graph: {} transient images placed in {} bytes "
+        "({} bytes without aliasing)", placements.size(),
+        transientMemorySize(), unaliased_size);
+}
+
+void usagi::VulkanRenderGraph::compile()
+{
+    assert(!mCompiled);
+
+    buildDependencies();
+    cullPasses();
+    schedulePasses();
+    computeLifetimes();
+    if(!reuseTransientImages())
+        allocateTransientImages();
+    mCompiled = true;
+}
+
+void usagi::VulkanRenderGraph::execute(VulkanGraphicsCommandList &cmd)
+{
+    assert(mCompiled);
+
+    for(std::size_t i = 0; i < mSchedule.size(); ++i)
+    {
+        auto &pass = mPasses[mSchedule[i]];
+        for(auto &&a : pass.accesses)
+        {
+            const auto &res = mResources[a.resource];
+            auto &image = *res.image;
+            if(res.imported)
+            {
+                // the stages are only used for images not accessed by any
+                // tracked command, which wait for semaphores at them
+                cmd.transition(image, a.layout, a.stages, a.access,
+                    false, a.stages);
+                continue;
+            }
+            const auto first = i == res.first_use;
+            if(first)
+            {
+                // the memory was last used by the images sharing it, by
+                // this frame or the last one. that must finish and their
+                // writes must be made available before the content is
+                // discarded.
+                auto &state = image.subresourceState(0, 0);
+                for(auto &&s : mTransientSlots[res.slot].aliases)
+                {
+                    const auto &other =
+                        mTransientSlots[s].image->subresourceState(0, 0);
+                    state.stages |= other.stages | other.read_stages;
+                    state.access |= other.access;
+                }
+            }
+            cmd.transition(image, a.layout, a.stages, a.access, first);
+        }
+        for(auto &&a : pass.accesses)
+            cmd.trackResource(mResources[a.resource].image);
+
+        cmd.pushLabel(pass.name.c_str());
+        pass.execute(cmd);
+        cmd.popLabel();
+    }
+
+    for(auto &&res : mResources)
+    {
+        if(!res.exported) continue;
+        const auto &a = res.final_access;
+        cmd.transition(*res.image, a.layout, a.stages, a.access);
+        cmd.trackResource(res.image);
+    }
+}
+
+const std::shared_ptr<usagi::VulkanGpuImage> & usagi::VulkanRenderGraph::
+    image(const ResourceHandle resource) const
+{
+    return mResources[resource].image;
+}
+
+std::size_t usagi::VulkanRenderGraph::transientMemorySize() const
+{
+    std::size_t size = 0;
+    for(auto &&h : mHeaps)
+        size += h->size();
+    return size;
+}
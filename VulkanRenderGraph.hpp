@@ -0,0 +1,217 @@
+﻿#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Runtime/Graphics/GpuImage.hpp>
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+class VulkanGpuDevice;
+class VulkanGpuImage;
+class VulkanGraphicsCommandList;
+class VulkanImageHeap;
+
+/**
+ * \brief Assembles a frame from passes declaring the images they access.
+ *
+ * The graph is declared every frame in the order the passes would be
+ * recorded by hand. A read refers to the content written by the last pass
+ * declared before it. compile() culls the passes whose results are never
+ * used, reorders the rest within the dependencies, and places the transient
+ * images into shared memory so that images not alive at the same time
+ * occupy the same range. execute() requests the layout transitions of each
+ * pass before invoking it, so the passes only record their commands. The
+ * transitions are recorded by beginRendering() and clearColorImage(); other
+ * commands accessing the images must be preceded by flushBarriers().
+ *
+ * The transient images and their memory are kept while the declared images
+ * and their lifetimes stay the same, so declaring the same graph every frame
+ * does not allocate.
+ */
+class VulkanRenderGraph : Noncopyable
+{
+public:
+    using ResourceHandle = std::uint32_t;
+    using PassHandle = std::uint32_t;
+    using ExecuteFunc = std::function<void(VulkanGraphicsCommandList &)>;
+
+    struct TransientImageInfo
+    {
+        GpuImageFormat format;
+        Vector2u32 size;
+        /**
+         * \brief The image is only used as attachments within a render pass
+         * and never stored, so tile-based GPUs may keep it in the tile
+         * memory without backing it with real memory. Ignored if the image
+         * is used in other ways.
+         */
+        bool lazily_allocated = false;
+    };
+
+private:
+    VulkanGpuDevice *mDevice = nullptr;
+
+    struct Access
+    {
+        ResourceHandle resource;
+        vk::ImageLayout layout;
+        vk::PipelineStageFlags stages;
+        vk::AccessFlags access;
+    };
+
+    struct Pass
+    {
+        std::string name;
+        ExecuteFunc execute;
+        std::vector<Access> accesses;
+        bool side_effects = false;
+        // filled by compile(). the producers wrote the content accessed by
+        // the pass, and the dependencies also include the passes which must
+        // finish accessing the resources before the pass overwrites them.
+        std::vector<PassHandle> producers;
+        std::vector<PassHandle> dependencies;
+        bool culled = false;
+    };
+
+    struct Resource
+    {
+        std::string name;
+        // null for transient images until compiled
+        std::shared_ptr<VulkanGpuImage> image;
+        bool imported = false;
+        TransientImageInfo info;
+        vk::ImageUsageFlags usage;
+        // the transitions done after the graph
+        bool exported = false;
+        Access final_access;
+        // filled by compile(), indices into the schedule
+        std::size_t first_use = 0;
+        std::size_t last_use = 0;
+        bool used = false;
+        // index of the transient slot
+        std::size_t slot = 0;
+    };
+
+    std::vector<Pass> mPasses;
+    std::vector<Resource> mResources;
+    std::vector<PassHandle> mSchedule;
+    bool mCompiled = false;
+
+    // transient images of the last compilation, reused if the new graph
+    // declares the same ones
+    struct TransientSlot
+    {
+        TransientImageInfo info;
+        vk::ImageUsageFlags usage;
+        std::size_t first_use = 0;
+        std::size_t last_use = 0;
+        std::shared_ptr<VulkanGpuImage> image;
+        // the slots whose images share memory with this one
+        std::vector<std::size_t> aliases;
+    };
+    std::vector<TransientSlot> mTransientSlots;
+    std::vector<std::shared_ptr<VulkanImageHeap>> mHeaps;
+
+    void access(
+        PassHandle pass,
+        ResourceHandle resource,
+        vk::ImageLayout layout,
+        vk::PipelineStageFlags stages,
+        vk::AccessFlags access,
+        vk::ImageUsageFlags usage);
+
+    void buildDependencies();
+    void cullPasses();
+    void schedulePasses();
+    void computeLifetimes();
+    bool reuseTransientImages();
+    void allocateTransientImages();
+
+public:
+    explicit VulkanRenderGraph(VulkanGpuDevice *device);
+    ~VulkanRenderGraph();
+
+    /**
+     * \brief Remove the declared passes and resources. The transient images
+     * are kept for the next compilation.
+     */
+    void reset();
+
+    /**
+     * \brief Declare an image only used within the graph. The usage is
+     * derived from the accesses.
+     */
+    ResourceHandle createImage(
+        std::string name,
+        const TransientImageInfo &info);
+    /**
+     * \brief Declare an image living outside the graph, e.g. a swapchain
+     * image. The passes writing it are never culled.
+     */
+    ResourceHandle importImage(
+        std::string name,
+        std::shared_ptr<VulkanGpuImage> image);
+    /**
+     * \brief Transition the image after the graph is executed, e.g. to the
+     * present layout. The writes to the image are not culled.
+     */
+    void exportImage(
+        ResourceHandle resource,
+        vk::ImageLayout layout,
+        vk::PipelineStageFlags stages,
+        vk::AccessFlags access);
+
+    PassHandle addPass(std::string name, ExecuteFunc execute);
+    /**
+     * \brief Keep the pass even if nothing reads its results, e.g. if it
+     * writes buffers which the graph does not know.
+     */
+    void setSideEffects(PassHandle pass);
+
+    void read(
+        PassHandle pass,
+        ResourceHandle resource,
+        vk::ImageLayout layout,
+        vk::PipelineStageFlags stages);
+    void write(
+        PassHandle pass,
+        ResourceHandle resource,
+        vk::ImageLayout layout,
+        vk::PipelineStageFlags stages);
+
+    void readTexture(PassHandle pass, ResourceHandle resource);
+    /**
+     * \brief Read the image as an input attachment of a subpass.
+     */
+    void readInputAttachment(PassHandle pass, ResourceHandle resource);
+    void writeColorAttachment(PassHandle pass, ResourceHandle resource);
+    void writeDepthAttachment(PassHandle pass, ResourceHandle resource);
+
+    void compile();
+    /**
+     * \brief Record the passes into the command list outside a render pass.
+     * The command list keeps the images alive.
+     */
+    void execute(VulkanGraphicsCommandList &cmd);
+
+    /**
+     * \brief The image of the resource. Transient images are only available
+     * after compile().
+     */
+    const std::shared_ptr<VulkanGpuImage> & image(
+        ResourceHandle resource) const;
+    bool isCulled(PassHandle pass) const { return mPasses[pass].culled; }
+    const std::vector<PassHandle> & schedule() const { return mSchedule; }
+    /**
+     * \brief The memory allocated for the transient images, including the
+     * lazily allocated one which may not be committed.
+     */
+    std::size_t transientMemorySize() const;
+};
+}
@@ -1,25 +1,168 @@
 ﻿#include "VulkanRenderPass.hpp"
 
+#include <algorithm>
+#include <cassert>
+
 #include <Usagi/Core/Logging.hpp>
 #include <Usagi/Runtime/Graphics/RenderPassCreateInfo.hpp>
 
+#include "VulkanBarrierBatch.hpp"
 #include "VulkanEnumTranslation.hpp"
 #include "VulkanGpuDevice.hpp"
 
 using namespace usagi::vulkan;
 
+namespace
+{
+struct AttachmentUse
+{
+    vk::PipelineStageFlags stages;
+    vk::AccessFlags access;
+
+    bool writes() const
+    {
+        return static_cast<bool>(
+            access & usagi::VulkanBarrierBatch::WRITE_ACCESSES);
+    }
+};
+
+AttachmentUse findUse(
+    const usagi::VulkanSubpassInfo &subpass,
+    const std::uint32_t attachment)
+{
+    using vk::AccessFlagBits;
+    using vk::PipelineStageFlagBits;
+
+    AttachmentUse use;
+    for(auto &&r : subpass.color_attachments)
+    {
+        if(r.attachment != attachment) continue;
+        use.stages |= PipelineStageFlagBits::eColorAttachmentOutput;
+        use.access |= AccessFlagBits::eColorAttachmentRead |
+            AccessFlagBits::eColorAttachmentWrite;
+    }
+    for(auto &&r : subpass.input_attachments)
+    {
+        if(r.attachment != attachment) continue;
+        use.stages |= PipelineStageFlagBits::eFragmentShader;
+        use.access |= AccessFlagBits::eInputAttachmentRead;
+    }
+    const auto &ds = subpass.depth_stencil_attachment;
+    if(ds.attachment == attachment)
+    {
+        use.stages |= PipelineStageFlagBits::eEarlyFragmentTests |
+            PipelineStageFlagBits::eLateFragmentTests;
+        use.access |= AccessFlagBits::eDepthStencilAttachmentRead;
+        if(ds.layout != vk::ImageLayout::eDepthStencilReadOnlyOptimal)
+            use.access |= AccessFlagBits::eDepthStencilAttachmentWrite;
+    }
+    return use;
+}
+
+vk::ImageLayout findLayout(
+    const usagi::VulkanSubpassInfo &subpass,
+    const std::uint32_t attachment)
+{
+    for(auto &&r : subpass.color_attachments)
+        if(r.attachment == attachment) return r.layout;
+    for(auto &&r : subpass.input_attachments)
+        if(r.attachment == attachment) return r.layout;
+    if(subpass.depth_stencil_attachment.attachment == attachment)
+        return subpass.depth_stencil_attachment.layout;
+    return vk::ImageLayout::eUndefined;
+}
+
+void addDependency(
+    std::vector<vk::SubpassDependency> &dependencies,
+    const std::uint32_t src_subpass,
+    const std::uint32_t dst_subpass,
+    const AttachmentUse &src,
+    const AttachmentUse &dst)
+{
+    // only the writes need to be made available
+    const auto src_access = src.access &
+        usagi::VulkanBarrierBatch::WRITE_ACCESSES;
+    const auto iter = std::find_if(
+        dependencies.begin(), dependencies.end(), [&](auto &&d) {
+            return d.srcSubpass == src_subpass && d.dstSubpass == dst_subpass;
+        });
+    if(iter != dependencies.end())
+    {
+        iter->srcStageMask |= src.stages;
+        iter->dstStageMask |= dst.stages;
+        iter->srcAccessMask |= src_access;
+        iter->dstAccessMask |= dst.access;
+        return;
+    }
+    vk::SubpassDependency d;
+    d.setSrcSubpass(src_subpass);
+    d.setDstSubpass(dst_subpass);
+    d.setSrcStageMask(src.stages);
+    d.setDstStageMask(dst.stages);
+    d.setSrcAccessMask(src_access);
+    d.setDstAccessMask(dst.access);
+    // the attachments are only accessed at the same pixel
+    d.setDependencyFlags(vk::DependencyFlagBits::eByRegion);
+    dependencies.push_back(d);
+}
+}
+
 usagi::VulkanRenderPass::VulkanRenderPass(
     VulkanGpuDevice *device,
     const RenderPassCreateInfo &info)
 {
-    mClearValues.reserve(info.attachment_usages.size());
+    // todo unused attachments? / one framebuffer per subsystem?
+    VulkanSubpassInfo subpass;
+    for(std::size_t i = 0; i < info.attachment_usages.size(); ++i)
+    {
+        auto &&a = info.attachment_usages[i];
+        vk::AttachmentReference r;
+        r.setAttachment(static_cast<uint32_t>(i));
+        r.setLayout(translate(a.layout));
+        if(a.layout == GpuImageLayout::DEPTH_STENCIL_ATTACHMENT)
+        {
+            if(subpass.depth_stencil_attachment.attachment !=
+                VK_ATTACHMENT_UNUSED)
+                LOG(error, "Only one depth stencil attachment may be used.");
+            subpass.depth_stencil_attachment = r;
+        }
+        else
+        {
+            subpass.color_attachments.push_back(r);
+        }
+    }
+    create(device, info, { subpass }, { });
+}
+
+usagi::VulkanRenderPass::VulkanRenderPass(
+    VulkanGpuDevice *device,
+    const RenderPassCreateInfo &info,
+    const std::vector<VulkanSubpassInfo> &subpasses,
+    std::vector<vk::SubpassDependency> dependencies)
+{
+    create(device, info, subpasses, std::move(dependencies));
+}
+
+void usagi::VulkanRenderPass::create(
+    VulkanGpuDevice *device,
+    const RenderPassCreateInfo &info,
+    const std::vector<VulkanSubpassInfo> &subpasses,
+    std::vector<vk::SubpassDependency> dependencies)
+{
+    assert(!subpasses.empty());
+
+    const auto attachment_count =
+        static_cast<std::uint32_t>(info.attachment_usages.size());
+    const auto subpass_count = static_cast<std::uint32_t>(subpasses.size());
+    mClearValues.reserve(attachment_count);
 
     vk::RenderPassCreateInfo vk_info;
 
     std::vector<vk::AttachmentDescription> attachment_descriptions;
-    attachment_descriptions.reserve(info.attachment_usages.size());
-    for(auto &&u : info.attachment_usages)
+    attachment_descriptions.reserve(attachment_count);
+    for(std::uint32_t i = 0; i < attachment_count; ++i)
     {
+        auto &&u = info.attachment_usages[i];
         vk::AttachmentDescription d;
         d.setFormat(translate(u.format.format));
         d.setSamples(translateSampleCount(u.format.sample_count));
@@ -28,45 +171,140 @@ usagi::VulkanRenderPass::VulkanRenderPass(
         d.setLoadOp(translate(u.op.load_op));
         d.setStoreOp(translate(u.op.store_op));
         attachment_descriptions.push_back(d);
+
+        AttachmentLayouts layouts;
+        layouts.initial = d.initialLayout;
+        layouts.final = d.finalLayout;
+        for(auto &&s : subpasses)
+        {
+            const auto use = findUse(s, i);
+            if(!use.stages) continue;
+            if(!layouts.stages)
+                layouts.subpass = findLayout(s, i);
+            layouts.stages |= use.stages;
+            layouts.access |= use.access;
+        }
+        mAttachmentLayouts.push_back(layouts);
         mClearValues.emplace_back(std::array<float, 4> {
             u.op.clear_color.x(), u.op.clear_color.y(),
             u.op.clear_color.z(), u.op.clear_color.w()
         });
     }
-    vk_info.setAttachmentCount(
-        static_cast<uint32_t>(attachment_descriptions.size()));
+    vk_info.setAttachmentCount(attachment_count);
     vk_info.setPAttachments(attachment_descriptions.data());
 
-    // todo unused attachments? / one framebuffer per subsystem?
-    vk::SubpassDescription subpass;
-    std::vector<vk::AttachmentReference> color_refs;
-    vk::AttachmentReference ds_ref;
-    for(std::size_t i = 0; i < info.attachment_usages.size(); ++i)
+    // the attachments referenced before and after a subpass must be
+    // preserved by it
+    std::vector<std::vector<std::uint32_t>> preserves(subpass_count);
+    for(std::uint32_t a = 0; a < attachment_count; ++a)
     {
-        auto &&a = info.attachment_usages[i];
-        if(a.layout == GpuImageLayout::DEPTH_STENCIL_ATTACHMENT)
+        std::uint32_t first = subpass_count, last = 0;
+        for(std::uint32_t s = 0; s < subpass_count; ++s)
         {
-            if(subpass.pDepthStencilAttachment)
-                LOG(error, "Only one depth stencil attachment may be used.");
-            ds_ref.setAttachment(static_cast<uint32_t>(i));
-            ds_ref.setLayout(translate(a.layout));
-            subpass.setPDepthStencilAttachment(&ds_ref);
+            if(!findUse(subpasses[s], a).stages) continue;
+            first = std::min(first, s);
+            last = s;
         }
-        else
+        for(auto s = first + 1; s < last; ++s)
+        {
+            if(!findUse(subpasses[s], a).stages)
+                preserves[s].push_back(a);
+        }
+    }
+
+    std::vector<vk::SubpassDescription> descriptions;
+    descriptions.reserve(subpass_count);
+    for(std::uint32_t s = 0; s < subpass_count; ++s)
+    {
+        auto &&sp = subpasses[s];
+        vk::SubpassDescription d;
+        d.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics);
+        d.setColorAttachmentCount(
+            static_cast<uint32_t>(sp.color_attachments.size()));
+        d.setPColorAttachments(sp.color_attachments.data());
+        d.setInputAttachmentCount(
+            static_cast<uint32_t>(sp.input_attachments.size()));
+        d.setPInputAttachments(sp.input_attachments.data());
+        if(sp.depth_stencil_attachment.attachment != VK_ATTACHMENT_UNUSED)
+            d.setPDepthStencilAttachment(&sp.depth_stencil_attachment);
+        d.setPreserveAttachmentCount(
+            static_cast<uint32_t>(preserves[s].size()));
+        d.setPPreserveAttachments(preserves[s].data());
+        descriptions.push_back(d);
+        mColorAttachmentCounts.push_back(d.colorAttachmentCount);
+    }
+    vk_info.setSubpassCount(subpass_count);
+    vk_info.setPSubpasses(descriptions.data());
+
+    if(dependencies.empty())
+    {
+        // same as the render graph: reads wait for the last write, and
+        // writes also wait for the reads since then
+        for(std::uint32_t a = 0; a < attachment_count; ++a)
         {
-            vk::AttachmentReference r;
-            r.setAttachment(static_cast<uint32_t>(i));
-            r.setLayout(translate(a.layout));
-            color_refs.push_back(r);
+            auto writer = VK_SUBPASS_EXTERNAL;
+            AttachmentUse write;
+            std::vector<std::pair<std::uint32_t, AttachmentUse>> readers;
+            for(std::uint32_t s = 0; s < subpass_count; ++s)
+            {
+                const auto use = findUse(subpasses[s], a);
+                if(!use.stages) continue;
+                if(writer != VK_SUBPASS_EXTERNAL)
+                    addDependency(dependencies, writer, s, write, use);
+                if(use.writes())
+                {
+                    for(auto &&r : readers)
+                        addDependency(dependencies, r.first, s, r.second, use);
+                    readers.clear();
+                    writer = s;
+                    write = use;
+                }
+                else
+                {
+                    readers.emplace_back(s, use);
+                }
+            }
         }
     }
-    subpass.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics);
-    subpass.setColorAttachmentCount(
-        static_cast<uint32_t>(color_refs.size()));
-    subpass.setPColorAttachments(color_refs.data());
+    vk_info.setDependencyCount(static_cast<uint32_t>(dependencies.size()));
+    vk_info.setPDependencies(dependencies.data());
 
-    vk_info.setSubpassCount(1);
-    vk_info.setPSubpasses(&subpass);
+    mCompatibilityKey.push_back(attachment_descriptions.size());
+    for(auto &&d : attachment_descriptions)
+    {
+        mCompatibilityKey.push_back(static_cast<std::uint64_t>(d.format));
+        mCompatibilityKey.push_back(static_cast<std::uint64_t>(d.samples));
+    }
+    for(auto &&sp : subpasses)
+    {
+        mCompatibilityKey.push_back(sp.color_attachments.size());
+        for(auto &&r : sp.color_attachments)
+            mCompatibilityKey.push_back(r.attachment);
+        mCompatibilityKey.push_back(sp.input_attachments.size());
+        for(auto &&r : sp.input_attachments)
+            mCompatibilityKey.push_back(r.attachment);
+        mCompatibilityKey.push_back(sp.depth_stencil_attachment.attachment);
+    }
+    // render passes with multiple subpasses are only compatible if their
+    // dependencies are also identical
+    if(subpass_count > 1)
+    {
+        for(auto &&d : dependencies)
+        {
+            mCompatibilityKey.push_back(d.srcSubpass);
+            mCompatibilityKey.push_back(d.dstSubpass);
+            mCompatibilityKey.push_back(
+                static_cast<VkPipelineStageFlags>(d.srcStageMask));
+            mCompatibilityKey.push_back(
+                static_cast<VkPipelineStageFlags>(d.dstStageMask));
+            mCompatibilityKey.push_back(
+                static_cast<VkAccessFlags>(d.srcAccessMask));
+            mCompatibilityKey.push_back(
+                static_cast<VkAccessFlags>(d.dstAccessMask));
+            mCompatibilityKey.push_back(
+                static_cast<VkDependencyFlags>(d.dependencyFlags));
+        }
+    }
 
     mRenderPass = device->device().createRenderPassUnique(vk_info);
 }
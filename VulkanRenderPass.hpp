@@ -1,21 +1,84 @@
 ﻿#pragma once
 
+#include <cassert>
+
 #include <vulkan/vulkan.hpp>
 
 #include <Usagi/Runtime/Graphics/RenderPass.hpp>
 
+#include "VulkanBatchResource.hpp"
+
 namespace usagi
 {
 struct RenderPassCreateInfo;
 class VulkanGpuDevice;
 
-class VulkanRenderPass : public RenderPass
+/**
+ * \brief The attachments referenced by a subpass. The attachment indices
+ * refer to the attachment usages of RenderPassCreateInfo.
+ */
+struct VulkanSubpassInfo
+{
+    std::vector<vk::AttachmentReference> color_attachments;
+    // read with subpassLoad() in the fragment shader
+    std::vector<vk::AttachmentReference> input_attachments;
+    vk::AttachmentReference depth_stencil_attachment {
+        VK_ATTACHMENT_UNUSED, vk::ImageLayout::eUndefined
+    };
+};
+
+class VulkanRenderPass
+    : public RenderPass
+    , public VulkanBatchResource
 {
+public:
+    struct AttachmentLayouts
+    {
+        vk::ImageLayout initial = vk::ImageLayout::eUndefined;
+        // used by the first subpass referencing the attachment
+        vk::ImageLayout subpass = vk::ImageLayout::eUndefined;
+        vk::ImageLayout final = vk::ImageLayout::eUndefined;
+        // the accesses by all the subpasses. empty if unused.
+        vk::PipelineStageFlags stages;
+        vk::AccessFlags access;
+    };
+
+private:
     vk::UniqueRenderPass mRenderPass;
+    std::vector<AttachmentLayouts> mAttachmentLayouts;
     std::vector<vk::ClearValue> mClearValues;
+    // the formats and sample counts of the attachments and the attachment
+    // references of the subpasses. render passes with the same key are
+    // compatible.
+    std::vector<std::uint64_t> mCompatibilityKey;
+    std::vector<std::uint32_t> mColorAttachmentCounts;
+
+    void create(
+        VulkanGpuDevice *device,
+        const RenderPassCreateInfo &info,
+        const std::vector<VulkanSubpassInfo> &subpasses,
+        std::vector<vk::SubpassDependency> dependencies);
 
 public:
+    /**
+     * \brief Create a render pass with a single subpass referencing all the
+     * attachments in the layouts of their usages.
+     */
     VulkanRenderPass(VulkanGpuDevice *device, const RenderPassCreateInfo &info);
+    /**
+     * \brief Create a render pass with multiple subpasses, so that the
+     * attachments passed between them may stay in the tile memory. The
+     * layouts of the attachment usages are ignored.
+     * \param dependencies If empty, the dependencies between the subpasses
+     * using the same attachments are derived from the references. The
+     * accesses before and after the render pass are synchronized by the
+     * command lists.
+     */
+    VulkanRenderPass(
+        VulkanGpuDevice *device,
+        const RenderPassCreateInfo &info,
+        const std::vector<VulkanSubpassInfo> &subpasses,
+        std::vector<vk::SubpassDependency> dependencies = { });
 
     vk::RenderPass renderPass() const { return mRenderPass.get(); }
 
@@ -23,5 +86,26 @@ public:
     {
         return mClearValues;
     }
+
+    const std::vector<AttachmentLayouts> & attachmentLayouts() const
+    {
+        return mAttachmentLayouts;
+    }
+
+    const std::vector<std::uint64_t> & compatibilityKey() const
+    {
+        return mCompatibilityKey;
+    }
+
+    std::uint32_t subpassCount() const
+    {
+        return static_cast<std::uint32_t>(mColorAttachmentCounts.size());
+    }
+
+    std::uint32_t colorAttachmentCount(const std::uint32_t subpass) const
+    {
+        assert(subpass < subpassCount());
+        return mColorAttachmentCounts[subpass];
+    }
 };
 }
@@ -0,0 +1,22 @@
+﻿#include "VulkanResourceTracker.hpp"
+
+#include "VulkanFrameContext.hpp"
+
+usagi::VulkanResourceTracker::VulkanResourceTracker(VulkanFrameContext *frame)
+    : mFrame(frame)
+    , mFrameNumber(frame ? frame->frameNumber() : 0)
+{
+}
+
+usagi::VulkanResourceTracker::~VulkanResourceTracker()
+{
+    // the recording may be abandoned and other command lists of the frame
+    // may rely on the references retained by it.
+    flush();
+}
+
+void usagi::VulkanResourceTracker::flush()
+{
+    if(!mFrame || mResources.empty()) return;
+    mFrame->retain(mFrameNumber, mResources);
+}
@@ -0,0 +1,76 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+#include "VulkanBatchResource.hpp"
+
+namespace usagi
+{
+class VulkanFrameContext;
+
+/**
+ * \brief Keeps the resources used by a command list alive until the GPU
+ * finished executing it, without copying a reference for every use.
+ *
+ * The command lists allocated from a frame context are submitted during the
+ * frame, so their resources only have to outlive the frame. A resource is
+ * only retained by its first use in the frame, as told by its stamp, and the
+ * references are handed over to the frame context when the recording ends
+ * since the other command lists of the frame rely on them as well. The
+ * command lists recorded outside frames keep a reference for every use.
+ */
+class VulkanResourceTracker : Noncopyable
+{
+    // null if the command list is not allocated from a frame context
+    VulkanFrameContext *mFrame = nullptr;
+    std::uint64_t mFrameNumber = 0;
+    std::vector<std::shared_ptr<VulkanBatchResource>> mResources;
+
+public:
+    explicit VulkanResourceTracker(VulkanFrameContext *frame);
+    ~VulkanResourceTracker();
+
+    /**
+     * \brief Whether this use of the resource must retain a reference.
+     */
+    bool needsReference(VulkanBatchResource &resource)
+    {
+        return !mFrame || resource.markUsed(mFrameNumber);
+    }
+    void retain(std::shared_ptr<VulkanBatchResource> resource)
+    {
+        mResources.push_back(std::move(resource));
+    }
+
+    template <typename Resource>
+    void track(const std::shared_ptr<Resource> &resource)
+    {
+        if(needsReference(*resource))
+            mResources.push_back(resource);
+        resource->trackAdditionalResources(*this);
+    }
+    /**
+     * \brief Track a resource reached without casting the pointer owning it,
+     * e.g. a shader resource of the engine interfaces.
+     */
+    template <typename Owner>
+    void track(
+        VulkanBatchResource &resource,
+        const std::shared_ptr<Owner> &owner)
+    {
+        if(needsReference(resource))
+            mResources.emplace_back(owner, &resource);
+        resource.trackAdditionalResources(*this);
+    }
+
+    /**
+     * \brief Hand over the references to the frame context. Does nothing
+     * for the command lists recorded outside frames, which keep them.
+     */
+    void flush();
+};
+}
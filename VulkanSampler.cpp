@@ -1,8 +1,23 @@
 ﻿#include "VulkanSampler.hpp"
 
-usagi::VulkanSampler::VulkanSampler(vk::UniqueSampler vk_sampler)
-    : mSampler(std::move(vk_sampler))
+#include "VulkanGpuDevice.hpp"
+#include "VulkanHelper.hpp"
+
+usagi::VulkanSampler::VulkanSampler(
+    VulkanGpuDevice *device,
+    vk::UniqueSampler vk_sampler,
+    const vk::SamplerCreateInfo &create_info)
+    : mDevice(device)
+    , mSampler(std::move(vk_sampler))
+    , mCreateInfo(create_info)
+{
+}
+
+usagi::VulkanSampler::~VulkanSampler()
 {
+    mDevice->samplerCache()->remove(this);
+    mDevice->descriptorSetCache()->evict(
+        vulkan::handleValue(mSampler.get()));
 }
 
 void usagi::VulkanSampler::fillShaderResourceInfo(
@@ -7,18 +7,40 @@
 
 namespace usagi
 {
+class VulkanGpuDevice;
+
+/**
+ * \brief Shared by all the users requesting the same states through
+ * VulkanSamplerCache.
+ */
 class VulkanSampler
     : public GpuSampler
     , public VulkanBatchResource
     , public VulkanShaderResource
 {
+    VulkanGpuDevice *mDevice = nullptr;
     vk::UniqueSampler mSampler;
+    // the key in the sampler cache
+    const vk::SamplerCreateInfo mCreateInfo;
 
 public:
-    explicit VulkanSampler(vk::UniqueSampler vk_sampler);
+    VulkanSampler(
+        VulkanGpuDevice *device,
+        vk::UniqueSampler vk_sampler,
+        const vk::SamplerCreateInfo &create_info);
+    ~VulkanSampler();
+
+    vk::Sampler sampler() const { return mSampler.get(); }
+    /**
+     * \brief The address of the handle, which stays valid as long as the
+     * sampler is alive. Used as the immutable samplers of set layouts.
+     */
+    const vk::Sampler * samplerPointer() const { return &*mSampler; }
+    const vk::SamplerCreateInfo & createInfo() const { return mCreateInfo; }
 
     void fillShaderResourceInfo(
         vk::WriteDescriptorSet &write,
         VulkanResourceInfo &info) override;
+    VulkanBatchResource & batchResource() override { return *this; }
 };
 }
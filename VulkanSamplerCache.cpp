@@ -0,0 +1,73 @@
+﻿#include "VulkanSamplerCache.hpp"
+
+#include <cassert>
+#include <functional>
+
+#include "VulkanGpuDevice.hpp"
+#include "VulkanHelper.hpp"
+#include "VulkanSampler.hpp"
+
+using namespace usagi::vulkan;
+
+std::size_t usagi::VulkanSamplerCache::KeyHasher::operator()(
+    const vk::SamplerCreateInfo &info) const
+{
+    std::size_t seed = 0;
+    hashCombine(seed, static_cast<VkSamplerCreateFlags>(info.flags));
+    hashCombine(seed, static_cast<std::uint64_t>(info.magFilter));
+    hashCombine(seed, static_cast<std::uint64_t>(info.minFilter));
+    hashCombine(seed, static_cast<std::uint64_t>(info.mipmapMode));
+    hashCombine(seed, static_cast<std::uint64_t>(info.addressModeU));
+    hashCombine(seed, static_cast<std::uint64_t>(info.addressModeV));
+    hashCombine(seed, static_cast<std::uint64_t>(info.addressModeW));
+    hashCombine(seed, std::hash<float>()(info.mipLodBias));
+    hashCombine(seed, info.anisotropyEnable);
+    hashCombine(seed, std::hash<float>()(info.maxAnisotropy));
+    hashCombine(seed, info.compareEnable);
+    hashCombine(seed, static_cast<std::uint64_t>(info.compareOp));
+    hashCombine(seed, std::hash<float>()(info.minLod));
+    hashCombine(seed, std::hash<float>()(info.maxLod));
+    hashCombine(seed, static_cast<std::uint64_t>(info.borderColor));
+    hashCombine(seed, info.unnormalizedCoordinates);
+    return seed;
+}
+
+usagi::VulkanSamplerCache::VulkanSamplerCache(VulkanGpuDevice *device)
+    : mDevice(device)
+{
+}
+
+std::shared_ptr<usagi::VulkanSampler> usagi::VulkanSamplerCache::acquire(
+    const vk::SamplerCreateInfo &info)
+{
+    assert(info.pNext == nullptr);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    auto &entry = mSamplers[info];
+    // the sampler may be being destroyed on another thread, in which case
+    // its removal leaves the new entry alone.
+    if(auto sampler = entry.weak.lock())
+        return std::move(sampler);
+
+    auto sampler = std::make_shared<VulkanSampler>(
+        mDevice, mDevice->device().createSamplerUnique(info), info);
+    entry.object = sampler.get();
+    entry.weak = sampler;
+    return std::move(sampler);
+}
+
+void usagi::VulkanSamplerCache::remove(const VulkanSampler *sampler)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    const auto iter = mSamplers.find(sampler->createInfo());
+    if(iter != mSamplers.end() && iter->second.object == sampler)
+        mSamplers.erase(iter);
+}
+
+std::size_t usagi::VulkanSamplerCache::size()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSamplers.size();
+}
@@ -0,0 +1,57 @@
+﻿#pragma once
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+class VulkanGpuDevice;
+class VulkanSampler;
+
+/**
+ * \brief Shares the samplers created with the same states. The number of
+ * samplers which may exist at once is limited by the device, often to 4000,
+ * and sharing them also lets the descriptor sets and the set layouts using
+ * them as immutable samplers be shared.
+ *
+ * The cache does not own the samplers. A sampler is destroyed when the last
+ * user releases it. Thread-safe.
+ */
+class VulkanSamplerCache : Noncopyable
+{
+    struct KeyHasher
+    {
+        std::size_t operator()(const vk::SamplerCreateInfo &info) const;
+    };
+
+    struct Entry
+    {
+        VulkanSampler *object = nullptr;
+        std::weak_ptr<VulkanSampler> weak;
+    };
+
+    VulkanGpuDevice *mDevice = nullptr;
+    std::mutex mMutex;
+    std::unordered_map<vk::SamplerCreateInfo, Entry, KeyHasher> mSamplers;
+
+    friend class VulkanSampler;
+
+    void remove(const VulkanSampler *sampler);
+
+public:
+    explicit VulkanSamplerCache(VulkanGpuDevice *device);
+
+    /**
+     * \brief Find or create the sampler with the states. The create info
+     * must not have a pNext chain.
+     */
+    std::shared_ptr<VulkanSampler> acquire(const vk::SamplerCreateInfo &info);
+
+    std::size_t size();
+};
+}
@@ -5,6 +5,7 @@
 #include <Usagi/Runtime/Graphics/GpuSemaphore.hpp>
 
 #include "VulkanBatchResource.hpp"
+#include "VulkanSyncObjectPool.hpp"
 
 namespace usagi
 {
@@ -13,13 +14,25 @@ class VulkanSemaphore
     , public VulkanBatchResource
 {
     vk::UniqueSemaphore mSemaphore;
+    // if set, the semaphore is returned to the pool instead of destroyed
+    VulkanSyncObjectPool *mPool = nullptr;
 
 public:
-    explicit VulkanSemaphore(vk::UniqueSemaphore vk_semaphore)
+    explicit VulkanSemaphore(
+        vk::UniqueSemaphore vk_semaphore,
+        VulkanSyncObjectPool *pool = nullptr)
         : mSemaphore { std::move(vk_semaphore) }
+        , mPool { pool }
     {
     }
 
+    ~VulkanSemaphore()
+    {
+        // the last reference is dropped after the batches using the
+        // semaphore are retired.
+        if(mPool) mPool->releaseSemaphore(std::move(mSemaphore));
+    }
+
     vk::Semaphore semaphore() const
     {
         return mSemaphore.get();
@@ -0,0 +1,221 @@
+﻿#include "VulkanShaderReflection.hpp"
+
+#include <algorithm>
+
+#include <Usagi/Core/Logging.hpp>
+#include <Usagi/Runtime/Graphics/Shader/SpirvBinary.hpp>
+
+using namespace spirv_cross;
+
+namespace
+{
+struct ReflectionHelper
+{
+    const Compiler &compiler;
+    ShaderResources resources;
+    usagi::VulkanShaderReflection &result;
+
+    ReflectionHelper(
+        const Compiler &compiler,
+        usagi::VulkanShaderReflection &result)
+        : compiler { compiler }
+        , resources { compiler.get_shader_resources() }
+        , result { result }
+    {
+    }
+
+    void reflectPushConstantField(const SPIRType &type, unsigned i)
+    {
+        const auto &member_name =
+            compiler.get_member_name(type.self, i);
+        const auto member_offset =
+            compiler.type_struct_member_offset(type, i);
+        const auto member_size =
+            compiler.get_declared_struct_member_size(type, i);
+
+        // if first member is named padding, it is considered as offset hint
+        // and is ignored.
+        if(i == 0 && member_name == "padding")
+        {
+            result.push_constant_offset =
+                static_cast<std::uint32_t>(member_size);
+            return;
+        }
+
+        LOG(info, "{}: offset={}, size={}",
+            member_name, member_offset, member_size);
+
+        // todo: if multiple constant buffers are allowed in the
+        // future, member name may not uniquely identify the fields.
+        // use struct_name.field_name instead?
+        usagi::VulkanShaderReflection::PushConstantField field;
+        field.name = member_name;
+        field.size = static_cast<std::uint32_t>(member_size);
+        field.offset = static_cast<std::uint32_t>(member_offset);
+        result.push_constant_fields.push_back(std::move(field));
+    }
+
+    std::size_t reflectPushConstantBuffer(const Resource &resource)
+    {
+        const auto &type = compiler.get_type(resource.base_type_id);
+        const auto size = compiler.get_declared_struct_size(type);
+
+        const auto member_count = type.member_types.size();
+        for(unsigned i = 0; i < member_count; i++)
+            reflectPushConstantField(type, i);
+
+        return size;
+    }
+
+    void reflectPushConstantRanges()
+    {
+        std::size_t size = 0;
+        for(const auto &resource : resources.push_constant_buffers)
+            size += reflectPushConstantBuffer(resource);
+        result.push_constant_size = static_cast<std::uint32_t>(size);
+    }
+
+    void reflectVertexInputAttributes()
+    {
+        for(auto &&resource : resources.stage_inputs)
+        {
+            usagi::VulkanShaderReflection::VertexInput input;
+            input.name = resource.name;
+            input.location = compiler.get_decoration(
+                resource.id, spv::DecorationLocation);
+            result.vertex_inputs.push_back(std::move(input));
+        }
+    }
+
+    void addResource(const Resource &resource,
+        const vk::DescriptorType resource_type) const
+    {
+        const auto &type = compiler.get_type(resource.type_id);
+
+        usagi::VulkanShaderReflection::DescriptorBinding binding;
+        binding.set = compiler.get_decoration(
+            resource.id, spv::DecorationDescriptorSet);
+        binding.binding = compiler.get_decoration(
+            resource.id, spv::DecorationBinding);
+        binding.count = type.vecsize;
+        binding.type = resource_type;
+        result.descriptor_bindings.push_back(binding);
+    }
+
+    void ignoreResource(const Resource &resource,
+        const vk::DescriptorType resource_type) const
+    {
+        const auto set = compiler.get_decoration(
+            resource.id, spv::DecorationDescriptorSet);
+        const auto binding = compiler.get_decoration(
+            resource.id, spv::DecorationBinding);
+
+        LOG(warn, "{} {} (set={},binding={}) is ignored.",
+            to_string(resource_type), resource.name, set, binding);
+    }
+
+    void reflectDescriptorSets()
+    {
+        // todo: deal with others resource types
+
+        for(auto &&resource : resources.storage_buffers)
+            addResource(resource, vk::DescriptorType::eStorageBuffer);
+
+        for(auto &&resource : resources.storage_images)
+            addResource(resource, vk::DescriptorType::eStorageImage);
+
+        // sampler2D is not supported in HLSL so not included here.
+        // don't use them in shaders.
+        for(auto &&resource : resources.sampled_images)
+            ignoreResource(resource, vk::DescriptorType::eSampledImage);
+
+        for(auto &&resource : resources.separate_images)
+            addResource(resource, vk::DescriptorType::eSampledImage);
+
+        for(auto &&resource : resources.separate_samplers)
+            addResource(resource, vk::DescriptorType::eSampler);
+
+        for(auto &&resource : resources.uniform_buffers)
+            addResource(resource, vk::DescriptorType::eUniformBuffer);
+
+        // note that only one subpass is used to maintain compatibility
+        // for shader cross-compiling
+        for(auto &&resource : resources.subpass_inputs)
+            addResource(resource, vk::DescriptorType::eInputAttachment);
+    }
+};
+}
+
+std::uint64_t usagi::VulkanShaderReflectionCache::hashBytecodes(
+    const SpirvBinary &binary)
+{
+    // 64-bit FNV-1a over the words
+    std::uint64_t hash = 14695981039346656037ull;
+    for(auto &&word : binary.bytecodes())
+    {
+        hash ^= word;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::shared_ptr<const usagi::VulkanShaderReflection>
+    usagi::VulkanShaderReflectionCache::reflectBinary(
+        const SpirvBinary &binary)
+{
+    auto result = std::make_shared<VulkanShaderReflection>();
+    ReflectionHelper helper { binary.reflectionCompiler(), *result };
+    helper.reflectVertexInputAttributes();
+    helper.reflectPushConstantRanges();
+    helper.reflectDescriptorSets();
+    return std::move(result);
+}
+
+std::shared_ptr<const usagi::VulkanShaderReflection>
+    usagi::VulkanShaderReflectionCache::find(
+        const std::uint64_t hash,
+        const SpirvBinary &binary) const
+{
+    const auto &bytecodes = binary.bytecodes();
+    const auto range = mEntries.equal_range(hash);
+    for(auto i = range.first; i != range.second; ++i)
+    {
+        const auto &cached = i->second.bytecodes;
+        if(std::equal(cached.begin(), cached.end(),
+            bytecodes.begin(), bytecodes.end()))
+            return i->second.reflection;
+    }
+    return { };
+}
+
+std::shared_ptr<const usagi::VulkanShaderReflection>
+    usagi::VulkanShaderReflectionCache::reflect(const SpirvBinary &binary)
+{
+    const auto hash = hashBytecodes(binary);
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(auto reflection = find(hash, binary))
+            return std::move(reflection);
+    }
+
+    // reflect without holding the lock. if another thread reflected the
+    // same binary in the meantime, the result is discarded.
+    auto reflection = reflectBinary(binary);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(auto cached = find(hash, binary))
+        return std::move(cached);
+    Entry entry;
+    entry.bytecodes.assign(
+        binary.bytecodes().begin(), binary.bytecodes().end());
+    entry.reflection = reflection;
+    mEntries.emplace(hash, std::move(entry));
+    return std::move(reflection);
+}
+
+std::size_t usagi::VulkanShaderReflectionCache::size()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mEntries.size();
+}
@@ -0,0 +1,83 @@
+﻿#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+class SpirvBinary;
+
+/**
+ * \brief The information of a shader required for building pipeline layouts
+ * and vertex input states. Shader stage flags are not included since the same
+ * binary may be used by multiple stages.
+ */
+struct VulkanShaderReflection
+{
+    struct VertexInput
+    {
+        std::string name;
+        std::uint32_t location = 0;
+    };
+    std::vector<VertexInput> vertex_inputs;
+
+    struct PushConstantField
+    {
+        std::string name;
+        std::uint32_t offset = 0, size = 0;
+    };
+    std::vector<PushConstantField> push_constant_fields;
+    // the range used by the push constant fields, in which the leading
+    // padding member is excluded.
+    std::uint32_t push_constant_offset = 0;
+    std::uint32_t push_constant_size = 0;
+
+    struct DescriptorBinding
+    {
+        std::uint32_t set = 0;
+        std::uint32_t binding = 0;
+        std::uint32_t count = 0;
+        vk::DescriptorType type = vk::DescriptorType::eSampler;
+    };
+    std::vector<DescriptorBinding> descriptor_bindings;
+};
+
+/**
+ * \brief Memoizes the reflection results of SPIR-V binaries keyed by the
+ * hash of the bytecodes, so the pipelines sharing a shader only reflect it
+ * once. The bytecodes are compared on hash hits. Thread-safe.
+ */
+class VulkanShaderReflectionCache : Noncopyable
+{
+    struct Entry
+    {
+        std::vector<std::uint32_t> bytecodes;
+        std::shared_ptr<const VulkanShaderReflection> reflection;
+    };
+
+    std::mutex mMutex;
+    std::unordered_multimap<std::uint64_t, Entry> mEntries;
+
+    // must be called with the lock held
+    std::shared_ptr<const VulkanShaderReflection> find(
+        std::uint64_t hash,
+        const SpirvBinary &binary) const;
+
+    static std::uint64_t hashBytecodes(const SpirvBinary &binary);
+    static std::shared_ptr<const VulkanShaderReflection> reflectBinary(
+        const SpirvBinary &binary);
+
+public:
+    std::shared_ptr<const VulkanShaderReflection> reflect(
+        const SpirvBinary &binary);
+
+    std::size_t size();
+};
+}
@@ -6,6 +6,8 @@
 
 namespace usagi
 {
+class VulkanBatchResource;
+
 /**
  * \brief Interface for filling vk::WriteDescriptorSet.
  */
@@ -23,5 +25,11 @@ public:
     virtual void fillShaderResourceInfo(
         vk::WriteDescriptorSet &write,
         VulkanResourceInfo &info) = 0;
+
+    /**
+     * \brief The tracked object of the resource, so that it is reached
+     * without casting again.
+     */
+    virtual VulkanBatchResource & batchResource() = 0;
 };
 }
@@ -0,0 +1,85 @@
+﻿#include "VulkanSubAllocator.hpp"
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Runtime/Memory/BitmapMemoryAllocator.hpp>
+
+#include "VulkanBuddyAllocator.hpp"
+#include "VulkanTlsfAllocator.hpp"
+
+namespace usagi
+{
+namespace
+{
+class VulkanBitmapSubAllocator : public VulkanSubAllocator
+{
+    BitmapMemoryAllocator mAllocator;
+    const std::size_t mTotalSize;
+
+public:
+    VulkanBitmapSubAllocator(
+        const std::size_t total_size,
+        const std::size_t block_size)
+        : mAllocator(nullptr, total_size, block_size)
+        , mTotalSize(total_size)
+    {
+    }
+
+    void * allocate(const std::size_t size, const std::size_t alignment)
+        override
+    {
+        return mAllocator.allocate(size, alignment);
+    }
+
+    void deallocate(void *pointer) override
+    {
+        mAllocator.deallocate(pointer);
+    }
+
+    std::size_t usedSize() const override
+    {
+        return mAllocator.usedSize();
+    }
+
+    VulkanSubAllocatorStatistics statistics() const override
+    {
+        // the bitmap allocator does not track its free blocks
+        VulkanSubAllocatorStatistics stats;
+        stats.total_size = mTotalSize;
+        stats.used_size = mAllocator.usedSize();
+        stats.free_size = mTotalSize - stats.used_size;
+        return stats;
+    }
+};
+}
+}
+
+std::unique_ptr<usagi::VulkanSubAllocator> usagi::createSubAllocator(
+    const VulkanMemoryPoolConfig &config,
+    const vk::MemoryRequirements &requirements)
+{
+    switch(config.allocator)
+    {
+        case VulkanSubAllocatorType::BITMAP:
+            return std::make_unique<VulkanBitmapSubAllocator>(
+                requirements.size, config.granularity);
+        case VulkanSubAllocatorType::TLSF:
+            return std::make_unique<VulkanTlsfAllocator>(
+                nullptr, requirements.size, config.granularity);
+        case VulkanSubAllocatorType::BUDDY:
+            return std::make_unique<VulkanBuddyAllocator>(
+                nullptr, requirements.size, config.granularity);
+        default:
+            USAGI_THROW(std::runtime_error("Invalid sub-allocator type."));
+    }
+}
+
+const char * usagi::to_string(const VulkanSubAllocatorType type)
+{
+    switch(type)
+    {
+        case VulkanSubAllocatorType::BITMAP: return "bitmap";
+        case VulkanSubAllocatorType::TLSF: return "tlsf";
+        case VulkanSubAllocatorType::BUDDY: return "buddy";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,98 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+enum class VulkanSubAllocatorType
+{
+    BITMAP,
+    TLSF,
+    BUDDY,
+};
+
+struct VulkanSubAllocatorStatistics
+{
+    std::size_t total_size = 0;
+    std::size_t used_size = 0;
+    std::size_t free_size = 0;
+    // 0 if unknown
+    std::size_t largest_free_block = 0;
+    std::size_t allocation_count = 0;
+    std::size_t free_block_count = 0;
+    // space given to the allocations but not requested, such as alignment
+    // padding and rounding to block sizes.
+    std::size_t wasted_size = 0;
+
+    /**
+     * \brief 0 if the free space is contiguous, approaches 1 as it is split
+     * into smaller blocks.
+     */
+    float fragmentation() const
+    {
+        if(free_size == 0 || largest_free_block == 0) return 0;
+        return 1.f - static_cast<float>(largest_free_block) / free_size;
+    }
+};
+
+/**
+ * \brief Manages the address space of a memory pool. The addresses are
+ * offsets into the memory block.
+ *
+ * Throws std::bad_alloc if an allocation cannot be satisfied.
+ */
+class VulkanSubAllocator : Noncopyable
+{
+public:
+    virtual ~VulkanSubAllocator() = default;
+
+    virtual void * allocate(std::size_t size, std::size_t alignment = 1) = 0;
+    virtual void deallocate(void *pointer) = 0;
+
+    virtual std::size_t usedSize() const = 0;
+    virtual VulkanSubAllocatorStatistics statistics() const = 0;
+};
+
+struct VulkanMemoryPoolConfig
+{
+    /**
+     * \brief The size of each device memory block. An allocation larger than
+     * it gets a block of its own.
+     */
+    std::size_t block_size = 0;
+    VulkanSubAllocatorType allocator = VulkanSubAllocatorType::TLSF;
+    /**
+     * \brief The allocation granularity. Allocations are rounded up to and
+     * aligned to at least it.
+     */
+    std::size_t granularity = 256;
+    /**
+     * \brief The maximum number of blocks. 0 if only limited by
+     * maxMemoryAllocationCount.
+     */
+    std::size_t max_blocks = 0;
+    /**
+     * \brief The number of frames an empty block is kept before being
+     * released.
+     */
+    std::uint64_t release_delay = 300;
+    /**
+     * \brief Allocate the first block on the first allocation instead of
+     * when the pool is created. Exhausting the device memory is then
+     * detected later.
+     */
+    bool lazy = false;
+};
+
+std::unique_ptr<VulkanSubAllocator> createSubAllocator(
+    const VulkanMemoryPoolConfig &config,
+    const vk::MemoryRequirements &requirements);
+
+const char * to_string(VulkanSubAllocatorType type);
+}
@@ -0,0 +1,143 @@
+﻿#include "VulkanSubmissionTimeline.hpp"
+
+#include <cassert>
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Core/Logging.hpp>
+
+#include "VulkanSyncObjectPool.hpp"
+
+usagi::VulkanSubmissionTimeline::VulkanSubmissionTimeline(
+    const vk::Device device,
+    VulkanSyncObjectPool *sync_object_pool,
+    const bool use_timeline_semaphore)
+    : mDevice(device)
+    , mSyncObjectPool(sync_object_pool)
+{
+#ifdef VK_KHR_timeline_semaphore
+    if(use_timeline_semaphore)
+    {
+        vk::SemaphoreTypeCreateInfoKHR type_info;
+        type_info.setSemaphoreType(vk::SemaphoreTypeKHR::eTimeline);
+        type_info.setInitialValue(0);
+        vk::SemaphoreCreateInfo info;
+        info.setPNext(&type_info);
+        mSemaphore = mDevice.createSemaphoreUnique(info);
+    }
+#endif
+    LOG(info, "Tracking submissions using {}",
+        mSemaphore ? "timeline semaphore" : "fences");
+}
+
+usagi::VulkanSubmissionTimeline::~VulkanSubmissionTimeline()
+{
+    for(auto &&f : mFences)
+        mSyncObjectPool->releaseFence(std::move(f.fence));
+}
+
+void usagi::VulkanSubmissionTimeline::submitWithSemaphore(
+    const vk::Queue queue,
+    const vk::SubmitInfo &info)
+{
+#ifdef VK_KHR_timeline_semaphore
+    // the values of binary semaphores are ignored
+    mSignalSemaphores.assign(info.pSignalSemaphores,
+        info.pSignalSemaphores + info.signalSemaphoreCount);
+    mSignalSemaphores.push_back(mSemaphore.get());
+    mSignalValues.assign(mSignalSemaphores.size(), 0);
+    mSignalValues.back() = mSubmitted;
+
+    vk::TimelineSemaphoreSubmitInfoKHR timeline_info;
+    timeline_info.setSignalSemaphoreValueCount(
+        static_cast<uint32_t>(mSignalValues.size()));
+    timeline_info.setPSignalSemaphoreValues(mSignalValues.data());
+
+    auto timeline_submit = info;
+    assert(timeline_submit.pNext == nullptr);
+    timeline_submit.setPNext(&timeline_info);
+    timeline_submit.setSignalSemaphoreCount(
+        static_cast<uint32_t>(mSignalSemaphores.size()));
+    timeline_submit.setPSignalSemaphores(mSignalSemaphores.data());
+
+    queue.submit({ timeline_submit }, { });
+#endif
+}
+
+void usagi::VulkanSubmissionTimeline::submitWithFence(
+    const vk::Queue queue,
+    const vk::SubmitInfo &info)
+{
+    PendingFence pending;
+    pending.serial = mSubmitted;
+    pending.fence = mSyncObjectPool->acquireFence();
+    queue.submit({ info }, pending.fence.get());
+    mFences.push_back(std::move(pending));
+}
+
+usagi::VulkanSubmissionTimeline::Serial
+    usagi::VulkanSubmissionTimeline::submit(
+        const vk::Queue queue,
+        const vk::SubmitInfo &info)
+{
+    ++mSubmitted;
+    if(mSemaphore)
+        submitWithSemaphore(queue, info);
+    else
+        submitWithFence(queue, info);
+    return mSubmitted;
+}
+
+usagi::VulkanSubmissionTimeline::Serial
+    usagi::VulkanSubmissionTimeline::poll()
+{
+#ifdef VK_KHR_timeline_semaphore
+    if(mSemaphore)
+    {
+        mCompleted = mDevice.getSemaphoreCounterValueKHR(mSemaphore.get());
+        return mCompleted;
+    }
+#endif
+    // stop at the first incomplete submission
+    while(!mFences.empty() &&
+        mDevice.getFenceStatus(mFences.front().fence.get()) ==
+        vk::Result::eSuccess)
+    {
+        mCompleted = mFences.front().serial;
+        mSyncObjectPool->releaseFence(std::move(mFences.front().fence));
+        mFences.pop_front();
+    }
+    return mCompleted;
+}
+
+void usagi::VulkanSubmissionTimeline::wait(const Serial serial)
+{
+    if(isComplete(serial)) return;
+    assert(serial <= mSubmitted);
+
+#ifdef VK_KHR_timeline_semaphore
+    if(mSemaphore)
+    {
+        const auto semaphore = mSemaphore.get();
+        vk::SemaphoreWaitInfoKHR info;
+        info.setSemaphoreCount(1);
+        info.setPSemaphores(&semaphore);
+        info.setPValues(&serial);
+        if(mDevice.waitSemaphoresKHR(info, UINT64_MAX) != vk::Result::eSuccess)
+            USAGI_THROW(std::runtime_error("Failed to wait for submission."));
+        poll();
+        return;
+    }
+#endif
+    // the fences are in submission order, so wait for the first one whose
+    // serial is not less than the requested one.
+    for(auto &&f : mFences)
+    {
+        if(f.serial < serial) continue;
+        const auto fence = f.fence.get();
+        if(mDevice.waitForFences(1, &fence, true, UINT64_MAX) !=
+            vk::Result::eSuccess)
+            USAGI_THROW(std::runtime_error("Failed to wait for submission."));
+        break;
+    }
+    poll();
+}
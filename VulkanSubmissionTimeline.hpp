@@ -0,0 +1,83 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+class VulkanSyncObjectPool;
+
+/**
+ * \brief Assigns increasing serial numbers to the submissions to a queue and
+ * tracks the last completed one.
+ *
+ * If VK_KHR_timeline_semaphore is enabled, each submission signals a timeline
+ * semaphore with its serial number. Otherwise a fence is attached to each
+ * submission. Since the submissions to one queue complete in order, only the
+ * oldest fences have to be checked.
+ */
+class VulkanSubmissionTimeline : Noncopyable
+{
+public:
+    using Serial = std::uint64_t;
+
+private:
+    vk::Device mDevice;
+    VulkanSyncObjectPool *mSyncObjectPool = nullptr;
+
+    // null if timeline semaphores are not available
+    vk::UniqueSemaphore mSemaphore;
+
+    struct PendingFence
+    {
+        Serial serial;
+        vk::UniqueFence fence;
+    };
+    std::deque<PendingFence> mFences;
+
+    Serial mSubmitted = 0;
+    Serial mCompleted = 0;
+
+    // scratch buffers for appending the timeline semaphore to submissions
+    std::vector<vk::Semaphore> mSignalSemaphores;
+    std::vector<std::uint64_t> mSignalValues;
+
+    void submitWithSemaphore(vk::Queue queue, const vk::SubmitInfo &info);
+    void submitWithFence(vk::Queue queue, const vk::SubmitInfo &info);
+
+public:
+    VulkanSubmissionTimeline(
+        vk::Device device,
+        VulkanSyncObjectPool *sync_object_pool,
+        bool use_timeline_semaphore);
+    ~VulkanSubmissionTimeline();
+
+    /**
+     * \brief Submit the work and return the serial number assigned to it.
+     * The submission must not have a fence.
+     */
+    Serial submit(vk::Queue queue, const vk::SubmitInfo &info);
+
+    /**
+     * \brief Query the GPU for the last completed submission.
+     */
+    Serial poll();
+    /**
+     * \brief Block until the submission is completed.
+     */
+    void wait(Serial serial);
+
+    bool isComplete(Serial serial) const { return serial <= mCompleted; }
+    /**
+     * \brief The last completed serial as of the last poll.
+     */
+    Serial completed() const { return mCompleted; }
+    Serial submitted() const { return mSubmitted; }
+    bool usesTimelineSemaphore() const { return static_cast<bool>(mSemaphore); }
+};
+}
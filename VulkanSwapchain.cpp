@@ -15,48 +15,91 @@ usagi::VulkanSwapchain::VulkanSwapchain(
     VulkanGpuDevice *device,
     vk::UniqueSurfaceKHR vk_surface_khr)
     : mDevice { device }
-    , mSurface { std::move(vk_surface_khr) }
+    , mSurface { std::make_shared<vk::UniqueSurfaceKHR>(
+        std::move(vk_surface_khr)) }
     , mFormat { vk::Format::eUndefined, vk::ColorSpaceKHR::eSrgbNonlinear }
 {
 }
 
 std::shared_ptr<usagi::GpuSemaphore> usagi::VulkanSwapchain::acquireNextImage()
+{
+    auto sem = acquireNextImage(UINT64_MAX);
+    if(!sem)
+        USAGI_THROW(std::runtime_error("No swapchain image is available."));
+    return std::move(sem);
+}
+
+std::shared_ptr<usagi::GpuSemaphore>
+    usagi::VulkanSwapchain::tryAcquireNextImage()
+{
+    return acquireNextImage(0);
+}
+
+std::shared_ptr<usagi::GpuSemaphore> usagi::VulkanSwapchain::acquireNextImage(
+    const std::uint64_t timeout)
 {
     if(mImagesInUse != 0)
         LOG(warn, "Requesting another image from swapchain while "
             "already {} is used.", mImagesInUse);
 
-    auto sem = mDevice->createSemaphore();
-    const auto vk_sem = static_cast<VulkanSemaphore&>(*sem).semaphore();
-
-    // todo sometimes hangs when debugging with RenderDoc
-    const auto result = mDevice->device().acquireNextImageKHR(
-        mSwapchain.get(),
-        UINT64_MAX, // 1000000000u, // 1s
-        vk_sem,
-        nullptr,
-        &mCurrentImageIndex
-    );
-    switch(result)
+    // the semaphore is waited on by the rendering of the frame, so it can be
+    // recycled by the frame context. the one left by a failed attempt is
+    // given out again by its frame context when reused.
+    const auto frame = mDevice->currentFrame();
+    const auto frame_number = frame ? frame->frameNumber() : 0;
+    if(mPendingSemaphore && mPendingSemaphoreFrame != frame_number)
+        mPendingSemaphore.reset();
+    if(!mPendingSemaphore)
     {
-        case vk::Result::eSuboptimalKHR:
-            LOG(warn, "Suboptimal swapchain");
-        case vk::Result::eSuccess: break;
-        case vk::Result::eNotReady:
-            USAGI_THROW(std::runtime_error("Currently no usable swapchain image."));
-        case vk::Result::eTimeout:
-            USAGI_THROW(std::runtime_error("acquireNextImageKHR() timed out."));
+        mPendingSemaphore = frame
+            ? frame->acquireSemaphore()
+            : mDevice->createSemaphore();
+        mPendingSemaphoreFrame = frame_number;
+    }
+    const auto vk_sem =
+        static_cast<VulkanSemaphore&>(*mPendingSemaphore).semaphore();
 
-        case vk::Result::eErrorOutOfDateKHR:
-            LOG(info, "Swapchain is out-of-date, recreating");
-            createSwapchain(mSize, mFormat.format);
-            return acquireNextImage();
+    // the semaphore stays unsignaled if no image is acquired, so it can be
+    // used again after recreating the swapchain, or recycled by the frame.
+    for(auto attempt = 0; attempt < 2; ++attempt)
+    {
+        if(mOutOfDate)
+        {
+            createSwapchain(mPendingSize, mFormat.format);
+            // e.g. the window is minimized
+            if(mOutOfDate) return { };
+        }
 
-        default: USAGI_THROW(std::runtime_error("acquireNextImageKHR() failed."));
+        // todo sometimes hangs when debugging with RenderDoc
+        const auto result = mDevice->device().acquireNextImageKHR(
+            swapchain(),
+            timeout,
+            vk_sem,
+            nullptr,
+            &mCurrentImageIndex
+        );
+        switch(result)
+        {
+            case vk::Result::eSuboptimalKHR:
+                LOG(warn, "Suboptimal swapchain");
+            case vk::Result::eSuccess:
+                ++mImagesInUse;
+                return std::move(mPendingSemaphore);
+            case vk::Result::eNotReady:
+            case vk::Result::eTimeout:
+                return { };
+
+            case vk::Result::eErrorOutOfDateKHR:
+                LOG(info, "Swapchain is out-of-date, recreating");
+                mOutOfDate = true;
+                mPendingSize = mSize;
+                break;
+
+            default: USAGI_THROW(
+                std::runtime_error("acquireNextImageKHR() failed."));
+        }
     }
-
-    ++mImagesInUse;
-    return sem;
+    return { };
 }
 
 usagi::GpuImage * usagi::VulkanSwapchain::currentImage()
@@ -83,7 +126,7 @@ void usagi::VulkanSwapchain::present(
 
     info.setWaitSemaphoreCount(static_cast<uint32_t>(wait_semaphores.size()));
     info.setPWaitSemaphores(wait_semaphores.data());
-    const auto sc_handle = mSwapchain.get();
+    const auto sc_handle = swapchain();
     info.setSwapchainCount(1);
     info.setPSwapchains(&sc_handle);
     info.setPImageIndices(&mCurrentImageIndex);
@@ -104,6 +147,8 @@ void usagi::VulkanSwapchain::present(
             break;
         case vk::Result::eErrorOutOfDateKHR:
             LOG(error, "Presented to a out-of-date swapchain.");
+            mOutOfDate = true;
+            mPendingSize = mSize;
             break;
         default: ;
     }
@@ -165,16 +210,50 @@ vk::Extent2D usagi::VulkanSwapchain::selectSurfaceExtent(
 }
 
 vk::PresentModeKHR usagi::VulkanSwapchain::selectPresentMode(
-    const std::vector<vk::PresentModeKHR> &present_modes)
+    const std::vector<vk::PresentModeKHR> &present_modes,
+    const VulkanPresentMode preferred_mode)
 {
-    // todo: allow disable v-sync
-    // prefer mailbox mode to achieve triple buffering
-    if(std::find(present_modes.begin(), present_modes.end(),
-        vk::PresentModeKHR::eMailbox) != present_modes.end())
-        return vk::PresentModeKHR::eMailbox;
+    vk::PresentModeKHR mode;
+    switch(preferred_mode)
+    {
+        case VulkanPresentMode::IMMEDIATE:
+            mode = vk::PresentModeKHR::eImmediate; break;
+        case VulkanPresentMode::MAILBOX:
+            mode = vk::PresentModeKHR::eMailbox; break;
+        case VulkanPresentMode::FIFO_RELAXED:
+            mode = vk::PresentModeKHR::eFifoRelaxed; break;
+        default: return vk::PresentModeKHR::eFifo;
+    }
+    if(std::find(present_modes.begin(), present_modes.end(), mode)
+        != present_modes.end())
+        return mode;
+    // todo: mailbox not available on my R9 290X
+    LOG(warn, "Present mode {} is not supported, falling back to FIFO.",
+        to_string(mode));
     return vk::PresentModeKHR::eFifo;
 }
 
+std::uint32_t usagi::VulkanSwapchain::selectImageCount(
+    const vk::SurfaceCapabilitiesKHR &surface_capabilities,
+    const vk::PresentModeKHR present_mode,
+    const std::uint32_t preferred_count)
+{
+    auto count = preferred_count;
+    if(count == 0)
+    {
+        // Ensures non-blocking vkAcquireNextImageKHR() in mailbox mode.
+        // See 3.6.12 of http://vulkan-spec-chunked.ahcox.com/apes03.html
+        count = surface_capabilities.minImageCount;
+        if(present_mode == vk::PresentModeKHR::eMailbox)
+            ++count;
+    }
+    count = std::max(count, surface_capabilities.minImageCount);
+    // 0 means no limit
+    if(surface_capabilities.maxImageCount != 0)
+        count = std::min(count, surface_capabilities.maxImageCount);
+    return count;
+}
+
 std::uint32_t usagi::VulkanSwapchain::selectPresentationQueueFamily() const
 {
     // todo use vkGetPhysicalDeviceWin32PresentationSupportKHR
@@ -185,7 +264,7 @@ std::uint32_t usagi::VulkanSwapchain::selectPresentationQueueFamily() const
         const auto queue_index =
             static_cast<uint32_t>(i - queue_families.begin());
         if(mDevice->physicalDevice().getSurfaceSupportKHR(
-            queue_index, mSurface.get()))
+            queue_index, surface()))
             return queue_index;
     }
     USAGI_THROW(std::runtime_error("No queue family supporting WSI was found."));
@@ -200,7 +279,13 @@ void usagi::VulkanSwapchain::create(
 
 void usagi::VulkanSwapchain::resize(const Vector2u32 &size)
 {
-    if(mSize != size)
+    if(mSize == size && !mOutOfDate) return;
+
+    // the acquired image must be presented to the swapchain it came from
+    mPendingSize = size;
+    if(mImagesInUse != 0)
+        mOutOfDate = true;
+    else
         createSwapchain(size, mFormat.format);
 }
 
@@ -218,13 +303,9 @@ void usagi::VulkanSwapchain::createSwapchain(
     const Vector2u32 &size,
     vk::Format image_format)
 {
-    assert(size.x() > 0 && size.y() > 0);
-
-    // Ensure that no operation involving the swapchain images is outstanding.
-    // Since acquireNextImage() and drawing operations aren't parallel,
-    // as long as the device is idle, it won't happen.
-    mDevice->device().waitIdle();
-
+    // The old swapchain is retired by passing it to the new one, and is
+    // destroyed after the frames in flight, which may have presented from
+    // it, are completed. The other work on the device doesn't need to wait.
     LOG(info, "Creating swapchain");
 
     // todo: query using vkGetPhysicalDeviceWin32PresentationSupportKHR
@@ -233,33 +314,39 @@ void usagi::VulkanSwapchain::createSwapchain(
     //     mPresentationQueueFamilyIndex);
 
     const auto surface_capabilities =
-        mDevice->physicalDevice().getSurfaceCapabilitiesKHR(mSurface.get());
+        mDevice->physicalDevice().getSurfaceCapabilitiesKHR(surface());
     const auto surface_formats =
-        mDevice->physicalDevice().getSurfaceFormatsKHR(mSurface.get());
+        mDevice->physicalDevice().getSurfaceFormatsKHR(surface());
     const auto surface_present_modes =
-        mDevice->physicalDevice().getSurfacePresentModesKHR(mSurface.get());
+        mDevice->physicalDevice().getSurfacePresentModesKHR(surface());
 
     vk::SwapchainCreateInfoKHR create_info;
 
-    create_info.setSurface(mSurface.get());
+    create_info.setSurface(surface());
     const auto vk_format = selectSurfaceFormat(surface_formats, image_format);
     LOG(info, "Surface format: {}", to_string(vk_format.format));
     LOG(info, "Surface colorspace: {}", to_string(vk_format.colorSpace));
     create_info.setImageFormat(vk_format.format);
     create_info.setImageColorSpace(vk_format.colorSpace);
     create_info.setImageExtent(selectSurfaceExtent(size, surface_capabilities));
+    if(create_info.imageExtent.width == 0 ||
+        create_info.imageExtent.height == 0)
+    {
+        LOG(info, "The surface is zero-sized, postponing the creation.");
+        mOutOfDate = true;
+        mPendingSize = size;
+        return;
+    }
     LOG(info, "Surface extent: {}x{}",
         create_info.imageExtent.width, create_info.imageExtent.height);
 
-    create_info.setPresentMode(selectPresentMode(surface_present_modes));
-    // todo: mailbox not available on my R9 290X
-    // todo triple buffering
-    if(create_info.presentMode == vk::PresentModeKHR::eMailbox)
-        // Ensures non-blocking vkAcquireNextImageKHR() in mailbox mode.
-        // See 3.6.12 of http://vulkan-spec-chunked.ahcox.com/apes03.html
-        create_info.setMinImageCount(surface_capabilities.minImageCount + 1);
-    else
-        create_info.setMinImageCount(surface_capabilities.minImageCount);
+    const auto &config = mDevice->config().swapchain;
+    create_info.setPresentMode(selectPresentMode(
+        surface_present_modes, config.present_mode));
+    create_info.setMinImageCount(selectImageCount(surface_capabilities,
+        create_info.presentMode, config.image_count));
+    LOG(info, "Present mode: {}, {} images",
+        to_string(create_info.presentMode), create_info.minImageCount);
 
     create_info.setImageArrayLayers(1);
     create_info.setImageSharingMode(vk::SharingMode::eExclusive);
@@ -270,9 +357,15 @@ void usagi::VulkanSwapchain::createSwapchain(
         vk::ImageUsageFlagBits::eTransferDst
     );
 
-    create_info.setOldSwapchain(mSwapchain.get());
+    create_info.setOldSwapchain(swapchain());
 
-    mSwapchain = mDevice->device().createSwapchainKHRUnique(create_info);
+    auto handle = std::make_shared<VulkanSwapchainHandle>();
+    handle->surface = mSurface;
+    handle->swapchain = mDevice->device().createSwapchainKHRUnique(create_info);
+    if(mSwapchain)
+        mDevice->retireSwapchain(mSwapchain);
+    mSwapchain = std::move(handle);
+    mOutOfDate = false;
     mFormat = vk_format;
     mSize = { create_info.imageExtent.width, create_info.imageExtent.height };
 
@@ -281,7 +374,7 @@ void usagi::VulkanSwapchain::createSwapchain(
 
 void usagi::VulkanSwapchain::getSwapchainImages()
 {
-    auto images = mDevice->device().getSwapchainImagesKHR(mSwapchain.get());
+    auto images = mDevice->device().getSwapchainImagesKHR(swapchain());
 
     mSwapchainImages.clear();
     mSwapchainImages.reserve(images.size());
@@ -289,7 +382,8 @@ void usagi::VulkanSwapchain::getSwapchainImages()
     for(auto &&vk_image : images)
     {
         mSwapchainImages.push_back(std::make_shared<VulkanSwapchainImage>(
-            format, mSize, mDevice->device(), vk_image));
+            format, mSize, mDevice, vk_image, mSwapchain));
+        mSwapchainImages.back()->setDebugName("Swapchain Image");
     }
     mCurrentImageIndex = INVALID_IMAGE_INDEX;
 }
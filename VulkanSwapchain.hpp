@@ -4,6 +4,7 @@
 
 #include <Usagi/Runtime/Graphics/Swapchain.hpp>
 
+#include "VulkanGpuDeviceConfig.hpp"
 #include "VulkanSwapchainImage.hpp"
 
 namespace usagi
@@ -14,16 +15,28 @@ class VulkanSwapchain final : public Swapchain
 {
     VulkanGpuDevice *mDevice;
 
-    vk::UniqueSurfaceKHR mSurface;
+    std::shared_ptr<vk::UniqueSurfaceKHR> mSurface;
     vk::SurfaceFormatKHR mFormat;
     Vector2u32 mSize;
 
-    vk::UniqueSwapchainKHR mSwapchain;
+    // the swapchains replaced by recreation are kept alive by the frame
+    // contexts in flight
+    std::shared_ptr<VulkanSwapchainHandle> mSwapchain;
+    // the swapchain is recreated by the next acquisition, since it can't
+    // be done while an image is acquired or the surface is zero-sized
+    bool mOutOfDate = false;
+    Vector2u32 mPendingSize;
 
     static inline constexpr uint32_t INVALID_IMAGE_INDEX = -1;
     uint32_t mCurrentImageIndex = INVALID_IMAGE_INDEX;
     std::vector<std::shared_ptr<VulkanSwapchainImage>> mSwapchainImages;
     int mImagesInUse = 0;
+    // the semaphore left unsignaled by the last failed acquisition, reused by
+    // the next one in the same frame so that polling doesn't take a new
+    // semaphore each time
+    std::shared_ptr<GpuSemaphore> mPendingSemaphore;
+    // 0 if the semaphore is not owned by a frame context
+    std::uint64_t mPendingSemaphoreFrame = 0;
 
     static vk::SurfaceFormatKHR selectSurfaceFormat(
         const std::vector<vk::SurfaceFormatKHR> &surface_formats,
@@ -32,11 +45,30 @@ class VulkanSwapchain final : public Swapchain
         const Vector2u32 &size,
         const vk::SurfaceCapabilitiesKHR &surface_capabilities) const;
     static vk::PresentModeKHR selectPresentMode(
-        const std::vector<vk::PresentModeKHR> &present_modes);
+        const std::vector<vk::PresentModeKHR> &present_modes,
+        VulkanPresentMode preferred_mode);
+    static std::uint32_t selectImageCount(
+        const vk::SurfaceCapabilitiesKHR &surface_capabilities,
+        vk::PresentModeKHR present_mode,
+        std::uint32_t preferred_count);
     std::uint32_t selectPresentationQueueFamily() const;
 
+    vk::SurfaceKHR surface() const { return mSurface->get(); }
+    vk::SwapchainKHR swapchain() const
+    {
+        return mSwapchain ? mSwapchain->swapchain.get() : vk::SwapchainKHR { };
+    }
+
+    /**
+     * \brief Replace the swapchain without waiting for the device. Sets
+     * mOutOfDate if the surface is zero-sized.
+     */
     void createSwapchain(const Vector2u32 &size, vk::Format image_format);
     void getSwapchainImages();
+    /**
+     * \return nullptr if no image is available within the timeout.
+     */
+    std::shared_ptr<GpuSemaphore> acquireNextImage(std::uint64_t timeout);
 
 public:
     VulkanSwapchain(
@@ -49,7 +81,17 @@ public:
     GpuBufferFormat format() const override;
     Vector2u32 size() const override;
 
+    /**
+     * \brief Block until an image is available.
+     */
     std::shared_ptr<GpuSemaphore> acquireNextImage() override;
+    /**
+     * \brief Acquire an image without blocking. Returns nullptr if none is
+     * available yet, e.g. all the images are queued for presentation in
+     * FIFO mode, so the caller may process the input and try again instead
+     * of stalling.
+     */
+    std::shared_ptr<GpuSemaphore> tryAcquireNextImage();
     GpuImage * currentImage() override;
 
     void present(std::initializer_list<std::shared_ptr<GpuSemaphore>>
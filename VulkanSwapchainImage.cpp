@@ -3,10 +3,12 @@
 usagi::VulkanSwapchainImage::VulkanSwapchainImage(
     GpuImageFormat format,
     const Vector2u32 &size,
-    vk::Device vk_device,
-    vk::Image vk_image)
-    : VulkanGpuImage(std::move(format), size, std::move(vk_device))
+    VulkanGpuDevice *device,
+    vk::Image vk_image,
+    std::shared_ptr<VulkanSwapchainHandle> swapchain)
+    : VulkanGpuImage(std::move(format), size, device)
     , mImage(std::move(vk_image))
+    , mSwapchain(std::move(swapchain))
 {
     VulkanGpuImage::createBaseView();
 }
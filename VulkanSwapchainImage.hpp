@@ -1,21 +1,36 @@
 ﻿#pragma once
 
 #include <Usagi/Core/Exception.hpp>
+#include <Usagi/Utility/Noncopyable.hpp>
 #include <Usagi/Extensions/RtVulkan/VulkanGpuImage.hpp>
 
 namespace usagi
 {
+/**
+ * \brief Owns a swapchain. Shared by its images, so a replaced swapchain is
+ * destroyed once the command lists using its images are released, instead
+ * of waiting for the device to be idle.
+ */
+struct VulkanSwapchainHandle : Noncopyable
+{
+    // the swapchains must be destroyed before their surface
+    std::shared_ptr<vk::UniqueSurfaceKHR> surface;
+    vk::UniqueSwapchainKHR swapchain;
+};
+
 class VulkanSwapchainImage : public VulkanGpuImage
 {
     // obtained from the presentation engine (image)
     vk::Image mImage;
+    std::shared_ptr<VulkanSwapchainHandle> mSwapchain;
 
 public:
     VulkanSwapchainImage(
         GpuImageFormat format,
         const Vector2u32 &size,
-        vk::Device vk_device,
-        vk::Image vk_image);
+        VulkanGpuDevice *device,
+        vk::Image vk_image,
+        std::shared_ptr<VulkanSwapchainHandle> swapchain);
 
     vk::Image image() const override { return mImage; }
 
@@ -0,0 +1,57 @@
+﻿#include "VulkanSyncObjectPool.hpp"
+
+usagi::VulkanSyncObjectPool::VulkanSyncObjectPool(const vk::Device device)
+    : mDevice(device)
+{
+}
+
+vk::UniqueSemaphore usagi::VulkanSyncObjectPool::acquireSemaphore()
+{
+    if(mFreeSemaphores.empty())
+    {
+        ++mSemaphoreCount;
+        return mDevice.createSemaphoreUnique(vk::SemaphoreCreateInfo { });
+    }
+    auto semaphore = std::move(mFreeSemaphores.back());
+    mFreeSemaphores.pop_back();
+    return std::move(semaphore);
+}
+
+void usagi::VulkanSyncObjectPool::releaseSemaphore(
+    vk::UniqueSemaphore semaphore)
+{
+    mFreeSemaphores.push_back(std::move(semaphore));
+}
+
+void usagi::VulkanSyncObjectPool::resetUsedFences()
+{
+    if(mUsedFences.empty()) return;
+
+    mResetList.clear();
+    for(auto &&f : mUsedFences)
+        mResetList.push_back(f.get());
+    mDevice.resetFences(mResetList);
+
+    for(auto &&f : mUsedFences)
+        mFreeFences.push_back(std::move(f));
+    mUsedFences.clear();
+}
+
+vk::UniqueFence usagi::VulkanSyncObjectPool::acquireFence()
+{
+    if(mFreeFences.empty())
+        resetUsedFences();
+    if(mFreeFences.empty())
+    {
+        ++mFenceCount;
+        return mDevice.createFenceUnique(vk::FenceCreateInfo { });
+    }
+    auto fence = std::move(mFreeFences.back());
+    mFreeFences.pop_back();
+    return std::move(fence);
+}
+
+void usagi::VulkanSyncObjectPool::releaseFence(vk::UniqueFence fence)
+{
+    mUsedFences.push_back(std::move(fence));
+}
@@ -0,0 +1,49 @@
+﻿#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+/**
+ * \brief Recycles binary semaphores and fences so that they are not created
+ * and destroyed for every submission.
+ *
+ * Semaphores must be returned unsignaled, i.e. after the GPU has finished
+ * the work waiting on them. Fences may be returned signaled. They are reset
+ * in bulk when the free list runs out.
+ */
+class VulkanSyncObjectPool : Noncopyable
+{
+    vk::Device mDevice;
+
+    std::vector<vk::UniqueSemaphore> mFreeSemaphores;
+    std::vector<vk::UniqueFence> mFreeFences;
+    // returned fences which may be signaled
+    std::vector<vk::UniqueFence> mUsedFences;
+    std::vector<vk::Fence> mResetList;
+
+    std::size_t mSemaphoreCount = 0;
+    std::size_t mFenceCount = 0;
+
+    void resetUsedFences();
+
+public:
+    explicit VulkanSyncObjectPool(vk::Device device);
+
+    vk::UniqueSemaphore acquireSemaphore();
+    void releaseSemaphore(vk::UniqueSemaphore semaphore);
+
+    /**
+     * \brief Get an unsignaled fence.
+     */
+    vk::UniqueFence acquireFence();
+    void releaseFence(vk::UniqueFence fence);
+
+    std::size_t semaphoreCount() const { return mSemaphoreCount; }
+    std::size_t fenceCount() const { return mFenceCount; }
+};
+}
@@ -0,0 +1,346 @@
+﻿#include "VulkanTextureContainer.hpp"
+
+#include <cassert>
+#include <cstring>
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Core/Logging.hpp>
+
+#include "VulkanBufferAllocation.hpp"
+#include "VulkanFormatInfo.hpp"
+#include "VulkanGpuDevice.hpp"
+#include "VulkanHelper.hpp"
+#include "VulkanMappedFile.hpp"
+#include "VulkanPooledImage.hpp"
+
+using namespace usagi::vulkan;
+
+namespace
+{
+// the containers are little-endian
+template <typename T>
+T readValue(const std::byte *data, const std::size_t offset)
+{
+    T value;
+    memcpy(&value, data + offset, sizeof(T));
+    return value;
+}
+
+constexpr std::uint32_t fourCC(const char (&code)[5])
+{
+    return static_cast<std::uint32_t>(code[0]) |
+        static_cast<std::uint32_t>(code[1]) << 8 |
+        static_cast<std::uint32_t>(code[2]) << 16 |
+        static_cast<std::uint32_t>(code[3]) << 24;
+}
+
+[[noreturn]] void invalidContainer(const char *reason)
+{
+    LOG(error, "Invalid texture container: {}", reason);
+    USAGI_THROW(std::runtime_error("Invalid texture container."));
+}
+
+vk::Format translateDxgiFormat(const std::uint32_t format)
+{
+    switch(format)
+    {
+        case 2: return vk::Format::eR32G32B32A32Sfloat;
+        case 16: return vk::Format::eR32G32Sfloat;
+        case 28: return vk::Format::eR8G8B8A8Unorm;
+        case 29: return vk::Format::eR8G8B8A8Srgb;
+        case 41: return vk::Format::eR32Sfloat;
+        case 49: return vk::Format::eR8G8Unorm;
+        case 61: return vk::Format::eR8Unorm;
+        case 71: return vk::Format::eBc1RgbaUnormBlock;
+        case 72: return vk::Format::eBc1RgbaSrgbBlock;
+        case 74: return vk::Format::eBc2UnormBlock;
+        case 75: return vk::Format::eBc2SrgbBlock;
+        case 77: return vk::Format::eBc3UnormBlock;
+        case 78: return vk::Format::eBc3SrgbBlock;
+        case 80: return vk::Format::eBc4UnormBlock;
+        case 81: return vk::Format::eBc4SnormBlock;
+        case 83: return vk::Format::eBc5UnormBlock;
+        case 84: return vk::Format::eBc5SnormBlock;
+        case 87: return vk::Format::eB8G8R8A8Unorm;
+        case 91: return vk::Format::eB8G8R8A8Srgb;
+        case 95: return vk::Format::eBc6HUfloatBlock;
+        case 96: return vk::Format::eBc6HSfloatBlock;
+        case 98: return vk::Format::eBc7UnormBlock;
+        case 99: return vk::Format::eBc7SrgbBlock;
+        default: return vk::Format::eUndefined;
+    }
+}
+
+vk::Format translateFourCC(const std::uint32_t code)
+{
+    switch(code)
+    {
+        case fourCC("DXT1"): return vk::Format::eBc1RgbaUnormBlock;
+        case fourCC("DXT2"):
+        case fourCC("DXT3"): return vk::Format::eBc2UnormBlock;
+        case fourCC("DXT4"):
+        case fourCC("DXT5"): return vk::Format::eBc3UnormBlock;
+        case fourCC("ATI1"):
+        case fourCC("BC4U"): return vk::Format::eBc4UnormBlock;
+        case fourCC("BC4S"): return vk::Format::eBc4SnormBlock;
+        case fourCC("ATI2"):
+        case fourCC("BC5U"): return vk::Format::eBc5UnormBlock;
+        case fourCC("BC5S"): return vk::Format::eBc5SnormBlock;
+        default: return vk::Format::eUndefined;
+    }
+}
+}
+
+usagi::VulkanTextureContainer::VulkanTextureContainer(
+    const std::filesystem::path &path)
+    : mFile(std::make_shared<VulkanMappedFile>(path))
+    , mData(mFile->data())
+    , mSize(mFile->size())
+{
+    parse();
+}
+
+usagi::VulkanTextureContainer::VulkanTextureContainer(
+    const void *data,
+    const std::size_t size)
+    : mData(static_cast<const std::byte *>(data))
+    , mSize(size)
+{
+    parse();
+}
+
+usagi::VulkanTextureContainer::~VulkanTextureContainer()
+{
+}
+
+void usagi::VulkanTextureContainer::parse()
+{
+    static const unsigned char KTX2_IDENTIFIER[12] = {
+        0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'
+    };
+
+    if(mSize >= sizeof(KTX2_IDENTIFIER) &&
+        memcmp(mData, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0)
+        parseKtx2();
+    else if(mSize >= 4 && readValue<std::uint32_t>(mData, 0) == fourCC("DDS "))
+        parseDds();
+    else
+        invalidContainer("unknown file type");
+
+    if(formatBlock(mFormat).size == 0)
+    {
+        LOG(error, "Unsupported texture format: {}", vk::to_string(mFormat));
+        USAGI_THROW(std::runtime_error("Unsupported texture format."));
+    }
+}
+
+void usagi::VulkanTextureContainer::addSubresource(
+    const std::size_t offset,
+    const std::size_t size)
+{
+    if(offset > mSize || size > mSize - offset)
+        invalidContainer("truncated image data");
+    mSubresources.push_back({ offset, size });
+}
+
+void usagi::VulkanTextureContainer::parseKtx2()
+{
+    constexpr std::size_t HEADER_SIZE = 80;
+    constexpr std::size_t LEVEL_INDEX_ENTRY_SIZE = 24;
+
+    if(mSize < HEADER_SIZE) invalidContainer("truncated KTX2 header");
+
+    mFormat = static_cast<vk::Format>(readValue<std::uint32_t>(mData, 12));
+    mWidth = readValue<std::uint32_t>(mData, 20);
+    mHeight = std::max(readValue<std::uint32_t>(mData, 24), 1u);
+    const auto depth = readValue<std::uint32_t>(mData, 28);
+    const auto layers = std::max(readValue<std::uint32_t>(mData, 32), 1u);
+    const auto faces = readValue<std::uint32_t>(mData, 36);
+    // 0 asks the loader to generate the mips, which only has the base one
+    mMipLevels = std::max(readValue<std::uint32_t>(mData, 40), 1u);
+    const auto supercompression = readValue<std::uint32_t>(mData, 44);
+
+    if(mFormat == vk::Format::eUndefined)
+        invalidContainer("KTX2 formats only described by the DFD");
+    if(supercompression != 0)
+        invalidContainer("KTX2 supercompression");
+    if(depth > 1)
+        invalidContainer("3D textures");
+    if(faces != 1 && faces != 6)
+        invalidContainer("invalid KTX2 face count");
+    if(mWidth == 0 || mMipLevels > fullMipCount(mWidth, mHeight))
+        invalidContainer("invalid KTX2 extent");
+    if(mSize < HEADER_SIZE + mMipLevels * LEVEL_INDEX_ENTRY_SIZE)
+        invalidContainer("truncated KTX2 level index");
+    mArrayLayers = layers * faces;
+
+    // the levels hold the images of all the layers and faces in order
+    std::vector<Subresource> levels(mMipLevels);
+    for(std::uint32_t mip = 0; mip < mMipLevels; ++mip)
+    {
+        const auto entry = HEADER_SIZE + mip * LEVEL_INDEX_ENTRY_SIZE;
+        const auto offset = readValue<std::uint64_t>(mData, entry);
+        const auto length = readValue<std::uint64_t>(mData, entry + 8);
+        const auto image_size = mipDataSize(mFormat, mWidth, mHeight, mip);
+        if(length < image_size * mArrayLayers)
+            invalidContainer("KTX2 level smaller than its images");
+        levels[mip] = {
+            static_cast<std::size_t>(offset), image_size
+        };
+    }
+    for(std::uint32_t layer = 0; layer < mArrayLayers; ++layer)
+    for(std::uint32_t mip = 0; mip < mMipLevels; ++mip)
+    {
+        const auto &level = levels[mip];
+        addSubresource(level.offset + layer * level.size, level.size);
+    }
+}
+
+void usagi::VulkanTextureContainer::parseDds()
+{
+    constexpr std::size_t HEADER_OFFSET = 4;
+    constexpr std::size_t HEADER_SIZE = 124;
+    constexpr std::size_t DX10_HEADER_SIZE = 20;
+    constexpr std::uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+    constexpr std::uint32_t DDPF_FOURCC = 0x4;
+    constexpr std::uint32_t DDPF_RGB = 0x40;
+    constexpr std::uint32_t DDPF_LUMINANCE = 0x20000;
+    constexpr std::uint32_t DDSCAPS2_CUBEMAP = 0x200;
+    constexpr std::uint32_t DDSCAPS2_VOLUME = 0x200000;
+    constexpr std::uint32_t DDS_RESOURCE_MISC_TEXTURECUBE = 0x4;
+
+    if(mSize < HEADER_OFFSET + HEADER_SIZE)
+        invalidContainer("truncated DDS header");
+
+    const auto header = mData + HEADER_OFFSET;
+    const auto flags = readValue<std::uint32_t>(header, 4);
+    mHeight = readValue<std::uint32_t>(header, 8);
+    mWidth = readValue<std::uint32_t>(header, 12);
+    mMipLevels = flags & DDSD_MIPMAPCOUNT
+        ? std::max(readValue<std::uint32_t>(header, 24), 1u) : 1u;
+    const auto pf_flags = readValue<std::uint32_t>(header, 76);
+    const auto pf_fourcc = readValue<std::uint32_t>(header, 80);
+    const auto pf_bits = readValue<std::uint32_t>(header, 84);
+    const auto pf_r = readValue<std::uint32_t>(header, 88);
+    const auto pf_b = readValue<std::uint32_t>(header, 96);
+    const auto caps2 = readValue<std::uint32_t>(header, 108);
+
+    if(caps2 & DDSCAPS2_VOLUME)
+        invalidContainer("3D textures");
+    if(mWidth == 0 || mHeight == 0 ||
+        mMipLevels > fullMipCount(mWidth, mHeight))
+        invalidContainer("invalid DDS extent");
+
+    auto data_offset = HEADER_OFFSET + HEADER_SIZE;
+    mArrayLayers = caps2 & DDSCAPS2_CUBEMAP ? 6 : 1;
+    if(pf_flags & DDPF_FOURCC && pf_fourcc == fourCC("DX10"))
+    {
+        if(mSize < data_offset + DX10_HEADER_SIZE)
+            invalidContainer("truncated DDS DX10 header");
+        const auto dx10 = mData + data_offset;
+        mFormat = translateDxgiFormat(readValue<std::uint32_t>(dx10, 0));
+        const auto misc = readValue<std::uint32_t>(dx10, 8);
+        const auto array_size = std::max(
+            readValue<std::uint32_t>(dx10, 12), 1u);
+        mArrayLayers = array_size *
+            (misc & DDS_RESOURCE_MISC_TEXTURECUBE ? 6 : 1);
+        data_offset += DX10_HEADER_SIZE;
+    }
+    else if(pf_flags & DDPF_FOURCC)
+    {
+        mFormat = translateFourCC(pf_fourcc);
+    }
+    else if(pf_flags & DDPF_RGB && pf_bits == 32)
+    {
+        if(pf_r == 0xFF && pf_b == 0xFF0000)
+            mFormat = vk::Format::eR8G8B8A8Unorm;
+        else if(pf_r == 0xFF0000 && pf_b == 0xFF)
+            mFormat = vk::Format::eB8G8R8A8Unorm;
+    }
+    else if(pf_flags & (DDPF_RGB | DDPF_LUMINANCE) && pf_bits == 8)
+    {
+        mFormat = vk::Format::eR8Unorm;
+    }
+
+    if(mFormat == vk::Format::eUndefined)
+        invalidContainer("unsupported DDS pixel format");
+
+    // the mips of each layer are stored together
+    for(std::uint32_t layer = 0; layer < mArrayLayers; ++layer)
+    for(std::uint32_t mip = 0; mip < mMipLevels; ++mip)
+    {
+        const auto size = mipDataSize(mFormat, mWidth, mHeight, mip);
+        addSubresource(data_offset, size);
+        data_offset += size;
+    }
+}
+
+usagi::GpuImageCreateInfo usagi::VulkanTextureContainer::imageInfo(
+    const GpuImageUsage usage) const
+{
+    GpuImageCreateInfo info;
+    info.size = { mWidth, mHeight };
+    info.mip_levels = mMipLevels;
+    info.usage = usage;
+    return info;
+}
+
+std::shared_ptr<usagi::VulkanPooledImage>
+usagi::VulkanTextureContainer::createImage(
+    VulkanGpuDevice *device,
+    const GpuImageUsage usage) const
+{
+    VulkanImageCreateInfo vk_info;
+    vk_info.format = mFormat;
+    vk_info.array_layers = mArrayLayers;
+    auto image = device->createImage(imageInfo(usage), vk_info);
+
+    // the layers of a mip are copied with one region, so the rows and the
+    // layers are given in whole blocks
+    const auto block = formatBlock(mFormat);
+    for(std::uint32_t mip = 0; mip < mMipLevels; ++mip)
+    {
+        const auto width = mipExtent(mWidth, mip);
+        const auto height = mipExtent(mHeight, mip);
+        const auto layer_size = subresource(mip, 0).size;
+        const auto buffer = device->allocateStageBuffer(
+            layer_size * mArrayLayers);
+        const auto dst = static_cast<std::byte *>(buffer->mappedAddress());
+        for(std::uint32_t layer = 0; layer < mArrayLayers; ++layer)
+            memcpy(dst + layer * layer_size, data(mip, layer), layer_size);
+
+        vk::BufferImageCopy region;
+        region.setBufferRowLength(
+            static_cast<std::uint32_t>(alignUp(width, block.width)));
+        region.setBufferImageHeight(
+            static_cast<std::uint32_t>(alignUp(height, block.height)));
+        region.imageSubresource.setAspectMask(
+            vk::ImageAspectFlagBits::eColor);
+        region.imageSubresource.setMipLevel(mip);
+        region.imageSubresource.setBaseArrayLayer(0);
+        region.imageSubresource.setLayerCount(mArrayLayers);
+        region.setImageExtent({ width, height, 1 });
+        device->copyBufferToImage(buffer, image.get(), region);
+    }
+    return std::move(image);
+}
+
+usagi::VulkanStreamedTexture::MipLoader
+usagi::VulkanTextureContainer::mipLoader() const
+{
+    // the streamed textures only have one layer
+    if(mArrayLayers > 1)
+    {
+        LOG(error, "Texture arrays of {} layers can't be streamed.",
+            mArrayLayers);
+        USAGI_THROW(std::runtime_error("Streamed texture is an array."));
+    }
+
+    std::vector<Subresource> mips(
+        mSubresources.begin(), mSubresources.begin() + mMipLevels);
+    return [file = mFile, data = mData, mips = std::move(mips)](
+        const std::uint32_t mip, void *dst, const std::size_t size) {
+        assert(size == mips[mip].size);
+        memcpy(dst, data + mips[mip].offset, size);
+    };
+}
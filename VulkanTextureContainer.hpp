@@ -0,0 +1,113 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Runtime/Graphics/Enum/GpuImageUsage.hpp>
+#include <Usagi/Runtime/Graphics/GpuImageCreateInfo.hpp>
+#include <Usagi/Utility/Noncopyable.hpp>
+
+#include "VulkanTextureStreamer.hpp"
+
+namespace usagi
+{
+class VulkanGpuDevice;
+class VulkanMappedFile;
+class VulkanPooledImage;
+
+/**
+ * \brief A KTX2 or DDS texture whose mips are uploaded as stored in the
+ * container, without decoding or reformatting. The data is usually a mapped
+ * file, so each mip is only copied once from the page cache into the staging
+ * memory.
+ *
+ * The containers must hold 2D textures, optionally arrays or cube maps whose
+ * faces become array layers, in a format known by vulkan::formatBlock().
+ * KTX2 files with supercompression are not supported.
+ */
+class VulkanTextureContainer : Noncopyable
+{
+public:
+    struct Subresource
+    {
+        // from the beginning of the container
+        std::size_t offset = 0;
+        std::size_t size = 0;
+    };
+
+private:
+    // null if the data is owned by the caller
+    std::shared_ptr<VulkanMappedFile> mFile;
+    const std::byte *mData = nullptr;
+    std::size_t mSize = 0;
+
+    vk::Format mFormat = vk::Format::eUndefined;
+    std::uint32_t mWidth = 0;
+    std::uint32_t mHeight = 0;
+    std::uint32_t mMipLevels = 0;
+    std::uint32_t mArrayLayers = 0;
+    // indexed by layer * mMipLevels + mip
+    std::vector<Subresource> mSubresources;
+
+    void parse();
+    void parseKtx2();
+    void parseDds();
+    void addSubresource(std::size_t offset, std::size_t size);
+
+public:
+    /**
+     * \brief Map the file and parse the header. Throws std::runtime_error if
+     * the file can't be mapped or is not a supported container.
+     */
+    explicit VulkanTextureContainer(const std::filesystem::path &path);
+    /**
+     * \brief Parse a container in memory which must outlive this object and
+     * the loaders created by it.
+     */
+    VulkanTextureContainer(const void *data, std::size_t size);
+    ~VulkanTextureContainer();
+
+    vk::Format format() const { return mFormat; }
+    std::uint32_t width() const { return mWidth; }
+    std::uint32_t height() const { return mHeight; }
+    std::uint32_t mipLevels() const { return mMipLevels; }
+    std::uint32_t arrayLayers() const { return mArrayLayers; }
+
+    const Subresource & subresource(
+        const std::uint32_t mip,
+        const std::uint32_t layer) const
+    {
+        return mSubresources[layer * mMipLevels + mip];
+    }
+    const std::byte * data(std::uint32_t mip, std::uint32_t layer) const
+    {
+        return mData + subresource(mip, layer).offset;
+    }
+
+    /**
+     * \brief The create info of an image of the container. The format is
+     * given separately by format().
+     */
+    GpuImageCreateInfo imageInfo(
+        GpuImageUsage usage = GpuImageUsage::SAMPLED) const;
+
+    /**
+     * \brief Create a device-local image and queue the copies of all the
+     * subresources. Throws if the format is not supported by the device.
+     */
+    std::shared_ptr<VulkanPooledImage> createImage(
+        VulkanGpuDevice *device,
+        GpuImageUsage usage = GpuImageUsage::SAMPLED) const;
+
+    /**
+     * \brief A loader of the mips for VulkanTextureStreamer::createTexture(),
+     * which keeps the mapped file alive. Throws if the texture has more than
+     * one layer, since the streamed textures can't be arrays.
+     */
+    VulkanStreamedTexture::MipLoader mipLoader() const;
+};
+}
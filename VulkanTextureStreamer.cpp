@@ -0,0 +1,278 @@
+﻿#include "VulkanTextureStreamer.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Core/Logging.hpp>
+#include <Usagi/Runtime/Graphics/GpuImageView.hpp>
+
+#include "VulkanBufferAllocation.hpp"
+#include "VulkanEnumTranslation.hpp"
+#include "VulkanFormatInfo.hpp"
+#include "VulkanGpuDevice.hpp"
+#include "VulkanHelper.hpp"
+#include "VulkanPooledImage.hpp"
+
+using namespace usagi::vulkan;
+
+usagi::VulkanStreamedTexture::VulkanStreamedTexture(
+    GpuImageCreateInfo info,
+    const vk::Format format,
+    MipLoader loader)
+    : mInfo(std::move(info))
+    , mFormat(format)
+    , mLoader(std::move(loader))
+{
+}
+
+usagi::VulkanStreamedTexture::~VulkanStreamedTexture()
+{
+}
+
+void usagi::VulkanStreamedTexture::requestExtent(const std::uint32_t pixels)
+{
+    auto requested = mRequestedExtent.load(std::memory_order_relaxed);
+    while(requested < pixels && !mRequestedExtent.compare_exchange_weak(
+        requested, pixels, std::memory_order_relaxed))
+    {
+    }
+}
+
+std::shared_ptr<usagi::GpuImageView> usagi::VulkanStreamedTexture::view()
+    const
+{
+    return mImage->baseView();
+}
+
+usagi::VulkanTextureStreamer::VulkanTextureStreamer(
+    VulkanGpuDevice *device,
+    VulkanTextureStreamerConfig config)
+    : mDevice(device)
+    , mConfig(std::move(config))
+{
+}
+
+usagi::VulkanTextureStreamer::~VulkanTextureStreamer()
+{
+}
+
+std::size_t usagi::VulkanTextureStreamer::mipSize(
+    const VulkanStreamedTexture &texture,
+    const std::uint32_t mip) const
+{
+    return mipDataSize(texture.mFormat,
+        texture.mInfo.size.x(), texture.mInfo.size.y(), mip);
+}
+
+vk::DeviceSize usagi::VulkanTextureStreamer::residentSize(
+    const VulkanStreamedTexture &texture,
+    const std::uint32_t mip) const
+{
+    // the alignment of the image memory is not counted
+    vk::DeviceSize size = 0;
+    for(auto i = mip; i < texture.mipLevels(); ++i)
+        size += mipSize(texture, i);
+    return size;
+}
+
+std::uint32_t usagi::VulkanTextureStreamer::priority(
+    const VulkanStreamedTexture &texture) const
+{
+    if(mUpdateCount - texture.mLastRequestedUpdate > mConfig.idle_updates)
+        return 0;
+    return texture.mScreenExtent;
+}
+
+std::uint32_t usagi::VulkanTextureStreamer::desiredMip(
+    const VulkanStreamedTexture &texture) const
+{
+    const auto screen = priority(texture);
+    if(screen == 0) return texture.mTailMip;
+
+    // the finest mip not smaller than the extent on the screen
+    const auto &size = texture.mInfo.size;
+    const auto extent = std::max(size.x(), size.y());
+    const auto mip = extent > screen ? highestBit(extent / screen) : 0;
+    return std::min(mip, texture.mTailMip);
+}
+
+vk::DeviceSize usagi::VulkanTextureStreamer::memoryLimit() const
+{
+    // the textures are allocated from the largest device-local heap
+    const auto budget = mDevice->memoryBudget();
+    vk::DeviceSize heap_size = 0;
+    vk::DeviceSize available = 0;
+    for(std::uint32_t i = 0; i < budget->heapCount(); ++i)
+    {
+        const auto &heap = budget->heap(i);
+        if(!(heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal) ||
+            heap.size <= heap_size)
+            continue;
+        heap_size = heap.size;
+        available = heap.available();
+    }
+
+    // the memory of the replaced images is only freed after the frames
+    // using them complete, so the limit may be underestimated for a while.
+    auto limit = mResidentSize + available;
+    limit = limit > mConfig.reserved_memory
+        ? limit - mConfig.reserved_memory : 0;
+    if(mConfig.max_resident_size)
+        limit = std::min(limit, mConfig.max_resident_size);
+    return limit;
+}
+
+bool usagi::VulkanTextureStreamer::makeResident(
+    VulkanStreamedTexture &texture,
+    const std::uint32_t mip)
+{
+    assert(mip <= texture.mTailMip);
+
+    const auto &size = texture.mInfo.size;
+    auto info = texture.mInfo;
+    info.size = { mipExtent(size.x(), mip), mipExtent(size.y(), mip) };
+    info.mip_levels = texture.mipLevels() - mip;
+
+    std::shared_ptr<VulkanPooledImage> image;
+    try
+    {
+        VulkanImageCreateInfo vk_info;
+        vk_info.format = texture.mFormat;
+        image = mDevice->createImage(info, vk_info);
+    }
+    catch(const std::bad_alloc &)
+    {
+        LOG(warn, "Out of memory for streaming in a texture.");
+        return false;
+    }
+    catch(const vk::OutOfDeviceMemoryError &)
+    {
+        LOG(warn, "Out of device memory for streaming in a texture.");
+        return false;
+    }
+
+    // copy the mips which are resident in both images and load the others
+    const auto old_image = texture.mImage.get();
+    const auto old_mip = texture.mResidentMip;
+    for(auto i = mip; i < texture.mipLevels(); ++i)
+    {
+        if(old_image && i >= old_mip)
+        {
+            mDevice->copyImage(old_image, i - old_mip, image.get(), i - mip);
+            continue;
+        }
+        const auto data_size = mipSize(texture, i);
+        const auto buffer = mDevice->allocateStageBuffer(data_size);
+        texture.mLoader(i, buffer->mappedAddress(), data_size);
+        mDevice->copyBufferToImage(buffer, image.get(), Vector2i::Zero(),
+            { mipExtent(size.x(), i), mipExtent(size.y(), i) }, i - mip);
+        mLoadedSize += data_size;
+    }
+
+    if(old_image)
+        mResidentSize -= residentSize(texture, old_mip);
+    mResidentSize += residentSize(texture, mip);
+    texture.mImage = std::move(image);
+    texture.mResidentMip = mip;
+    return true;
+}
+
+std::shared_ptr<usagi::VulkanStreamedTexture>
+usagi::VulkanTextureStreamer::createTexture(
+    const GpuImageCreateInfo &info,
+    VulkanStreamedTexture::MipLoader loader,
+    const vk::Format format)
+{
+    assert(info.mip_levels > 0);
+    assert(info.mip_levels <= fullMipCount(info.size.x(), info.size.y()));
+
+    auto texture = std::make_shared<VulkanStreamedTexture>(
+        info,
+        format == vk::Format::eUndefined ? translate(info.format) : format,
+        std::move(loader));
+    const auto extent = std::max(info.size.x(), info.size.y());
+    while(texture->mTailMip + 1 < info.mip_levels &&
+        mipExtent(extent, texture->mTailMip) > mConfig.min_resident_extent)
+        ++texture->mTailMip;
+
+    if(!makeResident(*texture, texture->mTailMip))
+        USAGI_THROW(std::bad_alloc());
+    mTextures.push_back(texture);
+    return std::move(texture);
+}
+
+void usagi::VulkanTextureStreamer::evict(
+    const std::uint32_t below_priority,
+    const vk::DeviceSize needed_size)
+{
+    // mOrder is sorted from the lowest priority
+    for(auto &&t : mOrder)
+    {
+        if(mResidentSize + needed_size <= mMemoryLimit) return;
+        if(priority(*t) >= below_priority) return;
+        if(t->mResidentMip >= t->mTailMip) continue;
+
+        // drop the mips not needed anymore first, otherwise lower the
+        // quality of a visible texture by one mip
+        const auto desired = desiredMip(*t);
+        const auto mip = desired > t->mResidentMip
+            ? desired : t->mResidentMip + 1;
+        if(makeResident(*t, mip))
+            t->mLastEvictedUpdate = mUpdateCount;
+    }
+}
+
+void usagi::VulkanTextureStreamer::update()
+{
+    ++mUpdateCount;
+    mLoadedSize = 0;
+
+    mTextures.erase(std::remove_if(mTextures.begin(), mTextures.end(),
+        [&](auto &&t) {
+            if(t.use_count() > 1) return false;
+            mResidentSize -= residentSize(*t, t->mResidentMip);
+            return true;
+        }), mTextures.end());
+
+    mOrder.clear();
+    for(auto &&t : mTextures)
+    {
+        const auto requested = t->mRequestedExtent.exchange(0,
+            std::memory_order_relaxed);
+        if(requested)
+        {
+            t->mScreenExtent = requested;
+            t->mLastRequestedUpdate = mUpdateCount;
+        }
+        mOrder.push_back(t.get());
+    }
+    std::stable_sort(mOrder.begin(), mOrder.end(), [&](auto &&l, auto &&r) {
+        return priority(*l) < priority(*r);
+    });
+
+    // the finer mips are kept while the memory allows, so that textures
+    // moving in and out of the view are not loaded repeatedly
+    mMemoryLimit = memoryLimit();
+    if(mResidentSize > mMemoryLimit)
+        evict(~std::uint32_t { 0 }, 0);
+
+    // the most visible textures first
+    for(auto i = mOrder.rbegin(); i != mOrder.rend(); ++i)
+    {
+        auto &t = **i;
+        const auto p = priority(t);
+        if(p == 0) break;
+        if(mLoadedSize >= mConfig.max_load_size_per_update) break;
+        if(t.mLastEvictedUpdate == mUpdateCount) continue;
+
+        const auto desired = desiredMip(t);
+        if(desired >= t.mResidentMip) continue;
+
+        const auto needed = residentSize(t, desired) -
+            residentSize(t, t.mResidentMip);
+        evict(p, needed);
+        if(mResidentSize + needed > mMemoryLimit) continue;
+        makeResident(t, desired);
+    }
+}
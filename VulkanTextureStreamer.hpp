@@ -0,0 +1,173 @@
+﻿#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Runtime/Graphics/GpuImageCreateInfo.hpp>
+#include <Usagi/Utility/Noncopyable.hpp>
+
+namespace usagi
+{
+class GpuImageView;
+class VulkanGpuDevice;
+class VulkanPooledImage;
+
+struct VulkanTextureStreamerConfig
+{
+    // the device-local memory left for the other resources
+    vk::DeviceSize reserved_memory = 1024 * 1024 * 256; // 256 MiB
+    // the most memory used by the resident mips. 0 is only limited by the
+    // memory budget.
+    vk::DeviceSize max_resident_size = 0;
+    // the most mip data loaded by an update, unless a single texture needs
+    // more
+    std::size_t max_load_size_per_update = 1024 * 1024 * 16; // 16 MiB
+    // the mips no larger than this are always resident
+    std::uint32_t min_resident_extent = 64;
+    // the textures not requested for this many updates are the first to be
+    // evicted and no longer stream in
+    std::uint32_t idle_updates = 30;
+};
+
+/**
+ * \brief A texture whose finer mips are only resident when it is large enough
+ * on the screen. The resident mips live in an image created for them, which
+ * is replaced when more or fewer mips become resident, so the view should be
+ * fetched each time the texture is bound.
+ */
+class VulkanStreamedTexture : Noncopyable
+{
+public:
+    /**
+     * \brief Write the tightly packed data of a mip level to the staging
+     * memory. Called by VulkanTextureStreamer::update() when the mip is made
+     * resident, which may happen again after it was evicted.
+     */
+    using MipLoader = std::function<
+        void(std::uint32_t mip, void *dst, std::size_t size)>;
+
+private:
+    friend class VulkanTextureStreamer;
+
+    GpuImageCreateInfo mInfo;
+    vk::Format mFormat;
+    MipLoader mLoader;
+    // the finest mip of the tail which is always resident
+    std::uint32_t mTailMip = 0;
+
+    // the mip 0 of the image is the mip mResidentMip of the texture
+    std::shared_ptr<VulkanPooledImage> mImage;
+    std::uint32_t mResidentMip = 0;
+
+    std::atomic<std::uint32_t> mRequestedExtent { 0 };
+    std::uint32_t mScreenExtent = 0;
+    std::uint64_t mLastRequestedUpdate = 0;
+    std::uint64_t mLastEvictedUpdate = 0;
+
+public:
+    VulkanStreamedTexture(
+        GpuImageCreateInfo info,
+        vk::Format format,
+        MipLoader loader);
+    ~VulkanStreamedTexture();
+
+    /**
+     * \brief Report the extent in pixels that the texture covers on the
+     * screen, e.g. the projected size of the longer edge of the surface. The
+     * largest extent requested between two updates decides the resident
+     * mips and the priority. Can be called from any thread.
+     */
+    void requestExtent(std::uint32_t pixels);
+
+    /**
+     * \brief The view of the resident mips. Replaced by
+     * VulkanTextureStreamer::update().
+     */
+    std::shared_ptr<GpuImageView> view() const;
+
+    std::uint32_t residentMip() const { return mResidentMip; }
+    std::uint32_t mipLevels() const { return mInfo.mip_levels; }
+};
+
+/**
+ * \brief Loads the mips of the textures on demand by the extents they cover
+ * on the screen, and evicts the mips of the least visible textures when the
+ * device-local memory runs low.
+ *
+ * The textures are resized instead of being bound to sparse memory: the mips
+ * which stay resident are copied to the new image by the GPU and only the
+ * missing ones are loaded, all by the upload queue of the device. Since the
+ * uploads are submitted before the graphics jobs, a new image can be used
+ * as soon as it is created, and the old one is released by the resource
+ * tracking after the frames using it complete.
+ */
+class VulkanTextureStreamer : Noncopyable
+{
+    VulkanGpuDevice *mDevice = nullptr;
+    VulkanTextureStreamerConfig mConfig;
+
+    // a texture is dropped when only the streamer refers to it
+    std::vector<std::shared_ptr<VulkanStreamedTexture>> mTextures;
+    std::uint64_t mUpdateCount = 0;
+    vk::DeviceSize mResidentSize = 0;
+    vk::DeviceSize mMemoryLimit = 0;
+    std::size_t mLoadedSize = 0;
+    // scratch buffer sorted by the priority
+    std::vector<VulkanStreamedTexture *> mOrder;
+
+    vk::DeviceSize residentSize(
+        const VulkanStreamedTexture &texture,
+        std::uint32_t mip) const;
+    std::size_t mipSize(
+        const VulkanStreamedTexture &texture,
+        std::uint32_t mip) const;
+    std::uint32_t priority(const VulkanStreamedTexture &texture) const;
+    std::uint32_t desiredMip(const VulkanStreamedTexture &texture) const;
+    vk::DeviceSize memoryLimit() const;
+
+    /**
+     * \brief Replace the image of the texture with one holding the mips from
+     * the given one.
+     * \return false if the memory could not be allocated.
+     */
+    bool makeResident(VulkanStreamedTexture &texture, std::uint32_t mip);
+    /**
+     * \brief Evict the mips of the textures with lower priorities than the
+     * given one until the resident mips fit in the memory limit.
+     */
+    void evict(std::uint32_t below_priority, vk::DeviceSize needed_size);
+
+public:
+    explicit VulkanTextureStreamer(
+        VulkanGpuDevice *device,
+        VulkanTextureStreamerConfig config = { });
+    ~VulkanTextureStreamer();
+
+    /**
+     * \brief Create a texture with the mips in the always resident tail
+     * uploaded. info.mip_levels is the length of the whole chain which the
+     * loader can provide.
+     * \param format Replaces info.format unless undefined, e.g. with a
+     * block-compressed format.
+     */
+    std::shared_ptr<VulkanStreamedTexture> createTexture(
+        const GpuImageCreateInfo &info,
+        VulkanStreamedTexture::MipLoader loader,
+        vk::Format format = vk::Format::eUndefined);
+
+    /**
+     * \brief Evict and load the mips by the extents requested since the last
+     * update. Should be called once per frame after
+     * VulkanGpuDevice::beginFrame() and not during the recording of the
+     * command lists binding the streamed textures.
+     */
+    void update();
+
+    vk::DeviceSize residentSize() const { return mResidentSize; }
+    std::size_t textureCount() const { return mTextures.size(); }
+};
+}
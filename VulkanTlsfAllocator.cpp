@@ -0,0 +1,269 @@
+﻿#include "VulkanTlsfAllocator.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <new>
+
+#include "VulkanHelper.hpp"
+
+using namespace usagi::vulkan;
+
+usagi::VulkanTlsfAllocator::VulkanTlsfAllocator(
+    void *base,
+    const std::size_t total_size,
+    const std::size_t granularity)
+    : mBase(reinterpret_cast<std::uintptr_t>(base))
+    , mTotalSize(total_size / granularity * granularity)
+    , mGranularity(granularity)
+{
+    assert(granularity > 0 && (granularity & (granularity - 1)) == 0);
+
+    for(auto &&fl : mFreeLists)
+        std::fill(std::begin(fl), std::end(fl), NIL);
+
+    if(mTotalSize == 0) return;
+
+    const auto index = newBlock();
+    mBlocks[index].offset = 0;
+    mBlocks[index].size = mTotalSize;
+    insertFree(index);
+}
+
+void usagi::VulkanTlsfAllocator::mapping(
+    const std::size_t units,
+    std::uint32_t &fl,
+    std::uint32_t &sl) const
+{
+    // small blocks are linearly bucketed
+    if(units < SL_COUNT)
+    {
+        fl = 0;
+        sl = static_cast<std::uint32_t>(units);
+        return;
+    }
+    const auto msb = highestBit(units);
+    fl = msb - SL_BITS + 1;
+    sl = static_cast<std::uint32_t>(units >> (msb - SL_BITS)) - SL_COUNT;
+}
+
+bool usagi::VulkanTlsfAllocator::findFreeList(
+    const std::size_t size,
+    std::uint32_t &fl,
+    std::uint32_t &sl) const
+{
+    auto units = size / mGranularity;
+    // round up to the next list so that any block in it is large enough
+    if(units >= SL_COUNT)
+        units += (std::size_t(1) << (highestBit(units) - SL_BITS)) - 1;
+    mapping(units, fl, sl);
+    if(fl >= FL_COUNT) return false;
+
+    std::uint32_t sl_map = mSlBitmaps[fl] & (~0u << sl);
+    if(sl_map == 0)
+    {
+        if(fl + 1 >= FL_COUNT) return false;
+        const auto fl_map = mFlBitmap & (~std::uint64_t(0) << (fl + 1));
+        if(fl_map == 0) return false;
+        fl = lowestBit(fl_map);
+        sl_map = mSlBitmaps[fl];
+    }
+    sl = lowestBit(sl_map);
+    return true;
+}
+
+std::uint32_t usagi::VulkanTlsfAllocator::newBlock()
+{
+    if(!mUnusedBlocks.empty())
+    {
+        const auto index = mUnusedBlocks.back();
+        mUnusedBlocks.pop_back();
+        mBlocks[index] = { };
+        return index;
+    }
+    mBlocks.emplace_back();
+    return static_cast<std::uint32_t>(mBlocks.size() - 1);
+}
+
+void usagi::VulkanTlsfAllocator::freeBlock(const std::uint32_t index)
+{
+    mUnusedBlocks.push_back(index);
+}
+
+void usagi::VulkanTlsfAllocator::insertFree(const std::uint32_t index)
+{
+    auto &b = mBlocks[index];
+    std::uint32_t fl, sl;
+    mapping(b.size / mGranularity, fl, sl);
+
+    auto &head = mFreeLists[fl][sl];
+    b.prev_free = NIL;
+    b.next_free = head;
+    if(head != NIL)
+        mBlocks[head].prev_free = index;
+    head = index;
+    b.free = true;
+
+    mSlBitmaps[fl] |= 1u << sl;
+    mFlBitmap |= std::uint64_t(1) << fl;
+    ++mFreeBlockCount;
+}
+
+void usagi::VulkanTlsfAllocator::removeFree(const std::uint32_t index)
+{
+    auto &b = mBlocks[index];
+    assert(b.free);
+    std::uint32_t fl, sl;
+    mapping(b.size / mGranularity, fl, sl);
+
+    if(b.prev_free != NIL)
+        mBlocks[b.prev_free].next_free = b.next_free;
+    if(b.next_free != NIL)
+        mBlocks[b.next_free].prev_free = b.prev_free;
+
+    auto &head = mFreeLists[fl][sl];
+    if(head == index)
+    {
+        head = b.next_free;
+        if(head == NIL)
+        {
+            mSlBitmaps[fl] &= ~(1u << sl);
+            if(mSlBitmaps[fl] == 0)
+                mFlBitmap &= ~(std::uint64_t(1) << fl);
+        }
+    }
+    b.prev_free = b.next_free = NIL;
+    b.free = false;
+    --mFreeBlockCount;
+}
+
+std::uint32_t usagi::VulkanTlsfAllocator::split(
+    const std::uint32_t index,
+    const std::size_t size)
+{
+    const auto rest = newBlock();
+    // the reference is taken after newBlock() which may reallocate
+    auto &b = mBlocks[index];
+    auto &r = mBlocks[rest];
+    assert(size < b.size);
+
+    r.offset = b.offset + size;
+    r.size = b.size - size;
+    r.prev_phys = index;
+    r.next_phys = b.next_phys;
+    if(r.next_phys != NIL)
+        mBlocks[r.next_phys].prev_phys = rest;
+    b.size = size;
+    b.next_phys = rest;
+
+    return rest;
+}
+
+std::uint32_t usagi::VulkanTlsfAllocator::mergeWithNext(
+    const std::uint32_t index)
+{
+    auto &b = mBlocks[index];
+    const auto next = b.next_phys;
+    auto &n = mBlocks[next];
+
+    b.size += n.size;
+    b.next_phys = n.next_phys;
+    if(b.next_phys != NIL)
+        mBlocks[b.next_phys].prev_phys = index;
+    freeBlock(next);
+
+    return index;
+}
+
+void * usagi::VulkanTlsfAllocator::allocate(
+    const std::size_t size,
+    std::size_t alignment)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    const auto block_size = alignUp(std::max<std::size_t>(size, 1),
+        mGranularity);
+    alignment = std::max(alignment, mGranularity);
+    // reserve the space for moving the start of the block to the alignment
+    const auto search_size = block_size + alignment - mGranularity;
+
+    std::uint32_t fl, sl;
+    if(!findFreeList(search_size, fl, sl))
+        throw std::bad_alloc();
+
+    auto index = mFreeLists[fl][sl];
+    removeFree(index);
+
+    const auto offset = mBlocks[index].offset;
+    const auto padding = alignUp(offset, alignment) - offset;
+    if(padding > 0)
+    {
+        // the padding stays free
+        const auto aligned = split(index, padding);
+        insertFree(index);
+        index = aligned;
+    }
+    if(mBlocks[index].size > block_size)
+        insertFree(split(index, block_size));
+
+    const auto &b = mBlocks[index];
+    mAllocations.insert({ b.offset, { index, size } });
+    mUsedSize += b.size;
+    mRequestedSize += size;
+
+    return reinterpret_cast<void*>(mBase + b.offset);
+}
+
+void usagi::VulkanTlsfAllocator::deallocate(void *pointer)
+{
+    const auto offset = static_cast<std::size_t>(
+        reinterpret_cast<std::uintptr_t>(pointer) - mBase);
+    const auto iter = mAllocations.find(offset);
+    assert(iter != mAllocations.end());
+    if(iter == mAllocations.end()) return;
+
+    auto index = iter->second.block;
+    mUsedSize -= mBlocks[index].size;
+    mRequestedSize -= iter->second.requested_size;
+    mAllocations.erase(iter);
+
+    // coalesce with the neighbors. free blocks are never adjacent.
+    const auto next = mBlocks[index].next_phys;
+    if(next != NIL && mBlocks[next].free)
+    {
+        removeFree(next);
+        mergeWithNext(index);
+    }
+    const auto prev = mBlocks[index].prev_phys;
+    if(prev != NIL && mBlocks[prev].free)
+    {
+        removeFree(prev);
+        index = mergeWithNext(prev);
+    }
+    insertFree(index);
+}
+
+usagi::VulkanSubAllocatorStatistics
+    usagi::VulkanTlsfAllocator::statistics() const
+{
+    VulkanSubAllocatorStatistics stats;
+    stats.total_size = mTotalSize;
+    stats.used_size = mUsedSize;
+    stats.free_size = mTotalSize - mUsedSize;
+    stats.allocation_count = mAllocations.size();
+    stats.free_block_count = mFreeBlockCount;
+    stats.wasted_size = mUsedSize - mRequestedSize;
+
+    // the largest block is in the highest non-empty list
+    if(mFlBitmap != 0)
+    {
+        const auto fl = highestBit(mFlBitmap);
+        const auto sl = highestBit(mSlBitmaps[fl]);
+        for(auto i = mFreeLists[fl][sl]; i != NIL; i = mBlocks[i].next_free)
+        {
+            stats.largest_free_block = std::max(
+                stats.largest_free_block, mBlocks[i].size);
+        }
+    }
+
+    return stats;
+}
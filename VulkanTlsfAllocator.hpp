@@ -0,0 +1,92 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "VulkanSubAllocator.hpp"
+
+namespace usagi
+{
+/**
+ * \brief Two-Level Segregated Fit allocator. The free blocks are bucketed by
+ * the position of the highest bit of their size and the next SL_BITS bits,
+ * so a block at least as large as the request can be found with two bit
+ * scans. Adjacent free blocks are merged on deallocation.
+ *
+ * The block metadata is kept outside of the managed memory since it is
+ * usually not accessible by the host.
+ */
+class VulkanTlsfAllocator : public VulkanSubAllocator
+{
+    static constexpr std::uint32_t SL_BITS = 4;
+    static constexpr std::uint32_t SL_COUNT = 1u << SL_BITS;
+    static constexpr std::uint32_t FL_COUNT = 64 - SL_BITS + 1;
+    static constexpr std::uint32_t NIL = static_cast<std::uint32_t>(-1);
+
+    struct Block
+    {
+        std::size_t offset = 0;
+        std::size_t size = 0;
+        // neighbors by address
+        std::uint32_t prev_phys = NIL, next_phys = NIL;
+        // neighbors in the free list
+        std::uint32_t prev_free = NIL, next_free = NIL;
+        bool free = false;
+    };
+
+    const std::uintptr_t mBase;
+    const std::size_t mTotalSize;
+    const std::size_t mGranularity;
+
+    std::vector<Block> mBlocks;
+    std::vector<std::uint32_t> mUnusedBlocks;
+
+    std::uint64_t mFlBitmap = 0;
+    std::uint32_t mSlBitmaps[FL_COUNT] { };
+    std::uint32_t mFreeLists[FL_COUNT][SL_COUNT];
+
+    struct Allocation
+    {
+        std::uint32_t block;
+        std::size_t requested_size;
+    };
+    // allocation offset -> block
+    std::unordered_map<std::size_t, Allocation> mAllocations;
+
+    std::size_t mUsedSize = 0;
+    std::size_t mRequestedSize = 0;
+    std::size_t mFreeBlockCount = 0;
+
+    void mapping(std::size_t units, std::uint32_t &fl, std::uint32_t &sl) const;
+    bool findFreeList(std::size_t size, std::uint32_t &fl, std::uint32_t &sl)
+        const;
+
+    std::uint32_t newBlock();
+    void freeBlock(std::uint32_t index);
+
+    void insertFree(std::uint32_t index);
+    void removeFree(std::uint32_t index);
+    /**
+     * \brief Shrink the block to size and return a new block holding the rest
+     * of it.
+     */
+    std::uint32_t split(std::uint32_t index, std::size_t size);
+    std::uint32_t mergeWithNext(std::uint32_t index);
+
+public:
+    /**
+     * \param granularity Must be a power of two.
+     */
+    VulkanTlsfAllocator(
+        void *base,
+        std::size_t total_size,
+        std::size_t granularity);
+
+    void * allocate(std::size_t size, std::size_t alignment = 1) override;
+    void deallocate(void *pointer) override;
+
+    std::size_t usedSize() const override { return mUsedSize; }
+    VulkanSubAllocatorStatistics statistics() const override;
+};
+}
@@ -0,0 +1,120 @@
+﻿#include "VulkanTransientBuffer.hpp"
+
+#include <algorithm>
+#include <new>
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Core/Logging.hpp>
+
+#include "VulkanGpuDevice.hpp"
+#include "VulkanHelper.hpp"
+
+using namespace usagi::vulkan;
+
+namespace
+{
+std::size_t regionAlignment(const vk::PhysicalDeviceLimits &limits)
+{
+    return static_cast<std::size_t>(std::max(
+        limits.nonCoherentAtomSize, limits.minUniformBufferOffsetAlignment));
+}
+}
+
+usagi::VulkanTransientBuffer::VulkanTransientBuffer(
+    VulkanGpuDevice *device,
+    const std::size_t region_size,
+    const std::size_t region_count)
+    : VulkanMemoryPool(device)
+    , mRegionSize(alignUp(region_size, regionAlignment(
+        device->capabilities()->limits())))
+{
+    const auto &limits = mDevice->capabilities()->limits();
+    mNonCoherentAtomSize =
+        static_cast<std::size_t>(limits.nonCoherentAtomSize);
+    mUniformAlignment =
+        static_cast<std::size_t>(limits.minUniformBufferOffsetAlignment);
+
+    allocateDeviceMemoryForBuffer(
+        mRegionSize * region_count,
+        vk::MemoryPropertyFlagBits::eHostVisible,
+        vk::MemoryPropertyFlagBits::eDeviceLocal |
+        vk::MemoryPropertyFlagBits::eHostCoherent,
+        vk::BufferUsageFlagBits::eVertexBuffer |
+        vk::BufferUsageFlagBits::eIndexBuffer |
+        vk::BufferUsageFlagBits::eUniformBuffer |
+        vk::BufferUsageFlagBits::eStorageBuffer |
+        vk::BufferUsageFlagBits::eIndirectBuffer,
+        mBuffer
+    );
+    mCoherent = static_cast<bool>(
+        device->memoryBudget()->properties().memoryTypes[mMemoryType]
+            .propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent);
+}
+
+usagi::VulkanTransientBuffer::~VulkanTransientBuffer()
+{
+    mDevice->descriptorSetCache()->evict(handleValue(mBuffer.get()));
+}
+
+void usagi::VulkanTransientBuffer::beginFrame(const std::size_t frame_index)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mRegionBegin = mRegionSize * frame_index;
+    mCursor = mRegionBegin;
+    mFlushedCursor = mRegionBegin;
+}
+
+usagi::VulkanTransientAllocation usagi::VulkanTransientBuffer::allocate(
+    const std::size_t size,
+    const std::size_t alignment)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    const auto offset = alignUp(mCursor, alignment);
+    if(offset + size > mRegionBegin + mRegionSize)
+    {
+        lock.unlock();
+        LOG(warn, "The transient buffer region of {} bytes is exhausted, "
+            "increase VulkanGpuDeviceConfig::transient_buffer_size.",
+            mRegionSize);
+        USAGI_THROW(std::bad_alloc());
+    }
+    mCursor = offset + size;
+    lock.unlock();
+
+    VulkanTransientAllocation allocation;
+    allocation.buffer = mBuffer.get();
+    allocation.offset = offset;
+    allocation.size = size;
+    allocation.mapped_address = mMappedMemory + offset;
+    return allocation;
+}
+
+usagi::VulkanTransientAllocation usagi::VulkanTransientBuffer::allocateUniform(
+    const std::size_t size)
+{
+    return allocate(size, mUniformAlignment);
+}
+
+void usagi::VulkanTransientBuffer::flush()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(mCoherent || mCursor == mFlushedCursor) return;
+
+    // the range must be aligned to nonCoherentAtomSize unless it reaches the
+    // end of the memory
+    const auto begin =
+        mFlushedCursor / mNonCoherentAtomSize * mNonCoherentAtomSize;
+    const auto end = std::min<std::size_t>(
+        alignUp(mCursor, mNonCoherentAtomSize), mMemoryRequirements.size);
+
+    vk::MappedMemoryRange range;
+    range.setMemory(mMemory.get());
+    range.setOffset(begin);
+    if(end == mMemoryRequirements.size)
+        range.setSize(VK_WHOLE_SIZE);
+    else
+        range.setSize(end - begin);
+    mDevice->device().flushMappedMemoryRanges({ range });
+
+    mFlushedCursor = mCursor;
+}
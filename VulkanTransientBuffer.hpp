@@ -0,0 +1,89 @@
+﻿#pragma once
+
+#include <mutex>
+
+#include <vulkan/vulkan.hpp>
+
+#include "VulkanMemoryPool.hpp"
+
+namespace usagi
+{
+/**
+ * \brief A region of the transient buffer. Only valid during the frame it is
+ * allocated in.
+ */
+struct VulkanTransientAllocation
+{
+    vk::Buffer buffer;
+    std::size_t offset = 0;
+    std::size_t size = 0;
+    void *mapped_address = nullptr;
+
+    explicit operator bool() const { return size != 0; }
+};
+
+/**
+ * \brief A persistently mapped host-visible buffer divided into one region
+ * per frame in flight, used for the data rewritten every frame such as UI
+ * vertices and per-draw uniforms.
+ *
+ * Allocating only bumps the cursor of the region of the current frame. The
+ * allocations are not reference-counted; the whole region is reclaimed when
+ * its frame context is reused, after the GPU finished the work of the frame.
+ * The cursor is guarded by a mutex since the secondary command lists of a
+ * frame may be recorded by several threads.
+ */
+class VulkanTransientBuffer : public VulkanMemoryPool
+{
+    vk::UniqueBuffer mBuffer;
+    const std::size_t mRegionSize;
+    std::size_t mRegionBegin = 0;
+    std::size_t mCursor = 0;
+    // the cursor when the region was last flushed
+    std::size_t mFlushedCursor = 0;
+    std::mutex mMutex;
+
+    bool mCoherent = false;
+    std::size_t mNonCoherentAtomSize = 1;
+    std::size_t mUniformAlignment = 1;
+
+public:
+    VulkanTransientBuffer(
+        VulkanGpuDevice *device,
+        std::size_t region_size,
+        std::size_t region_count);
+    ~VulkanTransientBuffer();
+
+    /**
+     * \brief Start allocating from the region of the frame context. The GPU
+     * must have finished using the region.
+     */
+    void beginFrame(std::size_t frame_index);
+
+    /**
+     * \brief Throws std::bad_alloc if the region of the current frame is
+     * exhausted.
+     */
+    VulkanTransientAllocation allocate(
+        std::size_t size,
+        std::size_t alignment);
+    /**
+     * \brief Allocate with the alignment required for dynamic uniform buffer
+     * offsets.
+     */
+    VulkanTransientAllocation allocateUniform(std::size_t size);
+
+    /**
+     * \brief Make the writes to the allocations since the last flush visible
+     * to the device. Called before submitting the graphics jobs.
+     */
+    void flush();
+
+    // the regions are reclaimed as a whole
+    void deallocate(std::size_t offset) override { }
+
+    vk::Buffer buffer() const { return mBuffer.get(); }
+    std::size_t regionSize() const { return mRegionSize; }
+    std::size_t usedSize() const { return mCursor - mRegionBegin; }
+};
+}
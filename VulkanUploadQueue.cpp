@@ -0,0 +1,761 @@
+﻿#include "VulkanUploadQueue.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Core/Logging.hpp>
+
+#include "VulkanFormatInfo.hpp"
+#include "VulkanGpuDevice.hpp"
+#include "VulkanGpuProfiler.hpp"
+#include "VulkanBufferAllocation.hpp"
+#include "VulkanMemoryPool.hpp"
+#include "VulkanSemaphore.hpp"
+
+/**
+ * \brief Owns the command buffers of a submitted batch and marks the batch
+ * as completed when the device releases it.
+ */
+class usagi::VulkanUploadQueue::Batch : public VulkanBatchResource
+{
+    VulkanUploadQueue *mQueue;
+    vk::UniqueCommandBuffer mCopyCommandBuffer;
+    vk::UniqueCommandBuffer mAcquireCommandBuffer;
+    const Token mToken;
+
+public:
+    Batch(
+        VulkanUploadQueue *queue,
+        vk::UniqueCommandBuffer copy_command_buffer,
+        vk::UniqueCommandBuffer acquire_command_buffer,
+        const Token token)
+        : mQueue(queue)
+        , mCopyCommandBuffer(std::move(copy_command_buffer))
+        , mAcquireCommandBuffer(std::move(acquire_command_buffer))
+        , mToken(token)
+    {
+    }
+
+    ~Batch()
+    {
+        mQueue->mCompletedToken = std::max(mQueue->mCompletedToken, mToken);
+    }
+};
+
+usagi::VulkanUploadQueue::VulkanUploadQueue(VulkanGpuDevice *device)
+    : mDevice(device)
+{
+    vk::CommandPoolCreateInfo info;
+    info.setQueueFamilyIndex(mDevice->transferQueueFamily());
+    info.setFlags(vk::CommandPoolCreateFlagBits::eTransient);
+    mCommandPool = mDevice->device().createCommandPoolUnique(info);
+
+    if(mDevice->hasDedicatedTransferQueue())
+    {
+        info.setQueueFamilyIndex(mDevice->graphicsQueueFamily());
+        mAcquireCommandPool = mDevice->device().createCommandPoolUnique(info);
+    }
+}
+
+namespace
+{
+bool coversSubresource(
+    const vk::ImageMemoryBarrier &barrier,
+    const vk::Image image,
+    const std::uint32_t mip,
+    const std::uint32_t layer)
+{
+    return barrier.image == image &&
+        barrier.subresourceRange.baseMipLevel == mip &&
+        barrier.subresourceRange.baseArrayLayer == layer;
+}
+
+vk::ImageSubresourceRange subresourceRange(
+    const std::uint32_t mip,
+    const std::uint32_t layer)
+{
+    vk::ImageSubresourceRange range;
+    range.setAspectMask(vk::ImageAspectFlagBits::eColor);
+    range.setBaseArrayLayer(layer);
+    range.setLayerCount(1);
+    range.setBaseMipLevel(mip);
+    range.setLevelCount(1);
+    return range;
+}
+
+void setShaderReadState(usagi::VulkanImageSubresourceState &state)
+{
+    // the post barrier makes the copy visible to the fragment shaders.
+    // other stages still have to wait for it.
+    state.layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    state.stages = vk::PipelineStageFlagBits::eFragmentShader;
+    state.access = { };
+    state.read_stages = vk::PipelineStageFlagBits::eFragmentShader;
+}
+}
+
+vk::ImageMemoryBarrier * usagi::VulkanUploadQueue::findPostBarrier(
+    const vk::Image image,
+    const std::uint32_t mip,
+    const std::uint32_t layer)
+{
+    const auto iter = std::find_if(
+        mPostBarriers.begin(), mPostBarriers.end(),
+        [&](auto &&b) { return coversSubresource(b, image, mip, layer); });
+    return iter == mPostBarriers.end() ? nullptr : &*iter;
+}
+
+void usagi::VulkanUploadQueue::addImageBarriers(
+    VulkanGpuImage *image,
+    const std::uint32_t mip,
+    const std::uint32_t layer,
+    const bool discard)
+{
+    const auto vk_image = image->image();
+
+    // only transit each subresource once in a batch
+    if(const auto post = findPostBarrier(vk_image, mip, layer))
+    {
+        assert(post->oldLayout == vk::ImageLayout::eTransferDstOptimal);
+        return;
+    }
+
+    const auto range = subresourceRange(mip, layer);
+
+    // discarding the old content only skips the layout transition. the
+    // earlier accesses must still finish before the copy overwrites it.
+    auto &state = image->subresourceState(mip, layer);
+    vk::ImageMemoryBarrier pre;
+    pre.setImage(vk_image);
+    pre.setOldLayout(discard
+        ? vk::ImageLayout::eUndefined
+        : state.layout);
+    if(state.layout != vk::ImageLayout::eUndefined ||
+        state.stages || state.read_stages)
+    {
+        pre.setSrcAccessMask(state.access);
+        mPreSrcStages |= state.stages | state.read_stages;
+        mAccessedBefore = true;
+    }
+    pre.setNewLayout(vk::ImageLayout::eTransferDstOptimal);
+    pre.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    pre.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    pre.setDstAccessMask(vk::AccessFlagBits::eTransferWrite);
+    pre.setSubresourceRange(range);
+    mPreBarriers.push_back(pre);
+
+    // when the queue families are different, this barrier is split into
+    // a release on the transfer queue and an acquire on the graphics queue.
+    vk::ImageMemoryBarrier post;
+    post.setImage(vk_image);
+    post.setOldLayout(vk::ImageLayout::eTransferDstOptimal);
+    post.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+    post.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    post.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    post.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
+    post.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+    post.setSubresourceRange(range);
+    mPostBarriers.push_back(post);
+
+    setShaderReadState(state);
+}
+
+void usagi::VulkanUploadQueue::addSourceBarriers(
+    VulkanGpuImage *image,
+    const std::uint32_t mip,
+    const std::uint32_t layer)
+{
+    const auto vk_image = image->image();
+
+    if(const auto post = findPostBarrier(vk_image, mip, layer))
+    {
+        assert(post->oldLayout == vk::ImageLayout::eTransferSrcOptimal);
+        return;
+    }
+
+    const auto range = subresourceRange(mip, layer);
+
+    // the content is always preserved, so the batch is executed on the
+    // graphics queue which owns the image.
+    auto &state = image->subresourceState(mip, layer);
+    vk::ImageMemoryBarrier pre;
+    pre.setImage(vk_image);
+    pre.setOldLayout(state.layout);
+    pre.setNewLayout(vk::ImageLayout::eTransferSrcOptimal);
+    pre.setSrcAccessMask(state.access);
+    pre.setDstAccessMask(vk::AccessFlagBits::eTransferRead);
+    pre.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    pre.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    pre.setSubresourceRange(range);
+    mPreBarriers.push_back(pre);
+    mPreSrcStages |= state.stages | state.read_stages;
+    mAccessedBefore = true;
+
+    vk::ImageMemoryBarrier post;
+    post.setImage(vk_image);
+    post.setOldLayout(vk::ImageLayout::eTransferSrcOptimal);
+    post.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+    post.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    post.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    post.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+    post.setSubresourceRange(range);
+    mPostBarriers.push_back(post);
+
+    setShaderReadState(state);
+}
+
+usagi::VulkanUploadQueue::Token usagi::VulkanUploadQueue::copyBufferToImage(
+    const std::shared_ptr<VulkanBufferAllocation> &buffer,
+    VulkanGpuImage *image,
+    const Vector2i &offset,
+    const Vector2u32 &size,
+    const std::uint32_t mip,
+    const std::uint32_t layer)
+{
+    vk::BufferImageCopy region;
+    region.setImageExtent({ size.x(), size.y(), 1 });
+    region.setImageOffset({ offset.x(), offset.y(), 0 });
+    region.imageSubresource.setAspectMask(vk::ImageAspectFlagBits::eColor);
+    region.imageSubresource.setLayerCount(1);
+    region.imageSubresource.setBaseArrayLayer(layer);
+    region.imageSubresource.setMipLevel(mip);
+    return copyBufferToImage(buffer, image, region);
+}
+
+usagi::VulkanUploadQueue::Token usagi::VulkanUploadQueue::copyBufferToImage(
+    const std::shared_ptr<VulkanBufferAllocation> &buffer,
+    VulkanGpuImage *image,
+    const vk::BufferImageCopy &region)
+{
+    using namespace vulkan;
+
+    const auto &sub = region.imageSubresource;
+    const auto mip = sub.mipLevel;
+    assert(mip < image->mipLevels());
+    assert(sub.baseArrayLayer + sub.layerCount <= image->arrayLayers());
+
+    const auto &image_size = image->size();
+    const auto &offset = region.imageOffset;
+    const auto &extent = region.imageExtent;
+    const auto discard = offset.x == 0 && offset.y == 0 &&
+        extent.width >= mipExtent(image_size.x(), mip) &&
+        extent.height >= mipExtent(image_size.y(), mip);
+    for(auto layer = sub.baseArrayLayer;
+        layer < sub.baseArrayLayer + sub.layerCount; ++layer)
+        addImageBarriers(image, mip, layer, discard);
+
+    ImageCopy copy;
+    copy.buffer = buffer->pool()->buffer();
+    copy.image = image->image();
+    copy.region = region;
+    copy.region.setBufferOffset(buffer->offset() + region.bufferOffset);
+    mCopies.push_back(copy);
+
+    mResources.push_back(buffer);
+    mResources.push_back(image->shared_from_this());
+
+    return mPendingToken;
+}
+
+usagi::VulkanUploadQueue::Token usagi::VulkanUploadQueue::streamToImage(
+    VulkanGpuImage *image,
+    const std::uint32_t mip,
+    const std::uint32_t layer,
+    const VulkanUploadReader &reader)
+{
+    using namespace vulkan;
+
+    assert(mip < image->mipLevels());
+    assert(layer < image->arrayLayers());
+
+    const auto &config = mDevice->config();
+    const auto block = formatBlock(image->imageFormat());
+    if(block.size == 0)
+    {
+        LOG(error, "Can't stream to an image of format {}",
+            vk::to_string(image->imageFormat()));
+        USAGI_THROW(std::runtime_error("Unsupported image format."));
+    }
+    const auto width = mipExtent(image->size().x(), mip);
+    const auto height = mipExtent(image->size().y(), mip);
+    const auto blocks_x = (width + block.width - 1) / block.width;
+    const auto blocks_y = (height + block.height - 1) / block.height;
+    const std::size_t row_size = std::size_t { blocks_x } * block.size;
+    const auto rows_per_chunk = static_cast<std::uint32_t>(std::clamp<
+        std::size_t>(config.upload_chunk_size / row_size, 1, blocks_y));
+
+    // the bands together replace the subresource. if the queue is flushed
+    // in between, the next batch preserves the bands already copied.
+    addImageBarriers(image, mip, layer, true);
+
+    for(std::uint32_t row = 0; row < blocks_y; row += rows_per_chunk)
+    {
+        const auto rows = std::min(rows_per_chunk, blocks_y - row);
+        const auto size = rows * row_size;
+        const auto buffer = mDevice->allocateStageBuffer(size);
+        reader(row * row_size, buffer->mappedAddress(), size);
+
+        const auto y = row * block.height;
+        vk::BufferImageCopy region;
+        region.setBufferRowLength(blocks_x * block.width);
+        region.setBufferImageHeight(rows * block.height);
+        region.setImageOffset({ 0, static_cast<std::int32_t>(y), 0 });
+        region.setImageExtent({
+            width, std::min(rows * block.height, height - y), 1 });
+        region.imageSubresource.setAspectMask(
+            vk::ImageAspectFlagBits::eColor);
+        region.imageSubresource.setLayerCount(1);
+        region.imageSubresource.setBaseArrayLayer(layer);
+        region.imageSubresource.setMipLevel(mip);
+        copyBufferToImage(buffer, image, region);
+
+        // double buffer the staging window: one half is being copied by
+        // the GPU while the other is filled.
+        mStreamedSize += size;
+        if(mStreamedSize >= config.max_streaming_staging_size / 2)
+        {
+            const auto previous = mLastSerial;
+            flush();
+            if(previous)
+            {
+                mDevice->submissionTimeline()->wait(previous);
+                mDevice->reclaimResources();
+            }
+        }
+    }
+
+    return mPendingToken;
+}
+
+usagi::VulkanUploadQueue::Token usagi::VulkanUploadQueue::copyImage(
+    VulkanGpuImage *src,
+    const std::uint32_t src_mip,
+    VulkanGpuImage *dst,
+    const std::uint32_t dst_mip)
+{
+    using namespace vulkan;
+
+    assert(src != dst);
+    assert(src->arrayLayers() == dst->arrayLayers());
+    const auto width = mipExtent(src->size().x(), src_mip);
+    const auto height = mipExtent(src->size().y(), src_mip);
+    assert(width == mipExtent(dst->size().x(), dst_mip));
+    assert(height == mipExtent(dst->size().y(), dst_mip));
+
+    // the image copies are recorded before the other copies, so the source
+    // written by the batch is copied in the next one.
+    for(std::uint32_t layer = 0; layer < src->arrayLayers(); ++layer)
+    {
+        const auto post = findPostBarrier(src->image(), src_mip, layer);
+        if(post && post->oldLayout == vk::ImageLayout::eTransferDstOptimal)
+        {
+            flush();
+            break;
+        }
+    }
+
+    for(std::uint32_t layer = 0; layer < src->arrayLayers(); ++layer)
+    {
+        addSourceBarriers(src, src_mip, layer);
+        addImageBarriers(dst, dst_mip, layer, true);
+    }
+
+    ImageToImageCopy copy;
+    copy.src = src->image();
+    copy.dst = dst->image();
+    copy.region.srcSubresource.setAspectMask(vk::ImageAspectFlagBits::eColor);
+    copy.region.srcSubresource.setMipLevel(src_mip);
+    copy.region.srcSubresource.setBaseArrayLayer(0);
+    copy.region.srcSubresource.setLayerCount(src->arrayLayers());
+    copy.region.dstSubresource = copy.region.srcSubresource;
+    copy.region.dstSubresource.setMipLevel(dst_mip);
+    copy.region.setExtent({ width, height, 1 });
+    mImageCopies.push_back(copy);
+
+    mResources.push_back(src->shared_from_this());
+    mResources.push_back(dst->shared_from_this());
+
+    return mPendingToken;
+}
+
+usagi::VulkanUploadQueue::Token usagi::VulkanUploadQueue::generateMipmaps(
+    VulkanGpuImage *image,
+    const std::uint32_t base_mip)
+{
+    if(base_mip + 1 >= image->mipLevels())
+        return mPendingToken;
+
+    const auto format = image->imageFormat();
+    const auto caps = mDevice->capabilities();
+    if(!caps->supportsOptimalTiling(format,
+        vk::FormatFeatureFlagBits::eBlitSrc |
+        vk::FormatFeatureFlagBits::eBlitDst))
+    {
+        LOG(error, "Format {} does not support blits, can't generate mips.",
+            vk::to_string(format));
+        USAGI_THROW(std::runtime_error("Unsupported mip generation."));
+    }
+    const auto filter = caps->supportsOptimalTiling(format,
+        vk::FormatFeatureFlagBits::eSampledImageFilterLinear)
+        ? vk::Filter::eLinear : vk::Filter::eNearest;
+
+    // the base level is read in place, so all the levels of the chain are
+    // written by the batch.
+    const auto iter = std::find_if(
+        mMipGenerations.begin(), mMipGenerations.end(),
+        [&](auto &&g) { return g.image == image; });
+    if(iter != mMipGenerations.end())
+    {
+        iter->base_mip = std::min(iter->base_mip, base_mip);
+    }
+    else
+    {
+        mMipGenerations.push_back({ image, base_mip, filter });
+        mResources.push_back(image->shared_from_this());
+    }
+    for(std::uint32_t layer = 0; layer < image->arrayLayers(); ++layer)
+    {
+        addImageBarriers(image, base_mip, layer, false);
+        for(auto mip = base_mip + 1; mip < image->mipLevels(); ++mip)
+            addImageBarriers(image, mip, layer, true);
+    }
+
+    return mPendingToken;
+}
+
+usagi::VulkanUploadQueue::Token usagi::VulkanUploadQueue::copyBuffer(
+    const std::shared_ptr<VulkanBufferAllocation> &src,
+    const std::shared_ptr<VulkanBufferAllocation> &dst)
+{
+    assert(src->size() <= dst->size());
+
+    BufferCopy copy;
+    copy.src = src->pool()->buffer();
+    copy.dst = dst->pool()->buffer();
+    copy.region.setSrcOffset(src->offset());
+    copy.region.setDstOffset(dst->offset());
+    copy.region.setSize(src->size());
+    mBufferCopies.push_back(copy);
+
+    mResources.push_back(src);
+    mResources.push_back(dst);
+
+    return mPendingToken;
+}
+
+vk::PipelineStageFlags usagi::VulkanUploadQueue::consumerStages() const
+{
+    vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eFragmentShader;
+    // indirect arguments, vertex, index, uniform and storage buffers,
+    // including the ones read by the compute jobs on the graphics queue
+    if(!mBufferCopies.empty())
+    {
+        stages |= vk::PipelineStageFlagBits::eDrawIndirect |
+            vk::PipelineStageFlagBits::eVertexInput |
+            vk::PipelineStageFlagBits::eVertexShader |
+            vk::PipelineStageFlagBits::eComputeShader;
+    }
+    return stages;
+}
+
+void usagi::VulkanUploadQueue::recordBufferCopies(const vk::CommandBuffer cmd)
+{
+    std::stable_sort(mBufferCopies.begin(), mBufferCopies.end(),
+        [](auto &&l, auto &&r) {
+            return std::make_pair(l.src, l.dst) <
+                std::make_pair(r.src, r.dst);
+        }
+    );
+    for(auto i = mBufferCopies.begin(); i != mBufferCopies.end();)
+    {
+        mBufferRegions.clear();
+        auto j = i;
+        for(; j != mBufferCopies.end() &&
+            j->src == i->src && j->dst == i->dst; ++j)
+            mBufferRegions.push_back(j->region);
+
+        cmd.copyBuffer(i->src, i->dst, mBufferRegions);
+        i = j;
+    }
+}
+
+void usagi::VulkanUploadQueue::recordCopies(const vk::CommandBuffer cmd)
+{
+    // group the copies so that regions of the same image are copied using
+    // a single command. the order of copies to the same image is preserved.
+    std::stable_sort(mCopies.begin(), mCopies.end(),
+        [](auto &&l, auto &&r) {
+            return std::make_pair(l.image, l.buffer) <
+                std::make_pair(r.image, r.buffer);
+        }
+    );
+    for(auto i = mCopies.begin(); i != mCopies.end();)
+    {
+        mRegions.clear();
+        auto j = i;
+        for(; j != mCopies.end() &&
+            j->image == i->image && j->buffer == i->buffer; ++j)
+            mRegions.push_back(j->region);
+
+        cmd.copyBufferToImage(
+            i->buffer, i->image,
+            vk::ImageLayout::eTransferDstOptimal, mRegions);
+        i = j;
+    }
+}
+
+void usagi::VulkanUploadQueue::recordImageCopies(const vk::CommandBuffer cmd)
+{
+    for(auto &&c : mImageCopies)
+    {
+        cmd.copyImage(
+            c.src, vk::ImageLayout::eTransferSrcOptimal,
+            c.dst, vk::ImageLayout::eTransferDstOptimal,
+            { c.region });
+    }
+}
+
+void usagi::VulkanUploadQueue::recordMipGenerations(const vk::CommandBuffer cmd)
+{
+    using namespace vulkan;
+
+    for(auto &&g : mMipGenerations)
+    {
+        const auto vk_image = g.image->image();
+        const auto layers = g.image->arrayLayers();
+        const auto &size = g.image->size();
+
+        vk::ImageMemoryBarrier barrier;
+        barrier.setImage(vk_image);
+        barrier.setOldLayout(vk::ImageLayout::eTransferDstOptimal);
+        barrier.setNewLayout(vk::ImageLayout::eTransferSrcOptimal);
+        barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
+        barrier.setDstAccessMask(vk::AccessFlagBits::eTransferRead);
+        barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+        barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+        barrier.subresourceRange = subresourceRange(0, 0);
+        barrier.subresourceRange.setLayerCount(layers);
+
+        for(auto mip = g.base_mip; mip + 1 < g.image->mipLevels(); ++mip)
+        {
+            // the level was written by the copies or the last blit
+            barrier.subresourceRange.setBaseMipLevel(mip);
+            cmd.pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eTransfer,
+                { }, { }, { }, { barrier });
+
+            vk::ImageBlit blit;
+            blit.srcSubresource.setAspectMask(
+                vk::ImageAspectFlagBits::eColor);
+            blit.srcSubresource.setMipLevel(mip);
+            blit.srcSubresource.setBaseArrayLayer(0);
+            blit.srcSubresource.setLayerCount(layers);
+            blit.srcOffsets[1] = vk::Offset3D(
+                mipExtent(size.x(), mip), mipExtent(size.y(), mip), 1);
+            blit.dstSubresource = blit.srcSubresource;
+            blit.dstSubresource.setMipLevel(mip + 1);
+            blit.dstOffsets[1] = vk::Offset3D(
+                mipExtent(size.x(), mip + 1), mipExtent(size.y(), mip + 1), 1);
+            cmd.blitImage(
+                vk_image, vk::ImageLayout::eTransferSrcOptimal,
+                vk_image, vk::ImageLayout::eTransferDstOptimal,
+                { blit }, g.filter);
+
+            // the read level leaves the batch from the source layout
+            for(std::uint32_t layer = 0; layer < layers; ++layer)
+            {
+                const auto post = findPostBarrier(vk_image, mip, layer);
+                assert(post);
+                post->setOldLayout(vk::ImageLayout::eTransferSrcOptimal);
+                post->setSrcAccessMask({ });
+            }
+        }
+    }
+}
+
+vk::UniqueCommandBuffer usagi::VulkanUploadQueue::beginCommandBuffer(
+    const vk::Device device,
+    const vk::CommandPool pool)
+{
+    vk::UniqueCommandBuffer cmd;
+    {
+        vk::CommandBufferAllocateInfo info;
+        info.setCommandBufferCount(1);
+        info.setCommandPool(pool);
+        info.setLevel(vk::CommandBufferLevel::ePrimary);
+
+        cmd = std::move(device.allocateCommandBuffersUnique(info).front());
+    }
+    {
+        vk::CommandBufferBeginInfo info;
+        info.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+        cmd->begin(info);
+    }
+    return std::move(cmd);
+}
+
+void usagi::VulkanUploadQueue::submitOnGraphicsQueue(
+    vk::UniqueCommandBuffer cmd)
+{
+    // the buffer accesses are only supported by the stages consuming the
+    // buffers, which are only included if buffers are copied
+    std::vector<vk::MemoryBarrier> buffer_barriers;
+    if(!mBufferCopies.empty())
+    {
+        vk::MemoryBarrier buffer_barrier;
+        buffer_barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
+        buffer_barrier.setDstAccessMask(
+            vk::AccessFlagBits::eIndirectCommandRead |
+            vk::AccessFlagBits::eVertexAttributeRead |
+            vk::AccessFlagBits::eIndexRead |
+            vk::AccessFlagBits::eUniformRead |
+            vk::AccessFlagBits::eShaderRead);
+        buffer_barriers.push_back(buffer_barrier);
+    }
+    cmd->pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        consumerStages(),
+        { },
+        buffer_barriers,
+        { },
+        mPostBarriers);
+    cmd->end();
+
+    const auto cmd_handle = cmd.get();
+    vk::SubmitInfo info;
+    info.setCommandBufferCount(1);
+    info.setPCommandBuffers(&cmd_handle);
+
+    mResources.push_back(std::make_shared<Batch>(
+        this, std::move(cmd), vk::UniqueCommandBuffer { }, mPendingToken));
+    mLastSerial = mDevice->submitBatch(
+        mDevice->graphicsQueue(), info, std::move(mResources));
+}
+
+void usagi::VulkanUploadQueue::submitOnTransferQueue(
+    vk::UniqueCommandBuffer cmd)
+{
+    // release the ownership of the images. the access masks of the
+    // destination stages are ignored. the images shared concurrently are
+    // only transitioned by the acquire barriers after the semaphore.
+    if(!mDevice->sharesImagesConcurrently())
+    {
+        for(auto &&b : mPostBarriers)
+        {
+            b.setSrcQueueFamilyIndex(mDevice->transferQueueFamily());
+            b.setDstQueueFamilyIndex(mDevice->graphicsQueueFamily());
+            b.setDstAccessMask({ });
+        }
+        cmd->pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eBottomOfPipe,
+            { }, { }, { }, mPostBarriers);
+    }
+    cmd->end();
+
+    // acquire the ownership on the graphics queue after the transfer queue
+    // signals the semaphore. the source stage matches the wait stage of the
+    // semaphore to form a dependency chain, which also orders the later
+    // submissions reading the buffers after the copies.
+    const auto wait_stages = consumerStages();
+    auto acquire_cmd = beginCommandBuffer(
+        mDevice->device(), mAcquireCommandPool.get());
+    for(auto &&b : mPostBarriers)
+    {
+        b.setSrcAccessMask({ });
+        b.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+    }
+    acquire_cmd->pipelineBarrier(
+        wait_stages,
+        wait_stages,
+        { }, { }, { }, mPostBarriers);
+    acquire_cmd->end();
+
+    auto sem = mDevice->createSemaphore();
+    const auto vk_sem = static_cast<VulkanSemaphore&>(*sem).semaphore();
+    {
+        const auto cmd_handle = cmd.get();
+        vk::SubmitInfo info;
+        info.setCommandBufferCount(1);
+        info.setPCommandBuffers(&cmd_handle);
+        info.setSignalSemaphoreCount(1);
+        info.setPSignalSemaphores(&vk_sem);
+        // no fence is needed. the fence of the acquire submission can only
+        // be signaled after this one completes.
+        mDevice->transferQueue().submit({ info }, { });
+    }
+    {
+        const auto cmd_handle = acquire_cmd.get();
+        vk::SubmitInfo info;
+        info.setCommandBufferCount(1);
+        info.setPCommandBuffers(&cmd_handle);
+        info.setWaitSemaphoreCount(1);
+        info.setPWaitSemaphores(&vk_sem);
+        info.setPWaitDstStageMask(&wait_stages);
+
+        mResources.push_back(std::make_shared<Batch>(
+            this, std::move(cmd), std::move(acquire_cmd), mPendingToken));
+        mResources.push_back(std::static_pointer_cast<VulkanSemaphore>(sem));
+        mLastSerial = mDevice->submitBatch(
+            mDevice->graphicsQueue(), info, std::move(mResources));
+    }
+}
+
+void usagi::VulkanUploadQueue::flush()
+{
+    if(empty()) return;
+
+    // only the batches writing never accessed subresources go to the
+    // transfer queue, which is not ordered with the graphics work using the
+    // others. the images are owned by the graphics queue family and the
+    // acquire pool belongs to it too. blits need a graphics queue.
+    const auto on_transfer_queue =
+        mDevice->hasDedicatedTransferQueue() && !mAccessedBefore &&
+        mMipGenerations.empty();
+    const auto pool = mAcquireCommandPool && !on_transfer_queue
+        ? mAcquireCommandPool.get() : mCommandPool.get();
+
+    auto cmd = beginCommandBuffer(mDevice->device(), pool);
+    // the scope is invalid on a transfer-only family
+    const auto profiler = mDevice->gpuProfiler();
+    const auto scope = profiler
+        ? profiler->beginScope(cmd.get(), "Upload",
+            on_transfer_queue
+                ? mDevice->transferQueueFamily()
+                : mDevice->graphicsQueueFamily(),
+            on_transfer_queue ? "Transfer" : "Graphics")
+        : VulkanGpuProfiler::INVALID_SCOPE;
+    // the transfer queue doesn't support the stages of the earlier accesses,
+    // which only exist for the batches kept on the graphics queue.
+    cmd->pipelineBarrier(
+        on_transfer_queue || !mPreSrcStages
+            ? vk::PipelineStageFlagBits::eTopOfPipe
+            : mPreSrcStages,
+        vk::PipelineStageFlagBits::eTransfer,
+        { }, { }, { }, mPreBarriers);
+    recordImageCopies(cmd.get());
+    recordCopies(cmd.get());
+    recordMipGenerations(cmd.get());
+    recordBufferCopies(cmd.get());
+    if(profiler)
+        profiler->endScope(cmd.get(), scope);
+
+    if(on_transfer_queue)
+        submitOnTransferQueue(std::move(cmd));
+    else
+        submitOnGraphicsQueue(std::move(cmd));
+
+    mResources.clear();
+    mCopies.clear();
+    mImageCopies.clear();
+    mMipGenerations.clear();
+    mBufferCopies.clear();
+    mPreBarriers.clear();
+    mPostBarriers.clear();
+    mPreSrcStages = { };
+    mAccessedBefore = false;
+    mStreamedSize = 0;
+    ++mPendingToken;
+}
@@ -0,0 +1,238 @@
+﻿#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Usagi/Utility/Noncopyable.hpp>
+
+#include "VulkanGpuImage.hpp"
+#include "VulkanSubmissionTimeline.hpp"
+#include "VulkanUploadReader.hpp"
+
+namespace usagi
+{
+class VulkanGpuDevice;
+class VulkanBufferAllocation;
+
+/**
+ * \brief Collects buffer-to-image, image-to-image and buffer-to-buffer
+ * copies and mip generations, and records them into a single transfer
+ * command buffer when flushed. The layout
+ * transitions of all the destination images are merged into one barrier
+ * before and one after the copies. The staging buffers and images are kept
+ * alive by the resource tracking of the device until the batch is executed,
+ * so no device-wide stall is needed.
+ *
+ * If the device has a dedicated transfer queue, the copies are executed on it
+ * and the ownership of the images is released to the graphics queue family.
+ * A small command buffer acquiring the ownership is then submitted to the
+ * graphics queue, which waits on a semaphore signaled by the transfer. The
+ * buffers are shared by both queue families so only the execution dependency
+ * is needed for them.
+ *
+ * Images are transitioned from the undefined layout when the copy replaces
+ * the whole image. Otherwise the content is preserved by transitioning from
+ * the tracked layout. Since the graphics queue family owns the images after
+ * their first upload, a batch preserving any image is executed on the
+ * graphics queue. So is a batch generating mips, because blits are not
+ * supported by transfer queues.
+ *
+ * The barriers are per mip level and layer. Within a batch, the
+ * image-to-image copies are recorded first, then the buffer-to-image copies
+ * and finally the mip generations.
+ *
+ * Streamed uploads read the source straight into staging chunks. The queue
+ * is flushed whenever half of the streaming staging window is filled, after
+ * waiting for the previous flush, so at most one window of staging memory is
+ * occupied regardless of the size of the image.
+ */
+class VulkanUploadQueue : Noncopyable
+{
+public:
+    /**
+     * \brief Serial number of the batch that an upload is recorded into.
+     * Tokens increase monotonically.
+     */
+    using Token = std::uint64_t;
+
+private:
+    VulkanGpuDevice *mDevice = nullptr;
+    vk::UniqueCommandPool mCommandPool;
+    // only created when the copies are done on a dedicated transfer queue
+    vk::UniqueCommandPool mAcquireCommandPool;
+
+    struct ImageCopy
+    {
+        vk::Buffer buffer;
+        vk::Image image;
+        vk::BufferImageCopy region;
+    };
+    std::vector<ImageCopy> mCopies;
+    struct ImageToImageCopy
+    {
+        vk::Image src;
+        vk::Image dst;
+        vk::ImageCopy region;
+    };
+    std::vector<ImageToImageCopy> mImageCopies;
+    struct MipGeneration
+    {
+        // kept alive by mResources
+        VulkanGpuImage *image;
+        std::uint32_t base_mip;
+        vk::Filter filter;
+    };
+    std::vector<MipGeneration> mMipGenerations;
+    struct BufferCopy
+    {
+        vk::Buffer src;
+        vk::Buffer dst;
+        vk::BufferCopy region;
+    };
+    std::vector<BufferCopy> mBufferCopies;
+    std::vector<vk::ImageMemoryBarrier> mPreBarriers;
+    std::vector<vk::ImageMemoryBarrier> mPostBarriers;
+    // the stages which accessed the written or read subresources before
+    vk::PipelineStageFlags mPreSrcStages;
+    // whether any subresource was accessed before on the graphics queue. the
+    // batch must then be ordered after that work on the same queue.
+    bool mAccessedBefore = false;
+    std::vector<std::shared_ptr<VulkanBatchResource>> mResources;
+    // scratch buffer for merging the regions of the same image
+    std::vector<vk::BufferImageCopy> mRegions;
+    std::vector<vk::BufferCopy> mBufferRegions;
+
+    Token mPendingToken = 1;
+    Token mCompletedToken = 0;
+
+    // staging memory filled by streamed uploads since the last flush
+    std::size_t mStreamedSize = 0;
+    // the device timeline serial of the last flushed batch
+    VulkanSubmissionTimeline::Serial mLastSerial = 0;
+
+    class Batch;
+
+    /**
+     * \brief Transit the subresource to be written by the batch.
+     */
+    void addImageBarriers(
+        VulkanGpuImage *image,
+        std::uint32_t mip,
+        std::uint32_t layer,
+        bool discard);
+    /**
+     * \brief Transit the subresource to be read by the image copies.
+     */
+    void addSourceBarriers(
+        VulkanGpuImage *image,
+        std::uint32_t mip,
+        std::uint32_t layer);
+    vk::ImageMemoryBarrier * findPostBarrier(
+        vk::Image image,
+        std::uint32_t mip,
+        std::uint32_t layer);
+    void recordImageCopies(vk::CommandBuffer cmd);
+    void recordCopies(vk::CommandBuffer cmd);
+    void recordMipGenerations(vk::CommandBuffer cmd);
+    void recordBufferCopies(vk::CommandBuffer cmd);
+    /**
+     * \brief The stages reading the uploaded resources, which must wait for
+     * the copies.
+     */
+    vk::PipelineStageFlags consumerStages() const;
+    static vk::UniqueCommandBuffer beginCommandBuffer(
+        vk::Device device,
+        vk::CommandPool pool);
+    void submitOnGraphicsQueue(vk::UniqueCommandBuffer cmd);
+    void submitOnTransferQueue(vk::UniqueCommandBuffer cmd);
+
+public:
+    explicit VulkanUploadQueue(VulkanGpuDevice *device);
+
+    /**
+     * \brief Queue a copy from a staging buffer to a mip level of a layer of
+     * the image. The offset and size are in the texels of the mip level. The
+     * copy is not submitted until flush() is called.
+     * \return The token of the batch which the copy is recorded into.
+     */
+    Token copyBufferToImage(
+        const std::shared_ptr<VulkanBufferAllocation> &buffer,
+        VulkanGpuImage *image,
+        const Vector2i &offset,
+        const Vector2u32 &size,
+        std::uint32_t mip = 0,
+        std::uint32_t layer = 0);
+    /**
+     * \brief Queue a copy with an explicit region, e.g. with the row length
+     * and the image height of block-compressed data or multiple layers. The
+     * buffer offset of the region is relative to the staging allocation.
+     */
+    Token copyBufferToImage(
+        const std::shared_ptr<VulkanBufferAllocation> &buffer,
+        VulkanGpuImage *image,
+        const vk::BufferImageCopy &region);
+
+    /**
+     * \brief Upload a whole mip level of a layer by reading its tightly
+     * packed data into staging chunks of about upload_chunk_size, each
+     * covering whole rows of texel blocks and copied as a separate region.
+     * The whole data is never held in memory. May flush the queue and wait
+     * for earlier copies to bound the staging memory in use.
+     */
+    Token streamToImage(
+        VulkanGpuImage *image,
+        std::uint32_t mip,
+        std::uint32_t layer,
+        const VulkanUploadReader &reader);
+
+    /**
+     * \brief Queue a copy of a whole mip level of all the layers between
+     * images with the same format, array layers and mip extents. Used to
+     * move the resident mips of a texture into a resized image. If the
+     * source is written by the pending batch, the batch is flushed first.
+     */
+    Token copyImage(
+        VulkanGpuImage *src,
+        std::uint32_t src_mip,
+        VulkanGpuImage *dst,
+        std::uint32_t dst_mip);
+
+    /**
+     * \brief Fill the mip levels after the base one by successively blitting
+     * each level to the next one, after all the copies of the batch. The
+     * format must support blits, and is filtered linearly if supported.
+     */
+    Token generateMipmaps(VulkanGpuImage *image, std::uint32_t base_mip = 0);
+
+    /**
+     * \brief Queue a copy of the whole source allocation to the destination.
+     * The destination must not be used by the GPU before the copy.
+     */
+    Token copyBuffer(
+        const std::shared_ptr<VulkanBufferAllocation> &src,
+        const std::shared_ptr<VulkanBufferAllocation> &dst);
+
+    /**
+     * \brief Record all pending copies into a command buffer and submit it.
+     * Does nothing if there is no pending copy.
+     */
+    void flush();
+
+    bool empty() const
+    {
+        return mCopies.empty() && mImageCopies.empty() &&
+            mBufferCopies.empty() && mMipGenerations.empty();
+    }
+    bool isComplete(Token token) const { return token <= mCompletedToken; }
+    /**
+     * \brief The serial of the last flushed batch on the graphics queue
+     * timeline of the device. 0 if nothing was flushed.
+     */
+    VulkanSubmissionTimeline::Serial lastSerial() const
+    {
+        return mLastSerial;
+    }
+};
+}
@@ -0,0 +1,52 @@
+﻿#include "VulkanUploadReader.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include <Usagi/Core/Exception.hpp>
+#include <Usagi/Core/Logging.hpp>
+
+usagi::VulkanUploadReader usagi::makeFileReader(
+    const std::filesystem::path &path,
+    const std::size_t offset)
+{
+#ifdef _WIN32
+    const auto file = _wfopen(path.c_str(), L"rb");
+#else
+    const auto file = fopen(path.c_str(), "rb");
+#endif
+    if(!file)
+    {
+        LOG(error, "Could not open file {}", path.u8string());
+        USAGI_THROW(std::runtime_error("Failed to open file."));
+    }
+    std::shared_ptr<std::FILE> handle(file, &fclose);
+    // the staging memory is write-combined on most devices, which is fine
+    // for fread since it only writes sequentially.
+    return [handle = std::move(handle), offset](
+        const std::size_t src_offset, void *dst, const std::size_t size) {
+#ifdef _WIN32
+        const auto seeked = _fseeki64(handle.get(),
+            static_cast<long long>(offset + src_offset), SEEK_SET) == 0;
+#else
+        const auto seeked = fseeko(handle.get(),
+            static_cast<off_t>(offset + src_offset), SEEK_SET) == 0;
+#endif
+        if(!seeked || fread(dst, 1, size, handle.get()) != size)
+        {
+            LOG(error, "Could not read {} bytes at {} from file.",
+                size, offset + src_offset);
+            USAGI_THROW(std::runtime_error("Failed to read file."));
+        }
+    };
+}
+
+usagi::VulkanUploadReader usagi::makeMemoryReader(const void *data)
+{
+    const auto bytes = static_cast<const std::byte *>(data);
+    return [bytes](
+        const std::size_t offset, void *dst, const std::size_t size) {
+        memcpy(dst, bytes + offset, size);
+    };
+}
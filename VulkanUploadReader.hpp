@@ -0,0 +1,30 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+
+namespace usagi
+{
+/**
+ * \brief Write the bytes of the source starting at the offset to the mapped
+ * staging memory. Throws if the source can't be read. Used for uploading
+ * data without holding all of it in memory.
+ */
+using VulkanUploadReader = std::function<
+    void(std::size_t offset, void *dst, std::size_t size)>;
+
+/**
+ * \brief Read a range of a file, starting at the offset, straight into the
+ * staging memory. The file is kept open by the reader.
+ */
+VulkanUploadReader makeFileReader(
+    const std::filesystem::path &path,
+    std::size_t offset = 0);
+
+/**
+ * \brief Copy from memory which must outlive the reader, such as a mapped
+ * file.
+ */
+VulkanUploadReader makeMemoryReader(const void *data);
+}